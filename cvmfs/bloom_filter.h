@@ -0,0 +1,77 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_BLOOM_FILTER_H_
+#define CVMFS_BLOOM_FILTER_H_
+
+#include <stdint.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "hash.h"
+#include "smalloc.h"
+#include "util/single_copy.h"
+
+/**
+ * Fixed-size Bloom filter over MD5 path hashes.  The path hash is already
+ * uniformly distributed, so its two halves serve as the two base hashes of
+ * double hashing; no further hashing is necessary.  Without deletions, the
+ * filter has no false negatives.  With b bits per entry and the optimal
+ * number of probes (b * ln 2), the false positive rate is about 0.62^b.
+ */
+class BloomFilter : SingleCopy {
+ public:
+  static const unsigned kMaxProbes = 16;
+
+  BloomFilter(const uint64_t num_entries, const unsigned bits_per_entry) {
+    num_bits_ = num_entries * bits_per_entry;
+    // Round up to full words, at least one
+    num_bits_ = ((num_bits_ + 63) / 64) * 64;
+    if (num_bits_ == 0)
+      num_bits_ = 64;
+    words_ = static_cast<uint64_t *>(smalloc(num_bits_ / 8));
+    memset(words_, 0, num_bits_ / 8);
+    // bits_per_entry * ln 2
+    num_probes_ = (bits_per_entry * 69 + 50) / 100;
+    if (num_probes_ < 1)
+      num_probes_ = 1;
+    if (num_probes_ > kMaxProbes)
+      num_probes_ = kMaxProbes;
+  }
+
+  ~BloomFilter() { free(words_); }
+
+  void Insert(const shash::Md5 &md5) {
+    uint64_t h1, h2;
+    md5.ToIntPair(&h1, &h2);
+    h2 |= 1;
+    for (unsigned i = 0; i < num_probes_; ++i) {
+      const uint64_t bit = (h1 + i * h2) % num_bits_;
+      words_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  }
+
+  bool Contains(const shash::Md5 &md5) const {
+    uint64_t h1, h2;
+    md5.ToIntPair(&h1, &h2);
+    h2 |= 1;
+    for (unsigned i = 0; i < num_probes_; ++i) {
+      const uint64_t bit = (h1 + i * h2) % num_bits_;
+      if ((words_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+        return false;
+    }
+    return true;
+  }
+
+  uint64_t num_bits() const { return num_bits_; }
+  unsigned num_probes() const { return num_probes_; }
+
+ private:
+  uint64_t *words_;
+  uint64_t num_bits_;
+  unsigned num_probes_;
+};
+
+#endif  // CVMFS_BLOOM_FILTER_H_
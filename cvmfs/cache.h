@@ -9,6 +9,7 @@
 #define __STDC_FORMAT_MACROS
 #endif
 
+#include <errno.h>
 #include <stdint.h>
 
 #include <string>
@@ -170,6 +171,16 @@ class CacheManager : SingleCopy {
   virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset) = 0;
   virtual int Dup(int fd) = 0;
   virtual int Readahead(int fd) = 0;
+  /**
+   * Cache managers that store objects in plain files can expose the kernel
+   * file descriptor behind one of their (virtual) file descriptors together
+   * with the offset of the object inside this file.  The fuse module uses it
+   * to let the kernel splice the data into the reply instead of copying it
+   * through a user space buffer.  The returned file descriptor is owned by the
+   * cache manager and remains valid until fd is closed.  Returns -ENOTSUP if
+   * the cache manager has no such file descriptor.
+   */
+  virtual int GetBackingFd(int fd, uint64_t *offset) { return -ENOTSUP; }
 
   virtual uint32_t SizeOfTxn() = 0;
   virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn) = 0;
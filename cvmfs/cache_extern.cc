@@ -8,7 +8,9 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -26,9 +28,11 @@
 #include "cache.pb.h"
 #include "hash.h"
 #include "logging.h"
+#include "platform.h"
 #ifdef __APPLE__
 #include "smalloc.h"
 #endif
+#include "util/file_guard.h"
 #include "util/pointer.h"
 #include "util/posix.h"
 #include "util/string.h"
@@ -72,6 +76,23 @@ int Ack2Errno(cvmfs::EnumStatus status_code) {
 const shash::Any ExternalCacheManager::kInvalidHandle;
 
 
+/**
+ * Returns -1 if all slots are in use.
+ */
+int ExternalCacheManager::AcquireShmSlot() {
+  while (true) {
+    int32_t used = atomic_read32(&shm_used_slots_);
+    unsigned slot = 0;
+    while ((slot < shm_num_slots_) && (used & SlotBit(slot)))
+      ++slot;
+    if (slot == shm_num_slots_)
+      return -1;
+    if (atomic_cas32(&shm_used_slots_, used, used | SlotBit(slot)))
+      return slot;
+  }
+}
+
+
 int ExternalCacheManager::AbortTxn(void *txn) {
   int result = Reset(txn);
 #ifdef __APPLE__
@@ -109,14 +130,7 @@ void ExternalCacheManager::CallRemotely(ExternalCacheManager::RpcJob *rpc_job) {
     } while (again);
   } else {
     Signal signal;
-    {
-      MutexLockGuard guard(lock_inflight_rpcs_);
-      inflight_rpcs_.push_back(RpcInFlight(rpc_job, &signal));
-    }
-    {
-      MutexLockGuard guard(lock_send_fd_);
-      transport_.SendFrame(rpc_job->frame_send());
-    }
+    SendRemotely(rpc_job, &signal);
     signal.Wait();
   }
 }
@@ -213,13 +227,16 @@ ExternalCacheManager *ExternalCacheManager::Create(
   cvmfs::MsgHandshake msg_handshake;
   msg_handshake.set_protocol_version(kPbProtocolVersion);
   msg_handshake.set_name(ident);
+  msg_handshake.set_flags(cvmfs::HANDSHAKE_SHM);
   CacheTransport::Frame frame_send(&msg_handshake);
   cache_mgr->transport_.SendFrame(&frame_send);
 
   CacheTransport::Frame frame_recv;
-  bool retval = cache_mgr->transport_.RecvFrame(&frame_recv);
+  int fd_shm;
+  bool retval = cache_mgr->transport_.RecvFrame(&frame_recv, &fd_shm);
   if (!retval)
     return NULL;
+  FdGuard fd_guard_shm(fd_shm);
   google::protobuf::MessageLite *msg_typed = frame_recv.GetMsgTyped();
   if (msg_typed->GetTypeName() != "cvmfs.MsgHandshakeAck")
     return NULL;
@@ -243,6 +260,15 @@ ExternalCacheManager *ExternalCacheManager::Create(
   }
   if (msg_ack->has_pid())
     cache_mgr->pid_plugin_ = msg_ack->pid();
+  if ((fd_shm >= 0) && msg_ack->has_flags() &&
+      (msg_ack->flags() & cvmfs::HANDSHAKE_SHM) && msg_ack->has_shm_slots())
+  {
+    retval = cache_mgr->MapShmRegion(fd_shm, msg_ack->shm_slots());
+    if (!retval) {
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+               "failed to map shared memory of external cache manager");
+    }
+  }
   return cache_mgr.Release();
 }
 
@@ -379,6 +405,10 @@ ExternalCacheManager::ExternalCacheManager(
   , spawned_(false)
   , terminated_(false)
   , capabilities_(cvmfs::CAP_NONE)
+  , max_inflight_reads_(kDefaultInflightReads)
+  , shm_region_(NULL)
+  , shm_size_(0)
+  , shm_num_slots_(0)
 {
   int retval = pthread_rwlock_init(&rwlock_fd_table_, NULL);
   assert(retval == 0);
@@ -388,6 +418,7 @@ ExternalCacheManager::ExternalCacheManager(
   assert(retval == 0);
   memset(&thread_read_, 0, sizeof(thread_read_));
   atomic_init64(&next_request_id_);
+  atomic_init32(&shm_used_slots_);
 }
 
 
@@ -404,6 +435,8 @@ ExternalCacheManager::~ExternalCacheManager() {
   if (spawned_)
     pthread_join(thread_read_, NULL);
   close(transport_.fd_connection());
+  if (shm_region_ != NULL)
+    munmap(shm_region_, shm_size_);
   pthread_rwlock_destroy(&rwlock_fd_table_);
   pthread_mutex_destroy(&lock_send_fd_);
   pthread_mutex_destroy(&lock_inflight_rpcs_);
@@ -433,9 +466,18 @@ int ExternalCacheManager::Flush(bool do_commit, Transaction *transaction) {
   }
 
   RpcJob rpc_job(&msg_store);
-  rpc_job.set_attachment_send(transaction->buffer, transaction->buf_pos);
+  int slot = (transaction->buf_pos > 0) ? AcquireShmSlot() : -1;
+  if (slot >= 0) {
+    memcpy(GetShmSlot(slot), transaction->buffer, transaction->buf_pos);
+    msg_store.set_shm_slot(slot);
+    msg_store.set_shm_size(transaction->buf_pos);
+  } else {
+    rpc_job.set_attachment_send(transaction->buffer, transaction->buf_pos);
+  }
   // TODO(jblomer): allow for out of order chunk upload
   CallRemotely(&rpc_job);
+  if (slot >= 0)
+    ReleaseShmSlot(slot);
   msg_store.release_object_id();
 
   cvmfs::MsgStoreReply *msg_reply = rpc_job.msg_store_reply();
@@ -455,6 +497,36 @@ shash::Any ExternalCacheManager::GetHandle(int fd) {
 }
 
 
+/**
+ * The plugin keeps the shared memory region alive for the duration of the
+ * session.  The file descriptor is closed by the caller.
+ */
+bool ExternalCacheManager::MapShmRegion(int fd_shm, unsigned num_slots) {
+  if (num_slots > kMaxShmSlots)
+    num_slots = kMaxShmSlots;
+  if (num_slots == 0)
+    return false;
+  const uint64_t size = static_cast<uint64_t>(num_slots) * max_object_size_;
+  platform_stat64 info;
+  if ((platform_fstat(fd_shm, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) < size))
+  {
+    return false;
+  }
+  void *region =
+    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
+  if (region == MAP_FAILED)
+    return false;
+  shm_region_ = static_cast<unsigned char *>(region);
+  shm_size_ = size;
+  shm_num_slots_ = num_slots;
+  LogCvmfs(kLogCache, kLogDebug,
+           "using %u shared memory slots with external cache manager",
+           num_slots);
+  return true;
+}
+
+
 int64_t ExternalCacheManager::GetSize(int fd) {
   shash::Any id = GetHandle(fd);
   if (id == kInvalidHandle)
@@ -594,36 +666,91 @@ int64_t ExternalCacheManager::Pread(
 
   cvmfs::MsgHash object_id;
   transport_.FillMsgHash(id, &object_id);
+  // Before the reader thread runs, replies are received in CallRemotely()
+  const unsigned max_inflight = spawned_ ? max_inflight_reads_ : 1;
   uint64_t nbytes = 0;
   while (nbytes < size) {
-    uint64_t batch_size =
-      std::min(size - nbytes, static_cast<uint64_t>(max_object_size_));
-    cvmfs::MsgReadReq msg_read;
-    msg_read.set_session_id(session_id_);
-    msg_read.set_req_id(NextRequestId());
-    msg_read.set_allocated_object_id(&object_id);
-    msg_read.set_offset(offset + nbytes);
-    msg_read.set_size(batch_size);
-    RpcJob rpc_job(&msg_read);
-    rpc_job.set_attachment_recv(reinterpret_cast<char *>(buf) + nbytes,
-                                batch_size);
-    CallRemotely(&rpc_job);
-    msg_read.release_object_id();
-
-    cvmfs::MsgReadReply *msg_reply = rpc_job.msg_read_reply();
-    if (msg_reply->status() == cvmfs::STATUS_OK) {
-      nbytes += rpc_job.frame_recv()->att_size();
+    cvmfs::MsgReadReq msg_reads[kMaxInflightReads];
+    UniquePtr<RpcJob> rpc_jobs[kMaxInflightReads];
+    Signal signals[kMaxInflightReads];
+    int slots[kMaxInflightReads];
+    uint64_t batch_sizes[kMaxInflightReads];
+
+    // Issue up to max_inflight requests for consecutive parts of the buffer
+    unsigned num_jobs = 0;
+    for (uint64_t pos = nbytes; (pos < size) && (num_jobs < max_inflight);
+         ++num_jobs)
+    {
+      batch_sizes[num_jobs] =
+        std::min(size - pos, static_cast<uint64_t>(max_object_size_));
+      cvmfs::MsgReadReq *msg_read = &msg_reads[num_jobs];
+      msg_read->set_session_id(session_id_);
+      msg_read->set_req_id(NextRequestId());
+      msg_read->set_allocated_object_id(&object_id);
+      msg_read->set_offset(offset + pos);
+      msg_read->set_size(batch_sizes[num_jobs]);
+      slots[num_jobs] = AcquireShmSlot();
+      if (slots[num_jobs] >= 0)
+        msg_read->set_shm_slot(slots[num_jobs]);
+      rpc_jobs[num_jobs] = new RpcJob(msg_read);
+      rpc_jobs[num_jobs]->set_attachment_recv(
+        reinterpret_cast<char *>(buf) + pos, batch_sizes[num_jobs]);
+      if (spawned_)
+        SendRemotely(rpc_jobs[num_jobs], &signals[num_jobs]);
+      else
+        CallRemotely(rpc_jobs[num_jobs]);
+      pos += batch_sizes[num_jobs];
+    }
+
+    // All replies need to be collected, even after an error or a short read,
+    // because the reader thread refers to the jobs and signals on our stack
+    int64_t result = 0;
+    bool done = false;
+    for (unsigned i = 0; i < num_jobs; ++i) {
+      if (spawned_)
+        signals[i].Wait();
+      msg_reads[i].release_object_id();
+      cvmfs::MsgReadReply *msg_reply = rpc_jobs[i]->msg_read_reply();
+      uint64_t batch_received = rpc_jobs[i]->frame_recv()->att_size();
+      if (!done && (msg_reply->status() != cvmfs::STATUS_OK)) {
+        result = Ack2Errno(msg_reply->status());
+        done = true;
+      }
+      if (slots[i] >= 0) {
+        if (!done && msg_reply->has_shm_size() &&
+            (msg_reply->shm_size() <= batch_sizes[i]))
+        {
+          batch_received = msg_reply->shm_size();
+          memcpy(reinterpret_cast<char *>(buf) + nbytes, GetShmSlot(slots[i]),
+                 batch_received);
+        }
+        ReleaseShmSlot(slots[i]);
+      }
+      if (done)
+        continue;
+      nbytes += batch_received;
       // Fuse sends in rounded up buffers, so short reads are expected
-      if (rpc_job.frame_recv()->att_size() < batch_size)
-        return nbytes;
-    } else {
-      return Ack2Errno(msg_reply->status());
+      if (batch_received < batch_sizes[i]) {
+        result = nbytes;
+        done = true;
+      }
     }
+    if (done)
+      return result;
   }
   return size;
 }
 
 
+void ExternalCacheManager::ReleaseShmSlot(int slot) {
+  while (true) {
+    int32_t used = atomic_read32(&shm_used_slots_);
+    if (atomic_cas32(&shm_used_slots_, used, used & ~SlotBit(slot)))
+      return;
+  }
+}
+
+
 int ExternalCacheManager::Readahead(int fd) {
   shash::Any id = GetHandle(fd);
   if (id == kInvalidHandle)
@@ -711,6 +838,25 @@ bool ExternalCacheManager::StoreBreadcrumb(const manifest::Manifest &manifest) {
 }
 
 
+/**
+ * Registers the job with the reader thread and sends the request without
+ * waiting for the reply.  The signal fires once the reply is in the job.  Only
+ * valid after Spawn().
+ */
+void ExternalCacheManager::SendRemotely(
+  ExternalCacheManager::RpcJob *rpc_job,
+  Signal *signal)
+{
+  assert(spawned_);
+  {
+    MutexLockGuard guard(lock_inflight_rpcs_);
+    inflight_rpcs_.push_back(RpcInFlight(rpc_job, signal));
+  }
+  MutexLockGuard guard(lock_send_fd_);
+  transport_.SendFrame(rpc_job->frame_send());
+}
+
+
 void ExternalCacheManager::Spawn() {
   int retval = pthread_create(&thread_read_, NULL, MainRead, this);
   assert(retval == 0);
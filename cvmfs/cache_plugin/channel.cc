@@ -7,7 +7,9 @@
 #include <errno.h>
 #include <poll.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -25,6 +27,33 @@
 
 using namespace std;  // NOLINT
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace {
+
+/**
+ * Anonymous memory that can be shared through a file descriptor.  Returns -1
+ * if the kernel does not support memfd_create().
+ */
+int MakeMemFd(uint64_t size) {
+#ifdef __NR_memfd_create
+  int fd = syscall(__NR_memfd_create, "cvmfs-cache-shm", MFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+}  // anonymous namespace
+
 
 SessionCtx *SessionCtx::instance_ = NULL;
 
@@ -147,6 +176,9 @@ void SessionCtx::Unset() {
 CachePlugin::SessionInfo::SessionInfo(uint64_t id, const std::string &name)
   : id(id)
   , name(name)
+  , fd_con(-1)
+  , shm_region(NULL)
+  , shm_size(0)
 {
   vector<string> tokens = SplitString(name, ':');
   reponame = strdup(tokens[0].c_str());
@@ -187,7 +219,9 @@ CachePlugin::CachePlugin(uint64_t capabilities)
 
 
 CachePlugin::~CachePlugin() {
+  // The I/O thread must not use the shared memory regions anymore
   Terminate();
+  UnmapShmRegions(-1);
   ClosePipe(pipe_ctrl_);
   if (fd_socket_ >= 0)
     close(fd_socket_);
@@ -271,7 +305,21 @@ void CachePlugin::HandleHandshake(
   msg_ack.set_capabilities(capabilities_);
   if (is_local_)
     msg_ack.set_pid(getpid());
-  transport->SendFrame(&frame_send);
+
+  int fd_shm = -1;
+  if (is_local_ && msg_req->has_flags() &&
+      (msg_req->flags() & cvmfs::HANDSHAKE_SHM))
+  {
+    sessions_[session_id].fd_con = transport->fd_connection();
+    fd_shm = CreateShmRegion(&sessions_[session_id]);
+    if (fd_shm >= 0) {
+      msg_ack.set_flags(cvmfs::HANDSHAKE_SHM);
+      msg_ack.set_shm_slots(kShmNumSlots);
+    }
+  }
+  transport->SendFrame(&frame_send, fd_shm);
+  if (fd_shm >= 0)
+    close(fd_shm);
 }
 
 
@@ -423,6 +471,28 @@ void CachePlugin::HandleRead(
     return;
   }
   unsigned size = msg_req->size();
+  if (msg_req->has_shm_slot()) {
+    unsigned char *slot =
+      GetShmSlot(msg_req->session_id(), msg_req->shm_slot());
+    if (slot == NULL) {
+      LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
+                      "invalid shared memory slot received from client");
+      msg_reply.set_status(cvmfs::STATUS_MALFORMED);
+      transport->SendFrame(&frame_send);
+      return;
+    }
+    cvmfs::EnumStatus status = Pread(object_id, msg_req->offset(), &size, slot);
+    msg_reply.set_status(status);
+    if (status == cvmfs::STATUS_OK) {
+      msg_reply.set_shm_size(size);
+    } else {
+      LogSessionError(msg_req->session_id(), status,
+                      "failed to read from object");
+    }
+    transport->SendFrame(&frame_send);
+    return;
+  }
+
 #ifdef __APPLE__
   unsigned char *buffer = reinterpret_cast<unsigned char *>(smalloc(size));
 #else
@@ -490,13 +560,7 @@ bool CachePlugin::HandleRequest(int fd_con) {
     HandleHandshake(msg_req, &transport);
   } else if (msg_typed->GetTypeName() == "cvmfs.MsgQuit") {
     cvmfs::MsgQuit *msg_req = reinterpret_cast<cvmfs::MsgQuit *>(msg_typed);
-    map<uint64_t, SessionInfo>::const_iterator iter =
-      sessions_.find(msg_req->session_id());
-    if (iter != sessions_.end()) {
-      free(iter->second.reponame);
-      free(iter->second.client_instance);
-    }
-    sessions_.erase(msg_req->session_id());
+    CloseSession(msg_req->session_id());
     return false;
   } else if (msg_typed->GetTypeName() == "cvmfs.MsgIoctl") {
     HandleIoctl(reinterpret_cast<cvmfs::MsgIoctl *>(msg_typed));
@@ -610,11 +674,18 @@ void CachePlugin::HandleStore(
   CacheTransport::Frame frame_send(&msg_reply);
   msg_reply.set_req_id(msg_req->req_id());
   msg_reply.set_part_nr(msg_req->part_nr());
+  unsigned char *payload =
+    reinterpret_cast<unsigned char *>(frame->attachment());
+  uint32_t payload_size = frame->att_size();
+  if (msg_req->has_shm_slot()) {
+    payload = GetShmSlot(msg_req->session_id(), msg_req->shm_slot());
+    payload_size = msg_req->shm_size();
+  }
   shash::Any object_id;
   bool retval = transport->ParseMsgHash(msg_req->object_id(), &object_id);
-  if ( !retval ||
-       (frame->att_size() > max_object_size_) ||
-       ((frame->att_size() < max_object_size_) && !msg_req->last_part()) )
+  if ( !retval || (payload == NULL) ||
+       (payload_size > max_object_size_) ||
+       ((payload_size < max_object_size_) && !msg_req->last_part()) )
   {
     LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                     "malformed hash or bad object size received from client");
@@ -661,10 +732,8 @@ void CachePlugin::HandleStore(
   }
 
   // TODO(jblomer): check part number and send objects up in order
-  if (frame->att_size() > 0) {
-    status = WriteTxn(txn_id,
-                      reinterpret_cast<unsigned char *>(frame->attachment()),
-                      frame->att_size());
+  if (payload_size > 0) {
+    status = WriteTxn(txn_id, payload, payload_size);
     if (status != cvmfs::STATUS_OK) {
       LogSessionError(msg_req->session_id(), status, "failure writing object");
       msg_reply.set_status(status);
@@ -686,6 +755,75 @@ void CachePlugin::HandleStore(
 }
 
 
+void CachePlugin::CloseSession(uint64_t session_id) {
+  map<uint64_t, SessionInfo>::const_iterator iter = sessions_.find(session_id);
+  if (iter != sessions_.end()) {
+    free(iter->second.reponame);
+    free(iter->second.client_instance);
+    if (iter->second.shm_region != NULL)
+      munmap(iter->second.shm_region, iter->second.shm_size);
+  }
+  sessions_.erase(session_id);
+}
+
+
+/**
+ * Creates and maps the shared memory region of a session.  Returns the file
+ * descriptor of the region, to be passed to the client, or -1 if shared memory
+ * is not available.
+ */
+int CachePlugin::CreateShmRegion(SessionInfo *session_info) {
+  const uint64_t size = static_cast<uint64_t>(kShmNumSlots) * max_object_size_;
+  int fd = MakeMemFd(size);
+  if (fd < 0)
+    return -1;
+  void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  session_info->shm_region = static_cast<unsigned char *>(region);
+  session_info->shm_size = size;
+  return fd;
+}
+
+
+/**
+ * Returns NULL if the session has no shared memory region or if the slot is out
+ * of range.
+ */
+unsigned char *CachePlugin::GetShmSlot(uint64_t session_id, uint32_t slot) {
+  map<uint64_t, SessionInfo>::const_iterator iter = sessions_.find(session_id);
+  if ((iter == sessions_.end()) || (iter->second.shm_region == NULL))
+    return NULL;
+  if (slot >= iter->second.shm_size / max_object_size_)
+    return NULL;
+  return iter->second.shm_region + static_cast<uint64_t>(slot) *
+                                   max_object_size_;
+}
+
+
+/**
+ * Unmaps the shared memory regions of the sessions on the given connection,
+ * e.g. if the client crashed without sending MsgQuit.  A negative connection
+ * unmaps the regions of all sessions.
+ */
+void CachePlugin::UnmapShmRegions(int fd_con) {
+  for (map<uint64_t, SessionInfo>::iterator i = sessions_.begin(),
+       i_end = sessions_.end(); i != i_end; ++i)
+  {
+    if ((fd_con >= 0) && (i->second.fd_con != fd_con))
+      continue;
+    if (i->second.shm_region != NULL) {
+      munmap(i->second.shm_region, i->second.shm_size);
+      i->second.shm_region = NULL;
+      i->second.shm_size = 0;
+    }
+    i->second.fd_con = -1;
+  }
+}
+
+
 bool CachePlugin::IsRunning() {
   return atomic_read32(&running_) != 0;
 }
@@ -845,6 +983,7 @@ void *CachePlugin::MainProcessRequests(void *data) {
       if (watch_fds[i].revents) {
         bool proceed = cache_plugin->HandleRequest(watch_fds[i].fd);
         if (!proceed) {
+          cache_plugin->UnmapShmRegions(watch_fds[i].fd);
           close(watch_fds[i].fd);
           cache_plugin->connections_.erase(watch_fds[i].fd);
           watch_fds.erase(watch_fds.begin() + i);
@@ -867,8 +1006,10 @@ void *CachePlugin::MainProcessRequests(void *data) {
   }
 
   // 0, 1 being closed by destructor
-  for (unsigned i = 2; i < watch_fds.size(); ++i)
+  for (unsigned i = 2; i < watch_fds.size(); ++i) {
+    cache_plugin->UnmapShmRegions(watch_fds[i].fd);
     close(watch_fds[i].fd);
+  }
   cache_plugin->txn_ids_.Clear();
 
   signal(SIGPIPE, save_sigpipe);
@@ -139,6 +139,11 @@ class CachePlugin {
  private:
   static const unsigned kDefaultMaxObjectSize = 256 * 1024;  // 256kB
   static const unsigned kListingSize = 4 * 1024 * 1024;  // 4MB
+  /**
+   * Number of shared memory slots per session, i.e. the number of read and
+   * store requests that can use the shared memory data plane at a time.
+   */
+  static const unsigned kShmNumSlots = 16;
   static const char kSignalTerminate = 'q';
   static const char kSignalDetach = 'd';
 
@@ -160,15 +165,22 @@ class CachePlugin {
   /**
    * The char pointers are prepared on Handshake and removed when the session
    * closes.  They are created to be consumed by the cvmcache_get_session() API.
+   * Local sessions can have a shared memory region for read and store payloads.
+   * The region is unmapped when the session's connection goes away.
    */
   struct SessionInfo {
-    SessionInfo() : id(0), reponame(NULL), client_instance(NULL) { }
+    SessionInfo()
+      : id(0), reponame(NULL), client_instance(NULL)
+      , fd_con(-1), shm_region(NULL), shm_size(0) { }
     SessionInfo(uint64_t id, const std::string &name);
 
     uint64_t id;
     std::string name;
     char *reponame;
     char *client_instance;
+    int fd_con;
+    unsigned char *shm_region;
+    uint64_t shm_size;
   };
 
   /**
@@ -215,6 +227,10 @@ class CachePlugin {
   }
 
   bool HandleRequest(int fd_con);
+  int CreateShmRegion(SessionInfo *session_info);
+  unsigned char *GetShmSlot(uint64_t session_id, uint32_t slot);
+  void UnmapShmRegions(int fd_con);
+  void CloseSession(uint64_t session_id);
   void HandleHandshake(cvmfs::MsgHandshake *msg_req,
                        CacheTransport *transport);
   void HandleRefcount(cvmfs::MsgRefcountReq *msg_req,
@@ -101,7 +101,7 @@ static int null_pread(struct cvmcache_hash *id,
                     unsigned char *buffer)
 {
   ComparableHash h(*id);
-  string data = storage[h].data;
+  const string &data = storage[h].data;
   if (offset > data.length())
     return CVMCACHE_STATUS_OUTOFBOUNDS;
   unsigned nbytes =
@@ -36,6 +36,7 @@
 #include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #ifndef __APPLE__
 #include <sys/statfs.h>
 #endif
@@ -297,6 +298,12 @@ string PosixCacheManager::Describe() {
 }
 
 
+void PosixCacheManager::DisableDirectIo(Transaction *transaction) {
+  platform_set_direct_io(transaction->fd, false);
+  transaction->direct_io = false;
+}
+
+
 /**
  * Nothing to do, the kernel keeps the state of open file descriptors.  Return
  * a dummy memory location.
@@ -331,11 +338,46 @@ int PosixCacheManager::Dup(int fd) {
 }
 
 
+/**
+ * Switches the transaction to an aligned buffer and direct I/O.  Stays with
+ * buffered I/O if the file system does not support it.
+ */
+void PosixCacheManager::EnableDirectIo(Transaction *transaction) {
+  void *buffer;
+  if (posix_memalign(&buffer, kDirectIoAlignment, kDirectIoBufferSize) != 0)
+    return;
+  if (platform_set_direct_io(transaction->fd, true) != 0) {
+    LogCvmfs(kLogCache, kLogDebug, "no direct I/O for %s (%d)",
+             transaction->tmp_path.c_str(), errno);
+    free(buffer);
+    return;
+  }
+  transaction->direct_buffer = reinterpret_cast<unsigned char *>(buffer);
+  transaction->direct_io = true;
+}
+
+
+/**
+ * In direct I/O mode, only full buffers keep the file offset aligned.  A
+ * partially filled buffer is the end of the object and it is written through
+ * the page cache.
+ */
 int PosixCacheManager::Flush(Transaction *transaction) {
   if (transaction->buf_pos == 0)
     return 0;
+  if (transaction->direct_io &&
+      (transaction->buf_pos % kDirectIoAlignment != 0))
+  {
+    DisableDirectIo(transaction);
+  }
   int written =
-    write(transaction->fd, transaction->buffer, transaction->buf_pos);
+    write(transaction->fd, transaction->GetBuffer(), transaction->buf_pos);
+  if ((written < 0) && (errno == EINVAL) && transaction->direct_io) {
+    // Direct I/O is accepted by fcntl() but not supported for writing
+    DisableDirectIo(transaction);
+    written =
+      write(transaction->fd, transaction->GetBuffer(), transaction->buf_pos);
+  }
   if (written < 0)
     return -errno;
   if (static_cast<unsigned>(written) != transaction->buf_pos) {
@@ -347,6 +389,16 @@ int PosixCacheManager::Flush(Transaction *transaction) {
 }
 
 
+/**
+ * File descriptors handed out by the POSIX cache manager are plain kernel file
+ * descriptors of the object file, so they can be used as they are.
+ */
+int PosixCacheManager::GetBackingFd(int fd, uint64_t *offset) {
+  *offset = 0;
+  return fd;
+}
+
+
 inline string PosixCacheManager::GetPathInCache(const shash::Any &id) {
   return cache_path_ + "/" + id.MakePathWithoutSuffix();
 }
@@ -458,6 +510,11 @@ int PosixCacheManager::Reset(void *txn) {
   retval = ftruncate(transaction->fd, 0);
   if (retval < 0)
     return -errno;
+  // The file offset is aligned again
+  if ((transaction->direct_buffer != NULL) && !transaction->direct_io) {
+    if (platform_set_direct_io(transaction->fd, true) == 0)
+      transaction->direct_io = true;
+  }
   return 0;
 }
 
@@ -523,6 +580,11 @@ int PosixCacheManager::StartTxn(
            template_path, transaction->fd);
   transaction->tmp_path = template_path;
   transaction->expected_size = size;
+  if ((direct_io_threshold_ > 0) && (size != kSizeUnknown) &&
+      (size >= direct_io_threshold_))
+  {
+    EnableDirectIo(transaction);
+  }
   return transaction->fd;
 }
 
@@ -561,10 +623,22 @@ int64_t PosixCacheManager::Write(const void *buf, uint64_t size, void *txn) {
     }
   }
 
+  // Saves the copy and further system calls if the data do not fit into the
+  // small buffer anyway
+  if ((transaction->direct_buffer == NULL) &&
+      (transaction->buf_pos + size > sizeof(transaction->buffer)))
+  {
+    int retval = WriteThrough(transaction, buf, size);
+    if (retval != 0)
+      return retval;
+    transaction->size += size;
+    return size;
+  }
+
   uint64_t written = 0;
   const unsigned char *read_pos = reinterpret_cast<const unsigned char *>(buf);
   while (written < size) {
-    if (transaction->buf_pos == sizeof(transaction->buffer)) {
+    if (transaction->buf_pos == transaction->GetBufferSize()) {
       int retval = Flush(transaction);
       if (retval != 0) {
         transaction->size += written;
@@ -573,9 +647,10 @@ int64_t PosixCacheManager::Write(const void *buf, uint64_t size, void *txn) {
     }
     uint64_t remaining = size - written;
     uint64_t space_in_buffer =
-      sizeof(transaction->buffer) - transaction->buf_pos;
+      transaction->GetBufferSize() - transaction->buf_pos;
     uint64_t batch_size = std::min(remaining, space_in_buffer);
-    memcpy(transaction->buffer + transaction->buf_pos, read_pos, batch_size);
+    memcpy(transaction->GetBuffer() + transaction->buf_pos, read_pos,
+           batch_size);
     transaction->buf_pos += batch_size;
     written += batch_size;
     read_pos += batch_size;
@@ -583,3 +658,41 @@ int64_t PosixCacheManager::Write(const void *buf, uint64_t size, void *txn) {
   transaction->size += written;
   return written;
 }
+
+
+/**
+ * Writes the buffered data followed by buf with a single system call (unless
+ * the kernel accepts only part of it).
+ */
+int PosixCacheManager::WriteThrough(
+  Transaction *transaction,
+  const void *buf,
+  uint64_t size)
+{
+  struct iovec iov[2];
+  iov[0].iov_base = transaction->buffer;
+  iov[0].iov_len = transaction->buf_pos;
+  iov[1].iov_base = const_cast<void *>(buf);
+  iov[1].iov_len = size;
+  unsigned idx = 0;
+  while (idx < 2) {
+    ssize_t written = writev(transaction->fd, iov + idx, 2 - idx);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    if (written == 0)
+      return -EIO;
+    while ((idx < 2) && (static_cast<size_t>(written) >= iov[idx].iov_len)) {
+      written -= iov[idx].iov_len;
+      idx++;
+    }
+    if (idx < 2) {
+      iov[idx].iov_base = reinterpret_cast<char *>(iov[idx].iov_base) + written;
+      iov[idx].iov_len -= written;
+    }
+  }
+  transaction->buf_pos = 0;
+  return 0;
+}
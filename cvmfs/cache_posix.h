@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <cstdlib>
 #include <map>
 #include <string>
 #include <vector>
@@ -65,6 +66,12 @@ class PosixCacheManager : public CacheManager {
    */
   static const uint64_t kBigFile;
 
+  /**
+   * Buffer size and alignment for objects that are written with direct I/O
+   */
+  static const unsigned kDirectIoBufferSize = 256 * 1024;  // 256kB
+  static const unsigned kDirectIoAlignment = 4096;
+
   virtual CacheManagerIds id() { return kPosixCacheManager; }
   virtual std::string Describe();
 
@@ -81,6 +88,7 @@ class PosixCacheManager : public CacheManager {
   virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset);
   virtual int Dup(int fd);
   virtual int Readahead(int fd);
+  virtual int GetBackingFd(int fd, uint64_t *offset);
 
   virtual uint32_t SizeOfTxn() { return sizeof(Transaction); }
   virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn);
@@ -98,6 +106,15 @@ class PosixCacheManager : public CacheManager {
   virtual manifest::Breadcrumb LoadBreadcrumb(const std::string &fqrn);
   virtual bool StoreBreadcrumb(const manifest::Manifest &manifest);
 
+  /**
+   * Objects of at least threshold bytes are written with direct I/O, so that
+   * large objects that are read only once do not evict the page cache.  Zero
+   * turns direct I/O off.
+   */
+  void SetDirectIoThreshold(const uint64_t threshold) {
+    direct_io_threshold_ = threshold;
+  }
+
   void TearDown2ReadOnly();
   CacheModes cache_mode() { return cache_mode_; }
   bool alien_cache() { return alien_cache_; }
@@ -115,17 +132,37 @@ class PosixCacheManager : public CacheManager {
       , size(0)
       , expected_size(kSizeUnknown)
       , fd(-1)
+      , direct_buffer(NULL)
+      , direct_io(false)
       , object_info(kTypeRegular, "")
       , tmp_path()
       , final_path(final_path)
       , id(id)
     { }
+    ~Transaction() { free(direct_buffer); }
+
+    unsigned char *GetBuffer() {
+      return (direct_buffer != NULL) ? direct_buffer : buffer;
+    }
+    unsigned GetBufferSize() const {
+      return (direct_buffer != NULL) ? kDirectIoBufferSize : sizeof(buffer);
+    }
 
     unsigned char buffer[4096];
     unsigned buf_pos;
     uint64_t size;
     uint64_t expected_size;
     int fd;
+    /**
+     * Aligned buffer of kDirectIoBufferSize bytes that replaces buffer for
+     * large objects
+     */
+    unsigned char *direct_buffer;
+    /**
+     * True as long as fd is in direct I/O mode.  Only full, aligned buffers are
+     * written in this mode.
+     */
+    bool direct_io;
     ObjectInfo object_info;
     std::string tmp_path;
     std::string final_path;
@@ -139,6 +176,7 @@ class PosixCacheManager : public CacheManager {
     , rename_workaround_(kRenameNormal)
     , cache_mode_(kCacheReadWrite)
     , reports_correct_filesize_(true)
+    , direct_io_threshold_(0)
   {
     atomic_init32(&no_inflight_txns_);
   }
@@ -146,6 +184,9 @@ class PosixCacheManager : public CacheManager {
   std::string GetPathInCache(const shash::Any &id);
   int Rename(const char *oldpath, const char *newpath);
   int Flush(Transaction *transaction);
+  int WriteThrough(Transaction *transaction, const void *buf, uint64_t size);
+  void EnableDirectIo(Transaction *transaction);
+  void DisableDirectIo(Transaction *transaction);
 
   std::string cache_path_;
   std::string txn_template_path_;
@@ -164,6 +205,8 @@ class PosixCacheManager : public CacheManager {
    * Hack for HDFS which writes file sizes asynchronously.
    */
   bool reports_correct_filesize_;
+
+  uint64_t direct_io_threshold_;
 };  // class PosixCacheManager
 
 #endif  // CVMFS_CACHE_POSIX_H_
@@ -21,8 +21,11 @@ using namespace std;  // NOLINT
 const shash::Any RamCacheManager::kInvalidHandle;
 
 string RamCacheManager::Describe() {
+  string shards;
+  if (shards_.size() > 1)
+    shards = ", " + StringifyInt(shards_.size()) + " shards";
   return "Internal in-memory cache manager (size " +
-         StringifyInt(max_size_ / (1024 * 1024)) + "MB)\n";
+         StringifyInt(max_size_ / (1024 * 1024)) + "MB" + shards + ")\n";
 }
 
 
@@ -30,34 +33,54 @@ RamCacheManager::RamCacheManager(
   uint64_t max_size,
   unsigned max_entries,
   MemoryKvStore::MemoryAllocator alloc,
-  perf::StatisticsTemplate statistics)
+  perf::StatisticsTemplate statistics,
+  unsigned num_shards)
   : max_size_(max_size)
   , fd_table_(max_entries, ReadOnlyHandle())
-  // TODO(jblomer): the number of slots in the kv-stores should _not_ be the
-  // number of open files.
-  , regular_entries_(max_entries,
-                     alloc,
-                     max_size,
-                     perf::StatisticsTemplate("kv.regular", statistics))
-  , volatile_entries_(max_entries,
-                      alloc,
-                      max_size,
-                      perf::StatisticsTemplate("kv.volatile", statistics))
   , counters_(statistics)
 {
-  int retval = pthread_rwlock_init(&rwlock_, NULL);
+  assert((num_shards > 0) && (num_shards <= kMaxShards));
+  int retval = pthread_rwlock_init(&rwlock_fd_table_, NULL);
   assert(retval == 0);
-  LogCvmfs(kLogCache, kLogDebug, "max %u B, %u entries",
-           max_size, max_entries);
+  atomic_init64(&used_bytes_);
+
+  // TODO(jblomer): the number of slots in the kv-stores should _not_ be the
+  // number of open files.
+  unsigned shard_entries = max_entries;
+  if (num_shards > 1) {
+    // Leave headroom for an uneven distribution of the objects; the number of
+    // slots of the LRU caches needs to be a multiple of 64
+    shard_entries = std::max(2 * max_entries / num_shards, 128U);
+    shard_entries = (shard_entries + 63) & ~63U;
+  }
+  // Same headroom for the heaps of the shards; the global limit is enforced
+  // by used_bytes_
+  shard_size_ = max_size;
+  if (num_shards > 1)
+    shard_size_ = std::min(2 * (max_size / num_shards), max_size);
+  for (unsigned i = 0; i < num_shards; ++i) {
+    string prefix = "kv.";
+    if (num_shards > 1)
+      prefix += "shard" + StringifyInt(i) + ".";
+    shards_.push_back(new Shard(
+      shard_entries, alloc, shard_size_,
+      perf::StatisticsTemplate(prefix + "regular", statistics),
+      perf::StatisticsTemplate(prefix + "volatile", statistics)));
+  }
+  LogCvmfs(kLogCache, kLogDebug, "max %u B, %u entries, %u shards",
+           max_size, max_entries, num_shards);
 }
 
 
 RamCacheManager::~RamCacheManager() {
-  pthread_rwlock_destroy(&rwlock_);
+  for (unsigned i = 0; i < shards_.size(); ++i)
+    delete shards_[i];
+  pthread_rwlock_destroy(&rwlock_fd_table_);
 }
 
 
 int RamCacheManager::AddFd(const ReadOnlyHandle &handle) {
+  WriteLockGuard guard(rwlock_fd_table_);
   int result = fd_table_.OpenFd(handle);
   if (result == -ENFILE) {
     LogCvmfs(kLogCache, kLogDebug, "too many open files");
@@ -75,20 +98,30 @@ bool RamCacheManager::AcquireQuotaManager(QuotaManager *quota_mgr) {
 }
 
 
+RamCacheManager::ReadOnlyHandle RamCacheManager::GetHandle(int fd) {
+  ReadLockGuard guard(rwlock_fd_table_);
+  return fd_table_.GetHandle(fd);
+}
+
+
 int RamCacheManager::Open(const BlessedObject &object) {
-  WriteLockGuard guard(rwlock_);
+  ReadLockGuard guard(GetShard(object.id)->rwlock);
   return DoOpen(object.id);
 }
 
 
+/**
+ * The caller holds the lock of the object's shard.
+ */
 int RamCacheManager::DoOpen(const shash::Any &id) {
   bool ok;
   bool is_volatile;
   MemoryBuffer buf;
 
-  if (regular_entries_.Contains(id)) {
+  Shard *shard = GetShard(id);
+  if (shard->regular_entries.Contains(id)) {
     is_volatile = false;
-  } else if (volatile_entries_.Contains(id)) {
+  } else if (shard->volatile_entries.Contains(id)) {
     is_volatile = true;
   } else {
     LogCvmfs(kLogCache, kLogDebug, "miss for %s",
@@ -119,8 +152,7 @@ int RamCacheManager::DoOpen(const shash::Any &id) {
 
 
 int64_t RamCacheManager::GetSize(int fd) {
-  ReadLockGuard guard(rwlock_);
-  ReadOnlyHandle generic_handle = fd_table_.GetHandle(fd);
+  ReadOnlyHandle generic_handle = GetHandle(fd);
   if (generic_handle.handle == kInvalidHandle) {
     LogCvmfs(kLogCache, kLogDebug, "bad fd %d on GetSize", fd);
     return -EBADF;
@@ -133,17 +165,22 @@ int64_t RamCacheManager::GetSize(int fd) {
 int RamCacheManager::Close(int fd) {
   bool rc;
 
-  WriteLockGuard guard(rwlock_);
-  ReadOnlyHandle generic_handle = fd_table_.GetHandle(fd);
-  if (generic_handle.handle == kInvalidHandle) {
-    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Close", fd);
-    return -EBADF;
+  ReadOnlyHandle generic_handle;
+  {
+    WriteLockGuard guard(rwlock_fd_table_);
+    generic_handle = fd_table_.GetHandle(fd);
+    if (generic_handle.handle == kInvalidHandle) {
+      LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Close", fd);
+      return -EBADF;
+    }
+    int rc_int = fd_table_.CloseFd(fd);
+    assert(rc_int == 0);
   }
+  // The reference is dropped only after the fd is gone, so that the entry
+  // cannot be evicted while the fd is still valid
   rc = GetStore(generic_handle)->Unref(generic_handle.handle);
   assert(rc);
 
-  int rc_int = fd_table_.CloseFd(fd);
-  assert(rc_int == 0);
   LogCvmfs(kLogCache, kLogDebug, "closed fd %d", fd);
   perf::Inc(counters_.n_close);
   return 0;
@@ -156,8 +193,7 @@ int64_t RamCacheManager::Pread(
   uint64_t size,
   uint64_t offset)
 {
-  ReadLockGuard guard(rwlock_);
-  ReadOnlyHandle generic_handle = fd_table_.GetHandle(fd);
+  ReadOnlyHandle generic_handle = GetHandle(fd);
   if (generic_handle.handle == kInvalidHandle) {
     LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Pread", fd);
     return -EBADF;
@@ -171,16 +207,22 @@ int64_t RamCacheManager::Pread(
 int RamCacheManager::Dup(int fd) {
   bool ok;
   int rc;
-  WriteLockGuard guard(rwlock_);
-  ReadOnlyHandle generic_handle = fd_table_.GetHandle(fd);
+  ReadOnlyHandle generic_handle = GetHandle(fd);
   if (generic_handle.handle == kInvalidHandle) {
     LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Dup", fd);
     return -EBADF;
   }
+  ReadLockGuard guard(GetShard(generic_handle.handle)->rwlock);
   rc = AddFd(generic_handle);
   if (rc < 0) return rc;
   ok = GetStore(generic_handle)->IncRef(generic_handle.handle);
-  assert(ok);
+  if (!ok) {
+    // fd has been closed concurrently and the entry is gone
+    WriteLockGuard guard_fd_table(rwlock_fd_table_);
+    fd_table_.CloseFd(rc);
+    LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Dup", fd);
+    return -EBADF;
+  }
   LogCvmfs(kLogCache, kLogDebug, "dup fd %d", fd);
   perf::Inc(counters_.n_dup);
   return rc;
@@ -191,8 +233,7 @@ int RamCacheManager::Dup(int fd) {
  * For a RAM cache, read-ahead is a no-op.
  */
 int RamCacheManager::Readahead(int fd) {
-  ReadLockGuard guard(rwlock_);
-  ReadOnlyHandle generic_handle = fd_table_.GetHandle(fd);
+  ReadOnlyHandle generic_handle = GetHandle(fd);
   if (generic_handle.handle == kInvalidHandle) {
     LogCvmfs(kLogCache, kLogDebug, "bad fd %d on Readahead", fd);
     return -EBADF;
@@ -288,8 +329,8 @@ int RamCacheManager::Reset(void *txn) {
 
 
 int RamCacheManager::OpenFromTxn(void *txn) {
-  WriteLockGuard guard(rwlock_);
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  WriteLockGuard guard(GetShard(transaction->buffer.id)->rwlock);
   int64_t retval = CommitToKvStore(transaction);
   if (retval < 0) {
     LogCvmfs(kLogCache, kLogDebug,
@@ -315,8 +356,8 @@ int RamCacheManager::AbortTxn(void *txn) {
 
 
 int RamCacheManager::CommitTxn(void *txn) {
-  WriteLockGuard guard(rwlock_);
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  WriteLockGuard guard(GetShard(transaction->buffer.id)->rwlock);
   perf::Inc(counters_.n_committxn);
   int64_t rc = CommitToKvStore(transaction);
   if (rc < 0) return rc;
@@ -325,13 +366,18 @@ int RamCacheManager::CommitTxn(void *txn) {
 }
 
 
+/**
+ * The caller holds the write lock of the transaction's shard.
+ */
 int64_t RamCacheManager::CommitToKvStore(Transaction *transaction) {
+  unsigned shard_idx = GetShardIndex(transaction->buffer.id);
+  Shard *shard = shards_[shard_idx];
   MemoryKvStore *store;
 
   if (transaction->buffer.object_type == kTypeVolatile) {
-    store = &volatile_entries_;
+    store = &shard->volatile_entries;
   } else {
-    store = &regular_entries_;
+    store = &shard->regular_entries;
   }
   if (transaction->buffer.object_type == kTypePinned ||
       transaction->buffer.object_type == kTypeCatalog) {
@@ -340,23 +386,29 @@ int64_t RamCacheManager::CommitToKvStore(Transaction *transaction) {
     transaction->buffer.refcount = 0;
   }
 
-  int64_t regular_size = regular_entries_.GetUsed();
-  int64_t volatile_size = volatile_entries_.GetUsed();
-  int64_t overrun = regular_size + volatile_size +
-    transaction->buffer.size - max_size_;
+  // Reserve the space up front so that concurrent commits to different shards
+  // cannot pass the limit check together
+  int64_t size = transaction->buffer.size;
+  int64_t overrun = atomic_xadd64(&used_bytes_, size) + size - max_size_;
 
   if (overrun > 0) {
     // if we're going to clean the cache, try to remove at least 25%
     overrun = max(overrun, (int64_t) max_size_>>2);
     perf::Inc(counters_.n_overrun);
-    volatile_entries_.ShrinkTo(max((int64_t) 0, volatile_size - overrun));
+    overrun -= Evict(true, shard_idx, overrun);
   }
-  overrun -= volatile_size - volatile_entries_.GetUsed();
   if (overrun > 0) {
-    regular_entries_.ShrinkTo(max((int64_t) 0, regular_size - overrun));
+    overrun -= Evict(false, shard_idx, overrun);
+  }
+  // The store's heap in the shard can fill up before the cache as a whole
+  int64_t heap_overrun = store->GetUsed() + size - shard_size_;
+  if ((overrun <= 0) && (heap_overrun > 0)) {
+    perf::Inc(counters_.n_overrun);
+    overrun = heap_overrun - EvictShard(
+      shard, transaction->buffer.object_type == kTypeVolatile, heap_overrun);
   }
-  overrun -= regular_size -regular_entries_.GetUsed();
   if (overrun > 0) {
+    atomic_xadd64(&used_bytes_, -size);
     LogCvmfs(kLogCache, kLogDebug,
              "transaction for %s would overrun the cache limit by %d",
              transaction->buffer.id.ToString().c_str(), overrun);
@@ -364,7 +416,11 @@ int64_t RamCacheManager::CommitToKvStore(Transaction *transaction) {
     return -ENOSPC;
   }
 
+  int64_t used_before = shard->GetUsed();
   int rc = store->Commit(transaction->buffer);
+  // Replace the reservation by the actual change, which differs if the commit
+  // failed or overwrote an existing entry
+  atomic_xadd64(&used_bytes_, shard->GetUsed() - used_before - size);
   if (rc < 0) {
     LogCvmfs(kLogCache, kLogDebug,
              "commit on %s failed",
@@ -375,3 +431,47 @@ int64_t RamCacheManager::CommitToKvStore(Transaction *transaction) {
            transaction->buffer.id.ToString().c_str());
   return 0;
 }
+
+
+/**
+ * Removes up to nbytes of unreferenced regular or volatile entries, starting
+ * with the shard first_shard whose write lock is held by the caller.  Other
+ * shards are skipped if they are busy; waiting for them could deadlock.
+ * Returns the number of bytes freed.
+ */
+int64_t RamCacheManager::Evict(
+  bool is_volatile,
+  unsigned first_shard,
+  int64_t nbytes)
+{
+  int64_t freed = 0;
+  for (unsigned i = 0; (i < shards_.size()) && (freed < nbytes); ++i) {
+    Shard *shard = shards_[(first_shard + i) % shards_.size()];
+    if ((i > 0) && (pthread_rwlock_trywrlock(&shard->rwlock) != 0))
+      continue;
+    freed += EvictShard(shard, is_volatile, nbytes - freed);
+    if (i > 0)
+      pthread_rwlock_unlock(&shard->rwlock);
+  }
+  return freed;
+}
+
+
+/**
+ * Removes up to nbytes of unreferenced regular or volatile entries from a
+ * shard whose write lock is held by the caller.  Returns the number of bytes
+ * freed.
+ */
+int64_t RamCacheManager::EvictShard(
+  Shard *shard,
+  bool is_volatile,
+  int64_t nbytes)
+{
+  MemoryKvStore *store =
+    is_volatile ? &shard->volatile_entries : &shard->regular_entries;
+  int64_t used_before = store->GetUsed();
+  store->ShrinkTo(max((int64_t) 0, used_before - nbytes));
+  int64_t shrunk = used_before - store->GetUsed();
+  atomic_xadd64(&used_bytes_, -shrunk);
+  return shrunk;
+}
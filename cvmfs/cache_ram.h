@@ -11,12 +11,14 @@
 #include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "cache.h"
 #include "fd_table.h"
 #include "hash.h"
 #include "kvstore.h"
 #include "statistics.h"
 #include "util/pointer.h"
+#include "util/single_copy.h"
 
 
 /**
@@ -40,6 +42,12 @@
  * RamCacheManager uses a custom heap allocator rather than
  * the system's libc @p malloc(). To switch to libc malloc, set
  * @p CVMFS_CACHE_RAM_MALLOC=libc
+ *
+ * With @p CVMFS_CACHE_RAM_SHARDS=N, objects are distributed over N shards by
+ * the first bytes of their content hash.  Every shard has its own key-value
+ * stores, heaps and lock, so reads from different shards do not contend and
+ * heap compaction only blocks the shard being compacted.  The size limit
+ * applies to the sum of all shards.
  */
 class RamCacheManager : public CacheManager {
  public:
@@ -103,11 +111,14 @@ class RamCacheManager : public CacheManager {
   virtual CacheManagerIds id() { return kRamCacheManager; }
   virtual std::string Describe();
 
+  static const unsigned kMaxShards = 256;
+
   RamCacheManager(
     uint64_t max_size,
     unsigned max_entries,
     MemoryKvStore::MemoryAllocator alloc,
-    perf::StatisticsTemplate statistics);
+    perf::StatisticsTemplate statistics,
+    unsigned num_shards = 1);
 
   virtual ~RamCacheManager();
 
@@ -275,31 +286,72 @@ class RamCacheManager : public CacheManager {
     std::string description;
   };
 
-  inline MemoryKvStore *GetStore(const ReadOnlyHandle &fd) {
-    if (fd.is_volatile) {
-      return &volatile_entries_;
-    } else {
-      return &regular_entries_;
+  /**
+   * The regular and volatile entries of a subset of the objects.  The lock
+   * protects the store selection and eviction; the stores have their own locks
+   * for reading and writing entries.
+   */
+  struct Shard : public ::SingleCopy {
+    Shard(unsigned max_entries,
+          MemoryKvStore::MemoryAllocator alloc,
+          uint64_t max_size,
+          perf::StatisticsTemplate statistics_regular,
+          perf::StatisticsTemplate statistics_volatile)
+      : regular_entries(max_entries, alloc, max_size, statistics_regular)
+      , volatile_entries(max_entries, alloc, max_size, statistics_volatile)
+    {
+      int retval = pthread_rwlock_init(&rwlock, NULL);
+      assert(retval == 0);
+    }
+    ~Shard() { pthread_rwlock_destroy(&rwlock); }
+    uint64_t GetUsed() {
+      return regular_entries.GetUsed() + volatile_entries.GetUsed();
     }
+
+    MemoryKvStore regular_entries;
+    MemoryKvStore volatile_entries;
+    pthread_rwlock_t rwlock;
+  };
+
+  inline unsigned GetShardIndex(const shash::Any &id) {
+    if (shards_.size() == 1)
+      return 0;
+    return ((id.digest[0] << 8) | id.digest[1]) % shards_.size();
+  }
+
+  inline Shard *GetShard(const shash::Any &id) {
+    return shards_[GetShardIndex(id)];
   }
 
-  inline MemoryKvStore *GetTransactionStore(Transaction *txn) {
-    if (txn->buffer.object_type == kTypeVolatile) {
-      return &volatile_entries_;
+  inline MemoryKvStore *GetStore(const ReadOnlyHandle &fd) {
+    Shard *shard = GetShard(fd.handle);
+    if (fd.is_volatile) {
+      return &shard->volatile_entries;
     } else {
-      return &regular_entries_;
+      return &shard->regular_entries;
     }
   }
 
   int AddFd(const ReadOnlyHandle &handle);
+  ReadOnlyHandle GetHandle(int fd);
   int64_t CommitToKvStore(Transaction *transaction);
+  int64_t Evict(bool is_volatile, unsigned first_shard, int64_t nbytes);
+  int64_t EvictShard(Shard *shard, bool is_volatile, int64_t nbytes);
   virtual int DoOpen(const shash::Any &id);
 
   uint64_t max_size_;
+  /**
+   * Heap size of the regular and volatile store of every shard
+   */
+  uint64_t shard_size_;
   FdTable<ReadOnlyHandle> fd_table_;
-  pthread_rwlock_t rwlock_;
-  MemoryKvStore regular_entries_;
-  MemoryKvStore volatile_entries_;
+  pthread_rwlock_t rwlock_fd_table_;
+  std::vector<Shard *> shards_;
+  /**
+   * Sum of the used bytes of all shards plus the space reserved by commits in
+   * flight
+   */
+  atomic_int64 used_bytes_;
   Counters counters_;
 };  // class RamCacheManager
 
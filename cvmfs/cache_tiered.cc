@@ -6,12 +6,19 @@
 
 #include <errno.h>
 
+#include <cassert>
+#include <cstdlib>
+#include <new>
 #include <string>
 #include <vector>
 
+#include "logging.h"
 #include "platform.h"
 #include "quota.h"
 #include "util/posix.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
 
 
 std::string TieredCacheManager::Describe() {
@@ -46,26 +53,27 @@ void *TieredCacheManager::DoSaveState() {
 }
 
 
-int TieredCacheManager::Open(const BlessedObject &object) {
-  int fd = upper_->Open(object);
-  if ((fd >= 0) || (fd != -ENOENT)) {return fd;}
-
-  int fd2 = lower_->Open(object);
-  if (fd2 < 0) {return fd;}  // NOTE: use error code from upper.
-
-  // Lower cache hit; upper cache miss.  Copy object into the upper cache.
-  int64_t size = lower_->GetSize(fd2);
-  if (size < 0) {
-    lower_->Close(fd2);
-    return fd;
-  }
+/**
+ * Copies an open object from the source to the destination cache.  If
+ * open_dest is set, returns a file descriptor to the new object in the
+ * destination cache, otherwise returns zero on success.
+ */
+int TieredCacheManager::CopyObject(
+  CacheManager *source,
+  const int fd_source,
+  CacheManager *dest,
+  const BlessedObject &object,
+  const bool open_dest)
+{
+  int64_t size = source->GetSize(fd_source);
+  if (size < 0)
+    return size;
 
-  void *txn = alloca(upper_->SizeOfTxn());
-  if (upper_->StartTxn(object.id, size, txn) < 0) {
-    lower_->Close(fd2);
-    return fd;
-  }
-  upper_->CtrlTxn(object.info, 0, txn);
+  void *txn = alloca(dest->SizeOfTxn());
+  int retval = dest->StartTxn(object.id, size, txn);
+  if (retval < 0)
+    return retval;
+  dest->CtrlTxn(object.info, 0, txn);
 
   std::vector<char> m_buffer;
   m_buffer.resize(kCopyBufferSize);
@@ -73,42 +81,98 @@ int TieredCacheManager::Open(const BlessedObject &object) {
   uint64_t offset = 0;
   while (remaining > 0) {
     unsigned nbytes = remaining > kCopyBufferSize ? kCopyBufferSize : remaining;
-    int64_t result = lower_->Pread(fd2, &m_buffer[0], nbytes, offset);
+    int64_t result = source->Pread(fd_source, &m_buffer[0], nbytes, offset);
     // The file we are reading is supposed to be exactly `size` bytes.
     if ((result < 0) || (result != nbytes)) {
-      lower_->Close(fd2);
-      upper_->AbortTxn(txn);
-      return fd;
+      dest->AbortTxn(txn);
+      return (result < 0) ? result : -EIO;
     }
-    result = upper_->Write(&m_buffer[0], nbytes, txn);
+    result = dest->Write(&m_buffer[0], nbytes, txn);
     if (result < 0) {
-      lower_->Close(fd2);
-      upper_->AbortTxn(txn);
-      return fd;
+      dest->AbortTxn(txn);
+      return result;
     }
     offset += nbytes;
     remaining -= nbytes;
   }
-  lower_->Close(fd2);
-  int fd_return = upper_->OpenFromTxn(txn);
-  if (fd_return < 0) {
-    upper_->AbortTxn(txn);
-    return fd;
+
+  int fd_return = 0;
+  if (open_dest) {
+    fd_return = dest->OpenFromTxn(txn);
+    if (fd_return < 0) {
+      dest->AbortTxn(txn);
+      return fd_return;
+    }
   }
-  if (upper_->CommitTxn(txn) < 0) {
-    upper_->Close(fd_return);
-    return fd;
+  retval = dest->CommitTxn(txn);
+  if (retval < 0) {
+    if (open_dest)
+      dest->Close(fd_return);
+    return retval;
   }
   return fd_return;
 }
 
 
+int TieredCacheManager::Dup(int fd) {
+  int result = Tier(fd)->Dup(Untag(fd));
+  if ((result < 0) || !(fd & kLowerFdFlag))
+    return result;
+  return result | kLowerFdFlag;
+}
+
+
+int TieredCacheManager::Open(const BlessedObject &object) {
+  int fd = upper_->Open(object);
+  if ((fd >= 0) || (fd != -ENOENT)) {return fd;}
+
+  int fd2 = lower_->Open(object);
+  if (fd2 < 0) {return fd;}  // NOTE: use error code from upper.
+
+  if (async_)
+    return OpenLower(object, fd2);
+
+  // Lower cache hit; upper cache miss.  Copy object into the upper cache.
+  int fd_return = CopyObject(lower_, fd2, upper_, object, true);
+  lower_->Close(fd2);
+  return (fd_return < 0) ? fd : fd_return;
+}
+
+
+/**
+ * Serves an upper cache miss from the lower cache and schedules the copy-up.
+ */
+int TieredCacheManager::OpenLower(const BlessedObject &object, int fd_lower) {
+  if (fd_lower & kLowerFdFlag) {
+    lower_->Close(fd_lower);
+    return -ENFILE;
+  }
+
+  int64_t size = lower_->GetSize(fd_lower);
+  int fd_job = (size < 0) ? -1 : lower_->Dup(fd_lower);
+  if (fd_job >= 0) {
+    EnqueueResult result = Enqueue(CopyJob(true, fd_job, size, object));
+    if (result != kEnqueueOk) {
+      lower_->Close(fd_job);
+      if (result == kEnqueueFull)
+        perf::Inc(counters_->n_promote_skipped);
+    }
+  }
+  return fd_lower | kLowerFdFlag;
+}
+
+
 int TieredCacheManager::StartTxn(const shash::Any &id, uint64_t size, void *txn)
 {
   int upper_result = upper_->StartTxn(id, size, txn);
-  if (lower_readonly_ || (upper_result < 0)) {
+  if (upper_result < 0)
+    return upper_result;
+  if (async_) {
+    new (GetTxnObject(txn)) TxnObject(id);
     return upper_result;
   }
+  if (lower_readonly_)
+    return upper_result;
 
   void *txn2 = static_cast<char *>(txn) + upper_->SizeOfTxn();
   int lower_result = lower_->StartTxn(id, size, txn2);
@@ -132,13 +196,30 @@ CacheManager *TieredCacheManager::Create(
 }
 
 
+/**
+ * Switches to asynchronous promotion and write-back.  Must be called before
+ * Spawn() and before any object is opened.
+ */
+void TieredCacheManager::SetAsync(
+  const uint64_t max_queue_bytes,
+  perf::StatisticsTemplate statistics)
+{
+  assert(!spawned_);
+  async_ = true;
+  max_queue_bytes_ = max_queue_bytes;
+  counters_ = new Counters(statistics);
+}
+
+
 void TieredCacheManager::CtrlTxn(
   const ObjectInfo &object_info,
   const int flags,
   void *txn)
 {
   upper_->CtrlTxn(object_info, flags, txn);
-  if (!lower_readonly_) {
+  if (async_) {
+    GetTxnObject(txn)->object.info = object_info;
+  } else if (!lower_readonly_) {
     void *txn2 = static_cast<char*>(txn) + upper_->SizeOfTxn();
     lower_->CtrlTxn(object_info, flags, txn2);
   }
@@ -147,7 +228,7 @@ void TieredCacheManager::CtrlTxn(
 
 int64_t TieredCacheManager::Write(const void *buf, uint64_t size, void *txn) {
   int upper_result = upper_->Write(buf, size, txn);
-  if (lower_readonly_ || (upper_result < 0)) { return upper_result; }
+  if (lower_readonly_ || async_ || (upper_result < 0)) { return upper_result; }
 
   void *txn2 = static_cast<char*>(txn) + upper_->SizeOfTxn();
   return lower_->Write(buf, size, txn2);
@@ -158,7 +239,7 @@ int TieredCacheManager::Reset(void *txn) {
   int upper_result = upper_->Reset(txn);
 
   int lower_result = upper_result;
-  if (!lower_readonly_) {
+  if (!lower_readonly_ && !async_) {
     void *txn2 = static_cast<char*>(txn) + upper_->SizeOfTxn();
     lower_result = lower_->Reset(txn2);
   }
@@ -169,6 +250,10 @@ int TieredCacheManager::Reset(void *txn) {
 
 int TieredCacheManager::AbortTxn(void *txn) {
   int upper_result = upper_->AbortTxn(txn);
+  if (async_) {
+    GetTxnObject(txn)->~TxnObject();
+    return upper_result;
+  }
 
   int lower_result = upper_result;
   if (!lower_readonly_) {
@@ -182,6 +267,13 @@ int TieredCacheManager::AbortTxn(void *txn) {
 
 int TieredCacheManager::CommitTxn(void *txn) {
   int upper_result = upper_->CommitTxn(txn);
+  if (async_) {
+    TxnObject *txn_object = GetTxnObject(txn);
+    if ((upper_result >= 0) && !lower_readonly_)
+      WriteBack(txn_object->object);
+    txn_object->~TxnObject();
+    return upper_result;
+  }
 
   int lower_result = upper_result;
   if (!lower_readonly_) {
@@ -214,11 +306,190 @@ bool TieredCacheManager::StoreBreadcrumb(const manifest::Manifest &manifest) {
 void TieredCacheManager::Spawn() {
   upper_->Spawn();
   lower_->Spawn();
+  if (!async_)
+    return;
+
+  assert(!spawned_);
+  int retval = pthread_create(&thread_worker_, NULL, MainWorker, this);
+  if (retval != 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "could not create tiered cache worker thread");
+    abort();
+  }
+  spawned_ = true;
+}
+
+
+TieredCacheManager::TieredCacheManager(
+  CacheManager *upper_cache,
+  CacheManager *lower_cache)
+  : upper_(upper_cache)
+  , lower_(lower_cache)
+  , lower_readonly_(false)
+  , async_(false)
+  , max_queue_bytes_(0)
+  , queue_bytes_(0)
+  , num_in_flight_(0)
+  , spawned_(false)
+  , terminate_(false)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_, NULL);
+  assert(retval == 0);
 }
 
 
+/**
+ * Stops the worker and finishes the queued jobs, so that no write-back gets
+ * lost.
+ */
 TieredCacheManager::~TieredCacheManager() {
+  if (spawned_) {
+    {
+      MutexLockGuard guard(&lock_);
+      terminate_ = true;
+      pthread_cond_broadcast(&cond_);
+    }
+    pthread_join(thread_worker_, NULL);
+  }
+  ProcessBatch(0);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+
   quota_mgr_ = NULL;  // gets deleted by upper
   delete upper_;
   delete lower_;
 }
+
+
+/**
+ * Processes the entire queue before it returns.
+ */
+void TieredCacheManager::Drain() {
+  ProcessBatch(0);
+  MutexLockGuard guard(&lock_);
+  while (num_in_flight_ > 0)
+    pthread_cond_wait(&cond_, &lock_);
+}
+
+
+/**
+ * Queues the job unless the queue is full or, for a promotion, the object is
+ * already queued for promotion.  The check and the insertion into the pending
+ * promotions happen under the same lock, so concurrent opens of an object
+ * queue a single promotion.  If the job is not queued, the caller still owns
+ * the job's file descriptor.
+ */
+TieredCacheManager::EnqueueResult TieredCacheManager::Enqueue(
+  const CopyJob &job)
+{
+  MutexLockGuard guard(&lock_);
+  if (job.promote && (pending_promotions_.count(job.object.id) > 0))
+    return kEnqueuePending;
+  if (queue_bytes_ + job.size > max_queue_bytes_)
+    return kEnqueueFull;
+  queue_.push_back(job);
+  queue_bytes_ += job.size;
+  if (job.promote)
+    pending_promotions_.insert(job.object.id);
+  perf::Xadd(counters_->sz_queued, job.size);
+  pthread_cond_broadcast(&cond_);
+  return kEnqueueOk;
+}
+
+
+void *TieredCacheManager::MainWorker(void *data) {
+  TieredCacheManager *cache_mgr = reinterpret_cast<TieredCacheManager *>(data);
+  LogCvmfs(kLogCache, kLogDebug, "starting tiered cache worker");
+
+  pthread_mutex_lock(&cache_mgr->lock_);
+  while (true) {
+    while (cache_mgr->queue_.empty() && !cache_mgr->terminate_)
+      pthread_cond_wait(&cache_mgr->cond_, &cache_mgr->lock_);
+    if (cache_mgr->terminate_)
+      break;
+
+    pthread_mutex_unlock(&cache_mgr->lock_);
+    cache_mgr->ProcessBatch(0);
+    pthread_mutex_lock(&cache_mgr->lock_);
+  }
+  pthread_mutex_unlock(&cache_mgr->lock_);
+
+  LogCvmfs(kLogCache, kLogDebug, "stopping tiered cache worker");
+  return NULL;
+}
+
+
+/**
+ * Takes up to max_jobs jobs from the head of the queue, all of them if
+ * max_jobs is zero.  The lock is not held while copying.
+ */
+void TieredCacheManager::ProcessBatch(const unsigned max_jobs) {
+  vector<CopyJob> batch;
+  {
+    MutexLockGuard guard(&lock_);
+    while (!queue_.empty() && ((max_jobs == 0) || (batch.size() < max_jobs))) {
+      batch.push_back(queue_.front());
+      queue_.pop_front();
+    }
+    num_in_flight_ += batch.size();
+  }
+  if (batch.empty())
+    return;
+
+  uint64_t batch_bytes = 0;
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    ProcessJob(batch[i]);
+    batch_bytes += batch[i].size;
+  }
+
+  MutexLockGuard guard(&lock_);
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    if (batch[i].promote)
+      pending_promotions_.erase(batch[i].object.id);
+  }
+  num_in_flight_ -= batch.size();
+  queue_bytes_ -= batch_bytes;
+  perf::Xadd(counters_->sz_queued, -static_cast<int64_t>(batch_bytes));
+  perf::Inc(counters_->n_batches);
+  pthread_cond_broadcast(&cond_);
+}
+
+
+/**
+ * Copies the object and closes the job's file descriptor.
+ */
+void TieredCacheManager::ProcessJob(const CopyJob &job) {
+  CacheManager *source = job.promote ? lower_ : upper_;
+  CacheManager *dest = job.promote ? upper_ : lower_;
+  int retval = CopyObject(source, job.fd, dest, job.object, false);
+  source->Close(job.fd);
+  if (retval < 0) {
+    LogCvmfs(kLogCache, kLogDebug, "failed to copy %s %s the lower cache (%d)",
+             job.object.id.ToString().c_str(), job.promote ? "from" : "to",
+             retval);
+    perf::Inc(counters_->n_copy_failed);
+    return;
+  }
+  perf::Inc(job.promote ? counters_->n_promote : counters_->n_writeback);
+}
+
+
+/**
+ * Queues the copy of a freshly committed object to the lower cache.  If the
+ * queue is full, the object is copied synchronously.
+ */
+void TieredCacheManager::WriteBack(const BlessedObject &object) {
+  int fd = upper_->Open(object);
+  if (fd < 0) {
+    perf::Inc(counters_->n_copy_failed);
+    return;
+  }
+  int64_t size = upper_->GetSize(fd);
+  CopyJob job(false, fd, (size < 0) ? 0 : size, object);
+  if ((size >= 0) && (Enqueue(job) == kEnqueueOk))
+    return;
+  perf::Inc(counters_->n_writeback_sync);
+  ProcessJob(job);
+}
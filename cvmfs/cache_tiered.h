@@ -7,10 +7,18 @@
 #ifndef CVMFS_CACHE_TIERED_H_
 #define CVMFS_CACHE_TIERED_H_
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <set>
 #include <string>
 
 #include "cache.h"
 #include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "statistics.h"
+#include "util/pointer.h"
 
 /**
  * Cache manager implementation that provides a hierarchical cache.
@@ -21,6 +29,16 @@
  *   to the upper cache.
  * - Writes are done to both caches simultaneously.
  *
+ * In asynchronous mode, an upper cache miss is served directly from the lower
+ * cache while a background worker copies the object up.  Transactions only go
+ * to the upper cache; once committed, the worker writes the object back to
+ * the lower cache.  The worker processes its queue in batches.  Queued objects
+ * are kept open in the source cache, so the queue is bounded by the total size
+ * of its objects.  If the queue is full, promotions are skipped and write-backs
+ * are done synchronously.
+ *
+ * File descriptors of the lower cache are marked with kLowerFdFlag.
+ *
  * The quota manager is only applied to the upper cache.
  */
 class TieredCacheManager : public CacheManager {
@@ -28,12 +46,17 @@ class TieredCacheManager : public CacheManager {
   FRIEND_TEST(T_MountPoint, TieredComplex);
 
  public:
+  static const unsigned kDefaultMaxQueueBytes = 64 * 1024 * 1024;  // 64MB
+
   virtual CacheManagerIds id() { return kTieredCacheManager; }
   virtual std::string Describe();
 
   static CacheManager *Create(CacheManager *upper_cache,
                               CacheManager *lower_cache);
   void SetLowerReadOnly() { lower_readonly_ = true; }
+  void SetAsync(const uint64_t max_queue_bytes,
+                perf::StatisticsTemplate statistics);
+  void Drain();
 
   virtual ~TieredCacheManager();
   virtual bool AcquireQuotaManager(QuotaManager *quota_mgr) {
@@ -43,15 +66,18 @@ class TieredCacheManager : public CacheManager {
   }
 
   virtual int Open(const BlessedObject &object);
-  virtual int64_t GetSize(int fd) {return upper_->GetSize(fd);}
-  virtual int Close(int fd) {return upper_->Close(fd);}
+  virtual int64_t GetSize(int fd) { return Tier(fd)->GetSize(Untag(fd)); }
+  virtual int Close(int fd) { return Tier(fd)->Close(Untag(fd)); }
   virtual int64_t Pread(int fd, void *buf, uint64_t size, uint64_t offset)
-  { return upper_->Pread(fd, buf, size, offset); }
-  virtual int Dup(int fd) { return upper_->Dup(fd); }
-  virtual int Readahead(int fd) { return upper_->Readahead(fd); }
-
-  virtual uint32_t SizeOfTxn()
-  { return upper_->SizeOfTxn() + lower_->SizeOfTxn(); }
+  { return Tier(fd)->Pread(Untag(fd), buf, size, offset); }
+  virtual int Dup(int fd);
+  virtual int Readahead(int fd) { return Tier(fd)->Readahead(Untag(fd)); }
+  virtual int GetBackingFd(int fd, uint64_t *offset)
+  { return Tier(fd)->GetBackingFd(Untag(fd), offset); }
+
+  virtual uint32_t SizeOfTxn() {
+    return upper_->SizeOfTxn() + lower_->SizeOfTxn() + sizeof(TxnObject);
+  }
   virtual int StartTxn(const shash::Any &id, uint64_t size, void *txn);
   virtual void CtrlTxn(const ObjectInfo &object_info,
                        const int flags,
@@ -73,6 +99,7 @@ class TieredCacheManager : public CacheManager {
 
  private:
   static const unsigned kCopyBufferSize = 64 * 1024;  // 64kB
+  static const int kLowerFdFlag = 1 << 30;
 
   struct SavedState {
     SavedState() : state_upper(NULL), state_lower(NULL) { }
@@ -80,14 +107,115 @@ class TieredCacheManager : public CacheManager {
     void *state_lower;
   };
 
+  struct Counters {
+    perf::Counter *n_promote;
+    perf::Counter *n_promote_skipped;
+    perf::Counter *n_writeback;
+    perf::Counter *n_writeback_sync;
+    perf::Counter *n_copy_failed;
+    perf::Counter *n_batches;
+    perf::Counter *sz_queued;
+
+    explicit Counters(perf::StatisticsTemplate statistics) {
+      n_promote = statistics.RegisterTemplated("n_promote",
+        "Number of objects copied from the lower to the upper cache");
+      n_promote_skipped = statistics.RegisterTemplated("n_promote_skipped",
+        "Number of promotions skipped due to a full queue");
+      n_writeback = statistics.RegisterTemplated("n_writeback",
+        "Number of objects written back to the lower cache");
+      n_writeback_sync = statistics.RegisterTemplated("n_writeback_sync",
+        "Number of synchronous write-backs due to a full queue");
+      n_copy_failed = statistics.RegisterTemplated("n_copy_failed",
+        "Number of failed copies between the cache tiers");
+      n_batches = statistics.RegisterTemplated("n_batches",
+        "Number of batches processed by the copy worker");
+      sz_queued = statistics.RegisterTemplated("sz_queued",
+        "Number of bytes waiting in the copy queue");
+    }
+  };
+
+  /**
+   * Copy job of the background worker.  The source object is kept open until
+   * the job is done.
+   */
+  struct CopyJob {
+    CopyJob(const bool promote, const int fd, const uint64_t size,
+            const BlessedObject &object)
+      : promote(promote), fd(fd), size(size), object(object) { }
+    bool promote;  ///< lower --> upper if true, upper --> lower otherwise
+    int fd;  ///< In the source cache, untagged
+    uint64_t size;
+    BlessedObject object;
+  };
+
+  enum EnqueueResult {
+    kEnqueueOk = 0,
+    kEnqueueFull,
+    kEnqueuePending,  ///< The object is already queued for promotion
+  };
+
+  /**
+   * Appended to the transaction memory of the upper and lower cache.  Keeps
+   * the object meta-data for the write-back in asynchronous mode.
+   */
+  struct TxnObject {
+    explicit TxnObject(const shash::Any &id) : object(id) { }
+    BlessedObject object;
+  };
+
   // NOTE: TieredCacheManager takes ownership of both caches passed.
   TieredCacheManager(CacheManager *upper_cache,
-                     CacheManager *lower_cache)
-    : upper_(upper_cache), lower_(lower_cache), lower_readonly_(false) { }
+                     CacheManager *lower_cache);
+
+  static void *MainWorker(void *data);
+
+  CacheManager *Tier(const int fd) {
+    return (fd & kLowerFdFlag) ? lower_ : upper_;
+  }
+  static int Untag(const int fd) { return fd & ~kLowerFdFlag; }
+  TxnObject *GetTxnObject(void *txn) {
+    return reinterpret_cast<TxnObject *>(static_cast<char *>(txn) +
+      upper_->SizeOfTxn() + lower_->SizeOfTxn());
+  }
+
+  int CopyObject(CacheManager *source, const int fd_source,
+                 CacheManager *dest, const BlessedObject &object,
+                 const bool open_dest);
+  int OpenLower(const BlessedObject &object, int fd_lower);
+  void WriteBack(const BlessedObject &object);
+  EnqueueResult Enqueue(const CopyJob &job);
+  void ProcessBatch(const unsigned max_jobs);
+  void ProcessJob(const CopyJob &job);
 
   CacheManager *upper_;
   CacheManager *lower_;
   bool lower_readonly_;
+
+  bool async_;
+  uint64_t max_queue_bytes_;
+  UniquePtr<Counters> counters_;
+  /**
+   * Protects the queue, the pending promotions and the worker state
+   */
+  pthread_mutex_t lock_;
+  /**
+   * Signals new jobs and termination to the worker and finished batches to
+   * Drain()
+   */
+  pthread_cond_t cond_;
+  std::deque<CopyJob> queue_;
+  /**
+   * Objects with a queued or running promotion
+   */
+  std::set<shash::Any> pending_promotions_;
+  /**
+   * Includes the jobs that are taken from the queue but not yet finished
+   */
+  uint64_t queue_bytes_;
+  unsigned num_in_flight_;
+  pthread_t thread_worker_;
+  bool spawned_;
+  bool terminate_;
 };  // class TieredCacheManager
 
 #endif  // CVMFS_CACHE_TIERED_H_
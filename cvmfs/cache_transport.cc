@@ -7,6 +7,8 @@
 #include <alloca.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <cstdlib>
@@ -387,12 +389,31 @@ bool CacheTransport::ParseObjectType(
 
 
 bool CacheTransport::RecvFrame(CacheTransport::Frame *frame) {
+  return RecvFrame(frame, NULL);
+}
+
+
+bool CacheTransport::RecvFrame(CacheTransport::Frame *frame, int *fd) {
   uint32_t size;
   bool has_attachment;
-  bool retval = RecvHeader(&size, &has_attachment);
+  bool retval = RecvHeader(&size, &has_attachment, fd);
   if (!retval)
     return false;
+  retval = RecvBody(frame, size, has_attachment);
+  if (!retval && (fd != NULL) && (*fd >= 0)) {
+    close(*fd);
+    *fd = -1;
+  }
+  return retval;
+}
+
 
+bool CacheTransport::RecvBody(
+  CacheTransport::Frame *frame,
+  uint32_t size,
+  bool has_attachment)
+{
+  bool retval;
   void *buffer;
   if (size <= kMaxStackAlloc)
     buffer = alloca(size);
@@ -447,9 +468,52 @@ bool CacheTransport::RecvFrame(CacheTransport::Frame *frame) {
 }
 
 
-bool CacheTransport::RecvHeader(uint32_t *size, bool *has_attachment) {
+/**
+ * If fd is not NULL, a file descriptor passed along with the header is
+ * received, too.
+ */
+bool CacheTransport::RecvHeader(
+  uint32_t *size,
+  bool *has_attachment,
+  int *fd)
+{
   unsigned char header[kHeaderSize];
-  ssize_t nbytes = SafeRead(fd_connection_, header, kHeaderSize);
+  ssize_t nbytes;
+  if (fd == NULL) {
+    nbytes = SafeRead(fd_connection_, header, kHeaderSize);
+  } else {
+    *fd = -1;
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = kHeaderSize;
+    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+    do {
+      nbytes = recvmsg(fd_connection_, &msg, 0);
+    } while ((nbytes < 0) && (errno == EINTR));
+    if (nbytes > 0) {
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+          (cmsg->cmsg_type == SCM_RIGHTS))
+      {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+      if (static_cast<unsigned>(nbytes) < kHeaderSize) {
+        ssize_t nbytes_rest = SafeRead(fd_connection_, header + nbytes,
+                                       kHeaderSize - nbytes);
+        nbytes = (nbytes_rest < 0) ? nbytes_rest : nbytes + nbytes_rest;
+      }
+    }
+    if ((*fd >= 0) && (static_cast<unsigned>(nbytes) != kHeaderSize)) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
   if ((nbytes < 0) || (static_cast<unsigned>(nbytes) != kHeaderSize))
     return false;
   if ((header[0] & (~kFlagHasAttachment)) != kWireProtocolVersion)
@@ -464,7 +528,8 @@ void CacheTransport::SendData(
   void *message,
   uint32_t msg_size,
   void *attachment,
-  uint32_t att_size)
+  uint32_t att_size,
+  int fd)
 {
   uint32_t total_size =
     msg_size + att_size + ((att_size > 0) ? kInnerHeaderSize : 0);
@@ -501,10 +566,15 @@ void CacheTransport::SendData(
     iov[1].iov_len = msg_size;
   }
   if (flags_ & kFlagSendNonBlocking) {
+    assert(fd < 0);
     SendNonBlocking(iov, (att_size == 0) ? 2 : 4);
     return;
   }
-  bool retval = SafeWriteV(fd_connection_, iov, (att_size == 0) ? 2 : 4);
+  bool retval;
+  if (fd >= 0)
+    retval = SendWithFd(iov, (att_size == 0) ? 2 : 4, fd);
+  else
+    retval = SafeWriteV(fd_connection_, iov, (att_size == 0) ? 2 : 4);
 
   if (!retval && !(flags_ & kFlagSendIgnoreFailure)) {
     LogCvmfs(kLogCache, kLogSyslogErr | kLogDebug,
@@ -540,7 +610,53 @@ void CacheTransport::SendNonBlocking(struct iovec *iov, unsigned iovcnt) {
 }
 
 
+/**
+ * The file descriptor goes along with the first chunk of data, the remaining
+ * data is written as usual.
+ */
+bool CacheTransport::SendWithFd(struct iovec *iov, unsigned iovcnt, int fd) {
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  memset(cmsg_buf, 0, sizeof(cmsg_buf));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t nbytes;
+  do {
+    nbytes = sendmsg(fd_connection_, &msg, 0);
+  } while ((nbytes < 0) && (errno == EINTR));
+  if (nbytes < 0)
+    return false;
+
+  // Skip what has been sent already
+  unsigned i = 0;
+  size_t skip = nbytes;
+  while ((i < iovcnt) && (skip >= iov[i].iov_len)) {
+    skip -= iov[i].iov_len;
+    ++i;
+  }
+  if (i == iovcnt)
+    return true;
+  iov[i].iov_base = reinterpret_cast<char *>(iov[i].iov_base) + skip;
+  iov[i].iov_len -= skip;
+  return SafeWriteV(fd_connection_, iov + i, iovcnt - i);
+}
+
+
 void CacheTransport::SendFrame(CacheTransport::Frame *frame) {
+  SendFrame(frame, -1);
+}
+
+
+void CacheTransport::SendFrame(CacheTransport::Frame *frame, int fd) {
   cvmfs::MsgRpc *msg_rpc = frame->GetMsgRpc();
   int32_t size = msg_rpc->ByteSize();
   assert(size > 0);
@@ -551,7 +667,7 @@ void CacheTransport::SendFrame(CacheTransport::Frame *frame) {
 #endif
   bool retval = msg_rpc->SerializeToArray(buffer, size);
   assert(retval);
-  SendData(buffer, size, frame->attachment(), frame->att_size());
+  SendData(buffer, size, frame->attachment(), frame->att_size(), fd);
 #ifdef __APPLE__
   free(buffer);
 #endif
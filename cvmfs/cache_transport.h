@@ -138,6 +138,16 @@ class CacheTransport {
 
   void SendFrame(Frame *frame);
   bool RecvFrame(Frame *frame);
+  /**
+   * Passes a file descriptor along with the frame.  Only works on UNIX domain
+   * sockets.
+   */
+  void SendFrame(Frame *frame, int fd);
+  /**
+   * Receives a file descriptor that was passed along with the frame.  The file
+   * descriptor is set to -1 if there is none.
+   */
+  bool RecvFrame(Frame *frame, int *fd);
 
   void FillMsgHash(const shash::Any &hash, cvmfs::MsgHash *msg_hash);
   bool ParseMsgHash(const cvmfs::MsgHash &msg_hash, shash::Any *hash);
@@ -154,9 +164,12 @@ class CacheTransport {
   void SendData(void *message,
                 uint32_t msg_size,
                 void *attachment = NULL,
-                uint32_t att_size = 0);
+                uint32_t att_size = 0,
+                int fd = -1);
   void SendNonBlocking(struct iovec *iov, unsigned iovcnt);
-  bool RecvHeader(uint32_t *size, bool *has_attachment);
+  bool SendWithFd(struct iovec *iov, unsigned iovcnt, int fd);
+  bool RecvHeader(uint32_t *size, bool *has_attachment, int *fd);
+  bool RecvBody(Frame *frame, uint32_t size, bool has_attachment);
 
   int fd_connection_;
   uint32_t flags_;
@@ -6,14 +6,18 @@
 
 #include <alloca.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <algorithm>
 #include <cassert>
 
+#include "bloom_filter.h"
+#include "catalog_index.h"
 #include "catalog_mgr.h"
 #include "logging.h"
 #include "platform.h"
 #include "smalloc.h"
+#include "statistics.h"
 #include "util_concurrency.h"
 
 using namespace std;  // NOLINT
@@ -22,6 +26,32 @@ namespace catalog {
 
 const shash::Md5 Catalog::kMd5PathEmpty("", 0);
 
+namespace {
+
+/**
+ * Batched lookups probe the path hashes in the order of the primary key of the
+ * catalog table, so that consecutive probes hit neighboring B-tree pages.
+ */
+struct PathProbe {
+  PathProbe(const shash::Md5 &md5path, const unsigned i) : idx(i) {
+    uint64_t high, low;
+    md5path.ToIntPair(&high, &low);
+    md5path_1 = static_cast<int64_t>(high);
+    md5path_2 = static_cast<int64_t>(low);
+  }
+  bool operator <(const PathProbe &other) const {
+    if (md5path_1 != other.md5path_1)
+      return md5path_1 < other.md5path_1;
+    return md5path_2 < other.md5path_2;
+  }
+
+  int64_t md5path_1;
+  int64_t md5path_2;
+  unsigned idx;
+};
+
+}  // anonymous namespace
+
 
 /**
  * Open a catalog outside the framework of a catalog manager.
@@ -70,7 +100,12 @@ Catalog::Catalog(const PathString &mountpoint,
   database_ = NULL;
   uid_map_ = NULL;
   gid_map_ = NULL;
+  index_ = NULL;
+  path_filter_ = NULL;
+  n_filtered_ = NULL;
+  n_false_positives_ = NULL;
   sql_listing_ = NULL;
+  sql_listing_range_ = NULL;
   sql_lookup_md5path_ = NULL;
   sql_lookup_nested_ = NULL;
   sql_list_nested_ = NULL;
@@ -85,6 +120,8 @@ Catalog::~Catalog() {
   pthread_mutex_destroy(lock_);
   free(lock_);
   FinalizePreparedStatements();
+  delete index_;
+  delete path_filter_;
   delete database_;
 }
 
@@ -97,6 +134,7 @@ Catalog::~Catalog() {
  */
 void Catalog::InitPreparedStatements() {
   sql_listing_          = new SqlListing(database());
+  sql_listing_range_    = new SqlListingRange(database());
   sql_lookup_md5path_   = new SqlLookupPathHash(database());
   sql_lookup_nested_    = new SqlNestedCatalogLookup(database());
   sql_list_nested_      = new SqlNestedCatalogListing(database());
@@ -111,6 +149,7 @@ void Catalog::FinalizePreparedStatements() {
   delete sql_lookup_xattrs_;
   delete sql_chunks_listing_;
   delete sql_all_chunks_;
+  delete sql_listing_range_;
   delete sql_listing_;
   delete sql_lookup_md5path_;
   delete sql_lookup_nested_;
@@ -305,6 +344,27 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
 {
   assert(IsInitialized());
 
+  if ((path_filter_ != NULL) && !path_filter_->Contains(md5path)) {
+    perf::Inc(n_filtered_);
+    return false;
+  }
+
+  if (UseIndex()) {
+    SqlLookup::DirentFields fields;
+    if (index_->Lookup(md5path, &fields)) {
+      if (dirent != NULL) {
+        *dirent = MakeIndexedDirent(fields, expand_symlink);
+        FixTransitionPoint(md5path, dirent);
+      }
+      return true;
+    }
+    if (!index_->IsCorrupted()) {
+      if (path_filter_ != NULL)
+        perf::Inc(n_false_positives_);
+      return false;
+    }
+  }
+
   MutexLockGuard m(lock_);
   sql_lookup_md5path_->BindPathHash(md5path);
   bool found = sql_lookup_md5path_->FetchRow();
@@ -313,6 +373,8 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
     FixTransitionPoint(md5path, dirent);
   }
   sql_lookup_md5path_->Reset();
+  if (!found && (path_filter_ != NULL))
+    perf::Inc(n_false_positives_);
 
   return found;
 }
@@ -331,6 +393,87 @@ bool Catalog::LookupMd5Path(const shash::Md5 &md5path,
 }
 
 
+/**
+ * Performs lookups for many MD5 path hashes in a single pass.  The catalog
+ * lock is taken once and all probes reuse the same prepared statement.
+ * @param md5paths the MD5 hashes of the searched paths
+ * @param dirents will be resized to md5paths and set to the found entries
+ * @param found will be resized to md5paths and tells which entries were found
+ * @return the number of found entries
+ */
+unsigned Catalog::LookupMd5Paths(const std::vector<shash::Md5> &md5paths,
+                                 std::vector<DirectoryEntry> *dirents,
+                                 std::vector<bool> *found) const
+{
+  assert(IsInitialized());
+
+  const unsigned num_paths = md5paths.size();
+  dirents->assign(num_paths, DirectoryEntry());
+  found->assign(num_paths, false);
+  vector<PathProbe> probes;
+  probes.reserve(num_paths);
+  for (unsigned i = 0; i < num_paths; ++i) {
+    if ((path_filter_ != NULL) && !path_filter_->Contains(md5paths[i])) {
+      perf::Inc(n_filtered_);
+      continue;
+    }
+    probes.push_back(PathProbe(md5paths[i], i));
+  }
+  const unsigned num_probes = probes.size();
+
+  unsigned num_found = 0;
+  if (UseIndex()) {
+    SqlLookup::DirentFields fields;
+    for (unsigned i = 0; i < num_probes; ++i) {
+      const unsigned idx = probes[i].idx;
+      if (index_->Lookup(md5paths[idx], &fields)) {
+        (*dirents)[idx] = MakeIndexedDirent(fields, true);
+        FixTransitionPoint(md5paths[idx], &(*dirents)[idx]);
+        (*found)[idx] = true;
+        ++num_found;
+      }
+    }
+    if (index_->IsCorrupted()) {
+      // Start over with the database
+      num_found = 0;
+      dirents->assign(num_paths, DirectoryEntry());
+      found->assign(num_paths, false);
+    }
+  }
+  if (!UseIndex()) {
+    sort(probes.begin(), probes.end());
+    MutexLockGuard m(lock_);
+    for (unsigned i = 0; i < num_probes; ++i) {
+      const unsigned idx = probes[i].idx;
+      sql_lookup_md5path_->BindPathHash(md5paths[idx]);
+      if (sql_lookup_md5path_->FetchRow()) {
+        (*dirents)[idx] = sql_lookup_md5path_->GetDirent(this);
+        FixTransitionPoint(md5paths[idx], &(*dirents)[idx]);
+        (*found)[idx] = true;
+        ++num_found;
+      }
+      sql_lookup_md5path_->Reset();
+    }
+  }
+
+  if (path_filter_ != NULL)
+    perf::Xadd(n_false_positives_, num_probes - num_found);
+  return num_found;
+}
+
+
+unsigned Catalog::LookupPaths(const std::vector<PathString> &paths,
+                              std::vector<DirectoryEntry> *dirents,
+                              std::vector<bool> *found) const
+{
+  vector<shash::Md5> md5paths;
+  md5paths.reserve(paths.size());
+  for (unsigned i = 0; i < paths.size(); ++i)
+    md5paths.push_back(NormalizePath(paths[i]));
+  return LookupMd5Paths(md5paths, dirents, found);
+}
+
+
 bool Catalog::LookupRawSymlink(const PathString &path,
                                LinkString *raw_symlink) const
 {
@@ -374,6 +517,25 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
   DirectoryEntry dirent;
   StatEntry entry;
 
+  if (UseIndex()) {
+    SqlLookup::DirentFields fields;
+    uint32_t begin, end;
+    index_->FindChildren(md5path, 0, &begin, &end);
+    if (!index_->IsCorrupted()) {
+      for (uint32_t i = begin; i < end; ++i) {
+        index_->GetChild(i, &fields);
+        dirent = MakeIndexedDirent(fields, true);
+        if (dirent.IsHidden())
+          continue;
+        FixTransitionPoint(md5path, &dirent);
+        entry.name = dirent.name();
+        entry.info = dirent.GetStatStructure();
+        listing->PushBack(entry);
+      }
+      return true;
+    }
+  }
+
   MutexLockGuard m(lock_);
   sql_listing_->BindPathHash(md5path);
   while (sql_listing_->FetchRow()) {
@@ -391,6 +553,66 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
 }
 
 
+/**
+ * Perform a listing of a slice of the directory with the given MD5 path hash.
+ * Returns only struct stat values, starting with the first entry after the
+ * given row id.  The row ids of the returned entries are stored in row_ids.
+ * If the listing contains less than max_entries entries, the end of the
+ * directory has been reached.
+ */
+bool Catalog::ListingMd5PathStatRange(const shash::Md5 &md5path,
+                                      const uint64_t after_row_id,
+                                      const unsigned max_entries,
+                                      StatEntryList *listing,
+                                      std::vector<uint64_t> *row_ids) const
+{
+  assert(IsInitialized());
+
+  DirectoryEntry dirent;
+  StatEntry entry;
+  unsigned num_entries = 0;
+
+  if (UseIndex()) {
+    SqlLookup::DirentFields fields;
+    uint32_t begin, end;
+    index_->FindChildren(md5path, after_row_id, &begin, &end);
+    if (!index_->IsCorrupted()) {
+      for (uint32_t i = begin; (i < end) && (num_entries < max_entries); ++i) {
+        index_->GetChild(i, &fields);
+        dirent = MakeIndexedDirent(fields, true);
+        if (dirent.IsHidden())
+          continue;
+        FixTransitionPoint(md5path, &dirent);
+        entry.name = dirent.name();
+        entry.info = dirent.GetStatStructure();
+        listing->PushBack(entry);
+        row_ids->push_back(fields.row_id);
+        ++num_entries;
+      }
+      return true;
+    }
+  }
+
+  MutexLockGuard m(lock_);
+  sql_listing_range_->BindPathHash(md5path);
+  sql_listing_range_->BindAfterRowId(after_row_id);
+  while ((num_entries < max_entries) && sql_listing_range_->FetchRow()) {
+    dirent = sql_listing_range_->GetDirent(this);
+    if (dirent.IsHidden())
+      continue;
+    FixTransitionPoint(md5path, &dirent);
+    entry.name = dirent.name();
+    entry.info = dirent.GetStatStructure();
+    listing->PushBack(entry);
+    row_ids->push_back(sql_listing_range_->GetRowId());
+    ++num_entries;
+  }
+  sql_listing_range_->Reset();
+
+  return true;
+}
+
+
 /**
  * Perform a listing of the directory with the given MD5 path hash.
  * Returns only struct stat values
@@ -405,6 +627,21 @@ bool Catalog::ListingMd5Path(const shash::Md5 &md5path,
 {
   assert(IsInitialized());
 
+  if (UseIndex()) {
+    SqlLookup::DirentFields fields;
+    uint32_t begin, end;
+    index_->FindChildren(md5path, 0, &begin, &end);
+    if (!index_->IsCorrupted()) {
+      for (uint32_t i = begin; i < end; ++i) {
+        index_->GetChild(i, &fields);
+        DirectoryEntry dirent = MakeIndexedDirent(fields, expand_symlink);
+        FixTransitionPoint(md5path, &dirent);
+        listing->push_back(dirent);
+      }
+      return true;
+    }
+  }
+
   MutexLockGuard m(lock_);
 
   sql_listing_->BindPathHash(md5path);
@@ -622,6 +859,31 @@ inode_t Catalog::GetMangledInode(const uint64_t row_id,
 }
 
 
+/**
+ * True if lookups and listings are served from the index.  Once the index
+ * found a damaged record, the catalog uses its database again.
+ */
+bool Catalog::UseIndex() const {
+  return (index_ != NULL) && !index_->IsCorrupted();
+}
+
+
+/**
+ * Builds a DirectoryEntry from a record of the catalog index.  Entries served
+ * by the index do not need the catalog lock, except for hard links whose
+ * inode is resolved through the shared hardlink group map.
+ */
+DirectoryEntry Catalog::MakeIndexedDirent(
+  const SqlLookup::DirentFields &fields,
+  const bool expand_symlink) const
+{
+  if (fields.hardlink_group() == 0)
+    return SqlLookup::MakeDirent(this, fields, expand_symlink);
+  MutexLockGuard m(lock_);
+  return SqlLookup::MakeDirent(this, fields, expand_symlink);
+}
+
+
 /**
  * Get a list of all registered nested catalogs and bind mountpoints in this
  * catalog.
@@ -723,6 +985,78 @@ void Catalog::SetOwnerMaps(const OwnerMap *uid_map, const OwnerMap *gid_map) {
 }
 
 
+/**
+ * Builds a Bloom filter over the path hashes of all entries of an indexed
+ * catalog.  Runs through the entire index, so it is called by the catalog
+ * index builder thread rather than in the lookup path.
+ */
+BloomFilter *Catalog::CreatePathFilter(
+  const CatalogIndex &index,
+  const unsigned bits_per_entry)
+{
+  const uint32_t num_records = index.num_records();
+  BloomFilter *path_filter = new BloomFilter(num_records, bits_per_entry);
+  for (uint32_t i = 0; i < num_records; ++i)
+    path_filter->Insert(index.GetPathHash(i));
+  return path_filter;
+}
+
+
+/**
+ * Builds a Bloom filter over the path hashes of all entries of a catalog
+ * database.  This is a full table scan; it is meant for a private database
+ * connection of the catalog index builder thread.
+ */
+BloomFilter *Catalog::CreatePathFilter(
+  const CatalogDatabase &database,
+  const unsigned bits_per_entry)
+{
+  SqlCatalog sql_max_row_id(database, "SELECT MAX(rowid) FROM catalog;");
+  if (!sql_max_row_id.FetchRow())
+    return NULL;
+  BloomFilter *path_filter =
+    new BloomFilter(sql_max_row_id.RetrieveInt64(0), bits_per_entry);
+  SqlAllDirents sql_all_dirents(database);
+  while (sql_all_dirents.FetchRow())
+    path_filter->Insert(sql_all_dirents.GetPathHash());
+  return path_filter;
+}
+
+
+/**
+ * Hands over a Bloom filter over the path hashes of all entries of the
+ * catalog.  Afterwards, lookups of paths that are not in the catalog are
+ * mostly answered by the filter.  Lookups answered by the filter and misses
+ * that passed the filter are counted in the given counters.  Like SetIndex(),
+ * needs to be called while no lookups run on the catalog.
+ */
+void Catalog::SetPathFilter(
+  BloomFilter *path_filter,
+  perf::Counter *n_filtered,
+  perf::Counter *n_false_positives)
+{
+  assert(path_filter_ == NULL);
+  LogCvmfs(kLogCatalog, kLogDebug, "set path filter of %" PRIu64 " bits "
+           "(%u probes) for catalog at %s", path_filter->num_bits(),
+           path_filter->num_probes(), mountpoint_.c_str());
+  n_filtered_ = n_filtered;
+  n_false_positives_ = n_false_positives;
+  path_filter_ = path_filter;
+}
+
+
+/**
+ * Hands over an index of the catalog's directory entries.  From then on,
+ * lookups and listings are served from the index.  Needs to be set before the
+ * catalog is used concurrently or under the catalog manager's write lock, which
+ * excludes all lookups.  The index is owned by the catalog.
+ */
+void Catalog::SetIndex(CatalogIndex *index) {
+  assert(index_ == NULL);
+  index_ = index;
+}
+
+
 /**
  * Add a Catalog as child to this Catalog.
  * @param child the Catalog to define as child
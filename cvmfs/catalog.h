@@ -24,6 +24,10 @@
 #include "uid_map.h"
 #include "xattr.h"
 
+class BloomFilter;
+namespace perf {
+class Counter;
+}
 namespace swissknife {
 class CommandMigrate;
 }
@@ -34,6 +38,7 @@ template <class CatalogT>
 class AbstractCatalogManager;
 
 class Catalog;
+class CatalogIndex;
 
 class Counters;
 
@@ -124,6 +129,9 @@ class Catalog : SingleCopy {
   inline bool LookupPath(const PathString &path, DirectoryEntry *dirent) const {
     return LookupMd5Path(NormalizePath(path), dirent);
   }
+  unsigned LookupPaths(const std::vector<PathString> &paths,
+                       std::vector<DirectoryEntry> *dirents,
+                       std::vector<bool> *found) const;
   bool LookupRawSymlink(const PathString &path, LinkString *raw_symlink) const;
   bool LookupXattrsPath(const PathString &path, XattrList *xattrs) const {
     return LookupXattrsMd5Path(NormalizePath(path), xattrs);
@@ -140,6 +148,15 @@ class Catalog : SingleCopy {
   {
     return ListingMd5PathStat(NormalizePath(path), listing);
   }
+  bool ListingPathStatRange(const PathString &path,
+                            const uint64_t after_row_id,
+                            const unsigned max_entries,
+                            StatEntryList *listing,
+                            std::vector<uint64_t> *row_ids) const
+  {
+    return ListingMd5PathStatRange(NormalizePath(path), after_row_id,
+                                   max_entries, listing, row_ids);
+  }
   bool AllChunksBegin();
   bool AllChunksNext(shash::Any *hash, zlib::Algorithms *compression_alg);
   bool AllChunksEnd();
@@ -216,6 +233,16 @@ class Catalog : SingleCopy {
                           const uint64_t hardlink_group) const;
 
   void SetOwnerMaps(const OwnerMap *uid_map, const OwnerMap *gid_map);
+  static BloomFilter *CreatePathFilter(const CatalogIndex &index,
+                                      const unsigned bits_per_entry);
+  static BloomFilter *CreatePathFilter(const CatalogDatabase &database,
+                                      const unsigned bits_per_entry);
+  void SetPathFilter(BloomFilter *path_filter,
+                     perf::Counter *n_filtered,
+                     perf::Counter *n_false_positives);
+  void SetIndex(CatalogIndex *index);
+  inline bool HasIndex() const { return index_ != NULL; }
+  inline bool HasPathFilter() const { return path_filter_ != NULL; }
   uint64_t MapUid(const uint64_t uid) const {
     if (uid_map_) { return uid_map_->Map(uid); }
     return uid;
@@ -275,6 +302,9 @@ class Catalog : SingleCopy {
                           DirectoryEntry *dirent) const;
 
   bool LookupMd5Path(const shash::Md5 &md5path, DirectoryEntry *dirent) const;
+  unsigned LookupMd5Paths(const std::vector<shash::Md5> &md5paths,
+                          std::vector<DirectoryEntry> *dirents,
+                          std::vector<bool> *found) const;
   bool LookupXattrsMd5Path(const shash::Md5 &md5path, XattrList *xattrs) const;
   bool ListMd5PathChunks(const shash::Md5 &md5path,
                          const shash::Algorithms interpret_hashes_as,
@@ -284,8 +314,16 @@ class Catalog : SingleCopy {
                       const bool expand_symlink = true) const;
   bool ListingMd5PathStat(const shash::Md5 &md5path,
                           StatEntryList *listing) const;
+  bool ListingMd5PathStatRange(const shash::Md5 &md5path,
+                               const uint64_t after_row_id,
+                               const unsigned max_entries,
+                               StatEntryList *listing,
+                               std::vector<uint64_t> *row_ids) const;
   bool LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
                    DirectoryEntry *dirent) const;
+  DirectoryEntry MakeIndexedDirent(const SqlLookup::DirentFields &fields,
+                                   const bool expand_symlink) const;
+  bool UseIndex() const;
 
   CatalogDatabase *database_;
 
@@ -323,8 +361,20 @@ class Catalog : SingleCopy {
   // Point to the maps in the catalog manager
   const OwnerMap *uid_map_;
   const OwnerMap *gid_map_;
+  /**
+   * Optional, serves lookups and listings instead of the SQL statements
+   */
+  CatalogIndex *index_;
+  /**
+   * Optional, answers lookups of paths that are not in the catalog without
+   * a probe of the index or the database
+   */
+  BloomFilter *path_filter_;
+  perf::Counter *n_filtered_;
+  perf::Counter *n_false_positives_;
 
   SqlListing                  *sql_listing_;
+  SqlListingRange             *sql_listing_range_;
   SqlLookupPathHash           *sql_lookup_md5path_;
   SqlNestedCatalogLookup      *sql_lookup_nested_;
   SqlNestedCatalogListing     *sql_list_nested_;
@@ -0,0 +1,461 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "catalog_sql.h"
+#include "logging.h"
+#include "murmur.h"
+#include "platform.h"
+#include "smalloc.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+namespace {
+
+/**
+ * Orders the records by path hash or by parent path hash.  Ties are broken by
+ * the row id, so that the entries of a directory are listed in row id order.
+ */
+struct SortKey {
+  SortKey(const shash::Md5 &md5path, const uint64_t r, const uint32_t i)
+    : row_id(r), idx(i)
+  {
+    md5path.ToIntPair(&md5path_1, &md5path_2);
+  }
+  bool operator <(const SortKey &other) const {
+    if (md5path_1 != other.md5path_1)
+      return md5path_1 < other.md5path_1;
+    if (md5path_2 != other.md5path_2)
+      return md5path_2 < other.md5path_2;
+    return row_id < other.row_id;
+  }
+  bool HasSamePath(const SortKey &other) const {
+    return (md5path_1 == other.md5path_1) && (md5path_2 == other.md5path_2);
+  }
+
+  uint64_t md5path_1;
+  uint64_t md5path_2;
+  uint64_t row_id;
+  uint32_t idx;
+};
+
+
+inline int ComparePathHash(const uint64_t a_1, const uint64_t a_2,
+                           const uint64_t b_1, const uint64_t b_2)
+{
+  if (a_1 != b_1)
+    return (a_1 < b_1) ? -1 : 1;
+  if (a_2 != b_2)
+    return (a_2 < b_2) ? -1 : 1;
+  return 0;
+}
+
+}  // anonymous namespace
+
+
+/**
+ * Scans the catalog table once and assembles the index image in memory.
+ * Returns false for catalogs that are too old or too large to be indexed.
+ */
+bool CatalogIndex::Build(const CatalogDatabase &database, string *image) {
+  if (database.schema_version() < 2.1 - CatalogDatabase::kSchemaEpsilon)
+    return false;
+
+  vector<Record> records;
+  vector<SortKey> path_keys;
+  vector<SortKey> parent_keys;
+  string pool;
+  SqlLookup::DirentFields fields;
+  SqlAllDirents sql_all_dirents(database);
+  while (sql_all_dirents.FetchRow()) {
+    sql_all_dirents.GetDirentFields(&fields);
+    if ((fields.hash_size > shash::kMaxDigestSize) ||
+        (records.size() == 0xFFFFFFFFU))
+    {
+      return false;
+    }
+    const uint32_t idx = records.size();
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    sql_all_dirents.GetPathHash().ToIntPair(&record.md5path_1,
+                                            &record.md5path_2);
+    record.row_id = fields.row_id;
+    record.hardlinks = fields.hardlinks;
+    record.size = fields.size;
+    record.mtime = fields.mtime;
+    record.uid = fields.uid;
+    record.gid = fields.gid;
+    record.mode = fields.mode;
+    record.flags = fields.flags;
+    record.name_offset = pool.size();
+    record.name_length = fields.name_length;
+    pool.append(fields.name, fields.name_length);
+    record.symlink_offset = pool.size();
+    record.symlink_length = fields.symlink_length;
+    pool.append(fields.symlink, fields.symlink_length);
+    record.hash_offset = pool.size();
+    record.hash_size = fields.hash_size;
+    pool.append(reinterpret_cast<const char *>(fields.hash), fields.hash_size);
+    record.has_xattrs = fields.has_xattrs ? 1 : 0;
+    if (pool.size() > 0xFFFFFFFFU)
+      return false;
+
+    records.push_back(record);
+    path_keys.push_back(
+      SortKey(sql_all_dirents.GetPathHash(), record.row_id, idx));
+    parent_keys.push_back(
+      SortKey(sql_all_dirents.GetParentPathHash(), record.row_id, idx));
+  }
+  sql_all_dirents.Reset();
+
+  const uint32_t num_records = records.size();
+  sort(path_keys.begin(), path_keys.end());
+  sort(parent_keys.begin(), parent_keys.end());
+  vector<uint32_t> positions(num_records);
+  for (uint32_t i = 0; i < num_records; ++i)
+    positions[path_keys[i].idx] = i;
+
+  vector<Directory> directories;
+  vector<uint32_t> children(num_records);
+  for (uint32_t i = 0; i < num_records; ++i) {
+    children[i] = positions[parent_keys[i].idx];
+    if ((i == 0) || !parent_keys[i].HasSamePath(parent_keys[i - 1])) {
+      Directory directory;
+      directory.md5path_1 = parent_keys[i].md5path_1;
+      directory.md5path_2 = parent_keys[i].md5path_2;
+      directory.begin = i;
+      directories.push_back(directory);
+    }
+    directories.back().end = i + 1;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.num_records = num_records;
+  header.num_directories = directories.size();
+  header.pool_size = pool.size();
+  header.size = ComputeSize(num_records, directories.size(), pool.size());
+  header.checksum = ComputeChecksum(header);
+
+  image->clear();
+  image->reserve(header.size);
+  image->append(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (uint32_t i = 0; i < num_records; ++i) {
+    image->append(reinterpret_cast<const char *>(&records[path_keys[i].idx]),
+                  sizeof(Record));
+  }
+  if (!directories.empty()) {
+    image->append(reinterpret_cast<const char *>(&directories[0]),
+                  directories.size() * sizeof(Directory));
+  }
+  if (!children.empty()) {
+    image->append(reinterpret_cast<const char *>(&children[0]),
+                  children.size() * sizeof(uint32_t));
+  }
+  image->append(pool);
+  assert(image->size() == header.size);
+
+  LogCvmfs(kLogCatalog, kLogDebug, "built catalog index of %u entries, "
+           "%u directories (%" PRIu64 " bytes)",
+           num_records, header.num_directories, header.size);
+  return true;
+}
+
+
+CatalogIndex::CatalogIndex(
+  void *buffer,
+  const uint64_t size,
+  const bool is_mapped)
+  : buffer_(buffer)
+  , size_(size)
+  , is_mapped_(is_mapped)
+  , header_(reinterpret_cast<const Header *>(buffer))
+  , records_(NULL)
+  , directories_(NULL)
+  , children_(NULL)
+  , pool_(NULL)
+{
+  atomic_init32(&corrupted_);
+}
+
+
+CatalogIndex::~CatalogIndex() {
+  if (is_mapped_)
+    munmap(buffer_, size_);
+  else
+    free(buffer_);
+}
+
+
+uint64_t CatalogIndex::ComputeSize(
+  const uint32_t num_records,
+  const uint32_t num_directories,
+  const uint64_t pool_size)
+{
+  return sizeof(Header) +
+         static_cast<uint64_t>(num_records) * sizeof(Record) +
+         static_cast<uint64_t>(num_directories) * sizeof(Directory) +
+         static_cast<uint64_t>(num_records) * sizeof(uint32_t) +
+         pool_size;
+}
+
+
+uint32_t CatalogIndex::ComputeChecksum(const Header &header) {
+  Header copy = header;
+  copy.checksum = 0;
+  return MurmurHash2(&copy, sizeof(copy), kMagic);
+}
+
+
+/**
+ * Copies a freshly built image.
+ */
+CatalogIndex *CatalogIndex::Create(const string &image) {
+  if (image.size() < sizeof(Header))
+    return NULL;
+  void *buffer = smalloc(image.size());
+  memcpy(buffer, image.data(), image.size());
+  CatalogIndex *index = new CatalogIndex(buffer, image.size(), false);
+  if (!index->Verify()) {
+    delete index;
+    return NULL;
+  }
+  return index;
+}
+
+
+void CatalogIndex::FindChildren(
+  const shash::Md5 &md5path,
+  const uint64_t after_row_id,
+  uint32_t *begin,
+  uint32_t *end) const
+{
+  *begin = *end = 0;
+  uint64_t md5path_1, md5path_2;
+  md5path.ToIntPair(&md5path_1, &md5path_2);
+
+  uint32_t low = 0;
+  uint32_t high = header_->num_directories;
+  while (low < high) {
+    const uint32_t mid = low + (high - low) / 2;
+    const Directory &directory = directories_[mid];
+    const int cmp = ComparePathHash(directory.md5path_1, directory.md5path_2,
+                                    md5path_1, md5path_2);
+    if (cmp == 0) {
+      if ((directory.begin > directory.end) ||
+          (directory.end > header_->num_records))
+      {
+        MarkCorrupted();
+        return;
+      }
+      // GetChild() relies on the records of the range being checked here
+      for (uint32_t i = directory.begin; i < directory.end; ++i) {
+        if ((children_[i] >= header_->num_records) ||
+            !IsValidRecord(records_[children_[i]]))
+        {
+          MarkCorrupted();
+          return;
+        }
+      }
+      // Entries of the directory are sorted by row id
+      low = directory.begin;
+      high = directory.end;
+      while (low < high) {
+        const uint32_t pos = low + (high - low) / 2;
+        if (records_[children_[pos]].row_id <= after_row_id)
+          low = pos + 1;
+        else
+          high = pos;
+      }
+      *begin = low;
+      *end = directory.end;
+      return;
+    }
+    if (cmp < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+}
+
+
+void CatalogIndex::GetChild(
+  const uint32_t idx,
+  SqlLookup::DirentFields *fields) const
+{
+  MakeFields(records_[children_[idx]], fields);
+}
+
+
+/**
+ * Maps a stored image read-only into memory.  Returns NULL for missing,
+ * corrupted, or outdated images.
+ */
+CatalogIndex *CatalogIndex::Load(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  platform_stat64 info;
+  if ((platform_fstat(fd, &info) != 0) ||
+      (info.st_size < static_cast<int64_t>(sizeof(Header))))
+  {
+    close(fd);
+    return NULL;
+  }
+  void *buffer = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to map catalog index %s (%d)",
+             path.c_str(), errno);
+    return NULL;
+  }
+
+  CatalogIndex *index = new CatalogIndex(buffer, info.st_size, true);
+  if (!index->Verify()) {
+    LogCvmfs(kLogCatalog, kLogDebug, "discarding invalid catalog index %s",
+             path.c_str());
+    delete index;
+    return NULL;
+  }
+  return index;
+}
+
+
+bool CatalogIndex::Lookup(
+  const shash::Md5 &md5path,
+  SqlLookup::DirentFields *fields) const
+{
+  uint64_t md5path_1, md5path_2;
+  md5path.ToIntPair(&md5path_1, &md5path_2);
+
+  uint32_t low = 0;
+  uint32_t high = header_->num_records;
+  while (low < high) {
+    const uint32_t mid = low + (high - low) / 2;
+    const Record &record = records_[mid];
+    const int cmp = ComparePathHash(record.md5path_1, record.md5path_2,
+                                    md5path_1, md5path_2);
+    if (cmp == 0) {
+      if (!IsValidRecord(record)) {
+        MarkCorrupted();
+        return false;
+      }
+      if (fields != NULL)
+        MakeFields(record, fields);
+      return true;
+    }
+    if (cmp < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return false;
+}
+
+
+void CatalogIndex::MakeFields(
+  const Record &record,
+  SqlLookup::DirentFields *fields) const
+{
+  fields->hash = reinterpret_cast<const unsigned char *>(
+    pool_ + record.hash_offset);
+  fields->hash_size = record.hash_size;
+  fields->hardlinks = record.hardlinks;
+  fields->size = record.size;
+  fields->mode = record.mode;
+  fields->mtime = record.mtime;
+  fields->flags = record.flags;
+  fields->name = pool_ + record.name_offset;
+  fields->name_length = record.name_length;
+  fields->symlink = pool_ + record.symlink_offset;
+  fields->symlink_length = record.symlink_length;
+  fields->row_id = record.row_id;
+  fields->uid = record.uid;
+  fields->gid = record.gid;
+  fields->has_xattrs = record.has_xattrs != 0;
+}
+
+
+/**
+ * The file name of the stored image of a catalog.  It contains the format
+ * version, so that images of an older format are never loaded.
+ */
+string CatalogIndex::MakeFileName(const shash::Any &catalog_hash) {
+  return catalog_hash.ToString(true) + ".v" + StringifyInt(kVersion);
+}
+
+
+/**
+ * True if the strings and the content hash of the record are within the pool.
+ */
+bool CatalogIndex::IsValidRecord(const Record &record) const {
+  const uint64_t pool_size = header_->pool_size;
+  const uint64_t name_end =
+    static_cast<uint64_t>(record.name_offset) + record.name_length;
+  const uint64_t symlink_end =
+    static_cast<uint64_t>(record.symlink_offset) + record.symlink_length;
+  const uint64_t hash_end =
+    static_cast<uint64_t>(record.hash_offset) + record.hash_size;
+  return (name_end <= pool_size) && (symlink_end <= pool_size) &&
+         (hash_end <= pool_size) && (record.hash_size <= shash::kMaxDigestSize);
+}
+
+
+void CatalogIndex::MarkCorrupted() const {
+  if (atomic_cas32(&corrupted_, 0, 1)) {
+    LogCvmfs(kLogCatalog, kLogDebug | kLogSyslogWarn,
+             "corrupted catalog index, falling back to the catalog database");
+  }
+}
+
+
+/**
+ * Checks the header and its checksum against the size of the buffer, so that
+ * the sections of the image lie within the buffer.  Sets the array pointers.
+ * Does not walk the records, see IsValidRecord().
+ */
+bool CatalogIndex::Verify() {
+  if ((header_->magic != kMagic) || (header_->version != kVersion))
+    return false;
+  if (header_->checksum != ComputeChecksum(*header_))
+    return false;
+  if ((header_->size != size_) || (header_->pool_size > size_))
+    return false;
+  if (ComputeSize(header_->num_records, header_->num_directories,
+                  header_->pool_size) != size_)
+  {
+    return false;
+  }
+
+  const char *base = reinterpret_cast<const char *>(buffer_);
+  records_ = reinterpret_cast<const Record *>(base + sizeof(Header));
+  directories_ =
+    reinterpret_cast<const Directory *>(records_ + header_->num_records);
+  children_ = reinterpret_cast<const uint32_t *>(
+    directories_ + header_->num_directories);
+  pool_ = reinterpret_cast<const char *>(children_ + header_->num_records);
+  return true;
+}
+
+}  // namespace catalog
@@ -0,0 +1,152 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_INDEX_H_
+#define CVMFS_CATALOG_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "atomic.h"
+#include "catalog_sql.h"
+#include "hash.h"
+#include "util/single_copy.h"
+
+namespace catalog {
+
+class CatalogDatabase;
+
+/**
+ * A compact, read-only image of the directory entries of a client catalog.
+ * Client catalogs never change once they are loaded, so their entries can be
+ * served from a flat buffer by binary search instead of from SQLite.
+ *
+ * The image is built from the catalog database in the background after the
+ * catalog is loaded for the first time.  It is stored as a plain file outside
+ * of the content-addressed cache, see MakeFileName().  Further loads map the
+ * file into memory.  The image consists of
+ *   - a header,
+ *   - the records of all directory entries, sorted by path hash,
+ *   - a directory table that maps the path hash of a directory to the range
+ *     of its entries in the children array, sorted by path hash,
+ *   - the children array, indexes into the records grouped by parent and
+ *     sorted by row id within a directory,
+ *   - a pool of names, symlinks, and content hashes.
+ * The image uses the host byte order; it is never shared between machines.
+ *
+ * Loading an image only checks the header, its checksum, and the size of the
+ * sections.  The offsets of a record are checked when the record is accessed.
+ * An access to a damaged record marks the index as corrupted, from then on the
+ * catalog uses its database again.
+ *
+ * Only catalogs of schema 2.1 and newer are indexed.
+ */
+class CatalogIndex : SingleCopy {
+ public:
+  static const uint32_t kMagic = 0x58444943;  // "CIDX"
+  static const uint32_t kVersion = 2;
+
+  static std::string MakeFileName(const shash::Any &catalog_hash);
+  static bool Build(const CatalogDatabase &database, std::string *image);
+  static CatalogIndex *Create(const std::string &image);
+  static CatalogIndex *Load(const std::string &path);
+  ~CatalogIndex();
+
+  bool Lookup(const shash::Md5 &md5path,
+              SqlLookup::DirentFields *fields) const;
+  /**
+   * Finds the entries of a directory with a row id larger than after_row_id.
+   * The range [begin, end) can be read by GetChild().  Directories that are
+   * not part of the catalog are empty, just like an SQL listing.  So are the
+   * directories with damaged entries, which mark the index as corrupted.
+   */
+  void FindChildren(const shash::Md5 &md5path,
+                    const uint64_t after_row_id,
+                    uint32_t *begin,
+                    uint32_t *end) const;
+  void GetChild(const uint32_t idx, SqlLookup::DirentFields *fields) const;
+  /**
+   * The path hash of the idx-th record, for idx < num_records()
+   */
+  shash::Md5 GetPathHash(const uint32_t idx) const {
+    return shash::Md5(records_[idx].md5path_1, records_[idx].md5path_2);
+  }
+
+  bool IsCorrupted() const { return atomic_read32(&corrupted_) != 0; }
+  bool IsMapped() const { return is_mapped_; }
+  uint32_t num_records() const { return header_->num_records; }
+  uint64_t size() const { return size_; }
+
+ private:
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_records;
+    uint32_t num_directories;
+    uint64_t pool_size;
+    uint64_t size;
+    /**
+     * MurmurHash2 of the header with the checksum set to zero
+     */
+    uint32_t checksum;
+    uint32_t padding;
+  };
+
+  struct Record {
+    uint64_t md5path_1;
+    uint64_t md5path_2;
+    uint64_t row_id;
+    uint64_t hardlinks;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t uid;
+    uint64_t gid;
+    uint32_t mode;
+    uint32_t flags;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t symlink_offset;
+    uint32_t symlink_length;
+    uint32_t hash_offset;
+    uint16_t hash_size;
+    uint8_t has_xattrs;
+    uint8_t padding;
+  };
+
+  struct Directory {
+    uint64_t md5path_1;
+    uint64_t md5path_2;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  static uint64_t ComputeSize(const uint32_t num_records,
+                              const uint32_t num_directories,
+                              const uint64_t pool_size);
+  static uint32_t ComputeChecksum(const Header &header);
+
+  CatalogIndex(void *buffer, const uint64_t size, const bool is_mapped);
+  bool Verify();
+  bool IsValidRecord(const Record &record) const;
+  void MarkCorrupted() const;
+  void MakeFields(const Record &record, SqlLookup::DirentFields *fields) const;
+
+  void *buffer_;
+  uint64_t size_;
+  bool is_mapped_;
+  const Header *header_;
+  const Record *records_;
+  const Directory *directories_;
+  const uint32_t *children_;
+  const char *pool_;
+  /**
+   * Set on the first access to a damaged record
+   */
+  mutable atomic_int32 corrupted_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_INDEX_H_
@@ -161,6 +161,9 @@ class AbstractCatalogManager : public SingleCopy {
     p.Assign(&path[0], path.length());
     return LookupPath(p, options, entry);
   }
+  unsigned LookupPaths(const std::vector<PathString> &paths,
+                       std::vector<DirectoryEntry> *entries,
+                       std::vector<bool> *found);
   bool LookupXattrs(const PathString &path, XattrList *xattrs);
 
   bool LookupNested(const PathString &path,
@@ -177,6 +180,11 @@ class AbstractCatalogManager : public SingleCopy {
     return Listing(p, listing);
   }
   bool ListingStat(const PathString &path, StatEntryList *listing);
+  bool ListingStatRange(const PathString &path,
+                        const uint64_t after_row_id,
+                        const unsigned max_entries,
+                        StatEntryList *listing,
+                        std::vector<uint64_t> *row_ids);
 
   bool ListFileChunks(const PathString &path,
                       const shash::Algorithms interpret_hashes_as,
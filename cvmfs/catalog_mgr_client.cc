@@ -5,10 +5,17 @@
 #include "cvmfs_config.h"
 #include "catalog_mgr_client.h"
 
+#include <errno.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
 #include <string>
 #include <vector>
 
+#include "bloom_filter.h"
 #include "cache_posix.h"
+#include "catalog_index.h"
 #include "download.h"
 #include "fetch.h"
 #include "manifest.h"
@@ -32,6 +39,25 @@ void ClientCatalogManager::ActivateCatalog(Catalog *catalog) {
     all_inodes_ = counters.GetAllEntries();
   }
   loaded_inodes_ += counters.GetSelfEntries();
+  // Building an index or a path filter runs a full table scan, which is left to
+  // the index builder thread
+  bool needs_job = (path_filter_bits_ > 0);
+  if (use_index_) {
+    CatalogIndex *index = CatalogIndex::Load(GetIndexPath(catalog->hash()));
+    if (index != NULL) {
+      perf::Inc(n_index_loads_);
+      catalog->SetIndex(index);
+    } else {
+      needs_job = true;
+    }
+  }
+  if (needs_job) {
+    MutexLockGuard m(&lock_index_jobs_);
+    if (index_jobs_.size() < kMaxIndexJobs) {
+      index_jobs_.push_back(IndexJob(catalog->mountpoint(), catalog->hash()));
+      pthread_cond_signal(&cond_index_jobs_);
+    }
+  }
 }
 
 
@@ -45,16 +71,45 @@ ClientCatalogManager::ClientCatalogManager(MountPoint *mountpoint)
   , all_inodes_(0)
   , loaded_inodes_(0)
   , fixed_alt_root_catalog_(false)
+  , use_index_(false)
+  , path_filter_bits_(0)
+  , index_dir_(workspace_ + "/catalog-index")
+  , index_builder_spawned_(false)
+  , index_builder_terminate_(false)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "constructing client catalog manager");
   n_certificate_hits_ = mountpoint->statistics()->Register(
     "cache.n_certificate_hits", "Number of certificate hits");
   n_certificate_misses_ = mountpoint->statistics()->Register(
     "cache.n_certificate_misses", "Number of certificate misses");
+  n_index_loads_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_index_loads", "Number of catalog indexes loaded from cache");
+  n_index_builds_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_index_builds", "Number of built catalog indexes");
+  n_path_filter_hits_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_path_filter_hits",
+    "Number of path lookups answered negatively by a catalog Bloom filter");
+  n_path_filter_false_positives_ = mountpoint->statistics()->Register(
+    "catalog_mgr.n_path_filter_false_positives",
+    "Number of path lookups that passed a catalog Bloom filter but missed");
+  int retval = pthread_mutex_init(&lock_index_jobs_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_index_jobs_, NULL);
+  assert(retval == 0);
 }
 
 
 ClientCatalogManager::~ClientCatalogManager() {
+  if (index_builder_spawned_) {
+    pthread_mutex_lock(&lock_index_jobs_);
+    index_builder_terminate_ = true;
+    pthread_cond_broadcast(&cond_index_jobs_);
+    pthread_mutex_unlock(&lock_index_jobs_);
+    pthread_join(thread_index_builder_, NULL);
+  }
+  pthread_cond_destroy(&cond_index_jobs_);
+  pthread_mutex_destroy(&lock_index_jobs_);
+
   LogCvmfs(kLogCache, kLogDebug, "unpinning / unloading all catalogs");
 
   for (map<PathString, shash::Any>::iterator i = mounted_catalogs_.begin(),
@@ -84,6 +139,44 @@ shash::Any ClientCatalogManager::GetRootHash() {
 }
 
 
+/**
+ * Starts the catalog index builder thread.  Catalogs that have been attached
+ * before get their index once the thread is running.
+ */
+void ClientCatalogManager::Spawn() {
+  if ((!use_index_ && (path_filter_bits_ == 0)) || index_builder_spawned_)
+    return;
+  int retval = pthread_create(&thread_index_builder_, NULL, MainIndexBuilder,
+                              this);
+  assert(retval == 0);
+  index_builder_spawned_ = true;
+}
+
+
+/**
+ * Opens a private, read-only copy of a catalog outside of the catalog tree,
+ * e.g. of a revision that has been replaced by a remount.  The catalog is
+ * downloaded again if it has been evicted from the cache meanwhile.  Its
+ * inodes are not valid.  The caller owns the returned catalog.
+ */
+Catalog *ClientCatalogManager::OpenDetachedCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  // Not pinned, the open file descriptor keeps the object available
+  const int fd = fetcher_->Fetch(hash, CacheManager::kSizeUnknown,
+    "detached catalog for " + mountpoint.ToString(), zlib::kZlibDefault,
+    CacheManager::kTypeRegular, "");
+  if (fd < 0) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to open detached catalog %s (%d)",
+             hash.ToString().c_str(), fd);
+    return NULL;
+  }
+  return Catalog::AttachFreely(mountpoint.ToString(), "@" + StringifyInt(fd),
+                               hash, NULL, !mountpoint.IsEmpty());
+}
+
+
 /**
  * Specialized initialization that uses a fixed root hash.
  */
@@ -234,6 +327,183 @@ LoadError ClientCatalogManager::LoadCatalog(
 }
 
 
+/**
+ * Opens a private, read-only connection to the catalog in the cache that is
+ * independent of the attached catalog.
+ */
+CatalogDatabase *ClientCatalogManager::OpenPrivateDatabase(const IndexJob &job)
+{
+  // The VFS takes over the file descriptor
+  const int fd = fetcher_->cache_mgr()->Open(CacheManager::Bless(
+    job.hash, CacheManager::kTypeCatalog,
+    "catalog index for " + job.mountpoint.ToString()));
+  if (fd < 0)
+    return NULL;
+  return CatalogDatabase::Open("@" + StringifyInt(fd),
+                               CatalogDatabase::kOpenReadOnly);
+}
+
+
+/**
+ * Builds the path filter of a catalog from its index or, without an index,
+ * from a private connection to the catalog.
+ */
+BloomFilter *ClientCatalogManager::BuildPathFilter(
+  const IndexJob &job,
+  const CatalogIndex *index)
+{
+  if (index != NULL)
+    return Catalog::CreatePathFilter(*index, path_filter_bits_);
+  CatalogDatabase *database = OpenPrivateDatabase(job);
+  if (database == NULL)
+    return NULL;
+  BloomFilter *path_filter =
+    Catalog::CreatePathFilter(*database, path_filter_bits_);
+  delete database;
+  return path_filter;
+}
+
+
+/**
+ * Builds the index of a catalog from a private read-only connection to the
+ * catalog in the cache, so that the attached catalog can be used and detached
+ * meanwhile.  The image is stored for later loads.  Returns NULL if the catalog
+ * cannot be indexed.
+ */
+CatalogIndex *ClientCatalogManager::BuildCatalogIndex(const IndexJob &job) {
+  // The catalog might have been queued twice
+  const string path = GetIndexPath(job.hash);
+  CatalogIndex *index = CatalogIndex::Load(path);
+  if (index != NULL)
+    return index;
+
+  CatalogDatabase *database = OpenPrivateDatabase(job);
+  if (database == NULL)
+    return NULL;
+  string image;
+  const bool retval = CatalogIndex::Build(*database, &image);
+  delete database;
+  if (!retval)
+    return NULL;
+  perf::Inc(n_index_builds_);
+
+  string tmp_path;
+  FILE *f = NULL;
+  if (MkdirDeep(index_dir_, 0700, false))
+    f = CreateTempFile(path + ".tmp", 0600, "w", &tmp_path);
+  if (f != NULL) {
+    bool written = (fwrite(image.data(), 1, image.size(), f) == image.size());
+    written = (fclose(f) == 0) && written;
+    if (written && (rename(tmp_path.c_str(), path.c_str()) == 0)) {
+      index = CatalogIndex::Load(path);
+      if (index != NULL)
+        return index;
+    } else {
+      unlink(tmp_path.c_str());
+    }
+  }
+  LogCvmfs(kLogCatalog, kLogDebug, "failed to store catalog index %s (%d)",
+           path.c_str(), errno);
+  return CatalogIndex::Create(image);
+}
+
+
+string ClientCatalogManager::GetIndexPath(const shash::Any &catalog_hash) const
+{
+  return index_dir_ + "/" + CatalogIndex::MakeFileName(catalog_hash);
+}
+
+
+/**
+ * Builds the missing indexes of attached catalogs one by one and hands them
+ * to the catalogs that are still attached.
+ */
+void *ClientCatalogManager::MainIndexBuilder(void *data) {
+  ClientCatalogManager *catalog_mgr =
+    reinterpret_cast<ClientCatalogManager *>(data);
+  LogCvmfs(kLogCatalog, kLogDebug, "starting catalog index builder thread");
+  if (catalog_mgr->use_index_)
+    catalog_mgr->PruneCatalogIndexes();
+
+  while (true) {
+    pthread_mutex_lock(&catalog_mgr->lock_index_jobs_);
+    while (catalog_mgr->index_jobs_.empty() &&
+           !catalog_mgr->index_builder_terminate_)
+    {
+      pthread_cond_wait(&catalog_mgr->cond_index_jobs_,
+                        &catalog_mgr->lock_index_jobs_);
+    }
+    if (catalog_mgr->index_builder_terminate_) {
+      pthread_mutex_unlock(&catalog_mgr->lock_index_jobs_);
+      break;
+    }
+    IndexJob job = catalog_mgr->index_jobs_.front();
+    catalog_mgr->index_jobs_.pop_front();
+    pthread_mutex_unlock(&catalog_mgr->lock_index_jobs_);
+
+    CatalogIndex *index = NULL;
+    if (catalog_mgr->use_index_)
+      index = catalog_mgr->BuildCatalogIndex(job);
+    BloomFilter *path_filter = NULL;
+    if (catalog_mgr->path_filter_bits_ > 0)
+      path_filter = catalog_mgr->BuildPathFilter(job, index);
+    if ((index == NULL) && (path_filter == NULL))
+      continue;
+
+    catalog_mgr->WriteLock();
+    Catalog *catalog = catalog_mgr->FindCatalog(job.mountpoint);
+    if ((catalog != NULL) && (catalog->mountpoint() == job.mountpoint) &&
+        (catalog->hash() == job.hash))
+    {
+      if ((index != NULL) && !catalog->HasIndex()) {
+        catalog->SetIndex(index);
+        index = NULL;
+      }
+      if ((path_filter != NULL) && !catalog->HasPathFilter()) {
+        catalog->SetPathFilter(path_filter,
+                               catalog_mgr->n_path_filter_hits_,
+                               catalog_mgr->n_path_filter_false_positives_);
+        path_filter = NULL;
+      }
+    }
+    catalog_mgr->Unlock();
+    delete index;
+    delete path_filter;
+  }
+
+  LogCvmfs(kLogCatalog, kLogDebug, "stopping catalog index builder thread");
+  return NULL;
+}
+
+
+/**
+ * Removes stored indexes of an outdated format and of catalogs that are not in
+ * the cache anymore.
+ */
+void ClientCatalogManager::PruneCatalogIndexes() {
+  vector<string> files = FindFilesByPrefix(index_dir_, "");
+  for (unsigned i = 0; i < files.size(); ++i) {
+    const string name = GetFileName(files[i]);
+    const string hex = name.substr(0, name.find('.'));
+    const shash::HexPtr hex_ptr(hex);
+    if (hex_ptr.IsValid()) {
+      const shash::Any catalog_hash = shash::MkFromSuffixedHexPtr(hex_ptr);
+      if (CatalogIndex::MakeFileName(catalog_hash) == name) {
+        const int fd = fetcher_->cache_mgr()->Open(
+          CacheManager::Bless(catalog_hash, CacheManager::kTypeCatalog));
+        if (fd >= 0) {
+          fetcher_->cache_mgr()->Close(fd);
+          continue;
+        }
+      }
+    }
+    LogCvmfs(kLogCatalog, kLogDebug, "removing stale catalog index %s",
+             files[i].c_str());
+    unlink(files[i].c_str());
+  }
+}
+
+
 LoadError ClientCatalogManager::LoadCatalogCas(
   const shash::Any &hash,
   const string &name,
@@ -8,7 +8,9 @@
 #include "catalog_mgr.h"
 
 #include <inttypes.h>
+#include <pthread.h>
 
+#include <deque>
 #include <map>
 #include <string>
 
@@ -32,6 +34,8 @@ class SignatureManager;
 
 namespace catalog {
 
+class CatalogIndex;
+
 /**
  * A catalog manager that uses a Fetcher to get file catalgs in the form of
  * (virtual) file descriptors from a cache manager.  Sqlite has a path based
@@ -51,10 +55,19 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   friend class CachedManifestEnsemble;
 
  public:
+  /**
+   * Upper bound for the bits per entry of the path filters.  Beyond that, the
+   * filter only grows while the number of probes stays at its maximum.
+   */
+  static const unsigned kMaxPathFilterBits = 32;
+
   explicit ClientCatalogManager(MountPoint *mountpoint);
   virtual ~ClientCatalogManager();
 
   bool InitFixed(const shash::Any &root_hash, bool alternative_path);
+  void Spawn();
+  Catalog *OpenDetachedCatalog(const PathString &mountpoint,
+                               const shash::Any &hash);
 
   shash::Any GetRootHash();
 
@@ -64,6 +77,21 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t all_inodes() const { return all_inodes_; }
   uint64_t loaded_inodes() const { return loaded_inodes_; }
   std::string repo_name() const { return repo_name_; }
+  /**
+   * Serve lookups and listings from a CatalogIndex.  Needs to be set before
+   * the first catalog is loaded.  Missing indexes are built by a background
+   * thread that is started by Spawn().
+   */
+  void set_use_index(const bool value) { use_index_ = value; }
+  /**
+   * Size of the per-catalog Bloom filter over path hashes in bits per entry.
+   * Zero disables the filter.  Needs to be set before the first catalog is
+   * loaded.  The filters are built by the background thread that is started by
+   * Spawn(); until then, lookups go without the filter.
+   */
+  void set_path_filter_bits(const unsigned value) {
+    path_filter_bits_ = value;
+  }
 
  protected:
   LoadError LoadCatalog(const PathString  &mountpoint,
@@ -77,10 +105,33 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   void ActivateCatalog(catalog::Catalog *catalog);
 
  private:
+  /**
+   * Catalogs beyond this number are not indexed if the index builder thread
+   * falls behind or is not running
+   */
+  static const unsigned kMaxIndexJobs = 1024;
+
+  /**
+   * An attached catalog without a stored index or without a path filter
+   */
+  struct IndexJob {
+    IndexJob(const PathString &m, const shash::Any &h)
+      : mountpoint(m), hash(h) { }
+    PathString mountpoint;
+    shash::Any hash;
+  };
+
+  static void *MainIndexBuilder(void *data);
+
   LoadError LoadCatalogCas(const shash::Any &hash,
                            const std::string &name,
                            const std::string &alt_catalog_path,
                            std::string *catalog_path);
+  std::string GetIndexPath(const shash::Any &catalog_hash) const;
+  CatalogDatabase *OpenPrivateDatabase(const IndexJob &job);
+  CatalogIndex *BuildCatalogIndex(const IndexJob &job);
+  BloomFilter *BuildPathFilter(const IndexJob &job, const CatalogIndex *index);
+  void PruneCatalogIndexes();
 
   /**
    * Required for unpinning
@@ -96,9 +147,30 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t all_inodes_;
   uint64_t loaded_inodes_;
   bool fixed_alt_root_catalog_;  /**< fixed root hash but alternative url */
+  bool use_index_;
+  unsigned path_filter_bits_;
   BackoffThrottle backoff_throttle_;
   perf::Counter *n_certificate_hits_;
   perf::Counter *n_certificate_misses_;
+  perf::Counter *n_index_loads_;
+  perf::Counter *n_index_builds_;
+  perf::Counter *n_path_filter_hits_;
+  perf::Counter *n_path_filter_false_positives_;
+
+  /**
+   * Stored catalog indexes are kept in this directory, outside of the cache
+   * directories
+   */
+  std::string index_dir_;
+  pthread_t thread_index_builder_;
+  bool index_builder_spawned_;
+  bool index_builder_terminate_;
+  /**
+   * Protects the index jobs and the terminate flag
+   */
+  pthread_mutex_t lock_index_jobs_;
+  pthread_cond_t cond_index_jobs_;
+  std::deque<IndexJob> index_jobs_;
 };
 
 
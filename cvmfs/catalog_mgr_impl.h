@@ -12,6 +12,7 @@
 #include "cvmfs_config.h"
 
 #include <cassert>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -301,6 +302,72 @@ bool AbstractCatalogManager<CatalogT>::LookupPath(const PathString &path,
 }
 
 
+/**
+ * Looks up many paths at once, equivalent to calling LookupPath with
+ * kLookupSole for every path.  The paths are grouped by the currently mounted
+ * catalog that serves them and every group is resolved in a single pass over
+ * the catalog, which amortizes the SQLite overhead of many lookups, e.g. for
+ * the entries of a directory listing.  Paths that are not found in the first
+ * pass might require loading nested catalogs; they fall back to LookupPath.
+ * @param paths the paths to look up
+ * @param entries will be resized to paths and set to the found entries;
+ *        entries not found are negative entries unless an error occurred
+ * @param found will be resized to paths and tells which entries were found
+ * @return the number of found entries
+ */
+template <class CatalogT>
+unsigned AbstractCatalogManager<CatalogT>::LookupPaths(
+  const std::vector<PathString> &paths,
+  std::vector<DirectoryEntry> *entries,
+  std::vector<bool> *found)
+{
+  const unsigned num_paths = paths.size();
+  entries->assign(num_paths, DirectoryEntry());
+  found->assign(num_paths, false);
+
+  EnforceSqliteMemLimit();
+  ReadLock();
+  std::map<CatalogT *, std::vector<unsigned> > groups;
+  for (unsigned i = 0; i < num_paths; ++i) {
+    CatalogT *best_fit = FindCatalog(paths[i]);
+    assert(best_fit != NULL);
+    groups[best_fit].push_back(i);
+  }
+
+  typename std::map<CatalogT *, std::vector<unsigned> >::const_iterator
+    i = groups.begin();
+  for (; i != groups.end(); ++i) {
+    const std::vector<unsigned> &indexes = i->second;
+    std::vector<PathString> group_paths;
+    group_paths.reserve(indexes.size());
+    for (unsigned j = 0; j < indexes.size(); ++j)
+      group_paths.push_back(paths[indexes[j]]);
+
+    std::vector<DirectoryEntry> group_entries;
+    std::vector<bool> group_found;
+    perf::Xadd(statistics_.n_lookup_path, indexes.size());
+    i->first->LookupPaths(group_paths, &group_entries, &group_found);
+    for (unsigned j = 0; j < indexes.size(); ++j) {
+      (*entries)[indexes[j]] = group_entries[j];
+      (*found)[indexes[j]] = group_found[j];
+    }
+  }
+  Unlock();
+
+  unsigned num_found = 0;
+  for (unsigned i = 0; i < num_paths; ++i) {
+    if (!(*found)[i]) {
+      DirectoryEntry entry;
+      (*found)[i] = LookupPath(paths[i], kLookupSole, &entry);
+      (*entries)[i] = entry;
+    }
+    if ((*found)[i])
+      ++num_found;
+  }
+  return num_found;
+}
+
+
 /**
  * Perform a lookup for Nested Catalog that serves this path.
  *  If the path specified is a catalog mountpoint the catalog at that point is
@@ -543,6 +610,55 @@ bool AbstractCatalogManager<CatalogT>::ListingStat(const PathString &path,
 }
 
 
+/**
+ * Do a listing of a slice of the specified directory, return only struct stat
+ * values.  Used to stream very large directories without holding the entire
+ * listing in memory.
+ * @param path the path of the directory to list
+ * @param after_row_id list entries following the entry with this row id;
+ *        0 to start from the beginning
+ * @param max_entries the maximum size of the slice
+ * @param listing the resulting StatEntryList
+ * @param row_ids the row ids of the entries in listing in the same order
+ * @return true if listing succeeded otherwise false
+ */
+template <class CatalogT>
+bool AbstractCatalogManager<CatalogT>::ListingStatRange(
+  const PathString &path,
+  const uint64_t after_row_id,
+  const unsigned max_entries,
+  StatEntryList *listing,
+  std::vector<uint64_t> *row_ids)
+{
+  EnforceSqliteMemLimit();
+  bool result;
+  ReadLock();
+
+  // Find catalog, possibly load nested
+  CatalogT *best_fit = FindCatalog(path);
+  CatalogT *catalog = best_fit;
+  if (MountSubtree(path, best_fit, NULL)) {
+    Unlock();
+    WriteLock();
+    // Check again to avoid race
+    best_fit = FindCatalog(path);
+    result = MountSubtree(path, best_fit, &catalog);
+    if (!result) {
+      Unlock();
+      return false;
+    }
+  }
+
+  if (after_row_id == 0)
+    perf::Inc(statistics_.n_listing);
+  result = catalog->ListingPathStatRange(path, after_row_id, max_entries,
+                                         listing, row_ids);
+
+  Unlock();
+  return result;
+}
+
+
 /**
  * Collect file chunks (if exist)
  * @param path the path of the directory to list
@@ -442,7 +442,7 @@ void SqlDirent::StoreHashAlgorithm(const shash::Algorithms algo,
 }
 
 
-shash::Algorithms SqlDirent::RetrieveHashAlgorithm(const unsigned flags) const {
+shash::Algorithms SqlDirent::RetrieveHashAlgorithm(const unsigned flags) {
   unsigned in_flags = ((7 << kFlagPosHash) & flags) >> kFlagPosHash;
   // Skip Md5
   in_flags++;
@@ -452,7 +452,6 @@ shash::Algorithms SqlDirent::RetrieveHashAlgorithm(const unsigned flags) const {
 
 
 zlib::Algorithms SqlDirent::RetrieveCompressionAlgorithm(const unsigned flags)
-  const
 {
   // 3 bits, so use 7 (111) to only pull out the flags we want
   unsigned in_flags =
@@ -461,12 +460,12 @@ zlib::Algorithms SqlDirent::RetrieveCompressionAlgorithm(const unsigned flags)
 }
 
 
-uint32_t SqlDirent::Hardlinks2Linkcount(const uint64_t hardlinks) const {
+uint32_t SqlDirent::Hardlinks2Linkcount(const uint64_t hardlinks) {
   return (hardlinks << 32) >> 32;
 }
 
 
-uint32_t SqlDirent::Hardlinks2HardlinkGroup(const uint64_t hardlinks) const {
+uint32_t SqlDirent::Hardlinks2HardlinkGroup(const uint64_t hardlinks) {
   return hardlinks >> 32;
 }
 
@@ -483,7 +482,7 @@ uint64_t SqlDirent::MakeHardlinks(const uint32_t hardlink_group,
  * Expands variant symlinks containing $(VARIABLE) string.  Uses the environment
  * variables of the current process (cvmfs2)
  */
-void SqlDirent::ExpandSymlink(LinkString *raw_symlink) const {
+void SqlDirent::ExpandSymlink(LinkString *raw_symlink) {
   const char *c = raw_symlink->GetChars();
   const char *cEnd = c+raw_symlink->GetLength();
   for (; c < cEnd; ++c) {
@@ -678,6 +677,12 @@ shash::Md5 SqlLookup::GetParentPathHash() const {
 DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
                                     const bool expand_symlink) const
 {
+  if (catalog->schema() >= 2.1 - CatalogDatabase::kSchemaEpsilon) {
+    DirentFields fields;
+    GetDirentFields(&fields);
+    return MakeDirent(catalog, fields, expand_symlink);
+  }
+
   DirectoryEntry result;
 
   const unsigned database_flags = RetrieveInt(5);
@@ -687,40 +692,14 @@ DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
   const char *name = reinterpret_cast<const char *>(RetrieveText(6));
   const char *symlink = reinterpret_cast<const char *>(RetrieveText(7));
 
-  // Retrieve the hardlink information from the hardlinks database field
-  if (catalog->schema() < 2.1 - CatalogDatabase::kSchemaEpsilon) {
-    result.linkcount_       = 1;
-    result.hardlink_group_  = 0;
-    result.inode_           = catalog->GetMangledInode(RetrieveInt64(12), 0);
-    result.is_chunked_file_ = false;
-    result.has_xattrs_      = false;
-    result.checksum_        = RetrieveHashBlob(0, shash::kSha1);
-    result.uid_             = g_uid;
-    result.gid_             = g_gid;
-  } else {
-    const uint64_t hardlinks   = RetrieveInt64(1);
-    result.linkcount_          = Hardlinks2Linkcount(hardlinks);
-    result.hardlink_group_     = Hardlinks2HardlinkGroup(hardlinks);
-    result.inode_              =
-      catalog->GetMangledInode(RetrieveInt64(12), result.hardlink_group_);
-    result.is_bind_mountpoint_ = (database_flags & kFlagDirBindMountpoint);
-    result.is_chunked_file_    = (database_flags & kFlagFileChunk);
-    result.is_hidden_          = (database_flags & kFlagHidden);
-    result.is_external_file_   = (database_flags & kFlagFileExternal);
-    result.has_xattrs_         = RetrieveInt(15) != 0;
-    result.checksum_           =
-      RetrieveHashBlob(0, RetrieveHashAlgorithm(database_flags));
-    result.compression_algorithm_ =
-      RetrieveCompressionAlgorithm(database_flags);
-
-    if (g_claim_ownership) {
-      result.uid_             = g_uid;
-      result.gid_             = g_gid;
-    } else {
-      result.uid_              = catalog->MapUid(RetrieveInt64(13));
-      result.gid_              = catalog->MapGid(RetrieveInt64(14));
-    }
-  }
+  result.linkcount_       = 1;
+  result.hardlink_group_  = 0;
+  result.inode_           = catalog->GetMangledInode(RetrieveInt64(12), 0);
+  result.is_chunked_file_ = false;
+  result.has_xattrs_      = false;
+  result.checksum_        = RetrieveHashBlob(0, shash::kSha1);
+  result.uid_             = g_uid;
+  result.gid_             = g_gid;
 
   result.mode_     = RetrieveInt(3);
   result.size_     = RetrieveInt64(2);
@@ -734,6 +713,77 @@ DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog,
 }
 
 
+void SqlLookup::GetDirentFields(DirentFields *fields) const {
+  // See the note on the order of sqlite3_column_XXX() in RetrieveHashBlob()
+  fields->hash = static_cast<const unsigned char *>(RetrieveBlob(0));
+  fields->hash_size = RetrieveBytes(0);
+  fields->hardlinks = RetrieveInt64(1);
+  fields->size = RetrieveInt64(2);
+  fields->mode = RetrieveInt(3);
+  fields->mtime = RetrieveInt64(4);
+  fields->flags = RetrieveInt(5);
+  fields->name = reinterpret_cast<const char *>(RetrieveText(6));
+  fields->name_length = strlen(fields->name);
+  fields->symlink = reinterpret_cast<const char *>(RetrieveText(7));
+  fields->symlink_length = strlen(fields->symlink);
+  fields->row_id = RetrieveInt64(12);
+  fields->uid = RetrieveInt64(13);
+  fields->gid = RetrieveInt64(14);
+  fields->has_xattrs = RetrieveInt(15) != 0;
+}
+
+
+/**
+ * This method is a friend of DirectoryEntry.
+ */
+DirectoryEntry SqlLookup::MakeDirent(const Catalog *catalog,
+                                     const DirentFields &fields,
+                                     const bool expand_symlink)
+{
+  DirectoryEntry result;
+
+  const unsigned database_flags = fields.flags;
+  result.is_nested_catalog_root_ = (database_flags & kFlagDirNestedRoot);
+  result.is_nested_catalog_mountpoint_ =
+    (database_flags & kFlagDirNestedMountpoint);
+
+  result.linkcount_          = Hardlinks2Linkcount(fields.hardlinks);
+  result.hardlink_group_     = Hardlinks2HardlinkGroup(fields.hardlinks);
+  result.inode_              =
+    catalog->GetMangledInode(fields.row_id, result.hardlink_group_);
+  result.is_bind_mountpoint_ = (database_flags & kFlagDirBindMountpoint);
+  result.is_chunked_file_    = (database_flags & kFlagFileChunk);
+  result.is_hidden_          = (database_flags & kFlagHidden);
+  result.is_external_file_   = (database_flags & kFlagFileExternal);
+  result.has_xattrs_         = fields.has_xattrs;
+  const shash::Algorithms hash_algorithm =
+    RetrieveHashAlgorithm(database_flags);
+  result.checksum_           = (fields.hash_size > 0)
+    ? shash::Any(hash_algorithm, fields.hash)
+    : shash::Any(hash_algorithm);
+  result.compression_algorithm_ =
+    RetrieveCompressionAlgorithm(database_flags);
+
+  if (g_claim_ownership) {
+    result.uid_             = g_uid;
+    result.gid_             = g_gid;
+  } else {
+    result.uid_              = catalog->MapUid(fields.uid);
+    result.gid_              = catalog->MapGid(fields.gid);
+  }
+
+  result.mode_     = fields.mode;
+  result.size_     = fields.size;
+  result.mtime_    = fields.mtime;
+  result.name_.Assign(fields.name, fields.name_length);
+  result.symlink_.Assign(fields.symlink, fields.symlink_length);
+  if (expand_symlink && !g_raw_symlinks)
+    ExpandSymlink(&result.symlink_);
+
+  return result;
+}
+
+
 //------------------------------------------------------------------------------
 
 
@@ -752,6 +802,41 @@ bool SqlListing::BindPathHash(const struct shash::Md5 &hash) {
 //------------------------------------------------------------------------------
 
 
+SqlListingRange::SqlListingRange(const CatalogDatabase &database) {
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
+                  "WHERE (parent_1 = :p_1) AND (parent_2 = :p_2) AND "
+                  "(catalog.rowid > :rowid) ORDER BY catalog.rowid;");
+  DEFERRED_INITS(database);
+}
+
+
+bool SqlListingRange::BindPathHash(const struct shash::Md5 &hash) {
+  return BindMd5(1, 2, hash);
+}
+
+
+bool SqlListingRange::BindAfterRowId(const uint64_t row_id) {
+  return BindInt64(3, row_id);
+}
+
+
+uint64_t SqlListingRange::GetRowId() const {
+  return RetrieveInt64(12);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+SqlAllDirents::SqlAllDirents(const CatalogDatabase &database) {
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog ORDER BY catalog.rowid;");
+  DEFERRED_INITS(database);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 SqlLookupPathHash::SqlLookupPathHash(const CatalogDatabase &database) {
   MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
                   "WHERE (md5path_1 = :md5_1) AND (md5path_2 = :md5_2);");
@@ -220,16 +220,16 @@ class SqlDirent : public SqlCatalog {
    */
   unsigned CreateDatabaseFlags(const DirectoryEntry &entry) const;
   void StoreHashAlgorithm(const shash::Algorithms algo, unsigned *flags) const;
-  shash::Algorithms RetrieveHashAlgorithm(const unsigned flags) const;
-  zlib::Algorithms RetrieveCompressionAlgorithm(const unsigned flags) const;
+  static shash::Algorithms RetrieveHashAlgorithm(const unsigned flags);
+  static zlib::Algorithms RetrieveCompressionAlgorithm(const unsigned flags);
 
   /**
    * The hardlink information (hardlink group ID and linkcount) is saved in one
    * uint_64t field in the CVMFS Catalogs. Therefore we need to do bitshifting
    * in these helper methods.
    */
-  uint32_t Hardlinks2Linkcount(const uint64_t hardlinks) const;
-  uint32_t Hardlinks2HardlinkGroup(const uint64_t hardlinks) const;
+  static uint32_t Hardlinks2Linkcount(const uint64_t hardlinks);
+  static uint32_t Hardlinks2HardlinkGroup(const uint64_t hardlinks);
   uint64_t MakeHardlinks(const uint32_t hardlink_group,
                          const uint32_t linkcount) const;
 
@@ -238,7 +238,7 @@ class SqlDirent : public SqlCatalog {
    * @param raw_symlink the raw symlink path (may) containing place holders
    * @return the expanded symlink
    */
-  void ExpandSymlink(LinkString *raw_symlink) const;
+  static void ExpandSymlink(LinkString *raw_symlink);
 };
 
 
@@ -284,6 +284,46 @@ class SqlListContentHashes : public SqlDirent {
 
 class SqlLookup : public SqlDirent {
  public:
+  /**
+   * The raw column values of a directory entry as of schema 2.1.  The
+   * pointers refer to the current row of the statement or, for entries served
+   * from a CatalogIndex, to the index buffer.
+   */
+  struct DirentFields {
+    DirentFields()
+      : hash(NULL), hash_size(0), hardlinks(0), size(0), mode(0), mtime(0)
+      , flags(0), name(NULL), name_length(0), symlink(NULL)
+      , symlink_length(0), row_id(0), uid(0), gid(0), has_xattrs(false)
+    { }
+    uint32_t hardlink_group() const {
+      return Hardlinks2HardlinkGroup(hardlinks);
+    }
+
+    const unsigned char *hash;
+    unsigned hash_size;
+    uint64_t hardlinks;
+    uint64_t size;
+    unsigned mode;
+    int64_t mtime;
+    unsigned flags;
+    const char *name;
+    unsigned name_length;
+    const char *symlink;
+    unsigned symlink_length;
+    uint64_t row_id;
+    uint64_t uid;
+    uint64_t gid;
+    bool has_xattrs;
+  };
+
+  /**
+   * Builds a DirectoryEntry from raw column values.  Only valid for catalogs
+   * with schema 2.1 or newer.
+   */
+  static DirectoryEntry MakeDirent(const Catalog *catalog,
+                                   const DirentFields &fields,
+                                   const bool expand_symlink = true);
+
   /**
    * Retrieves a DirectoryEntry from a freshly performed SqlLookup statement.
    * @param catalog the catalog in which the DirectoryEntry resides
@@ -305,6 +345,13 @@ class SqlLookup : public SqlDirent {
    * @return the MD5 parent path hash of a freshly performed lookup
    */
   shash::Md5 GetParentPathHash() const;
+
+  /**
+   * Retrieves the raw columns of a freshly performed SqlLookup statement.  The
+   * pointers are valid until the statement is stepped or reset.  Requires
+   * schema 2.1 or newer.
+   */
+  void GetDirentFields(DirentFields *fields) const;
 };
 
 
@@ -321,6 +368,37 @@ class SqlListing : public SqlLookup {
 //------------------------------------------------------------------------------
 
 
+/**
+ * Lists a directory in slices.  The entries are ordered by their row id, which
+ * serves as a cursor for the next slice.  The rows of a directory are found
+ * by the parent index, so that a slice costs a seek into the index rather
+ * than a scan of the whole directory.
+ */
+class SqlListingRange : public SqlLookup {
+ public:
+  explicit SqlListingRange(const CatalogDatabase &database);
+  bool BindPathHash(const struct shash::Md5 &hash);
+  bool BindAfterRowId(const uint64_t row_id);
+  uint64_t GetRowId() const;
+};
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Iterates over all directory entries of a catalog in order of their row id.
+ * Used to build a CatalogIndex.
+ */
+class SqlAllDirents : public SqlLookup {
+ public:
+  explicit SqlAllDirents(const CatalogDatabase &database);
+};
+
+
+//------------------------------------------------------------------------------
+
+
 class SqlLookupPathHash : public SqlLookup {
  public:
   explicit SqlLookupPathHash(const CatalogDatabase &database);
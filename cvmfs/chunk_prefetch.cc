@@ -0,0 +1,235 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "chunk_prefetch.h"
+
+#include <cassert>
+
+#include "clientctx.h"
+#include "fetch.h"
+#include "logging.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace cvmfs {
+
+ChunkPrefetcher::ChunkPrefetcher(
+  Fetcher *fetcher,
+  Fetcher *external_fetcher,
+  const unsigned depth,
+  const unsigned num_threads,
+  perf::StatisticsTemplate statistics)
+  : fetcher_(fetcher)
+  , external_fetcher_(external_fetcher)
+  , depth_(depth)
+  , num_threads_(num_threads)
+  , spawned_(false)
+  , terminate_(false)
+{
+  assert((depth_ > 0) && (depth_ <= kMaxDepth));
+  assert((num_threads_ > 0) && (num_threads_ <= kMaxThreads));
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_jobs_, NULL);
+  assert(retval == 0);
+
+  n_prefetch_ = statistics.RegisterTemplated("n_prefetch",
+    "Number of chunks queued for prefetching");
+  n_hits_ = statistics.RegisterTemplated("n_hits",
+    "Number of opened chunks that have been prefetched");
+  n_waste_ = statistics.RegisterTemplated("n_waste",
+    "Number of prefetched chunks that have not been opened");
+  n_failed_ = statistics.RegisterTemplated("n_failed",
+    "Number of failed prefetches");
+  n_dropped_ = statistics.RegisterTemplated("n_dropped",
+    "Number of prefetches dropped due to a full queue");
+}
+
+
+ChunkPrefetcher::~ChunkPrefetcher() {
+  pthread_mutex_lock(&lock_);
+  terminate_ = true;
+  pthread_cond_broadcast(&cond_jobs_);
+  pthread_mutex_unlock(&lock_);
+  for (unsigned i = 0; i < threads_.size(); ++i)
+    pthread_join(threads_[i], NULL);
+  pthread_cond_destroy(&cond_jobs_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+void *ChunkPrefetcher::MainPrefetch(void *data) {
+  ChunkPrefetcher *prefetcher = reinterpret_cast<ChunkPrefetcher *>(data);
+  LogCvmfs(kLogCvmfs, kLogDebug, "starting chunk prefetcher thread");
+
+  while (true) {
+    pthread_mutex_lock(&prefetcher->lock_);
+    while (prefetcher->jobs_.empty() && !prefetcher->terminate_)
+      pthread_cond_wait(&prefetcher->cond_jobs_, &prefetcher->lock_);
+    if (prefetcher->terminate_) {
+      pthread_mutex_unlock(&prefetcher->lock_);
+      break;
+    }
+    Job job = prefetcher->jobs_.front();
+    prefetcher->jobs_.pop_front();
+    pthread_mutex_unlock(&prefetcher->lock_);
+
+    prefetcher->Prefetch(job);
+  }
+
+  LogCvmfs(kLogCvmfs, kLogDebug, "stopping chunk prefetcher thread");
+  return NULL;
+}
+
+
+/**
+ * Called by cvmfs_read() before it fetches the chunk chunk_idx for a file
+ * handle.  The previous chunk descriptor of the handle is used to detect
+ * sequential access.  Only crossing a chunk boundary counts as sequential, so
+ * that readers who just look at the head of a file do not trigger downloads
+ * of the rest.  Chunks are referenced by value in the job queue because
+ * the chunk list can be freed once the file is closed.  The client context of
+ * the calling reader is stored with the jobs.
+ */
+void ChunkPrefetcher::OnChunkSwitch(
+  const FileChunkReflist &chunks,
+  const ChunkFd &previous,
+  const unsigned chunk_idx,
+  const CacheManager::ObjectType object_type)
+{
+  const shash::Any &id = chunks.list->AtPtr(chunk_idx)->content_hash();
+  const bool is_sequential =
+    (previous.fd != -1) && (chunk_idx == previous.chunk_idx + 1);
+  const unsigned num_chunks = chunks.list->size();
+  uid_t uid;
+  gid_t gid;
+  pid_t pid;
+  ClientCtx::GetInstance()->Get(&uid, &gid, &pid);
+
+  MutexLockGuard guard(lock_);
+  map<shash::Any, list<shash::Any>::iterator>::iterator iter_prefetched =
+    prefetched_.find(id);
+  if (iter_prefetched != prefetched_.end()) {
+    prefetched_fifo_.erase(iter_prefetched->second);
+    prefetched_.erase(iter_prefetched);
+    perf::Inc(n_hits_);
+  } else {
+    map<shash::Any, bool>::iterator iter = pending_.find(id);
+    if (iter != pending_.end()) {
+      // The reader caught up; the fetcher collapses it onto the prefetch
+      iter->second = true;
+      perf::Inc(n_hits_);
+    }
+  }
+
+  if (!is_sequential)
+    return;
+
+  bool has_new_jobs = false;
+  for (unsigned i = chunk_idx + 1;
+       (i <= chunk_idx + depth_) && (i < num_chunks); ++i)
+  {
+    const FileChunk *chunk = chunks.list->AtPtr(i);
+    const shash::Any &next_id = chunk->content_hash();
+    if ((pending_.find(next_id) != pending_.end()) ||
+        (prefetched_.find(next_id) != prefetched_.end()))
+    {
+      continue;
+    }
+    if (jobs_.size() >= kMaxQueueLength) {
+      perf::Inc(n_dropped_);
+      break;
+    }
+
+    Job job;
+    job.id = next_id;
+    job.size = chunk->size();
+    job.compression_alg = chunks.compression_alg;
+    job.object_type = object_type;
+    job.external_data = chunks.external_data;
+    job.path = chunks.path.ToString();
+    job.uid = uid;
+    job.gid = gid;
+    job.pid = pid;
+    if (chunks.external_data)
+      job.range_offset = chunk->offset();
+    jobs_.push_back(job);
+    pending_[next_id] = false;
+    perf::Inc(n_prefetch_);
+    has_new_jobs = true;
+  }
+  if (has_new_jobs)
+    pthread_cond_broadcast(&cond_jobs_);
+}
+
+
+void ChunkPrefetcher::Prefetch(const Job &job) {
+  int fd;
+  const string verbose_path = "Prefetch of part of " + job.path;
+  {
+    ClientCtxGuard ctx_guard(job.uid, job.gid, job.pid);
+    if (job.external_data) {
+      fd = external_fetcher_->Fetch(job.id, job.size, verbose_path,
+                                    job.compression_alg, job.object_type,
+                                    job.path, job.range_offset);
+    } else {
+      fd = fetcher_->Fetch(job.id, job.size, verbose_path,
+                           job.compression_alg, job.object_type);
+    }
+  }
+  if (fd >= 0) {
+    if (job.external_data)
+      external_fetcher_->cache_mgr()->Close(fd);
+    else
+      fetcher_->cache_mgr()->Close(fd);
+  }
+
+  MutexLockGuard guard(lock_);
+  map<shash::Any, bool>::iterator iter = pending_.find(job.id);
+  assert(iter != pending_.end());
+  const bool is_accessed = iter->second;
+  pending_.erase(iter);
+  if (fd < 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "failed to prefetch %s (%d)",
+             job.id.ToString().c_str(), fd);
+    perf::Inc(n_failed_);
+    return;
+  }
+  if (!is_accessed)
+    TrackPrefetched(job.id);
+}
+
+
+void ChunkPrefetcher::Spawn() {
+  assert(!spawned_);
+  threads_.resize(num_threads_);
+  for (unsigned i = 0; i < num_threads_; ++i) {
+    int retval = pthread_create(&threads_[i], NULL, MainPrefetch, this);
+    assert(retval == 0);
+  }
+  spawned_ = true;
+  LogCvmfs(kLogCvmfs, kLogDebug, "spawned %u chunk prefetcher threads "
+           "(depth %u)", num_threads_, depth_);
+}
+
+
+/**
+ * Remembers a prefetched chunk until it is opened.  Chunks that fall out of
+ * the bounded FIFO before being opened count as waste.  Needs to be called
+ * with lock_ held.
+ */
+void ChunkPrefetcher::TrackPrefetched(const shash::Any &id) {
+  if (prefetched_.find(id) != prefetched_.end())
+    return;
+  prefetched_[id] = prefetched_fifo_.insert(prefetched_fifo_.end(), id);
+  if (prefetched_.size() > kMaxTracked) {
+    prefetched_.erase(prefetched_fifo_.front());
+    prefetched_fifo_.pop_front();
+    perf::Inc(n_waste_);
+  }
+}
+
+}  // namespace cvmfs
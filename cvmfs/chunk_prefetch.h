@@ -0,0 +1,138 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CHUNK_PREFETCH_H_
+#define CVMFS_CHUNK_PREFETCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "compression.h"
+#include "file_chunk.h"
+#include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+namespace cvmfs {
+
+class Fetcher;
+
+/**
+ * The fuse module fetches a chunk of a chunked file only when a reader
+ * crosses into it.  Sequential readers thus stall on every chunk boundary for
+ * a full download.  The ChunkPrefetcher is informed whenever a file handle
+ * switches to another chunk.  If the switch is to the successor of the
+ * previous chunk, it queues the next few chunks of the file for download by a
+ * small pool of worker threads.  The workers load the chunks into the cache
+ * through the regular Fetchers, so a reader that catches up with an ongoing
+ * prefetch is collapsed onto the same download.
+ *
+ * Prefetched chunks that have not yet been opened are remembered in a bounded
+ * FIFO in order to count hits and wasted downloads.
+ */
+class ChunkPrefetcher : SingleCopy {
+  FRIEND_TEST(T_ChunkPrefetcher, TrackPrefetched);
+  FRIEND_TEST(T_ChunkPrefetcher, ClientCtx);
+
+ public:
+  static const unsigned kMaxDepth = 64;
+  /**
+   * Upper bound of the worker threads, also the number of workers the mount
+   * point starts for a prefetch depth of at least kMaxThreads
+   */
+  static const unsigned kMaxThreads = 4;
+  /**
+   * Prefetch jobs beyond this limit are dropped.
+   */
+  static const unsigned kMaxQueueLength = 256;
+  /**
+   * Number of prefetched but not yet accessed chunks that are remembered.
+   */
+  static const unsigned kMaxTracked = 1024;
+
+  ChunkPrefetcher(Fetcher *fetcher,
+                  Fetcher *external_fetcher,
+                  const unsigned depth,
+                  const unsigned num_threads,
+                  perf::StatisticsTemplate statistics);
+  ~ChunkPrefetcher();
+  void Spawn();
+
+  void OnChunkSwitch(const FileChunkReflist &chunks,
+                     const ChunkFd &previous,
+                     const unsigned chunk_idx,
+                     const CacheManager::ObjectType object_type);
+
+  unsigned depth() const { return depth_; }
+
+ private:
+  struct Job {
+    Job() : size(0), range_offset(-1), compression_alg(zlib::kZlibDefault),
+      object_type(CacheManager::kTypeRegular), external_data(false),
+      uid(-1), gid(-1), pid(-1) { }
+    shash::Any id;
+    uint64_t size;
+    off_t range_offset;
+    std::string path;
+    zlib::Algorithms compression_alg;
+    CacheManager::ObjectType object_type;
+    bool external_data;
+    /**
+     * Client context of the reader that triggered the prefetch, so that the
+     * download uses the reader's credentials.  The pid is -1 if unknown.
+     */
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+  };
+
+  static void *MainPrefetch(void *data);
+  void Prefetch(const Job &job);
+  void TrackPrefetched(const shash::Any &id);
+
+  Fetcher *fetcher_;
+  Fetcher *external_fetcher_;
+  unsigned depth_;
+  unsigned num_threads_;
+  std::vector<pthread_t> threads_;
+  bool spawned_;
+  bool terminate_;
+
+  /**
+   * Protects the job queue and the tracking of pending and prefetched chunks.
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_jobs_;
+  std::deque<Job> jobs_;
+  /**
+   * Chunks that are queued or being downloaded.  The flag is set if a reader
+   * opens the chunk before the prefetch finished.
+   */
+  std::map<shash::Any, bool> pending_;
+  /**
+   * Chunks that have been prefetched but not yet opened, in order of arrival.
+   * The map points into the FIFO so that opened chunks leave both.
+   */
+  std::map<shash::Any, std::list<shash::Any>::iterator> prefetched_;
+  std::list<shash::Any> prefetched_fifo_;
+
+  perf::Counter *n_prefetch_;
+  perf::Counter *n_hits_;
+  perf::Counter *n_waste_;
+  perf::Counter *n_failed_;
+  perf::Counter *n_dropped_;
+};
+
+}  // namespace cvmfs
+
+#endif  // CVMFS_CHUNK_PREFETCH_H_
@@ -168,6 +168,58 @@ void Migrate(InodeTracker *old_tracker, glue::InodeTracker *new_tracker) {
 //------------------------------------------------------------------------------
 
 
+namespace {
+
+/**
+ * As of version 5, the chunk tables are sharded.  Distributes the entries of
+ * the flat hash maps of previous versions over the shards.
+ */
+void MigrateHandleMaps(
+  const SmallHashDynamic<uint64_t, ::ChunkFd> &handle2fd,
+  const SmallHashDynamic<uint64_t, uint64_t> *handle2uniqino,
+  ::ChunkTables *new_tables)
+{
+  for (unsigned keyno = 0; keyno < handle2fd.capacity(); ++keyno) {
+    const uint64_t handle = handle2fd.keys()[keyno];
+    if (handle == 0) continue;
+    new_tables->Handle2Shard(handle)->handle2fd.Insert(
+      handle, handle2fd.values()[keyno]);
+  }
+  if (handle2uniqino == NULL)
+    return;
+  for (unsigned keyno = 0; keyno < handle2uniqino->capacity(); ++keyno) {
+    const uint64_t handle = handle2uniqino->keys()[keyno];
+    if (handle == 0) continue;
+    new_tables->Handle2Shard(handle)->handle2uniqino.Insert(
+      handle, handle2uniqino->values()[keyno]);
+  }
+}
+
+
+void MigrateInodeMaps(
+  const SmallHashDynamic<uint64_t, uint32_t> &inode2references,
+  const SmallHashDynamic<uint64_t, ::FileChunkReflist> *inode2chunks,
+  ::ChunkTables *new_tables)
+{
+  for (unsigned keyno = 0; keyno < inode2references.capacity(); ++keyno) {
+    const uint64_t inode = inode2references.keys()[keyno];
+    if (inode == 0) continue;
+    new_tables->Inode2Shard(inode)->inode2references.Insert(
+      inode, inode2references.values()[keyno]);
+  }
+  if (inode2chunks == NULL)
+    return;
+  for (unsigned keyno = 0; keyno < inode2chunks->capacity(); ++keyno) {
+    const uint64_t inode = inode2chunks->keys()[keyno];
+    if (inode == 0) continue;
+    new_tables->Inode2Shard(inode)->inode2chunks.Insert(
+      inode, inode2chunks->values()[keyno]);
+  }
+}
+
+}  // anonymous namespace
+
+
 namespace chunk_tables {
 
 ChunkTables::~ChunkTables() {
@@ -181,8 +233,8 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateHandleMaps(old_tables->handle2fd, NULL, new_tables);
+  MigrateInodeMaps(old_tables->inode2references, NULL, new_tables);
 
   SmallHashDynamic<uint64_t, FileChunkReflist> *old_inode2chunks =
     &old_tables->inode2chunks;
@@ -204,7 +256,7 @@ void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
     delete old_list;
     ::FileChunkReflist new_reflist(new_list, old_reflist->path,
                                    zlib::kZlibDefault, false);
-    new_tables->inode2chunks.Insert(inode, new_reflist);
+    new_tables->Inode2Shard(inode)->inode2chunks.Insert(inode, new_reflist);
   }
 }
 
@@ -227,8 +279,8 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateHandleMaps(old_tables->handle2fd, NULL, new_tables);
+  MigrateInodeMaps(old_tables->inode2references, NULL, new_tables);
 
   SmallHashDynamic<uint64_t, FileChunkReflist> *old_inode2chunks =
     &old_tables->inode2chunks;
@@ -250,7 +302,7 @@ void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
     delete old_list;
     ::FileChunkReflist new_reflist(new_list, old_reflist->path,
                                    zlib::kZlibDefault, false);
-    new_tables->inode2chunks.Insert(inode, new_reflist);
+    new_tables->Inode2Shard(inode)->inode2chunks.Insert(inode, new_reflist);
   }
 }
 
@@ -273,11 +325,36 @@ ChunkTables::~ChunkTables() {
 
 void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
   new_tables->next_handle = old_tables->next_handle;
-  new_tables->handle2fd = old_tables->handle2fd;
-  new_tables->inode2chunks = old_tables->inode2chunks;
-  new_tables->inode2references = old_tables->inode2references;
+  MigrateHandleMaps(old_tables->handle2fd, NULL, new_tables);
+  MigrateInodeMaps(old_tables->inode2references, &old_tables->inode2chunks,
+                   new_tables);
 }
 
 }  // namespace chunk_tables_v3
 
+
+//------------------------------------------------------------------------------
+
+
+namespace chunk_tables_v4 {
+
+ChunkTables::~ChunkTables() {
+  pthread_mutex_destroy(lock);
+  free(lock);
+  for (unsigned i = 0; i < kNumHandleLocks; ++i) {
+    pthread_mutex_destroy(handle_locks.At(i));
+    free(handle_locks.At(i));
+  }
+}
+
+void Migrate(ChunkTables *old_tables, ::ChunkTables *new_tables) {
+  new_tables->next_handle = old_tables->next_handle;
+  MigrateHandleMaps(old_tables->handle2fd, &old_tables->handle2uniqino,
+                    new_tables);
+  MigrateInodeMaps(old_tables->inode2references, &old_tables->inode2chunks,
+                   new_tables);
+}
+
+}  // namespace chunk_tables_v4
+
 }  // namespace compat
@@ -71,6 +71,7 @@
 #include "backoff.h"
 #include "cache.h"
 #include "catalog_mgr_client.h"
+#include "chunk_prefetch.h"
 #include "clientctx.h"
 #include "compat.h"
 #include "compression.h"
@@ -139,6 +140,38 @@ struct DirectoryListing {
   DirectoryListing() : buffer(NULL), size(0), capacity(0) { }
 };
 
+/**
+ * For streaming directory listings (CVMFS_STREAMING_READDIR).  Instead of the
+ * complete listing, the directory handle only refers to the directory path.
+ * Every cvmfs_readdir call looks up the next slice of entries in the catalog.
+ * The offsets handed out to the kernel are derived from the catalog row ids,
+ * so that a listing can be continued at any offset independent of previous
+ * readdir calls.
+ *
+ * Row ids are only stable within a catalog revision.  The cursor therefore
+ * remembers the catalog that held the directory on opendir.  If a remount
+ * replaces that catalog, the listing continues on a private copy of the
+ * remembered catalog, see GetDirCursorCatalog().
+ */
+struct DirectoryCursor {
+  PathString path;
+  struct stat info_self;
+  struct stat info_parent;
+  bool has_parent;
+  /**
+   * The repository revision in which catalog_hash was last confirmed to be
+   * the mounted catalog of the directory
+   */
+  uint64_t revision;
+  PathString catalog_mountpoint;
+  shash::Any catalog_hash;
+
+  DirectoryCursor() : has_parent(false), revision(0) {
+    memset(&info_self, 0, sizeof(info_self));
+    memset(&info_parent, 0, sizeof(info_parent));
+  }
+};
+
 const loader::LoaderExports *loader_exports_ = NULL;
 OptionsManager *options_mgr_ = NULL;
 pid_t pid_ = 0;  /**< will be set after deamon() */
@@ -150,10 +183,50 @@ typedef google::dense_hash_map<uint64_t, DirectoryListing,
                                hash_murmur<uint64_t> >
         DirectoryHandles;
 DirectoryHandles *directory_handles_ = NULL;
+typedef google::dense_hash_map<uint64_t, DirectoryCursor,
+                               hash_murmur<uint64_t> >
+        DirectoryCursors;
+/**
+ * Shares the handle space and the lock with directory_handles_
+ */
+DirectoryCursors *directory_cursors_ = NULL;
+typedef google::dense_hash_map<uint64_t, catalog::Catalog *,
+                               hash_murmur<uint64_t> >
+        PinnedDirCatalogs;
+/**
+ * Private copies of replaced catalogs for open directory cursors.  Not saved
+ * on reload; the cursors open them again if needed.  Protected by
+ * lock_directory_handles_.
+ */
+PinnedDirCatalogs *pinned_dir_catalogs_ = NULL;
 pthread_mutex_t lock_directory_handles_ = PTHREAD_MUTEX_INITIALIZER;
 uint64_t next_directory_handle_ = 0;
+/**
+ * Set by CVMFS_STREAMING_READDIR=yes
+ */
+bool streaming_readdir_ = false;
+/**
+ * Number of entries that are looked up at once for a streaming listing.  Bounds
+ * the memory of a cvmfs_readdir call independent of the directory size.
+ */
+const unsigned kDirCursorSliceSize = 256;
+/**
+ * The kernel offsets of "." and ".." in a streaming listing.  Catalog entries
+ * follow at their row id shifted by kDirCursorNumDots.
+ */
+const off_t kDirCursorNumDots = 2;
+/**
+ * Directory entries are resolved in batches of this size when a listing is
+ * assembled, see GetDirentsForPaths()
+ */
+const unsigned kLookupBatchSize = 256;
 
 unsigned max_open_files_; /**< maximum allowed number of open files */
+/**
+ * Serve reads of cached files by splicing from the cache file descriptor.
+ * Can be turned off by CVMFS_FUSE_SPLICE_READ=no.
+ */
+bool splice_read_ = true;
 /**
  * Number of reserved file descriptors for internal use
  */
@@ -315,6 +388,82 @@ static bool GetDirentForPath(const PathString &path,
 }
 
 
+static PathString GetEntryPath(const PathString &directory,
+                               const NameString &name)
+{
+  PathString entry_path;
+  entry_path.Assign(directory);
+  entry_path.Append("/", 1);
+  entry_path.Append(name.GetChars(), name.GetLength());
+  return entry_path;
+}
+
+
+/**
+ * Like GetDirentForPath for many paths at once, used for the entries of
+ * directory listings.  Paths that miss the md5path cache are resolved by a
+ * single batched catalog lookup.
+ */
+static void GetDirentsForPaths(const vector<PathString> &paths,
+                               vector<catalog::DirectoryEntry> *dirents,
+                               vector<bool> *found)
+{
+  const unsigned num_paths = paths.size();
+  dirents->assign(num_paths, catalog::DirectoryEntry());
+  found->assign(num_paths, false);
+  vector<uint64_t> live_inodes(num_paths, 0);
+  vector<shash::Md5> md5paths;
+  md5paths.reserve(num_paths);
+  vector<unsigned> misses;
+  for (unsigned i = 0; i < num_paths; ++i) {
+    if (!file_system_->IsNfsSource())
+      live_inodes[i] = mount_point_->inode_tracker()->FindInode(paths[i]);
+
+    md5paths.push_back(shash::Md5(paths[i].GetChars(), paths[i].GetLength()));
+    catalog::DirectoryEntry *dirent = &(*dirents)[i];
+    if (mount_point_->md5path_cache()->Lookup(md5paths[i], dirent)) {
+      if (dirent->GetSpecial() == catalog::kDirentNegative)
+        continue;
+      if (!file_system_->IsNfsSource() && (live_inodes[i] != 0))
+        dirent->set_inode(live_inodes[i]);
+      (*found)[i] = true;
+      continue;
+    }
+    misses.push_back(i);
+  }
+  if (misses.empty())
+    return;
+
+  vector<PathString> miss_paths;
+  miss_paths.reserve(misses.size());
+  for (unsigned i = 0; i < misses.size(); ++i)
+    miss_paths.push_back(paths[misses[i]]);
+  vector<catalog::DirectoryEntry> miss_dirents;
+  vector<bool> miss_found;
+  mount_point_->catalog_mgr()->LookupPaths(miss_paths, &miss_dirents,
+                                           &miss_found);
+
+  for (unsigned i = 0; i < misses.size(); ++i) {
+    const unsigned idx = misses[i];
+    catalog::DirectoryEntry *dirent = &(*dirents)[idx];
+    *dirent = miss_dirents[i];
+    if (!miss_found[i]) {
+      if (dirent->GetSpecial() == catalog::kDirentNegative)
+        mount_point_->md5path_cache()->InsertNegative(md5paths[idx]);
+      continue;
+    }
+    if (file_system_->IsNfsSource()) {
+      dirent->set_inode(file_system_->nfs_maps()->GetInode(paths[idx]));
+    } else {
+      if (live_inodes[idx] != 0)
+        dirent->set_inode(live_inodes[idx]);
+    }
+    mount_point_->md5path_cache()->Insert(md5paths[idx], *dirent);
+    (*found)[idx] = true;
+  }
+}
+
+
 static bool GetPathForInode(const fuse_ino_t ino, PathString *path) {
   // Check the path cache first
   if (mount_point_->path_cache()->Lookup(ino, path))
@@ -645,6 +794,42 @@ static void cvmfs_opendir(fuse_req_t req, fuse_ino_t ino,
   LogCvmfs(kLogCvmfs, kLogDebug, "cvmfs_opendir on inode: %" PRIu64 ", path %s",
            uint64_t(ino), path.c_str());
 
+  if (streaming_readdir_) {
+    DirectoryCursor cursor;
+    cursor.path = path;
+    cursor.info_self = d.GetStatStructure();
+    uint64_t catalog_size;
+    cursor.revision = catalog_mgr->GetRevision();
+    if (!catalog_mgr->LookupNested(path, &cursor.catalog_mountpoint,
+                                   &cursor.catalog_hash, &catalog_size))
+    {
+      cursor.catalog_hash = shash::Any();
+    }
+    catalog::DirectoryEntry p;
+    if (d.inode() != catalog_mgr->GetRootInode() &&
+        GetDirentForPath(GetParentPath(path), &p))
+    {
+      cursor.info_parent = p.GetStatStructure();
+      cursor.has_parent = true;
+    }
+    fuse_remounter_->fence()->Leave();
+
+    {
+      MutexLockGuard m(&lock_directory_handles_);
+      LogCvmfs(kLogCvmfs, kLogDebug,
+               "linking directory cursor %d to dir inode: %" PRIu64,
+               next_directory_handle_, uint64_t(ino));
+      (*directory_cursors_)[next_directory_handle_] = cursor;
+      fi->fh = next_directory_handle_;
+      ++next_directory_handle_;
+    }
+    perf::Inc(file_system_->n_fs_dir_open());
+    perf::Inc(file_system_->no_open_dirs());
+
+    fuse_reply_open(req, fi);
+    return;
+  }
+
   // Build listing
   BigVector<char> fuse_listing(512);
 
@@ -672,25 +857,31 @@ static void cvmfs_opendir(fuse_req_t req, fuse_ino_t ino,
     fuse_reply_err(req, EIO);
     return;
   }
-  for (unsigned i = 0; i < listing_from_catalog.size(); ++i) {
+  const unsigned num_entries = listing_from_catalog.size();
+  for (unsigned begin = 0; begin < num_entries; begin += kLookupBatchSize) {
+    const unsigned end = std::min(begin + kLookupBatchSize, num_entries);
     // Fix inodes
-    PathString entry_path;
-    entry_path.Assign(path);
-    entry_path.Append("/", 1);
-    entry_path.Append(listing_from_catalog.AtPtr(i)->name.GetChars(),
-                      listing_from_catalog.AtPtr(i)->name.GetLength());
-
-    catalog::DirectoryEntry entry_dirent;
-    if (!GetDirentForPath(entry_path, &entry_dirent)) {
-      LogCvmfs(kLogCvmfs, kLogDebug, "listing entry %s vanished, skipping",
-               entry_path.c_str());
-      continue;
+    vector<PathString> entry_paths;
+    for (unsigned i = begin; i < end; ++i) {
+      entry_paths.push_back(
+        GetEntryPath(path, listing_from_catalog.AtPtr(i)->name));
     }
+    vector<catalog::DirectoryEntry> entry_dirents;
+    vector<bool> entry_found;
+    GetDirentsForPaths(entry_paths, &entry_dirents, &entry_found);
+
+    for (unsigned i = begin; i < end; ++i) {
+      if (!entry_found[i - begin]) {
+        LogCvmfs(kLogCvmfs, kLogDebug, "listing entry %s vanished, skipping",
+                 entry_paths[i - begin].c_str());
+        continue;
+      }
 
-    struct stat fixed_info = listing_from_catalog.AtPtr(i)->info;
-    fixed_info.st_ino = entry_dirent.inode();
-    AddToDirListing(req, listing_from_catalog.AtPtr(i)->name.c_str(),
-                    &fixed_info, &fuse_listing);
+      struct stat fixed_info = listing_from_catalog.AtPtr(i)->info;
+      fixed_info.st_ino = entry_dirents[i - begin].inode();
+      AddToDirListing(req, listing_from_catalog.AtPtr(i)->name.c_str(),
+                      &fixed_info, &fuse_listing);
+    }
   }
   fuse_remounter_->fence()->Leave();
 
@@ -741,6 +932,14 @@ static void cvmfs_releasedir(fuse_req_t req, fuse_ino_t ino,
         free(iter_handle->second.buffer);
       directory_handles_->erase(iter_handle);
       perf::Dec(file_system_->no_open_dirs());
+    } else if (directory_cursors_->erase(fi->fh) > 0) {
+      PinnedDirCatalogs::iterator iter_pinned =
+        pinned_dir_catalogs_->find(fi->fh);
+      if (iter_pinned != pinned_dir_catalogs_->end()) {
+        delete iter_pinned->second;
+        pinned_dir_catalogs_->erase(iter_pinned);
+      }
+      perf::Dec(file_system_->no_open_dirs());
     } else {
       reply = EINVAL;
     }
@@ -766,6 +965,173 @@ static void ReplyBufferSlice(const fuse_req_t req, const char *buffer,
 }
 
 
+/**
+ * Adds a directory entry to a reply buffer of a streaming listing.  Returns
+ * false if the entry does not fit anymore.
+ */
+static bool AddToDirSlice(const fuse_req_t req,
+                          const char *name, const struct stat *stat_info,
+                          const off_t next_off,
+                          char *buffer, const size_t size, size_t *pos)
+{
+  const size_t entry_size = fuse_add_direntry(req, NULL, 0, name, stat_info, 0);
+  if (*pos + entry_size > size)
+    return false;
+  fuse_add_direntry(req, buffer + *pos, size - *pos, name, stat_info,
+                    next_off);
+  *pos += entry_size;
+  return true;
+}
+
+
+/**
+ * Returns the private copy of the catalog that held the directory on opendir if
+ * a remount replaced that catalog since.  The copy is opened on first use and
+ * kept until the directory is released.  Returns NULL if the mounted catalog
+ * serves the cursor; sets failed if the private copy cannot be opened.  Needs
+ * to be called inside the remount fence.
+ */
+static catalog::Catalog *GetDirCursorCatalog(const uint64_t handle,
+                                             const DirectoryCursor &cursor,
+                                             bool *failed)
+{
+  *failed = false;
+  if (cursor.catalog_hash.IsNull())
+    return NULL;
+  {
+    MutexLockGuard m(&lock_directory_handles_);
+    PinnedDirCatalogs::const_iterator iter = pinned_dir_catalogs_->find(handle);
+    if (iter != pinned_dir_catalogs_->end())
+      return iter->second;
+  }
+
+  catalog::ClientCatalogManager *catalog_mgr = mount_point_->catalog_mgr();
+  const uint64_t revision = catalog_mgr->GetRevision();
+  if (revision == cursor.revision)
+    return NULL;
+  PathString mountpoint;
+  shash::Any hash;
+  uint64_t size;
+  if (catalog_mgr->LookupNested(cursor.path, &mountpoint, &hash, &size) &&
+      (hash == cursor.catalog_hash))
+  {
+    // Unchanged catalog, no need to check again until the next remount
+    MutexLockGuard m(&lock_directory_handles_);
+    DirectoryCursors::iterator iter = directory_cursors_->find(handle);
+    if (iter != directory_cursors_->end())
+      iter->second.revision = revision;
+    return NULL;
+  }
+
+  LogCvmfs(kLogCvmfs, kLogDebug, "catalog of directory cursor %s replaced, "
+           "continuing on catalog %s", cursor.path.c_str(),
+           cursor.catalog_hash.ToString().c_str());
+  catalog::Catalog *catalog = catalog_mgr->OpenDetachedCatalog(
+    cursor.catalog_mountpoint, cursor.catalog_hash);
+  if (catalog == NULL) {
+    *failed = true;
+    return NULL;
+  }
+  MutexLockGuard m(&lock_directory_handles_);
+  PinnedDirCatalogs::const_iterator iter = pinned_dir_catalogs_->find(handle);
+  if (iter != pinned_dir_catalogs_->end()) {
+    delete catalog;
+    return iter->second;
+  }
+  (*pinned_dir_catalogs_)[handle] = catalog;
+  return catalog;
+}
+
+
+/**
+ * Fills up to size bytes of a streaming listing, starting after the entry with
+ * the kernel offset off.  Directory entries are looked up from the catalog in
+ * slices of kDirCursorSliceSize.
+ */
+static void ReplyDirCursorSlice(const fuse_req_t req,
+                                const uint64_t handle,
+                                const DirectoryCursor &cursor,
+                                const off_t off, const size_t size)
+{
+  const struct fuse_ctx *fuse_ctx = fuse_req_ctx(req);
+  ClientCtxGuard ctx_guard(fuse_ctx->uid, fuse_ctx->gid, fuse_ctx->pid);
+
+  char *buffer = static_cast<char *>(smalloc(size));
+  size_t pos = 0;
+  bool is_full = false;
+  if (off < 1)
+    is_full =
+      !AddToDirSlice(req, ".", &cursor.info_self, 1, buffer, size, &pos);
+  if (!is_full && (off < 2) && cursor.has_parent) {
+    is_full = !AddToDirSlice(req, "..", &cursor.info_parent, 2,
+                             buffer, size, &pos);
+  }
+
+  if (!is_full) {
+    fuse_remounter_->fence()->Enter();
+    bool failed;
+    catalog::Catalog *pinned_catalog =
+      GetDirCursorCatalog(handle, cursor, &failed);
+    uint64_t after_row_id =
+      (off > kDirCursorNumDots) ? (off - kDirCursorNumDots) : 0;
+    while (!is_full) {
+      catalog::StatEntryList listing;
+      vector<uint64_t> row_ids;
+      bool retval = !failed;
+      if (pinned_catalog != NULL) {
+        retval = pinned_catalog->ListingPathStatRange(
+          cursor.path, after_row_id, kDirCursorSliceSize, &listing, &row_ids);
+      } else if (retval) {
+        retval = mount_point_->catalog_mgr()->ListingStatRange(
+          cursor.path, after_row_id, kDirCursorSliceSize, &listing, &row_ids);
+      }
+      if (!retval) {
+        fuse_remounter_->fence()->Leave();
+        free(buffer);
+        fuse_reply_err(req, EIO);
+        return;
+      }
+
+      // Fix inodes
+      vector<PathString> entry_paths;
+      for (unsigned i = 0; i < listing.size(); ++i) {
+        entry_paths.push_back(
+          GetEntryPath(cursor.path, listing.AtPtr(i)->name));
+      }
+      vector<catalog::DirectoryEntry> entry_dirents;
+      vector<bool> entry_found;
+      GetDirentsForPaths(entry_paths, &entry_dirents, &entry_found);
+
+      for (unsigned i = 0; i < listing.size(); ++i) {
+        if (!entry_found[i]) {
+          LogCvmfs(kLogCvmfs, kLogDebug, "listing entry %s vanished, skipping",
+                   entry_paths[i].c_str());
+          after_row_id = row_ids[i];
+          continue;
+        }
+
+        struct stat fixed_info = listing.AtPtr(i)->info;
+        fixed_info.st_ino = entry_dirents[i].inode();
+        if (!AddToDirSlice(req, listing.AtPtr(i)->name.c_str(), &fixed_info,
+                           row_ids[i] + kDirCursorNumDots,
+                           buffer, size, &pos))
+        {
+          is_full = true;
+          break;
+        }
+        after_row_id = row_ids[i];
+      }
+      if (listing.size() < kDirCursorSliceSize)
+        break;
+    }
+    fuse_remounter_->fence()->Leave();
+  }
+
+  fuse_reply_buf(req, buffer, pos);
+  free(buffer);
+}
+
+
 /**
  * Read the directory listing.
  */
@@ -777,18 +1143,30 @@ static void cvmfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
            uint64_t(mount_point_->catalog_mgr()->MangleInode(ino)), size, off);
 
   DirectoryListing listing;
+  DirectoryCursor cursor;
 
-  MutexLockGuard m(&lock_directory_handles_);
-  DirectoryHandles::const_iterator iter_handle =
-    directory_handles_->find(fi->fh);
-  if (iter_handle != directory_handles_->end()) {
-    listing = iter_handle->second;
+  {
+    MutexLockGuard m(&lock_directory_handles_);
+    DirectoryHandles::const_iterator iter_handle =
+      directory_handles_->find(fi->fh);
+    if (iter_handle != directory_handles_->end()) {
+      listing = iter_handle->second;
 
-    ReplyBufferSlice(req, listing.buffer, listing.size, off, size);
-    return;
+      ReplyBufferSlice(req, listing.buffer, listing.size, off, size);
+      return;
+    }
+
+    DirectoryCursors::const_iterator iter_cursor =
+      directory_cursors_->find(fi->fh);
+    if (iter_cursor == directory_cursors_->end()) {
+      fuse_reply_err(req, EINVAL);
+      return;
+    }
+    cursor = iter_cursor->second;
   }
 
-  fuse_reply_err(req, EINVAL);
+  // The catalog is queried outside the lock on the directory handles
+  ReplyDirCursorSlice(req, fi->fh, cursor, off, size);
 }
 
 
@@ -883,9 +1261,11 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
     const uint64_t unique_inode = dirent_origin.inode();
 
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    if (!chunk_tables->inode2chunks.Contains(unique_inode)) {
-      chunk_tables->Unlock();
+    ChunkTables::InodeShard *inode_shard =
+      chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    if (!inode_shard->inode2chunks.Contains(unique_inode)) {
+      inode_shard->Unlock();
 
       // Retrieve File chunks from the catalog
       UniquePtr<FileChunkList> chunks(new FileChunkList());
@@ -901,42 +1281,45 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
       }
       fuse_remounter_->fence()->Leave();
 
-      chunk_tables->Lock();
+      inode_shard->Lock();
       // Check again to avoid race
-      if (!chunk_tables->inode2chunks.Contains(unique_inode)) {
-        chunk_tables->inode2chunks.Insert(
+      if (!inode_shard->inode2chunks.Contains(unique_inode)) {
+        inode_shard->inode2chunks.Insert(
           unique_inode, FileChunkReflist(chunks.Release(), path,
                                          dirent.compression_algorithm(),
                                          dirent.IsExternalFile()));
-        chunk_tables->inode2references.Insert(unique_inode, 1);
+        inode_shard->inode2references.Insert(unique_inode, 1);
       } else {
         uint32_t refctr;
         bool retval =
-          chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+          inode_shard->inode2references.Lookup(unique_inode, &refctr);
         assert(retval);
-        chunk_tables->inode2references.Insert(unique_inode, refctr+1);
+        inode_shard->inode2references.Insert(unique_inode, refctr+1);
       }
     } else {
       fuse_remounter_->fence()->Leave();
       uint32_t refctr;
       bool retval =
-        chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+        inode_shard->inode2references.Lookup(unique_inode, &refctr);
       assert(retval);
-      chunk_tables->inode2references.Insert(unique_inode, refctr+1);
+      inode_shard->inode2references.Insert(unique_inode, refctr+1);
     }
+    inode_shard->Unlock();
 
     // Update the chunk handle list
+    const uint64_t chunk_handle = chunk_tables->NextHandle();
     LogCvmfs(kLogCvmfs, kLogDebug,
              "linking chunk handle %d to unique inode: %" PRIu64,
-             chunk_tables->next_handle, uint64_t(unique_inode));
-    chunk_tables->handle2fd.Insert(chunk_tables->next_handle, ChunkFd());
-    chunk_tables->handle2uniqino.Insert(chunk_tables->next_handle,
-                                        unique_inode);
+             chunk_handle, uint64_t(unique_inode));
+    ChunkTables::HandleShard *handle_shard =
+      chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(chunk_handle, ChunkFd());
+    handle_shard->handle2uniqino.Insert(chunk_handle, unique_inode);
+    handle_shard->Unlock();
     // The same inode can refer to different revisions of a path.  Don't cache.
     fi->keep_cache = 0;
-    fi->fh = static_cast<uint64_t>(-chunk_tables->next_handle);
-    ++chunk_tables->next_handle;
-    chunk_tables->Unlock();
+    fi->fh = static_cast<uint64_t>(-static_cast<int64_t>(chunk_handle));
 
     fuse_reply_open(req, fi);
     return;
@@ -990,6 +1373,53 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
 }
 
 
+/**
+ * Replies to a read request by handing the cache manager's backing file
+ * descriptor to libfuse, so that the kernel moves the pages from the cache file
+ * into the fuse device without a detour through a user space buffer.  Returns
+ * false if the cache manager cannot provide a backing file descriptor.  In this
+ * case, no reply has been sent and the caller needs to copy the data.
+ */
+static bool ReplyDataSplice(
+  fuse_req_t req,
+  int fd,
+  size_t size,
+  off_t off)
+{
+#if FUSE_VERSION >= 29
+  if (!splice_read_)
+    return false;
+  uint64_t backing_offset;
+  const int backing_fd =
+    file_system_->cache_mgr()->GetBackingFd(fd, &backing_offset);
+  if (backing_fd < 0)
+    return false;
+
+  struct fuse_bufvec bufvec = FUSE_BUFVEC_INIT(size);
+  bufvec.buf[0].flags =
+    static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+  bufvec.buf[0].fd = backing_fd;
+  bufvec.buf[0].pos = backing_offset + off;
+  // Short reads at the end of the file are handled by libfuse.  On errors,
+  // libfuse replies with the error code itself.  The pages are not moved so
+  // that they stay in the page cache of the cache file.
+  int retval =
+    fuse_reply_data(req, &bufvec, static_cast<fuse_buf_copy_flags>(0));
+  if (retval != 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "splice read from fd %d failed (%d)",
+             backing_fd, retval);
+    return true;
+  }
+  perf::Inc(file_system_->n_fs_read_splice());
+  LogCvmfs(kLogCvmfs, kLogDebug, "spliced %" PRIu64 " bytes from fd %d to user",
+           uint64_t(size), backing_fd);
+  return true;
+#else
+  return false;
+#endif
+}
+
+
 /**
  * Redirected to pread into cache.
  */
@@ -1002,6 +1432,14 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
            size, off, fi->fh);
   perf::Inc(file_system_->n_fs_read());
 
+  // Regular files in a cache that keeps them as plain files don't need a
+  // buffer at all
+  if ((static_cast<int64_t>(fi->fh) >= 0) &&
+      ReplyDataSplice(req, fi->fh, size, off))
+  {
+    return;
+  }
+
   // Get data chunk (<=128k guaranteed by Fuse)
   char *data = static_cast<char *>(alloca(size));
   unsigned int overall_bytes_fetched = 0;
@@ -1020,31 +1458,44 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 
     // Fetch unique inode, chunk list and file descriptor
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    ChunkTables::HandleShard *handle_shard =
+      chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    retval = handle_shard->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    handle_shard->Unlock();
     if (!retval) {
       LogCvmfs(kLogCvmfs, kLogDebug, "no unique inode, fall back to fuse ino");
       unique_inode = ino;
     }
-    retval = chunk_tables->inode2chunks.Lookup(unique_inode, &chunks);
+    ChunkTables::InodeShard *inode_shard =
+      chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    retval = inode_shard->inode2chunks.Lookup(unique_inode, &chunks);
     assert(retval);
-    chunk_tables->Unlock();
+    inode_shard->Unlock();
 
     unsigned chunk_idx = chunks.FindChunkIdx(off);
 
     // Lock chunk handle
     pthread_mutex_t *handle_lock = chunk_tables->Handle2Lock(chunk_handle);
     MutexLockGuard m(handle_lock);
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2fd.Lookup(chunk_handle, &chunk_fd);
+    handle_shard->Lock();
+    retval = handle_shard->handle2fd.Lookup(chunk_handle, &chunk_fd);
     assert(retval);
-    chunk_tables->Unlock();
+    handle_shard->Unlock();
 
     // Fetch all needed chunks and read the requested data
     off_t offset_in_chunk = off - chunks.list->AtPtr(chunk_idx)->offset();
     do {
       // Open file descriptor to chunk
       if ((chunk_fd.fd == -1) || (chunk_fd.chunk_idx != chunk_idx)) {
+        if (mount_point_->chunk_prefetcher() != NULL) {
+          mount_point_->chunk_prefetcher()->OnChunkSwitch(
+            chunks, chunk_fd, chunk_idx,
+            mount_point_->catalog_mgr()->volatile_flag()
+              ? CacheManager::kTypeVolatile
+              : CacheManager::kTypeRegular);
+        }
         if (chunk_fd.fd != -1) file_system_->cache_mgr()->Close(chunk_fd.fd);
         string verbose_path = "Part of " + chunks.path.ToString();
         if (chunks.external_data) {
@@ -1070,9 +1521,9 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         }
         if (chunk_fd.fd < 0) {
           chunk_fd.fd = -1;
-          chunk_tables->Lock();
-          chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-          chunk_tables->Unlock();
+          handle_shard->Lock();
+          handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+          handle_shard->Unlock();
           fuse_reply_err(req, EIO);
           return;
         }
@@ -1096,9 +1547,9 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
       if (bytes_fetched < 0) {
         LogCvmfs(kLogCvmfs, kLogSyslogErr, "read err no %" PRId64 " (%s)",
                  bytes_fetched, chunks.path.ToString().c_str());
-        chunk_tables->Lock();
-        chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-        chunk_tables->Unlock();
+        handle_shard->Lock();
+        handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+        handle_shard->Unlock();
         fuse_reply_err(req, -bytes_fetched);
         return;
       }
@@ -1111,9 +1562,9 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
              (chunk_idx < chunks.list->size()));
 
     // Update chunk file descriptor
-    chunk_tables->Lock();
-    chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
-    chunk_tables->Unlock();
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(chunk_handle, chunk_fd);
+    handle_shard->Unlock();
     LogCvmfs(kLogCvmfs, kLogDebug, "released chunk file descriptor %d",
              chunk_fd.fd);
   } else {
@@ -1157,34 +1608,40 @@ static void cvmfs_release(fuse_req_t req, fuse_ino_t ino,
     bool retval;
 
     ChunkTables *chunk_tables = mount_point_->chunk_tables();
-    chunk_tables->Lock();
-    retval = chunk_tables->handle2uniqino.Lookup(chunk_handle, &unique_inode);
+    ChunkTables::HandleShard *handle_shard =
+      chunk_tables->Handle2Shard(chunk_handle);
+    handle_shard->Lock();
+    retval = handle_shard->handle2uniqino.Lookup(chunk_handle, &unique_inode);
     if (!retval) {
       LogCvmfs(kLogCvmfs, kLogDebug, "no unique inode, fall back to fuse ino");
       unique_inode = ino;
     } else {
-      chunk_tables->handle2uniqino.Erase(chunk_handle);
+      handle_shard->handle2uniqino.Erase(chunk_handle);
     }
-    retval = chunk_tables->handle2fd.Lookup(chunk_handle, &chunk_fd);
+    retval = handle_shard->handle2fd.Lookup(chunk_handle, &chunk_fd);
     assert(retval);
-    chunk_tables->handle2fd.Erase(chunk_handle);
+    handle_shard->handle2fd.Erase(chunk_handle);
+    handle_shard->Unlock();
 
-    retval = chunk_tables->inode2references.Lookup(unique_inode, &refctr);
+    ChunkTables::InodeShard *inode_shard =
+      chunk_tables->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    retval = inode_shard->inode2references.Lookup(unique_inode, &refctr);
     assert(retval);
     refctr--;
     if (refctr == 0) {
       LogCvmfs(kLogCvmfs, kLogDebug, "releasing chunk list for inode %" PRIu64,
                uint64_t(unique_inode));
       FileChunkReflist to_delete;
-      retval = chunk_tables->inode2chunks.Lookup(unique_inode, &to_delete);
+      retval = inode_shard->inode2chunks.Lookup(unique_inode, &to_delete);
       assert(retval);
-      chunk_tables->inode2references.Erase(unique_inode);
-      chunk_tables->inode2chunks.Erase(unique_inode);
+      inode_shard->inode2references.Erase(unique_inode);
+      inode_shard->inode2chunks.Erase(unique_inode);
       delete to_delete.list;
     } else {
-      chunk_tables->inode2references.Insert(unique_inode, refctr);
+      inode_shard->inode2references.Insert(unique_inode, refctr);
     }
-    chunk_tables->Unlock();
+    inode_shard->Unlock();
 
     if (chunk_fd.fd != -1)
       file_system_->cache_mgr()->Close(chunk_fd.fd);
@@ -1692,6 +2149,13 @@ static void cvmfs_init(void *userdata, struct fuse_conn_info *conn) {
 #ifdef CVMFS_NFS_SUPPORT
   conn->want |= FUSE_CAP_EXPORT_SUPPORT;
 #endif
+
+#ifdef FUSE_CAP_SPLICE_WRITE
+  // Let the kernel move file pages from the cache into the fuse device,
+  // used by ReplyDataSplice()
+  if (cvmfs::splice_read_ && (conn->capable & FUSE_CAP_SPLICE_WRITE))
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+#endif
 }
 
 static void cvmfs_destroy(void *unused __attribute__((unused))) {
@@ -1834,6 +2298,12 @@ static int Init(const loader::LoaderExports *loader_exports) {
   cvmfs::directory_handles_ = new cvmfs::DirectoryHandles();
   cvmfs::directory_handles_->set_empty_key((uint64_t)(-1));
   cvmfs::directory_handles_->set_deleted_key((uint64_t)(-2));
+  cvmfs::directory_cursors_ = new cvmfs::DirectoryCursors();
+  cvmfs::directory_cursors_->set_empty_key((uint64_t)(-1));
+  cvmfs::directory_cursors_->set_deleted_key((uint64_t)(-2));
+  cvmfs::pinned_dir_catalogs_ = new cvmfs::PinnedDirCatalogs();
+  cvmfs::pinned_dir_catalogs_->set_empty_key((uint64_t)(-1));
+  cvmfs::pinned_dir_catalogs_->set_deleted_key((uint64_t)(-2));
 
   LogCvmfs(kLogCvmfs, kLogDebug, "fuse inode size is %d bits",
            sizeof(fuse_ino_t) * 8);
@@ -1858,6 +2328,16 @@ static int Init(const loader::LoaderExports *loader_exports) {
       fuse_notify_invalidation = false;
     }
   }
+  if (cvmfs::options_mgr_->GetValue("CVMFS_FUSE_SPLICE_READ", &buf)) {
+    if (!cvmfs::options_mgr_->IsOn(buf)) {
+      cvmfs::splice_read_ = false;
+    }
+  }
+  if (cvmfs::options_mgr_->GetValue("CVMFS_STREAMING_READDIR", &buf) &&
+      cvmfs::options_mgr_->IsOn(buf))
+  {
+    cvmfs::streaming_readdir_ = true;
+  }
   cvmfs::fuse_remounter_ =
       new FuseRemounter(cvmfs::mount_point_, &cvmfs::inode_generation_info_,
                         channel_or_session, fuse_notify_invalidation);
@@ -1934,6 +2414,9 @@ static void Spawn() {
       cvmfs::mount_point_->uuid()->uuid() + "-unpin");
   }
   cvmfs::mount_point_->tracer()->Spawn();
+  cvmfs::mount_point_->catalog_mgr()->Spawn();
+  if (cvmfs::mount_point_->chunk_prefetcher() != NULL)
+    cvmfs::mount_point_->chunk_prefetcher()->Spawn();
   cvmfs::talk_mgr_->Spawn();
 
   if (cvmfs::notification_client_ != NULL) {
@@ -1977,10 +2460,23 @@ static void Fini() {
   }
 
   delete cvmfs::directory_handles_;
+  delete cvmfs::directory_cursors_;
+  // The private catalogs use the cache manager of the mount point
+  if (cvmfs::pinned_dir_catalogs_ != NULL) {
+    for (cvmfs::PinnedDirCatalogs::iterator
+         i = cvmfs::pinned_dir_catalogs_->begin(),
+         iEnd = cvmfs::pinned_dir_catalogs_->end(); i != iEnd; ++i)
+    {
+      delete i->second;
+    }
+  }
+  delete cvmfs::pinned_dir_catalogs_;
   delete cvmfs::mount_point_;
   delete cvmfs::file_system_;
   delete cvmfs::options_mgr_;
   cvmfs::directory_handles_ = NULL;
+  cvmfs::directory_cursors_ = NULL;
+  cvmfs::pinned_dir_catalogs_ = NULL;
   cvmfs::mount_point_ = NULL;
   cvmfs::file_system_ = NULL;
   cvmfs::options_mgr_ = NULL;
@@ -2046,6 +2542,20 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
     saved_states->push_back(save_open_dirs);
   }
 
+  unsigned num_open_cursors = cvmfs::directory_cursors_->size();
+  if (num_open_cursors != 0) {
+    msg_progress = "Saving open directory cursors (" +
+      StringifyInt(num_open_cursors) + " cursors)\n";
+    SendMsg2Socket(fd_progress, msg_progress);
+
+    cvmfs::DirectoryCursors *saved_cursors =
+      new cvmfs::DirectoryCursors(*cvmfs::directory_cursors_);
+    loader::SavedState *save_open_cursors = new loader::SavedState();
+    save_open_cursors->state_id = loader::kStateOpenDirCursors;
+    save_open_cursors->state = saved_cursors;
+    saved_states->push_back(save_open_cursors);
+  }
+
   if (!cvmfs::file_system_->IsNfsSource()) {
     msg_progress = "Saving inode tracker\n";
     SendMsg2Socket(fd_progress, msg_progress);
@@ -2062,7 +2572,7 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
   ChunkTables *saved_chunk_tables = new ChunkTables(
     *cvmfs::mount_point_->chunk_tables());
   loader::SavedState *state_chunk_tables = new loader::SavedState();
-  state_chunk_tables->state_id = loader::kStateOpenChunksV4;
+  state_chunk_tables->state_id = loader::kStateOpenChunksV5;
   state_chunk_tables->state = saved_chunk_tables;
   saved_states->push_back(state_chunk_tables);
 
@@ -2108,7 +2618,7 @@ static bool RestoreState(const int fd_progress,
         (cvmfs::DirectoryHandles *)saved_states[i]->state;
       cvmfs::directory_handles_ = new cvmfs::DirectoryHandles(*saved_handles);
       cvmfs::file_system_->no_open_dirs()->Set(
-        cvmfs::directory_handles_->size());
+        cvmfs::directory_handles_->size() + cvmfs::directory_cursors_->size());
       cvmfs::DirectoryHandles::const_iterator i =
         cvmfs::directory_handles_->begin();
       for (; i != cvmfs::directory_handles_->end(); ++i) {
@@ -2120,6 +2630,25 @@ static bool RestoreState(const int fd_progress,
         StringifyInt(cvmfs::directory_handles_->size()) + " handles\n");
     }
 
+    if (saved_states[i]->state_id == loader::kStateOpenDirCursors) {
+      SendMsg2Socket(fd_progress, "Restoring open directory cursors... ");
+      delete cvmfs::directory_cursors_;
+      cvmfs::DirectoryCursors *saved_cursors =
+        (cvmfs::DirectoryCursors *)saved_states[i]->state;
+      cvmfs::directory_cursors_ = new cvmfs::DirectoryCursors(*saved_cursors);
+      cvmfs::file_system_->no_open_dirs()->Xadd(
+        cvmfs::directory_cursors_->size());
+      cvmfs::DirectoryCursors::const_iterator i =
+        cvmfs::directory_cursors_->begin();
+      for (; i != cvmfs::directory_cursors_->end(); ++i) {
+        if (i->first >= cvmfs::next_directory_handle_)
+          cvmfs::next_directory_handle_ = i->first + 1;
+      }
+
+      SendMsg2Socket(fd_progress,
+        StringifyInt(cvmfs::directory_cursors_->size()) + " cursors\n");
+    }
+
     if (saved_states[i]->state_id == loader::kStateGlueBuffer) {
       SendMsg2Socket(fd_progress, "Migrating inode tracker (v1 to v4)... ");
       compat::inode_tracker::InodeTracker *saved_inode_tracker =
@@ -2160,33 +2689,42 @@ static bool RestoreState(const int fd_progress,
     ChunkTables *chunk_tables = cvmfs::mount_point_->chunk_tables();
 
     if (saved_states[i]->state_id == loader::kStateOpenChunks) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v1 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v1 to v5)... ");
       compat::chunk_tables::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->GetNumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV2) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v2 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v2 to v5)... ");
       compat::chunk_tables_v2::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables_v2::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables_v2::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->GetNumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV3) {
-      SendMsg2Socket(fd_progress, "Migrating chunk tables (v3 to v4)... ");
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v3 to v5)... ");
       compat::chunk_tables_v3::ChunkTables *saved_chunk_tables =
         (compat::chunk_tables_v3::ChunkTables *)saved_states[i]->state;
       compat::chunk_tables_v3::Migrate(saved_chunk_tables, chunk_tables);
       SendMsg2Socket(fd_progress,
-        StringifyInt(chunk_tables->handle2fd.size()) + " handles\n");
+        StringifyInt(chunk_tables->GetNumHandles()) + " handles\n");
     }
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV4) {
+      SendMsg2Socket(fd_progress, "Migrating chunk tables (v4 to v5)... ");
+      compat::chunk_tables_v4::ChunkTables *saved_chunk_tables =
+        (compat::chunk_tables_v4::ChunkTables *)saved_states[i]->state;
+      compat::chunk_tables_v4::Migrate(saved_chunk_tables, chunk_tables);
+      SendMsg2Socket(fd_progress,
+        StringifyInt(chunk_tables->GetNumHandles()) + " handles\n");
+    }
+
+    if (saved_states[i]->state_id == loader::kStateOpenChunksV5) {
       SendMsg2Socket(fd_progress, "Restoring chunk tables... ");
       chunk_tables->~ChunkTables();
       ChunkTables *saved_chunk_tables = reinterpret_cast<ChunkTables *>(
@@ -2243,6 +2781,10 @@ static void FreeSavedState(const int fd_progress,
         SendMsg2Socket(fd_progress, "Releasing saved open directory handles\n");
         delete static_cast<cvmfs::DirectoryHandles *>(saved_states[i]->state);
         break;
+      case loader::kStateOpenDirCursors:
+        SendMsg2Socket(fd_progress, "Releasing saved open directory cursors\n");
+        delete static_cast<cvmfs::DirectoryCursors *>(saved_states[i]->state);
+        break;
       case loader::kStateGlueBuffer:
         SendMsg2Socket(
           fd_progress, "Releasing saved glue buffer (version 1)\n");
@@ -2281,6 +2823,11 @@ static void FreeSavedState(const int fd_progress,
           saved_states[i]->state);
         break;
       case loader::kStateOpenChunksV4:
+        SendMsg2Socket(fd_progress, "Releasing chunk tables (version 4)\n");
+        delete static_cast<compat::chunk_tables_v4::ChunkTables *>(
+          saved_states[i]->state);
+        break;
+      case loader::kStateOpenChunksV5:
         SendMsg2Socket(fd_progress, "Releasing chunk tables\n");
         delete static_cast<ChunkTables *>(saved_states[i]->state);
         break;
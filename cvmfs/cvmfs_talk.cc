@@ -157,6 +157,7 @@ static void Usage(const std::string &exe) {
     "  cache list catalogs    gets all file catalogs in cache          \n"
     "  cleanup <MB>           cleans file cache until size <= <MB>     \n"
     "  cleanup rate <period>  n.o. cleanups in the last <period> min   \n"
+    "  cleanup status         background cleanup watermark and backlog \n"
     "  evict <path>           removes <path> from the cache            \n"
     "  pin <path>             pins <path> in the cache                 \n"
     "  mountpoint             returns the mount point                  \n"
@@ -181,6 +182,8 @@ static void Usage(const std::string &exe) {
     "  proxy set <proxy list> sets a new chain of load-balance proxy   \n"
     "                         groups (not including fallback proxies)  \n"
     "  proxy fallback <list>  sets a new list of fallback proxies      \n"
+    "  endpoint scores        gets the measured latency and throughput \n"
+    "                         of proxies and hosts                     \n"
     "  external host info     gets info about external host chain      \n"
     "  external host switch   switches to the next external host       \n"
     "  external host set                                               \n"
@@ -188,6 +191,8 @@ static void Usage(const std::string &exe) {
     "  external proxy info    gets info about external proxy groups    \n"
     "  external proxy set                                              \n"
     "       <proxy list>      sets chain of external proxy groups      \n"
+    "  external endpoint scores                                        \n"
+    "                         gets scores of external proxies and hosts\n"
     "  timeout info           gets the network timeouts                \n"
     "  timeout set                                                     \n"
     "       <proxy> <direct>  sets the network timeouts in seconds     \n"
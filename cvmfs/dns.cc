@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <poll.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -34,9 +35,12 @@
 #include <cstring>
 
 #include "logging.h"
+#include "platform.h"
 #include "sanitizer.h"
 #include "smalloc.h"
+#include "util/posix.h"
 #include "util/string.h"
+#include "util_concurrency.h"
 
 using namespace std;  // NOLINT
 
@@ -287,6 +291,206 @@ bool Host::IsValid() const {
 //------------------------------------------------------------------------------
 
 
+static string JoinAddresses(const set<string> &addresses) {
+  if (addresses.empty())
+    return "-";
+  string result;
+  for (set<string>::const_iterator i = addresses.begin(),
+       iEnd = addresses.end(); i != iEnd; ++i)
+  {
+    if (!result.empty())
+      result += ",";
+    result += *i;
+  }
+  return result;
+}
+
+
+static set<string> SplitAddresses(const string &addresses) {
+  set<string> result;
+  if (addresses == "-")
+    return result;
+  vector<string> tokens = SplitString(addresses, ',');
+  for (unsigned i = 0; i < tokens.size(); ++i) {
+    if (!tokens[i].empty())
+      result.insert(tokens[i]);
+  }
+  return result;
+}
+
+
+/**
+ * Returns NULL if the directory of the cache file does not exist.  A missing
+ * or unreadable cache file is not an error, it starts out empty.
+ */
+HostCache *HostCache::Create(const string &path) {
+  if (!DirectoryExists(GetParentPath(path))) {
+    LogCvmfs(kLogDns, kLogDebug, "cannot place DNS cache at %s", path.c_str());
+    return NULL;
+  }
+  HostCache *cache = new HostCache(path);
+  MutexLockGuard m(&cache->lock_);
+  cache->ReadUnlocked();
+  return cache;
+}
+
+
+HostCache::HostCache(const string &path)
+  : path_(path)
+  , file_inode_(0)
+  , file_mtime_(0)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+HostCache::~HostCache() {
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Returns the cached entry for the name, possibly expired, as a new Host
+ * object.
+ */
+bool HostCache::Lookup(const string &name, Host *host) {
+  MutexLockGuard m(&lock_);
+  ReadUnlocked();
+  map<string, Host>::const_iterator iter = entries_.find(name);
+  if (iter == entries_.end())
+    return false;
+
+  Host result;
+  result.name_ = iter->second.name_;
+  result.deadline_ = iter->second.deadline_;
+  result.ipv4_addresses_ = iter->second.ipv4_addresses_;
+  result.ipv6_addresses_ = iter->second.ipv6_addresses_;
+  result.status_ = kFailOk;
+  *host = result;
+  return true;
+}
+
+
+/**
+ * Merges the successfully resolved hosts into the cache file.  The names are
+ * the ones given to the resolver.
+ */
+void HostCache::Store(const vector<string> &names, const vector<Host> &hosts) {
+  assert(names.size() == hosts.size());
+  MutexLockGuard m(&lock_);
+  ReadUnlocked();
+  bool changed = false;
+  for (unsigned i = 0; i < names.size(); ++i) {
+    if (names[i].empty() || (hosts[i].status() != kFailOk))
+      continue;
+    entries_[names[i]] = hosts[i];
+    changed = true;
+  }
+  if (changed)
+    WriteUnlocked();
+}
+
+
+/**
+ * Merges the file into the entries in memory if another process or another
+ * HostCache object replaced it since the last read.  For names known to both,
+ * the later deadline wins.
+ */
+void HostCache::ReadUnlocked() {
+  platform_stat64 info;
+  if (platform_stat(path_.c_str(), &info) != 0)
+    return;
+  if ((static_cast<uint64_t>(info.st_ino) == file_inode_) &&
+      (info.st_mtime == file_mtime_))
+  {
+    return;
+  }
+  FILE *f = fopen(path_.c_str(), "r");
+  if (f == NULL)
+    return;
+  file_inode_ = info.st_ino;
+  file_mtime_ = info.st_mtime;
+
+  string line;
+  while (GetLineFile(f, &line)) {
+    vector<string> fields = SplitString(line, ' ');
+    if (fields.size() != 5)
+      continue;
+    Host host;
+    host.name_ = fields[1];
+    host.deadline_ = String2Int64(fields[2]);
+    host.ipv4_addresses_ = SplitAddresses(fields[3]);
+    host.ipv6_addresses_ = SplitAddresses(fields[4]);
+    host.status_ = kFailOk;
+    if (fields[0].empty() || host.name_.empty() ||
+        (host.ipv4_addresses_.empty() && host.ipv6_addresses_.empty()))
+    {
+      continue;
+    }
+    map<string, Host>::const_iterator iter = entries_.find(fields[0]);
+    if ((iter == entries_.end()) || (iter->second.deadline_ < host.deadline_))
+      entries_[fields[0]] = host;
+  }
+  fclose(f);
+}
+
+
+/**
+ * Drops the entries with the earliest deadlines beyond kMaxEntries and
+ * replaces the cache file.
+ */
+bool HostCache::WriteUnlocked() {
+  while (entries_.size() > kMaxEntries) {
+    map<string, Host>::iterator oldest = entries_.begin();
+    for (map<string, Host>::iterator i = entries_.begin(),
+         iEnd = entries_.end(); i != iEnd; ++i)
+    {
+      if (i->second.deadline_ < oldest->second.deadline_)
+        oldest = i;
+    }
+    entries_.erase(oldest);
+  }
+
+  string tmp_path;
+  FILE *f = CreateTempFile(path_ + ".tmp", 0644, "w", &tmp_path);
+  if (f == NULL) {
+    LogCvmfs(kLogDns, kLogDebug, "failed to write DNS cache %s (%d)",
+             path_.c_str(), errno);
+    return false;
+  }
+  bool retval = true;
+  for (map<string, Host>::const_iterator i = entries_.begin(),
+       iEnd = entries_.end(); i != iEnd; ++i)
+  {
+    const string line = i->first + " " + i->second.name_ + " " +
+      StringifyInt(i->second.deadline_) + " " +
+      JoinAddresses(i->second.ipv4_addresses_) + " " +
+      JoinAddresses(i->second.ipv6_addresses_) + "\n";
+    if (fputs(line.c_str(), f) == EOF)
+      retval = false;
+  }
+  if (fclose(f) != 0)
+    retval = false;
+  if (!retval || (rename(tmp_path.c_str(), path_.c_str()) != 0)) {
+    LogCvmfs(kLogDns, kLogDebug, "failed to write DNS cache %s (%d)",
+             path_.c_str(), errno);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  platform_stat64 info;
+  if (platform_stat(path_.c_str(), &info) == 0) {
+    file_inode_ = info.st_ino;
+    file_mtime_ = info.st_mtime;
+  }
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+
+
 /**
  * Basic input validation to ensure that this could syntactically represent a
  * valid IPv4 address.
@@ -332,6 +536,8 @@ Resolver::Resolver(
   , throttle_(0)
   , min_ttl_(kDefaultMinTtl)
   , max_ttl_(kDefaultMaxTtl)
+  , cache_(NULL)
+  , max_stale_(0)
 {
   prng_.InitLocaltime();
 }
@@ -364,6 +570,7 @@ void Resolver::ResolveMany(const vector<string> &names, vector<Host> *hosts) {
   vector<unsigned> ttls(num);
   vector<string> fqdns(num);
   vector<bool> skip(num);
+  Host cached_host;
 
   // Deal with special names: empty, IPv4, IPv6
   for (unsigned i = 0; i < num; ++i) {
@@ -395,6 +602,9 @@ void Resolver::ResolveMany(const vector<string> &names, vector<Host> *hosts) {
       ipv6_host.deadline_ = time(NULL) + max_ttl_;
       hosts->push_back(ipv6_host);
       skip[i] = true;
+    } else if (LookupCache(names[i], &cached_host)) {
+      hosts->push_back(cached_host);
+      skip[i] = true;
     } else {
       hosts->push_back(Host());
       skip[i] = false;
@@ -479,6 +689,38 @@ void Resolver::ResolveMany(const vector<string> &names, vector<Host> *hosts) {
 
     (*hosts)[i] = host;
   }
+
+  if (cache_ != NULL) {
+    vector<string> resolved_names;
+    vector<Host> resolved_hosts;
+    for (unsigned i = 0; i < num; ++i) {
+      if (!skip[i] && ((*hosts)[i].status() == kFailOk)) {
+        resolved_names.push_back(names[i]);
+        resolved_hosts.push_back((*hosts)[i]);
+      }
+    }
+    if (!resolved_names.empty())
+      cache_->Store(resolved_names, resolved_hosts);
+  }
+}
+
+
+/**
+ * Names are taken from the cache until their deadline, and up to max_stale_
+ * seconds beyond.
+ */
+bool Resolver::LookupCache(const string &name, Host *host) {
+  if ((cache_ == NULL) || !cache_->Lookup(name, host))
+    return false;
+  if (host->deadline_ + static_cast<time_t>(max_stale_) < time(NULL))
+    return false;
+  if (ipv4_only_)
+    host->ipv6_addresses_.clear();
+  if (host->ipv4_addresses_.empty() && host->ipv6_addresses_.empty())
+    return false;
+  LogCvmfs(kLogDns, kLogDebug, "%s from cache%s", name.c_str(),
+           host->IsExpired() ? " (stale)" : "");
+  return true;
 }
 
 
@@ -5,6 +5,7 @@
 #ifndef CVMFS_DNS_H_
 #define CVMFS_DNS_H_
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include <cstdio>
@@ -94,6 +95,7 @@ class Host {
   FRIEND_TEST(T_Dns, HostExtendDeadline);
   FRIEND_TEST(T_Dns, HostBestAddresses);
   friend class Resolver;
+  friend class HostCache;
 
  public:
   static Host ExtendDeadline(const Host &original, unsigned seconds_from_now);
@@ -163,6 +165,44 @@ class Host {
 };
 
 
+/**
+ * Keeps successfully resolved names in a file, typically in the cache
+ * directory, so that they survive remounts and are shared by the repositories
+ * of a shared cache.  Every line reads
+ *   <name> <fully qualified name> <deadline> <IPv4 list> <IPv6 list>
+ * with comma-separated address lists or "-" for an empty list.  The file is
+ * replaced atomically by a renamed temporary file; concurrent writers can
+ * lose each other's updates but never corrupt the file.  Expired entries are
+ * kept for stale use until the file grows beyond kMaxEntries.  Thread-safe.
+ */
+class HostCache : SingleCopy {
+ public:
+  static const unsigned kMaxEntries = 1024;
+
+  static HostCache *Create(const std::string &path);
+  ~HostCache();
+  bool Lookup(const std::string &name, Host *host);
+  void Store(const std::vector<std::string> &names,
+             const std::vector<Host> &hosts);
+  const std::string &path() const { return path_; }
+
+ private:
+  explicit HostCache(const std::string &path);
+  void ReadUnlocked();
+  bool WriteUnlocked();
+
+  std::string path_;
+  /**
+   * Inode and modification time of the file when it was last read, to notice
+   * updates from other processes
+   */
+  uint64_t file_inode_;
+  time_t file_mtime_;
+  std::map<std::string, Host> entries_;
+  pthread_mutex_t lock_;
+};
+
+
 /**
  * Abstract interface of a name resolver.  Returns a Host object upon successful
  * name resolution.  Also provides a vector interface to resolve multiple names
@@ -208,6 +248,10 @@ class Resolver : SingleCopy {
   unsigned min_ttl() const { return min_ttl_; }
   void set_max_ttl(unsigned seconds) { max_ttl_ = seconds; }
   unsigned max_ttl() const { return max_ttl_; }
+  void set_cache(HostCache *cache) { cache_ = cache; }
+  HostCache *cache() const { return cache_; }
+  void set_max_stale(unsigned seconds) { max_stale_ = seconds; }
+  unsigned max_stale() const { return max_stale_; }
 
  protected:
   /**
@@ -227,6 +271,7 @@ class Resolver : SingleCopy {
                          std::vector<std::string> *fqdns) = 0;
   bool IsIpv4Address(const std::string &address);
   bool IsIpv6Address(const std::string &address);
+  bool LookupCache(const std::string &name, Host *host);
 
   /**
    * Currently active search domain list
@@ -271,6 +316,18 @@ class Resolver : SingleCopy {
    */
   unsigned max_ttl_;
 
+  /**
+   * Optional, not owned.  Names found in the cache are not resolved again
+   * before their deadline.
+   */
+  HostCache *cache_;
+
+  /**
+   * Cached names are used up to max_stale_ seconds past their deadline.  The
+   * caller is expected to refresh such expired Host objects in the background.
+   */
+  unsigned max_stale_;
+
   /**
    * Required for picking IP addresses in throttle_
    */
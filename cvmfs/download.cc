@@ -45,6 +45,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <set>
 
 #include "atomic.h"
@@ -166,6 +167,31 @@ static Failures PrepareDownloadDestination(JobInfo *info) {
 }
 
 
+static uint64_t GetTimeMs() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+
+/**
+ * Removes the partial result of a failed download.
+ */
+static void DiscardDestination(JobInfo *info) {
+  LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d - %s)",
+           info->error_code, Code2Ascii(info->error_code));
+
+  if (info->destination == kDestinationPath)
+    unlink(info->destination_path->c_str());
+
+  if (info->destination_mem.data) {
+    free(info->destination_mem.data);
+    info->destination_mem.data = NULL;
+    info->destination_mem.size = 0;
+  }
+}
+
+
 /**
  * Called by curl for every HTTP header. Not called for file:// transfers.
  */
@@ -180,12 +206,15 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
   //          header_line.c_str());
 
   // Check http status codes
-  if (HasPrefix(header_line, "HTTP/1.", false)) {
+  const bool is_http2 = HasPrefix(header_line, "HTTP/2", false);
+  if (HasPrefix(header_line, "HTTP/1.", false) || is_http2) {
     if (header_line.length() < 10)
       return 0;
 
+    // The status code follows "HTTP/1.x " or "HTTP/2 "
     unsigned i;
-    for (i = 8; (i < header_line.length()) && (header_line[i] == ' '); ++i) {}
+    for (i = is_http2 ? 6 : 8;
+         (i < header_line.length()) && (header_line[i] == ' '); ++i) {}
 
     // Code is initialized to -1
     if (header_line.length() > i+2) {
@@ -230,15 +259,23 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     }
   }
 
-  // Allocate memory for kDestinationMemory
+  // Allocate memory for kDestinationMemory.  Parts of parallel range
+  // downloads come with a preallocated buffer.
   if ((info->destination == kDestinationMem) &&
+      (info->range_parent == NULL) &&
       HasPrefix(header_line, "CONTENT-LENGTH:", true))
   {
     char *tmp = reinterpret_cast<char *>(alloca(num_bytes+1));
     uint64_t length = 0;
     sscanf(header_line.c_str(), "%s %" PRIu64, tmp, &length);
     if (length > 0) {
-      if (length > DownloadManager::kMaxMemSize) {
+      if (info->hedge_parent != NULL) {
+        // Duplicate requests take the object from the download job
+        if (length > DownloadManager::kMaxHedgeMemSize) {
+          info->error_code = kFailTooBig;
+          return 0;
+        }
+      } else if (length > DownloadManager::kMaxMemSize) {
         LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
                  "resource %s too large to store in memory (%" PRIu64 ")",
                  info->url->c_str(), length);
@@ -254,6 +291,17 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
   } else if (HasPrefix(header_line, "LOCATION:", true)) {
     // This comes along with redirects
     LogCvmfs(kLogDownload, kLogDebug, "%s", header_line.c_str());
+  } else if (info->range_parallel && (info->http_code == 206) &&
+             HasPrefix(header_line, "CONTENT-RANGE:", true))
+  {
+    // Content-Range: bytes <first>-<last>/<total>
+    uint64_t first, last, total;
+    if (sscanf(header_line.c_str() + strlen("CONTENT-RANGE:"),
+               " bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64,
+               &first, &last, &total) == 3)
+    {
+      info->range_total = total;
+    }
   }
 
   return num_bytes;
@@ -522,14 +570,19 @@ void *DownloadManager::MainDownload(void *data) {
       ReadPipe(download_mgr->pipe_jobs_[0], &info, sizeof(info));
       if (!still_running)
         gettimeofday(&timeval_start, NULL);
-      CURL *handle = download_mgr->AcquireCurlHandle();
-      download_mgr->InitializeRequest(info, handle);
-      download_mgr->SetUrlOptions(info);
-      curl_multi_add_handle(download_mgr->curl_multi_, handle);
-      retval = curl_multi_socket_action(download_mgr->curl_multi_,
-                                        CURL_SOCKET_TIMEOUT,
-                                        0,
-                                        &still_running);
+      JobBatch *batch = info->batch;
+      if ((batch != NULL) && (batch->max_in_flight_ > 0) &&
+          (batch->num_in_flight_ >= batch->max_in_flight_))
+      {
+        // Started by FinalizeBatchJob() once another job of the batch is done
+        batch->waiting_.push_back(info);
+      } else {
+        download_mgr->StartJob(info);
+        retval = curl_multi_socket_action(download_mgr->curl_multi_,
+                                          CURL_SOCKET_TIMEOUT,
+                                          0,
+                                          &still_running);
+      }
     }
 
     // Activity on curl sockets
@@ -564,6 +617,7 @@ void *DownloadManager::MainDownload(void *data) {
     // Check if transfers are completed
     CURLMsg *curl_msg;
     int msgs_in_queue;
+    bool handles_added = false;
     while ((curl_msg = curl_multi_info_read(download_mgr->curl_multi_,
                                             &msgs_in_queue)))
     {
@@ -575,21 +629,37 @@ void *DownloadManager::MainDownload(void *data) {
         curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
 
         curl_multi_remove_handle(download_mgr->curl_multi_, easy_handle);
-        if (download_mgr->VerifyAndFinalize(curl_error, info)) {
-          curl_multi_add_handle(download_mgr->curl_multi_, easy_handle);
-          retval = curl_multi_socket_action(download_mgr->curl_multi_,
-                                            CURL_SOCKET_TIMEOUT,
-                                            0,
-                                            &still_running);
+        if (info->hedge_parent != NULL) {
+          // A duplicate request of a slow download job
+          handles_added |= download_mgr->FinalizeHedge(curl_error, info);
+        } else if (info->range_parent != NULL) {
+          // A part of a parallel range download
+          download_mgr->FinalizeRangePart(curl_error, info);
+          handles_added |= download_mgr->DrainRangeParts(info->range_parent);
+        } else if (info->range_parallel && (curl_error == CURLE_OK) &&
+                   (info->range_total > info->range_next))
+        {
+          // The first segment is complete, the parts provide the rest
+          info->range_done = true;
+          handles_added |= download_mgr->DrainRangeParts(info);
         } else {
-          // Return easy handle into pool and write result back
-          download_mgr->ReleaseCurlHandle(easy_handle);
-
-          WritePipe(info->wait_at[1], &info->error_code,
-                    sizeof(info->error_code));
+          download_mgr->SettleHedge(curl_error, info);
+          download_mgr->AbortRangeParts(info);
+          handles_added |= download_mgr->CompleteJob(curl_error, info);
         }
       }
     }
+
+    // Request the next parts of parallel range downloads
+    handles_added |= download_mgr->ScheduleRangeParts();
+    // Duplicate the requests of slow latency-critical download jobs
+    handles_added |= download_mgr->ScheduleHedges();
+    if (handles_added) {
+      retval = curl_multi_socket_action(download_mgr->curl_multi_,
+                                        CURL_SOCKET_TIMEOUT,
+                                        0,
+                                        &still_running);
+    }
   }
 
   for (set<CURL *>::iterator i = download_mgr->pool_handles_inuse_->begin(),
@@ -606,6 +676,68 @@ void *DownloadManager::MainDownload(void *data) {
 }
 
 
+/**
+ * Resolves the proxy names queued by ValidateProxyIpsUnlocked() with a
+ * separate resolver, so that neither the DNS queries nor the options lock
+ * delay the downloads that keep using the stale addresses.
+ */
+void *DownloadManager::MainDnsRefresh(void *data) {
+  LogCvmfs(kLogDownload, kLogDebug, "DNS refresh thread started");
+  DownloadManager *download_mgr = static_cast<DownloadManager *>(data);
+
+  pthread_mutex_lock(download_mgr->lock_options_);
+  while (true) {
+    while (download_mgr->dns_refresh_queue_.empty() &&
+           !download_mgr->dns_refresh_terminate_)
+    {
+      pthread_cond_wait(&download_mgr->cond_dns_refresh_,
+                        download_mgr->lock_options_);
+    }
+    if (download_mgr->dns_refresh_terminate_)
+      break;
+
+    vector<ProxyInfo> stale_proxies;
+    stale_proxies.swap(download_mgr->dns_refresh_queue_);
+    dns::NormalResolver *resolver = download_mgr->CloneResolverUnlocked();
+    pthread_mutex_unlock(download_mgr->lock_options_);
+
+    vector<string> names;
+    for (unsigned i = 0; i < stale_proxies.size(); ++i)
+      names.push_back(stale_proxies[i].host.name());
+    vector<dns::Host> hosts;
+    resolver->ResolveMany(names, &hosts);
+    delete resolver;
+    perf::Xadd(download_mgr->counters_->n_dns_refreshes, names.size());
+
+    pthread_mutex_lock(download_mgr->lock_options_);
+    for (unsigned i = 0; i < stale_proxies.size(); ++i) {
+      const dns::Host &host = stale_proxies[i].host;
+      download_mgr->dns_refresh_pending_.erase(host.id());
+      // The proxy might have been replaced in the meantime
+      if (download_mgr->opt_proxy_groups_ == NULL)
+        continue;
+      bool in_use = false;
+      const vector<ProxyInfo> &group = (*download_mgr->opt_proxy_groups_)
+        [download_mgr->opt_proxy_groups_current_];
+      for (unsigned j = 0; j < group.size(); ++j) {
+        if (group[j].host.id() == host.id()) {
+          in_use = true;
+          break;
+        }
+      }
+      if (in_use) {
+        download_mgr->UpdateProxyHostUnlocked(stale_proxies[i].url, host,
+                                              hosts[i]);
+      }
+    }
+  }
+  pthread_mutex_unlock(download_mgr->lock_options_);
+
+  LogCvmfs(kLogDownload, kLogDebug, "DNS refresh thread terminated");
+  return NULL;
+}
+
+
 //------------------------------------------------------------------------------
 
 
@@ -728,6 +860,211 @@ void HeaderLists::AddBlock() {
 //------------------------------------------------------------------------------
 
 
+double EndpointScores::Score::Cost() const {
+  if (throughput <= 0.0)
+    return ttfb_ms;
+  return ttfb_ms + static_cast<double>(kReferenceSize) * 1000.0 / throughput;
+}
+
+
+double EndpointScores::Average(const double average, const double sample) {
+  return average + (sample - average) * kWeightPercent / 100.0;
+}
+
+
+void EndpointScores::AddSample(
+  const string &endpoint,
+  const double ttfb_ms,
+  const uint64_t size,
+  const double transfer_ms)
+{
+  Score *score = &scores_[endpoint];
+  if (score->num_samples + score->num_failures == 0)
+    score->ttfb_ms = ttfb_ms;
+  else
+    score->ttfb_ms = Average(score->ttfb_ms, ttfb_ms);
+  score->num_samples++;
+
+  if ((size < kMinThroughputSize) || (transfer_ms <= 0.0))
+    return;
+  const double throughput = static_cast<double>(size) * 1000.0 / transfer_ms;
+  if (score->throughput <= 0.0)
+    score->throughput = throughput;
+  else
+    score->throughput = Average(score->throughput, throughput);
+}
+
+
+void EndpointScores::AddFailure(const string &endpoint,
+                                const double penalty_ms)
+{
+  Score *score = &scores_[endpoint];
+  if (score->num_samples + score->num_failures == 0)
+    score->ttfb_ms = penalty_ms;
+  else
+    score->ttfb_ms = Average(score->ttfb_ms, penalty_ms);
+  score->num_failures++;
+}
+
+
+/**
+ * Endpoints without measurements have zero cost.
+ */
+double EndpointScores::GetCost(const string &endpoint) const {
+  map<string, Score>::const_iterator iter = scores_.find(endpoint);
+  if (iter == scores_.end())
+    return 0.0;
+  return iter->second.Cost();
+}
+
+
+void EndpointScores::GetScores(
+  vector<string> *endpoints,
+  vector<Score> *scores) const
+{
+  endpoints->clear();
+  scores->clear();
+  map<string, Score>::const_iterator i = scores_.begin();
+  for (map<string, Score>::const_iterator iEnd = scores_.end(); i != iEnd; ++i)
+  {
+    endpoints->push_back(i->first);
+    scores->push_back(i->second);
+  }
+}
+
+
+void LatencyWindow::Add(const unsigned ms) {
+  if (samples_.size() < kWindowSize)
+    samples_.push_back(ms);
+  else
+    samples_[num_samples_ % kWindowSize] = ms;
+  num_samples_++;
+}
+
+
+unsigned LatencyWindow::GetPercentile(const unsigned percentile) const {
+  if (samples_.empty())
+    return 0;
+  vector<unsigned> sorted(samples_);
+  const unsigned idx =
+    (sorted.size() - 1) * std::min(percentile, 100U) / 100;
+  std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+  return sorted[idx];
+}
+
+
+//------------------------------------------------------------------------------
+
+
+JobBatch::JobBatch(const unsigned max_in_flight)
+  : max_in_flight_(max_in_flight)
+  , callback_(NULL)
+{
+  Init();
+}
+
+
+JobBatch::JobBatch(const unsigned max_in_flight, CallbackTN *callback)
+  : max_in_flight_(max_in_flight)
+  , callback_(callback)
+{
+  Init();
+}
+
+
+void JobBatch::Init() {
+  timestamp_start_ms_ = 0;
+  num_in_flight_ = 0;
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_, NULL);
+  assert(retval == 0);
+}
+
+
+JobBatch::~JobBatch() {
+  Wait();
+  delete callback_;
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Returns the next completed job in the order of completion.  Blocks until a
+ * job completes.  Returns NULL if all submitted jobs are collected.  Only
+ * available without callback.
+ */
+JobInfo *JobBatch::WaitNext() {
+  assert(callback_ == NULL);
+  MutexLockGuard m(&lock_);
+  while (completed_.empty() &&
+         (statistics_.num_completed < statistics_.num_submitted))
+  {
+    pthread_cond_wait(&cond_, &lock_);
+  }
+  if (completed_.empty())
+    return NULL;
+  JobInfo *info = completed_.front();
+  completed_.pop_front();
+  return info;
+}
+
+
+/**
+ * Blocks until all submitted jobs are completed.  With a callback, all
+ * callbacks have returned, too.
+ */
+void JobBatch::Wait() {
+  MutexLockGuard m(&lock_);
+  while (statistics_.num_completed < statistics_.num_submitted)
+    pthread_cond_wait(&cond_, &lock_);
+}
+
+
+JobBatch::Statistics JobBatch::GetStatistics() {
+  MutexLockGuard m(&lock_);
+  return statistics_;
+}
+
+
+void JobBatch::Enqueue() {
+  MutexLockGuard m(&lock_);
+  if (statistics_.num_completed == statistics_.num_submitted)
+    timestamp_start_ms_ = GetTimeMs() - statistics_.elapsed_ms;
+  statistics_.num_submitted++;
+}
+
+
+/**
+ * The job must not be touched after it is handed over to the callback or to
+ * WaitNext(), and the batch must not be touched after the lock is released.
+ */
+void JobBatch::Complete(JobInfo *info) {
+  const bool failed = (info->error_code != kFailOk);
+  if (callback_ != NULL)
+    (*callback_)(info);
+
+  MutexLockGuard m(&lock_);
+  if (callback_ == NULL)
+    completed_.push_back(info);
+  statistics_.num_completed++;
+  if (failed)
+    statistics_.num_failed++;
+  statistics_.elapsed_ms = GetTimeMs() - timestamp_start_ms_;
+  pthread_cond_broadcast(&cond_);
+}
+
+
+void JobBatch::AddTransferredBytes(const uint64_t nbytes) {
+  MutexLockGuard m(&lock_);
+  statistics_.sz_transferred_bytes += nbytes;
+}
+
+
+//------------------------------------------------------------------------------
+
+
 string DownloadManager::ProxyInfo::Print() {
   if (url == "DIRECT")
     return url;
@@ -806,6 +1143,10 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
   info->num_used_hosts = 1;
   info->num_retries = 0;
   info->backoff_ms = 0;
+  info->range_parallel = false;
+  info->range_done = false;
+  info->range_total = 0;
+  info->range_next = 0;
   info->headers = header_lists_->DuplicateList(default_headers_);
   if (info->info_header) {
     header_lists_->AppendHeader(info->headers, info->info_header);
@@ -855,6 +1196,13 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
     curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
     curl_easy_setopt(handle, CURLOPT_MAXREDIRS, 4);
   }
+  // Otherwise libcurl's default applies.  HTTP/2 cannot be switched off again,
+  // so pooled handles do not need to be reset.
+  if (enable_http2_) {
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    // Rather wait for a connection that can multiplex than open a new one
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+  }
 }
 
 
@@ -922,17 +1270,52 @@ void DownloadManager::SetUrlOptions(JobInfo *info) {
       opt_timestamp_backup_host_ = 0;
     }
   }
+  // Check if proxy and host need to be reselected according to their scores
+  if (opt_latency_interval_ > 0) {
+    const time_t now = time(NULL);
+    if (static_cast<int64_t>(now) >=
+        static_cast<int64_t>(opt_timestamp_latency_ + opt_latency_interval_))
+    {
+      opt_timestamp_latency_ = now;
+      if (opt_proxy_groups_) {
+        const unsigned group_size =
+          (*opt_proxy_groups_)[opt_proxy_groups_current_].size();
+        SelectProxyUnlocked(group_size - opt_proxy_groups_current_burned_ + 1);
+      }
+      SelectHostUnlocked();
+    }
+  }
+
+  // A duplicate request goes to the next proxy of the load-balancing group
+  // that did not fail or, if there is none, to the next host
+  unsigned proxy_idx = 0;
+  unsigned host_idx = opt_host_chain_current_;
+  if (info->hedge_parent != NULL) {
+    if (opt_proxy_groups_ &&
+        ((*opt_proxy_groups_)[opt_proxy_groups_current_].size() >
+         opt_proxy_groups_current_burned_))
+    {
+      proxy_idx = 1;
+    } else if (info->probe_hosts && opt_host_chain_) {
+      host_idx = (opt_host_chain_current_ + 1) % opt_host_chain_->size();
+    }
+  }
 
   if (!opt_proxy_groups_ ||
-      ((*opt_proxy_groups_)[opt_proxy_groups_current_][0].url == "DIRECT"))
+      ((*opt_proxy_groups_)[opt_proxy_groups_current_][proxy_idx].url ==
+       "DIRECT"))
   {
     info->proxy = "DIRECT";
     curl_easy_setopt(info->curl_handle, CURLOPT_PROXY, "");
   } else {
-    ProxyInfo proxy = (*opt_proxy_groups_)[opt_proxy_groups_current_][0];
+    ProxyInfo proxy =
+      (*opt_proxy_groups_)[opt_proxy_groups_current_][proxy_idx];
     ValidateProxyIpsUnlocked(proxy.url, proxy.host);
+    // Changed DNS entries can shrink the group
+    if (proxy_idx >= (*opt_proxy_groups_)[opt_proxy_groups_current_].size())
+      proxy_idx = 0;
     ProxyInfo *proxy_ptr =
-      &((*opt_proxy_groups_)[opt_proxy_groups_current_][0]);
+      &((*opt_proxy_groups_)[opt_proxy_groups_current_][proxy_idx]);
     info->proxy = proxy_ptr->url;
     if (proxy_ptr->host.status() == dns::kFailOk) {
       curl_easy_setopt(info->curl_handle, CURLOPT_PROXY, info->proxy.c_str());
@@ -953,7 +1336,8 @@ void DownloadManager::SetUrlOptions(JobInfo *info) {
     curl_easy_setopt(curl_handle, CURLOPT_DNS_SERVERS, opt_dns_server_.c_str());
 
   if (info->probe_hosts && opt_host_chain_)
-    url_prefix = (*opt_host_chain_)[opt_host_chain_current_];
+    url_prefix = (*opt_host_chain_)[host_idx];
+  info->host = url_prefix;
 
   string url = url_prefix + *(info->url);
 
@@ -1023,6 +1407,19 @@ void DownloadManager::SetUrlOptions(JobInfo *info) {
     info->destination_mem.data = static_cast<char *>(smalloc(64*1024));
   }
 
+  if (info->range_parallel) {
+    // Only HTTP reports the object size along with a range
+    if (HasPrefix(url, "http", true)) {
+      char byte_range_array[100];
+      snprintf(byte_range_array, sizeof(byte_range_array), "0-%u",
+               opt_parallel_segment_ - 1);
+      curl_easy_setopt(curl_handle, CURLOPT_RANGE, byte_range_array);
+    } else {
+      info->range_parallel = false;
+      curl_easy_setopt(curl_handle, CURLOPT_RANGE, NULL);
+    }
+  }
+
   curl_easy_setopt(curl_handle, CURLOPT_URL, EscapeUrl(url).c_str());
 }
 
@@ -1032,7 +1429,8 @@ void DownloadManager::SetUrlOptions(JobInfo *info) {
  * object should be one from the current load-balance group.  If the information
  * changed, gather new set of resolved IPs and, if different, exchange them in
  * the load-balance group on the fly.  In the latter case, also rebalance the
- * proxies.  The options mutex needs to be open.
+ * proxies.  In stale DNS mode, the expired addresses are used further while the
+ * refresh thread resolves the name.  The options mutex needs to be locked.
  */
 void DownloadManager::ValidateProxyIpsUnlocked(
   const string &url,
@@ -1040,11 +1438,40 @@ void DownloadManager::ValidateProxyIpsUnlocked(
 {
   if (!host.IsExpired())
     return;
+
+  if (dns_refresh_spawned_ && (opt_dns_max_stale_ > 0) &&
+      (host.status() == dns::kFailOk) &&
+      (host.deadline() + static_cast<time_t>(opt_dns_max_stale_) >=
+       time(NULL)))
+  {
+    // Keep using the expired addresses while the refresh thread resolves
+    if (dns_refresh_pending_.insert(host.id()).second) {
+      LogCvmfs(kLogDownload, kLogDebug, "refresh stale DNS entry for %s",
+               host.name().c_str());
+      dns_refresh_queue_.push_back(ProxyInfo(host, url));
+      pthread_cond_signal(&cond_dns_refresh_);
+    }
+    return;
+  }
+
   LogCvmfs(kLogDownload, kLogDebug, "validate DNS entry for %s",
            host.name().c_str());
+  UpdateProxyHostUnlocked(url, host, resolver_->Resolve(host.name()));
+}
 
+
+/**
+ * Replaces the host object in the current load-balance group by the result
+ * of resolving its name again.  If the resolution failed, the old addresses
+ * are kept for the minimum TTL.  The options mutex needs to be locked.
+ */
+void DownloadManager::UpdateProxyHostUnlocked(
+  const string &url,
+  const dns::Host &host,
+  const dns::Host &resolved_host)
+{
   unsigned group_idx = opt_proxy_groups_current_;
-  dns::Host new_host = resolver_->Resolve(host.name());
+  dns::Host new_host = resolved_host;
 
   bool update_only = true;  // No changes to the list of IP addresses.
   if (new_host.status() != dns::kFailOk) {
@@ -1095,7 +1522,8 @@ void DownloadManager::ValidateProxyIpsUnlocked(
 
 
 /**
- * Adds transfer time and downloaded bytes to the global counters.
+ * Adds transfer time and downloaded bytes to the global counters and to the
+ * statistics of the job's batch.
  */
 void DownloadManager::UpdateStatistics(CURL *handle) {
   double val;
@@ -1109,6 +1537,85 @@ void DownloadManager::UpdateStatistics(CURL *handle) {
   assert(retval == CURLE_OK);
   sum += static_cast<int64_t>(val);*/
   perf::Xadd(counters_->sz_transferred_bytes, sum);
+
+  JobInfo *info;
+  curl_easy_getinfo(handle, CURLINFO_PRIVATE, &info);
+  if (info->range_parent != NULL)
+    info = info->range_parent;
+  else if (info->hedge_parent != NULL)
+    info = info->hedge_parent;
+  if (info->batch != NULL)
+    info->batch->AddTransferredBytes(sum);
+
+  // Connection reuse, only meaningful for HTTP
+  long http_version = 0;  // NOLINT
+  retval = curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &http_version);
+  if ((retval != CURLE_OK) || (http_version == 0))
+    return;
+  long num_connects = 0;  // NOLINT
+  retval = curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &num_connects);
+  assert(retval == CURLE_OK);
+  if (num_connects == 0)
+    perf::Inc(counters_->n_connections_reused);
+  else
+    perf::Xadd(counters_->n_connections, num_connects);
+  if (http_version == CURL_HTTP_VERSION_2_0)
+    perf::Inc(counters_->n_http2_requests);
+}
+
+
+/**
+ * Feeds the time to first byte and the throughput of a finished HTTP transfer
+ * into the scores of the proxy and, for direct connections, of the host.
+ * Failures to resolve, to connect, or to transfer the data count as a time to
+ * first byte of the connection timeout.  Other errors, such as HTTP errors,
+ * say little about the speed of the endpoint and are ignored.
+ */
+void DownloadManager::UpdateScores(const JobInfo *info, const Failures error) {
+  const bool failed = (error == kFailProxyResolve) ||
+                      (error == kFailHostResolve) ||
+                      IsProxyTransferError(error) ||
+                      IsHostTransferError(error);
+  if ((error != kFailOk) && !failed)
+    return;
+  if (!HasPrefix(info->host + *info->url, "http", true))
+    return;
+
+  double ttfb_s = 0.0;
+  double total_s = 0.0;
+  double size = 0.0;
+  if (!failed) {
+    CURL *handle = info->curl_handle;
+    int retval =
+      curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &ttfb_s);
+    assert(retval == CURLE_OK);
+    retval = curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total_s);
+    assert(retval == CURLE_OK);
+    retval = curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD, &size);
+    assert(retval == CURLE_OK);
+  }
+
+  const bool is_direct = (info->proxy == "DIRECT");
+  MutexLockGuard m(lock_options_);
+  if (opt_latency_interval_ == 0)
+    return;
+  if (failed) {
+    const unsigned timeout = is_direct ? opt_timeout_direct_ :
+                                         opt_timeout_proxy_;
+    const double penalty_ms = std::max(timeout, 1U) * 1000.0;
+    endpoint_scores_.AddFailure(info->proxy, penalty_ms);
+    if (is_direct && !info->host.empty())
+      endpoint_scores_.AddFailure(info->host, penalty_ms);
+    return;
+  }
+  const double ttfb_ms = ttfb_s * 1000.0;
+  const double transfer_ms = (total_s - ttfb_s) * 1000.0;
+  endpoint_scores_.AddSample(info->proxy, ttfb_ms,
+                             static_cast<uint64_t>(size), transfer_ms);
+  if (is_direct && !info->host.empty()) {
+    endpoint_scores_.AddSample(info->host, ttfb_ms,
+                               static_cast<uint64_t>(size), transfer_ms);
+  }
 }
 
 
@@ -1300,6 +1807,8 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       break;
   }
 
+  UpdateScores(info, info->error_code);
+
   std::vector<std::string> *host_chain = opt_host_chain_;
 
   // Determination if download should be repeated
@@ -1377,34 +1886,8 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
   if (try_again) {
     LogCvmfs(kLogDownload, kLogDebug, "Trying again on same curl handle, "
              "same url: %d, error code %d", same_url_retry, info->error_code);
-    // Reset internal state and destination
-    if ((info->destination == kDestinationMem) && info->destination_mem.data) {
-      free(info->destination_mem.data);
-      info->destination_mem.data = NULL;
-      info->destination_mem.size = 0;
-      info->destination_mem.pos = 0;
-    }
-    if ((info->destination == kDestinationFile) ||
-        (info->destination == kDestinationPath))
-    {
-      if ((fflush(info->destination_file) != 0) ||
-          (ftruncate(fileno(info->destination_file), 0) != 0))
-      {
-        info->error_code = kFailLocalIO;
-        goto verify_and_finalize_stop;
-      }
-      rewind(info->destination_file);
-    }
-    if (info->destination == kDestinationSink) {
-      if (info->destination_sink->Reset() != 0) {
-        info->error_code = kFailLocalIO;
-        goto verify_and_finalize_stop;
-      }
-    }
-    if (info->expected_hash)
-      shash::Init(info->hash_context);
-    if (info->compressed)
-      zlib::DecompressInit(&info->zstream);
+    if (!RewindDestination(info))
+      goto verify_and_finalize_stop;
     SetRegularCache(info);
 
     // Failure handling
@@ -1480,6 +1963,486 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
 }
 
 
+/**
+ * Resets the destination, the decompression, and the hash verification of a
+ * job in order to download the object again from the start.
+ *
+ * \return false on local I/O errors
+ */
+bool DownloadManager::RewindDestination(JobInfo *info) {
+  if ((info->destination == kDestinationMem) && info->destination_mem.data) {
+    free(info->destination_mem.data);
+    info->destination_mem.data = NULL;
+    info->destination_mem.size = 0;
+    info->destination_mem.pos = 0;
+  }
+  if ((info->destination == kDestinationFile) ||
+      (info->destination == kDestinationPath))
+  {
+    if ((fflush(info->destination_file) != 0) ||
+        (ftruncate(fileno(info->destination_file), 0) != 0))
+    {
+      info->error_code = kFailLocalIO;
+      return false;
+    }
+    rewind(info->destination_file);
+  }
+  if (info->destination == kDestinationSink) {
+    if (info->destination_sink->Reset() != 0) {
+      info->error_code = kFailLocalIO;
+      return false;
+    }
+  }
+  if (info->expected_hash)
+    shash::Init(info->hash_context);
+  if (info->compressed)
+    zlib::DecompressInit(&info->zstream);
+
+  info->range_done = false;
+  info->range_total = 0;
+  info->range_next = opt_parallel_segment_;
+  return true;
+}
+
+
+/**
+ * Verifies a finished transfer in the I/O thread.  Either the transfer starts
+ * over or the result is handed to the thread that waits in Fetch().
+ *
+ * \return true if the curl handle was added again to the multi handle
+ */
+bool DownloadManager::CompleteJob(const int curl_error, JobInfo *info) {
+  if (VerifyAndFinalize(curl_error, info)) {
+    curl_multi_add_handle(curl_multi_, info->curl_handle);
+    return true;
+  }
+
+  if (!range_jobs_.empty()) {
+    vector<JobInfo *>::iterator i =
+      std::find(range_jobs_.begin(), range_jobs_.end(), info);
+    if (i != range_jobs_.end())
+      range_jobs_.erase(i);
+  }
+  // Return easy handle into pool and write result back
+  ReleaseCurlHandle(info->curl_handle);
+  if (info->batch != NULL)
+    return FinalizeBatchJob(info);
+  WritePipe(info->wait_at[1], &info->error_code, sizeof(info->error_code));
+  return false;
+}
+
+
+/**
+ * Hands a new job from the pipe over to curl.
+ */
+void DownloadManager::StartJob(JobInfo *info) {
+  if (info->batch != NULL)
+    info->batch->num_in_flight_++;
+  CURL *handle = AcquireCurlHandle();
+  InitializeRequest(info, handle);
+  InitializeRangeParallel(info);
+  SetUrlOptions(info);
+  InitializeHedge(info);
+  curl_multi_add_handle(curl_multi_, handle);
+}
+
+
+/**
+ * Delivers a completed job of a batch and starts the next waiting job of the
+ * same batch, if any.  The buffers allocated by Submit() are freed.
+ *
+ * \return true if a curl handle was added to the multi handle
+ */
+bool DownloadManager::FinalizeBatchJob(JobInfo *info) {
+  JobBatch *batch = info->batch;
+  assert(batch->num_in_flight_ > 0);
+  batch->num_in_flight_--;
+  bool added = false;
+  if (!batch->waiting_.empty()) {
+    JobInfo *next = batch->waiting_.front();
+    batch->waiting_.pop_front();
+    StartJob(next);
+    added = true;
+  }
+
+  free(info->hash_context.buffer);
+  info->hash_context.buffer = NULL;
+  free(info->info_header);
+  info->info_header = NULL;
+  if (info->error_code != kFailOk)
+    DiscardDestination(info);
+  batch->Complete(info);
+  return added;
+}
+
+
+/**
+ * Large objects are downloaded in parallel range mode if the job downloads
+ * the entire object to a file or a sink.  Range requests bypass the cache of
+ * most proxies, so only objects whose expected size exceeds one segment use
+ * them; objects of unknown size are downloaded by a plain request.
+ */
+void DownloadManager::InitializeRangeParallel(JobInfo *info) {
+  if ((opt_parallel_streams_ < 2) ||
+      (info->expected_size <= opt_parallel_segment_) ||
+      (info->range_offset != -1) ||
+      info->head_request ||
+      (info->destination == kDestinationMem))
+  {
+    return;
+  }
+  info->range_parallel = true;
+  info->range_next = opt_parallel_segment_;
+  range_jobs_.push_back(info);
+}
+
+
+/**
+ * Adds range requests for the next segments of objects in parallel range
+ * mode until the number of parts in flight or waiting to be drained reaches
+ * the number of streams.  Parts are buffered in memory, so this also limits
+ * the memory used per download.
+ *
+ * \return true if curl handles were added to the multi handle
+ */
+bool DownloadManager::ScheduleRangeParts() {
+  bool added = false;
+  for (unsigned i = 0; i < range_jobs_.size(); ++i) {
+    JobInfo *info = range_jobs_[i];
+    if (!info->range_parallel || (info->range_next >= info->range_total))
+      continue;
+    if (info->range_next == opt_parallel_segment_)
+      perf::Inc(counters_->n_parallel_downloads);
+
+    while ((info->range_parts.size() + 1 < opt_parallel_streams_) &&
+           (info->range_next < info->range_total))
+    {
+      const uint64_t size =
+        std::min(static_cast<uint64_t>(opt_parallel_segment_),
+                 info->range_total - info->range_next);
+      JobInfo *part = new JobInfo();
+      part->url = info->url;
+      part->probe_hosts = info->probe_hosts;
+      part->force_nocache = info->nocache;
+      part->pid = info->pid;
+      part->uid = info->uid;
+      part->gid = info->gid;
+      part->info_header = info->info_header;
+      part->destination = kDestinationMem;
+      part->destination_mem.size = size;
+      part->destination_mem.data = static_cast<char *>(smalloc(size));
+      part->range_offset = info->range_next;
+      part->range_size = size;
+      part->range_parent = info;
+
+      CURL *handle = AcquireCurlHandle();
+      InitializeRequest(part, handle);
+      SetUrlOptions(part);
+      curl_multi_add_handle(curl_multi_, handle);
+      info->range_parts.push_back(part);
+      info->range_next += size;
+      perf::Inc(counters_->n_parallel_parts);
+      added = true;
+    }
+  }
+  return added;
+}
+
+
+/**
+ * A part must contain exactly the requested range.  Parts are not retried;
+ * if one fails, the entire download falls back to a single request.
+ */
+void DownloadManager::FinalizeRangePart(const int curl_error, JobInfo *part) {
+  UpdateStatistics(part->curl_handle);
+  if ((curl_error != CURLE_OK) ||
+      (part->http_code != 206) ||
+      (part->destination_mem.pos != part->destination_mem.size))
+  {
+    LogCvmfs(kLogDownload, kLogDebug,
+             "range request %" PRId64 "+%" PRId64 " of %s failed "
+             "(curl error %d, http code %d)",
+             static_cast<int64_t>(part->range_offset),
+             static_cast<int64_t>(part->range_size), part->url->c_str(),
+             curl_error, part->http_code);
+    if (part->error_code == kFailOk)
+      part->error_code = kFailOther;
+  } else {
+    UpdateScores(part, kFailOk);
+  }
+  ReleaseCredential(part);
+  header_lists_->PutList(part->headers);
+  part->headers = NULL;
+  ReleaseCurlHandle(part->curl_handle);
+  part->curl_handle = NULL;
+  part->range_done = true;
+}
+
+
+/**
+ * Cancels the parts of a parallel range download, including the buffered
+ * ones.
+ */
+void DownloadManager::AbortRangeParts(JobInfo *info) {
+  for (unsigned i = 0; i < info->range_parts.size(); ++i) {
+    JobInfo *part = info->range_parts[i];
+    if (!part->range_done) {
+      curl_multi_remove_handle(curl_multi_, part->curl_handle);
+      ReleaseCredential(part);
+      header_lists_->PutList(part->headers);
+      ReleaseCurlHandle(part->curl_handle);
+    }
+    free(part->destination_mem.data);
+    delete part;
+  }
+  info->range_parts.clear();
+}
+
+
+/**
+ * Once the first segment is received, the buffered parts are passed in order
+ * through the data callback of the download job.  Thus the parts are
+ * decompressed, hashed, and written to the destination as if they were
+ * received by a single request.  When the last part is drained, the job is
+ * verified and completed.
+ *
+ * \return true if the curl handle of the job was added again to the multi
+ * handle
+ */
+bool DownloadManager::DrainRangeParts(JobInfo *info) {
+  if (!info->range_done)
+    return false;
+
+  while (!info->range_parts.empty()) {
+    JobInfo *part = info->range_parts[0];
+    if (!part->range_done)
+      return false;
+    if (part->error_code != kFailOk)
+      return FallbackRangeParallel(info);
+
+    const size_t nbytes = part->destination_mem.pos;
+    if (CallbackCurlData(part->destination_mem.data, 1, nbytes, info) !=
+        nbytes)
+    {
+      // The data callback set the error code
+      AbortRangeParts(info);
+      return CompleteJob(CURLE_WRITE_ERROR, info);
+    }
+    free(part->destination_mem.data);
+    delete part;
+    info->range_parts.erase(info->range_parts.begin());
+  }
+
+  if (info->range_next < info->range_total)
+    return false;
+  return CompleteJob(CURLE_OK, info);
+}
+
+
+/**
+ * Restarts a parallel range download as a regular, single request, e.g. if a
+ * server in the chain does not serve ranges properly.
+ *
+ * \return true if the curl handle of the job was added again to the multi
+ * handle
+ */
+bool DownloadManager::FallbackRangeParallel(JobInfo *info) {
+  LogCvmfs(kLogDownload, kLogDebug,
+           "parallel range download of %s failed, using a single request",
+           info->url->c_str());
+  perf::Inc(counters_->n_parallel_fallbacks);
+  // The first segment is complete, so the handle is not in the multi handle
+  AbortRangeParts(info);
+  info->range_parallel = false;
+  curl_easy_setopt(info->curl_handle, CURLOPT_RANGE, NULL);
+  if (!RewindDestination(info))
+    return CompleteJob(CURLE_WRITE_ERROR, info);
+  curl_multi_add_handle(curl_multi_, info->curl_handle);
+  return true;
+}
+
+
+/**
+ * Latency-critical HTTP download jobs are hedged if they do not receive a
+ * response before the current threshold.
+ */
+void DownloadManager::InitializeHedge(JobInfo *info) {
+  if ((opt_hedge_percentile_ == 0) ||
+      !info->latency_critical ||
+      info->head_request ||
+      info->range_parallel ||
+      !HasPrefix(info->host + *info->url, "http", true))
+  {
+    return;
+  }
+  hedge_tokens_ = std::min(hedge_tokens_ + opt_hedge_budget_ / 100.0,
+                           static_cast<double>(kMaxHedgeTokens));
+  if (hedge_ttfb_.size() < kMinHedgeSamples)
+    return;
+  info->hedge_deadline_ms = GetTimeMs() + hedge_threshold_ms_;
+  hedge_jobs_.push_back(info);
+}
+
+
+/**
+ * Sends duplicate requests for the download jobs that passed their hedge
+ * deadline without a response, as far as the budget allows.  The duplicate
+ * request receives the object in memory.  Every job is hedged at most once.
+ *
+ * \return true if curl handles were added to the multi handle
+ */
+bool DownloadManager::ScheduleHedges() {
+  if (hedge_jobs_.empty())
+    return false;
+
+  const uint64_t now = GetTimeMs();
+  bool added = false;
+  for (unsigned i = 0; i < hedge_jobs_.size(); ) {
+    JobInfo *info = hedge_jobs_[i];
+    if (now < info->hedge_deadline_ms) {
+      ++i;
+      continue;
+    }
+    hedge_jobs_.erase(hedge_jobs_.begin() + i);
+    if ((info->http_code != -1) || (hedge_tokens_ < 1.0))
+      continue;
+    hedge_tokens_ -= 1.0;
+
+    JobInfo *hedge = new JobInfo();
+    hedge->url = info->url;
+    hedge->probe_hosts = info->probe_hosts;
+    hedge->force_nocache = info->nocache;
+    hedge->pid = info->pid;
+    hedge->uid = info->uid;
+    hedge->gid = info->gid;
+    hedge->info_header = info->info_header;
+    hedge->destination = kDestinationMem;
+    hedge->range_offset = info->range_offset;
+    hedge->range_size = info->range_size;
+    hedge->hedge_parent = info;
+
+    CURL *handle = AcquireCurlHandle();
+    InitializeRequest(hedge, handle);
+    SetUrlOptions(hedge);
+    curl_multi_add_handle(curl_multi_, handle);
+    info->hedge = hedge;
+    perf::Inc(counters_->n_hedges_fired);
+    LogCvmfs(kLogDownload, kLogDebug,
+             "no response for %s from proxy %s after %u ms, "
+             "sending duplicate request to proxy %s",
+             info->url->c_str(), info->proxy.c_str(), hedge_threshold_ms_,
+             hedge->proxy.c_str());
+    added = true;
+  }
+  return added;
+}
+
+
+/**
+ * If the duplicate request completes first, the original request is canceled
+ * and the download job continues on the curl handle of the duplicate.  The
+ * received data is passed through the data callback of the job, so that it is
+ * decompressed, verified, and written to the destination as usual.
+ *
+ * \return true if curl handles were added to the multi handle
+ */
+bool DownloadManager::FinalizeHedge(const int curl_error, JobInfo *hedge) {
+  JobInfo *info = hedge->hedge_parent;
+  info->hedge = NULL;
+  if ((curl_error != CURLE_OK) || ((hedge->http_code / 100) != 2)) {
+    LogCvmfs(kLogDownload, kLogDebug,
+             "duplicate request for %s failed (curl error %d, http code %d)",
+             info->url->c_str(), curl_error, hedge->http_code);
+    UpdateStatistics(hedge->curl_handle);
+    DiscardHedge(hedge);
+    return false;
+  }
+
+  LogCvmfs(kLogDownload, kLogDebug,
+           "duplicate request for %s via proxy %s completed first",
+           info->url->c_str(), hedge->proxy.c_str());
+  perf::Inc(counters_->n_hedges_won);
+  RecordTtfb(hedge->curl_handle);
+
+  curl_multi_remove_handle(curl_multi_, info->curl_handle);
+  ReleaseCredential(info);
+  header_lists_->PutList(info->headers);
+  ReleaseCurlHandle(info->curl_handle);
+  info->curl_handle = hedge->curl_handle;
+  info->headers = hedge->headers;
+  info->cred_data = hedge->cred_data;
+  info->proxy = hedge->proxy;
+  info->host = hedge->host;
+  info->http_code = hedge->http_code;
+  curl_easy_setopt(info->curl_handle, CURLOPT_PRIVATE,
+                   static_cast<void *>(info));
+  curl_easy_setopt(info->curl_handle, CURLOPT_WRITEHEADER,
+                   static_cast<void *>(info));
+  curl_easy_setopt(info->curl_handle, CURLOPT_WRITEDATA,
+                   static_cast<void *>(info));
+  char *data = hedge->destination_mem.data;
+  const size_t nbytes = hedge->destination_mem.pos;
+  delete hedge;
+
+  if (!RewindDestination(info)) {
+    free(data);
+    return CompleteJob(CURLE_WRITE_ERROR, info);
+  }
+  if ((info->destination == kDestinationMem) && (nbytes > 0)) {
+    info->destination_mem.data = static_cast<char *>(smalloc(nbytes));
+    info->destination_mem.size = nbytes;
+  }
+  if ((nbytes > 0) && (CallbackCurlData(data, 1, nbytes, info) != nbytes)) {
+    // The data callback set the error code
+    free(data);
+    return CompleteJob(CURLE_WRITE_ERROR, info);
+  }
+  free(data);
+  return CompleteJob(CURLE_OK, info);
+}
+
+
+/**
+ * Called when the original request of a download job completes.  Cancels the
+ * duplicate request, if any, and records the time to first byte.
+ */
+void DownloadManager::SettleHedge(const int curl_error, JobInfo *info) {
+  if (!info->latency_critical || (opt_hedge_percentile_ == 0))
+    return;
+  if (!hedge_jobs_.empty()) {
+    vector<JobInfo *>::iterator i =
+      std::find(hedge_jobs_.begin(), hedge_jobs_.end(), info);
+    if (i != hedge_jobs_.end())
+      hedge_jobs_.erase(i);
+  }
+  if (info->hedge != NULL) {
+    curl_multi_remove_handle(curl_multi_, info->hedge->curl_handle);
+    DiscardHedge(info->hedge);
+    info->hedge = NULL;
+  }
+  if ((curl_error == CURLE_OK) && ((info->http_code / 100) == 2))
+    RecordTtfb(info->curl_handle);
+}
+
+
+void DownloadManager::DiscardHedge(JobInfo *hedge) {
+  ReleaseCredential(hedge);
+  header_lists_->PutList(hedge->headers);
+  ReleaseCurlHandle(hedge->curl_handle);
+  free(hedge->destination_mem.data);
+  delete hedge;
+}
+
+
+void DownloadManager::RecordTtfb(CURL *handle) {
+  double ttfb_s;
+  int retval = curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &ttfb_s);
+  assert(retval == CURLE_OK);
+  hedge_ttfb_.Add(static_cast<unsigned>(ttfb_s * 1000.0));
+  hedge_threshold_ms_ = hedge_ttfb_.GetPercentile(opt_hedge_percentile_);
+}
+
+
 DownloadManager::DownloadManager() {
   pool_handles_idle_ = NULL;
   pool_handles_inuse_ = NULL;
@@ -1524,8 +2487,24 @@ DownloadManager::DownloadManager() {
   opt_ipv4_only_ = false;
   follow_redirects_ = false;
   use_system_proxy_ = false;
+  opt_parallel_streams_ = 0;
+  opt_parallel_segment_ = kDefaultParallelSegment;
+  enable_http2_ = false;
+  opt_latency_interval_ = 0;
+  opt_latency_explore_ = 0;
+  opt_timestamp_latency_ = 0;
+  opt_hedge_percentile_ = 0;
+  opt_hedge_budget_ = 0;
+  hedge_tokens_ = 0.0;
+  hedge_threshold_ms_ = 0;
 
   resolver_ = NULL;
+  dns_cache_ = NULL;
+  opt_dns_max_stale_ = 0;
+  dns_refresh_spawned_ = false;
+  dns_refresh_terminate_ = false;
+  retval = pthread_cond_init(&cond_dns_refresh_, NULL);
+  assert(retval == 0);
 
   opt_timestamp_backup_proxies_ = 0;
   opt_timestamp_failover_proxies_ = 0;
@@ -1540,6 +2519,7 @@ DownloadManager::DownloadManager() {
 
 
 DownloadManager::~DownloadManager() {
+  pthread_cond_destroy(&cond_dns_refresh_);
   pthread_mutex_destroy(lock_options_);
   pthread_mutex_destroy(lock_synchronous_mode_);
   free(lock_options_);
@@ -1636,6 +2616,19 @@ void DownloadManager::Init(const unsigned max_pool_handles,
 
 
 void DownloadManager::Fini() {
+  if (dns_refresh_spawned_) {
+    {
+      MutexLockGuard m(lock_options_);
+      dns_refresh_terminate_ = true;
+      pthread_cond_broadcast(&cond_dns_refresh_);
+    }
+    pthread_join(thread_dns_refresh_, NULL);
+    dns_refresh_spawned_ = false;
+    dns_refresh_terminate_ = false;
+    dns_refresh_queue_.clear();
+    dns_refresh_pending_.clear();
+  }
+
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
     // Shutdown I/O thread
     char buf = 'T';
@@ -1679,6 +2672,9 @@ void DownloadManager::Fini() {
 
   delete resolver_;
   resolver_ = NULL;
+  delete dns_cache_;
+  dns_cache_ = NULL;
+  opt_dns_max_stale_ = 0;
 }
 
 
@@ -1694,6 +2690,14 @@ void DownloadManager::Spawn() {
                               static_cast<void *>(this));
   assert(retval == 0);
 
+  MutexLockGuard m(lock_options_);
+  if (opt_dns_max_stale_ > 0) {
+    retval = pthread_create(&thread_dns_refresh_, NULL, MainDnsRefresh,
+                            static_cast<void *>(this));
+    assert(retval == 0);
+    dns_refresh_spawned_ = true;
+  }
+
   atomic_inc32(&multi_threaded_);
 }
 
@@ -1759,21 +2763,63 @@ Failures DownloadManager::Fetch(JobInfo *info) {
     ReleaseCurlHandle(info->curl_handle);
   }
 
-  if (result != kFailOk) {
-    LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d - %s)", result,
-             Code2Ascii(result));
+  if (result != kFailOk)
+    DiscardDestination(info);
 
-    if (info->destination == kDestinationPath)
-      unlink(info->destination_path->c_str());
+  return result;
+}
 
-    if (info->destination_mem.data) {
-      free(info->destination_mem.data);
-      info->destination_mem.data = NULL;
-      info->destination_mem.size = 0;
-    }
+
+/**
+ * Downloads a job asynchronously as part of the batch.  The job and the
+ * strings it points to must stay valid until it is completed.  Without the
+ * I/O thread, the job is downloaded synchronously before Submit() returns.
+ * Jobs that fail before they reach the I/O thread are completed in the
+ * calling thread, too.
+ */
+void DownloadManager::Submit(JobBatch *batch, JobInfo *info) {
+  assert(batch != NULL);
+  assert(info != NULL);
+  assert(info->url != NULL);
+
+  info->batch = batch;
+  batch->Enqueue();
+  if (atomic_xadd32(&multi_threaded_, 0) == 0) {
+    info->error_code = Fetch(info);
+    batch->Complete(info);
+    return;
   }
 
-  return result;
+  const Failures result = PrepareDownloadDestination(info);
+  if (result != kFailOk) {
+    info->error_code = result;
+    DiscardDestination(info);
+    batch->Complete(info);
+    return;
+  }
+
+  // Unlike in Fetch(), the buffers outlive this stack frame
+  info->hash_context.buffer = NULL;
+  if (info->expected_hash) {
+    const shash::Algorithms algorithm = info->expected_hash->algorithm;
+    info->hash_context.algorithm = algorithm;
+    info->hash_context.size = shash::GetContextSize(algorithm);
+    info->hash_context.buffer = smalloc(info->hash_context.size);
+  }
+  info->info_header = NULL;
+  if (enable_info_header_ && info->extra_info) {
+    const char *header_name = "cvmfs-info: ";
+    const size_t header_name_len = strlen(header_name);
+    const unsigned header_size = 1 + header_name_len +
+      EscapeHeader(*(info->extra_info), NULL, 0);
+    info->info_header = static_cast<char *>(smalloc(header_size));
+    memcpy(info->info_header, header_name, header_name_len);
+    EscapeHeader(*(info->extra_info), info->info_header + header_name_len,
+                 header_size - header_name_len);
+    info->info_header[header_size-1] = '\0';
+  }
+
+  WritePipe(pipe_jobs_[1], &info, sizeof(info));
 }
 
 
@@ -1830,6 +2876,8 @@ void DownloadManager::SetDnsParameters(
   resolver_ =
     dns::NormalResolver::Create(opt_ipv4_only_, retries, timeout_ms);
   assert(resolver_);
+  resolver_->set_cache(dns_cache_);
+  resolver_->set_max_stale(opt_dns_max_stale_);
 }
 
 
@@ -2000,7 +3048,18 @@ void DownloadManager::SwitchProxy(JobInfo *info) {
 
   // Select new one
   if ((group_size - opt_proxy_groups_current_burned_) > 0) {
-    int select = prng_.Next(group_size - opt_proxy_groups_current_burned_ + 1);
+    int select;
+    if (opt_latency_interval_ > 0) {
+      vector<string> candidates;
+      for (unsigned i = 0;
+           i <= group_size - opt_proxy_groups_current_burned_; ++i)
+      {
+        candidates.push_back((*group)[i].url);
+      }
+      select = SelectEndpointUnlocked(candidates);
+    } else {
+      select = prng_.Next(group_size - opt_proxy_groups_current_burned_ + 1);
+    }
 
     // Move selected proxy to front
     const ProxyInfo swap = (*group)[select];
@@ -2602,6 +3661,10 @@ void DownloadManager::RebalanceProxiesUnlocked() {
   opt_timestamp_failover_proxies_ = 0;
   opt_proxy_groups_current_burned_ = 1;
   vector<ProxyInfo> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  if (opt_latency_interval_ > 0) {
+    SelectProxyUnlocked(group->size());
+    return;
+  }
   int select = prng_.Next(group->size());
   swap((*group)[select], (*group)[0]);
   // LogCvmfs(kLogDownload, kLogDebug | kLogSyslog,
@@ -2616,6 +3679,98 @@ void DownloadManager::RebalanceProxies() {
 }
 
 
+/**
+ * Returns the index of the candidate with the lowest cost, or of a random
+ * candidate in opt_latency_explore_ percent of the calls.  The first candidate
+ * is the active endpoint.  It is kept unless another one is faster by
+ * kLatencyHysteresisPercent, so that similar endpoints do not take turns.
+ */
+unsigned DownloadManager::SelectEndpointUnlocked(
+  const vector<string> &candidates)
+{
+  if (candidates.size() < 2)
+    return 0;
+  if (prng_.Next(100) < opt_latency_explore_)
+    return prng_.Next(candidates.size());
+
+  unsigned best = 0;
+  double best_cost = endpoint_scores_.GetCost(candidates[0]);
+  const double threshold =
+    best_cost * (100 - kLatencyHysteresisPercent) / 100.0;
+  for (unsigned i = 1; i < candidates.size(); ++i) {
+    const double cost = endpoint_scores_.GetCost(candidates[i]);
+    if ((cost < best_cost) && ((best > 0) || (cost < threshold))) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+
+/**
+ * Selects the active proxy among the first num_candidates proxies of the
+ * current load-balancing group, i.e. among the active one and the ones that
+ * did not fail.
+ */
+void DownloadManager::SelectProxyUnlocked(const unsigned num_candidates) {
+  vector<ProxyInfo> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  const unsigned num_proxies =
+    std::min(num_candidates, static_cast<unsigned>(group->size()));
+  vector<string> candidates;
+  for (unsigned i = 0; i < num_proxies; ++i)
+    candidates.push_back((*group)[i].url);
+  const unsigned select = SelectEndpointUnlocked(candidates);
+  if (select == 0)
+    return;
+  LogCvmfs(kLogDownload, kLogDebug,
+           "switching proxy from %s to %s (latency-aware selection)",
+           (*group)[0].url.c_str(), (*group)[select].url.c_str());
+  swap((*group)[select], (*group)[0]);
+}
+
+
+/**
+ * Selects the active host among the hosts that are not known to be down.
+ * Hosts are only scored on direct connections; behind a proxy, the time to
+ * first byte depends mostly on the proxy's cache.  After a host failover, the
+ * backup host stays active until the host reset.
+ */
+void DownloadManager::SelectHostUnlocked() {
+  if (!opt_host_chain_ || (opt_host_chain_->size() < 2) ||
+      (opt_timestamp_backup_host_ > 0))
+  {
+    return;
+  }
+  if (opt_proxy_groups_ &&
+      ((*opt_proxy_groups_)[opt_proxy_groups_current_][0].url != "DIRECT"))
+  {
+    return;
+  }
+
+  vector<unsigned> indexes;
+  vector<string> candidates;
+  indexes.push_back(opt_host_chain_current_);
+  candidates.push_back((*opt_host_chain_)[opt_host_chain_current_]);
+  for (unsigned i = 0; i < opt_host_chain_->size(); ++i) {
+    if ((i == opt_host_chain_current_) ||
+        ((*opt_host_chain_rtt_)[i] == kProbeDown))
+    {
+      continue;
+    }
+    indexes.push_back(i);
+    candidates.push_back((*opt_host_chain_)[i]);
+  }
+  const unsigned select = SelectEndpointUnlocked(candidates);
+  if (select == 0)
+    return;
+  LogCvmfs(kLogDownload, kLogDebug,
+           "switching host from %s to %s (latency-aware selection)",
+           candidates[0].c_str(), candidates[select].c_str());
+  opt_host_chain_current_ = indexes[select];
+}
+
+
 /**
  * Switches to the next load-balancing group of proxy servers.
  */
@@ -2695,6 +3850,145 @@ void DownloadManager::EnableRedirects() {
 }
 
 
+/**
+ * Downloads objects larger than one segment with up to num_streams parallel
+ * range requests.  Fewer than two streams disable parallel range downloads.
+ */
+void DownloadManager::SetParallelRanges(const unsigned num_streams,
+                                        const unsigned segment_size)
+{
+  MutexLockGuard m(lock_options_);
+  opt_parallel_streams_ = num_streams;
+  opt_parallel_segment_ =
+    (segment_size == 0) ? kDefaultParallelSegment : segment_size;
+}
+
+
+/**
+ * Returns false and stays with HTTP/1.1 if libcurl is built without HTTP/2
+ * support, i.e. without nghttp2.  This is the case for the bundled libcurl, so
+ * the option only has an effect if cvmfs is linked against a system libcurl
+ * with nghttp2.  Even then, only direct https requests use HTTP/2; requests
+ * through proxies stay on HTTP/1.1.  Must be called before the first download.
+ * With the bundled libcurl, the Http2Multiplexing unit test is skipped.
+ */
+bool DownloadManager::EnableHttp2() {
+  curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+  if ((info->features & CURL_VERSION_HTTP2) == 0) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+             "libcurl %s does not support HTTP/2, using HTTP/1.1",
+             info->version);
+    return false;
+  }
+  enable_http2_ = true;
+  curl_multi_setopt(curl_multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  return true;
+}
+
+
+/**
+ * Selects proxies and hosts by their measured time to first byte and
+ * throughput, reconsidering the selection every interval seconds.  An
+ * interval of zero switches back to random proxy selection and the fixed host
+ * order.
+ */
+void DownloadManager::EnableLatencySelection(
+  const unsigned interval,
+  const unsigned explore_percent)
+{
+  MutexLockGuard m(lock_options_);
+  opt_latency_interval_ = interval;
+  opt_latency_explore_ = std::min(explore_percent, 100U);
+  opt_timestamp_latency_ = 0;
+  endpoint_scores_.Clear();
+}
+
+
+/**
+ * Hedges latency-critical downloads that did not receive a response within
+ * the given percentile of the recent times to first byte.  At most
+ * budget_percent of the latency-critical downloads are duplicated on average.
+ * A percentile of zero disables hedging.  Hedging requires the I/O thread,
+ * i.e. Spawn().
+ */
+void DownloadManager::EnableHedging(
+  const unsigned percentile,
+  const unsigned budget_percent)
+{
+  MutexLockGuard m(lock_options_);
+  opt_hedge_percentile_ = std::min(percentile, 100U);
+  opt_hedge_budget_ = std::min(budget_percent, 100U);
+}
+
+
+/**
+ * Stores resolved proxy names in the given file, typically in the cache
+ * directory, and takes names from there until their DNS TTL expires.  Should
+ * be set before the proxy chain.
+ */
+bool DownloadManager::SetDnsCache(const string &path) {
+  dns::HostCache *cache = dns::HostCache::Create(path);
+  if (cache == NULL)
+    return false;
+  MutexLockGuard m(lock_options_);
+  delete dns_cache_;
+  dns_cache_ = cache;
+  resolver_->set_cache(dns_cache_);
+  return true;
+}
+
+
+/**
+ * Proxy addresses whose DNS TTL expired less than max_stale_seconds ago are
+ * used further while a background thread resolves the name again.  Together
+ * with the DNS cache, a remount can start with the cached addresses without
+ * waiting for the DNS server.  Zero disables the stale mode.  The refresh
+ * thread is started by Spawn(), so the stale mode needs to be enabled before.
+ * Without the refresh thread, expired proxy addresses are resolved in the
+ * calling thread as before.
+ */
+void DownloadManager::EnableStaleDns(const unsigned max_stale_seconds) {
+  MutexLockGuard m(lock_options_);
+  opt_dns_max_stale_ = max_stale_seconds;
+  resolver_->set_max_stale(max_stale_seconds);
+}
+
+
+/**
+ * A resolver with the same settings as resolver_ for the refresh thread.  It
+ * does not accept stale cache entries.
+ */
+dns::NormalResolver *DownloadManager::CloneResolverUnlocked() {
+  dns::NormalResolver *resolver = dns::NormalResolver::Create(
+    opt_ipv4_only_, resolver_->retries(), resolver_->timeout_ms());
+  assert(resolver);
+  if (!opt_dns_server_.empty()) {
+    bool retval = resolver->SetResolvers(resolver_->resolvers());
+    assert(retval);
+  }
+  resolver->set_min_ttl(resolver_->min_ttl());
+  resolver->set_max_ttl(resolver_->max_ttl());
+  resolver->set_throttle(resolver_->throttle());
+  resolver->set_cache(dns_cache_);
+  return resolver;
+}
+
+
+/**
+ * Returns false if latency-aware selection is disabled.
+ */
+bool DownloadManager::GetEndpointScores(
+  vector<string> *endpoints,
+  vector<EndpointScores::Score> *scores)
+{
+  MutexLockGuard m(lock_options_);
+  if (opt_latency_interval_ == 0)
+    return false;
+  endpoint_scores_.GetScores(endpoints, scores);
+  return true;
+}
+
+
 /**
  * Creates a copy of the existing download manager.  Must only be called in
  * single-threaded stage because it calls curl_global_init().
@@ -2717,6 +4011,18 @@ DownloadManager *DownloadManager::Clone(perf::StatisticsTemplate statistics) {
   clone->opt_backoff_max_ms_ = opt_backoff_max_ms_;
   clone->enable_info_header_ = enable_info_header_;
   clone->follow_redirects_ = follow_redirects_;
+  clone->opt_parallel_streams_ = opt_parallel_streams_;
+  clone->opt_parallel_segment_ = opt_parallel_segment_;
+  if (enable_http2_)
+    clone->EnableHttp2();
+  clone->opt_latency_interval_ = opt_latency_interval_;
+  clone->opt_latency_explore_ = opt_latency_explore_;
+  clone->opt_hedge_percentile_ = opt_hedge_percentile_;
+  clone->opt_hedge_budget_ = opt_hedge_budget_;
+  if (dns_cache_)
+    clone->SetDnsCache(dns_cache_->path());
+  if (opt_dns_max_stale_ > 0)
+    clone->EnableStaleDns(opt_dns_max_stale_);
   if (opt_host_chain_) {
     clone->opt_host_chain_ = new vector<string>(*opt_host_chain_);
     clone->opt_host_chain_rtt_ = new vector<int>(*opt_host_chain_rtt_);
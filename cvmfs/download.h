@@ -11,6 +11,8 @@
 #include <unistd.h>
 
 #include <cstdio>
+#include <deque>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -25,10 +27,14 @@
 #include "prng.h"
 #include "sink.h"
 #include "statistics.h"
+#include "util/async.h"
+#include "util/single_copy.h"
 
 
 namespace download {
 
+class JobBatch;
+
 /**
  * Possible return values.  Adjust ObjectFetcher error handling if new network
  * error conditions are added.
@@ -126,6 +132,15 @@ struct Counters {
   perf::Counter *n_retries;
   perf::Counter *n_proxy_failover;
   perf::Counter *n_host_failover;
+  perf::Counter *n_parallel_downloads;
+  perf::Counter *n_parallel_parts;
+  perf::Counter *n_parallel_fallbacks;
+  perf::Counter *n_connections;
+  perf::Counter *n_connections_reused;
+  perf::Counter *n_http2_requests;
+  perf::Counter *n_hedges_fired;
+  perf::Counter *n_hedges_won;
+  perf::Counter *n_dns_refreshes;
 
   explicit Counters(perf::StatisticsTemplate statistics) {
     sz_transferred_bytes = statistics.RegisterTemplated("sz_transferred_bytes",
@@ -139,6 +154,24 @@ struct Counters {
         "Number of proxy failovers");
     n_host_failover = statistics.RegisterTemplated("n_host_failover",
         "Number of host failovers");
+    n_parallel_downloads = statistics.RegisterTemplated("n_parallel_downloads",
+        "Number of downloads split into parallel range requests");
+    n_parallel_parts = statistics.RegisterTemplated("n_parallel_parts",
+        "Number of parallel range requests");
+    n_parallel_fallbacks = statistics.RegisterTemplated("n_parallel_fallbacks",
+        "Number of parallel downloads restarted as a single request");
+    n_connections = statistics.RegisterTemplated("n_connections",
+        "Number of new HTTP connections");
+    n_connections_reused = statistics.RegisterTemplated("n_connections_reused",
+        "Number of HTTP requests sent over an existing connection");
+    n_http2_requests = statistics.RegisterTemplated("n_http2_requests",
+        "Number of HTTP requests served with HTTP/2");
+    n_hedges_fired = statistics.RegisterTemplated("n_hedges_fired",
+        "Number of duplicate requests for slow latency-critical downloads");
+    n_hedges_won = statistics.RegisterTemplated("n_hedges_won",
+        "Number of downloads completed by the duplicate request");
+    n_dns_refreshes = statistics.RegisterTemplated("n_dns_refreshes",
+        "Number of proxy names resolved in the background while stale");
   }
 };  // Counters
 
@@ -153,6 +186,16 @@ struct JobInfo {
   bool head_request;
   bool follow_redirects;
   bool force_nocache;
+  /**
+   * Catalogs, manifests, and small objects: the request may be hedged, see
+   * DownloadManager::EnableHedging()
+   */
+  bool latency_critical;
+  /**
+   * Size of the object if known, 0 otherwise.  Only objects known to be larger
+   * than one segment are downloaded with parallel range requests.
+   */
+  uint64_t expected_size;
   pid_t pid;
   uid_t uid;
   gid_t gid;
@@ -181,6 +224,8 @@ struct JobInfo {
     head_request = false;
     follow_redirects = false;
     force_nocache = false;
+    latency_critical = false;
+    expected_size = 0;
     pid = -1;
     uid = -1;
     gid = -1;
@@ -207,6 +252,18 @@ struct JobInfo {
     range_offset = -1;
     range_size = -1;
     http_code = -1;
+
+    range_parallel = false;
+    range_done = false;
+    range_total = 0;
+    range_next = 0;
+    range_parent = NULL;
+
+    hedge_deadline_ms = 0;
+    hedge = NULL;
+    hedge_parent = NULL;
+
+    batch = NULL;
   }
 
   // One constructor per destination + head request
@@ -276,6 +333,7 @@ struct JobInfo {
   shash::ContextPtr hash_context;
   int wait_at[2];  /**< Pipe used for the return value */
   std::string proxy;
+  std::string host;  /**< Host chain entry, empty without probe_hosts */
   bool nocache;
   Failures error_code;
   int http_code;
@@ -283,6 +341,25 @@ struct JobInfo {
   unsigned char num_used_hosts;
   unsigned char num_retries;
   unsigned backoff_ms;
+
+  // Parallel range downloads, see DownloadManager::SetParallelRanges()
+  bool range_parallel;  /**< The first request is limited to one segment */
+  /**
+   * In the download job: the first segment is received.  In a part: the part
+   * is received or failed.
+   */
+  bool range_done;
+  uint64_t range_total;  /**< Object size according to Content-Range */
+  uint64_t range_next;  /**< Offset of the next part to request */
+  std::vector<JobInfo *> range_parts;  /**< Parts in flight or buffered */
+  JobInfo *range_parent;  /**< In a part: the download job */
+
+  // Hedged requests, see DownloadManager::EnableHedging()
+  uint64_t hedge_deadline_ms;  /**< When to send the duplicate request */
+  JobInfo *hedge;  /**< In the download job: the duplicate request in flight */
+  JobInfo *hedge_parent;  /**< In a duplicate request: the download job */
+
+  JobBatch *batch;  /**< Set by DownloadManager::Submit() */
 };  // JobInfo
 
 
@@ -333,12 +410,133 @@ class CredentialsAttachment {
 };
 
 
+/**
+ * Keeps exponentially weighted moving averages of the time to first byte and
+ * of the throughput of proxies and hosts.  Endpoints are compared by the
+ * estimated time to download an object of kReferenceSize bytes.  Failed
+ * transfers count as a time to first byte of the given penalty.  Not
+ * thread-safe.
+ */
+class EndpointScores {
+ public:
+  /**
+   * Weight of a new sample in the moving averages.
+   */
+  static const unsigned kWeightPercent = 30;
+  /**
+   * Smaller transfers are dominated by the time to first byte and do not
+   * update the throughput.
+   */
+  static const unsigned kMinThroughputSize = 64 * 1024;
+  static const unsigned kReferenceSize = 256 * 1024;
+
+  struct Score {
+    Score() : ttfb_ms(0.0), throughput(0.0), num_samples(0), num_failures(0)
+    { }
+    double Cost() const;
+    double ttfb_ms;
+    double throughput;  ///< bytes per second, 0 if not yet measured
+    uint64_t num_samples;
+    uint64_t num_failures;
+  };
+
+  void AddSample(const std::string &endpoint, const double ttfb_ms,
+                 const uint64_t size, const double transfer_ms);
+  void AddFailure(const std::string &endpoint, const double penalty_ms);
+  double GetCost(const std::string &endpoint) const;
+  void GetScores(std::vector<std::string> *endpoints,
+                 std::vector<Score> *scores) const;
+  void Clear() { scores_.clear(); }
+
+ private:
+  static double Average(const double average, const double sample);
+
+  std::map<std::string, Score> scores_;
+};
+
+
+/**
+ * Keeps the last kWindowSize times to first byte in milliseconds and computes
+ * percentiles over them.  Not thread-safe.
+ */
+class LatencyWindow {
+ public:
+  static const unsigned kWindowSize = 256;
+
+  LatencyWindow() : num_samples_(0) { }
+  void Add(const unsigned ms);
+  unsigned GetPercentile(const unsigned percentile) const;
+  unsigned size() const { return samples_.size(); }
+
+ private:
+  std::vector<unsigned> samples_;
+  uint64_t num_samples_;
+};
+
+
+/**
+ * A group of download jobs that are processed asynchronously by the I/O thread
+ * of a DownloadManager, see DownloadManager::Submit().  At most max_in_flight
+ * jobs of the batch are transferred at the same time (unlimited if zero), the
+ * others wait in the I/O thread.  Completed jobs are either passed to the
+ * callback, which runs in the I/O thread and must not block, or queued until
+ * they are collected by WaitNext().  The batch must outlive its jobs.
+ */
+class JobBatch : SingleCopy, public Callbackable<JobInfo *> {
+  friend class DownloadManager;
+
+ public:
+  struct Statistics {
+    Statistics()
+      : num_submitted(0), num_completed(0), num_failed(0)
+      , sz_transferred_bytes(0), elapsed_ms(0)
+    { }
+    uint64_t num_submitted;
+    uint64_t num_completed;
+    uint64_t num_failed;
+    uint64_t sz_transferred_bytes;  ///< Including failed and retried requests
+    uint64_t elapsed_ms;  ///< Time with outstanding jobs
+  };
+
+  explicit JobBatch(const unsigned max_in_flight);
+  /**
+   * Takes ownership of the callback.
+   */
+  JobBatch(const unsigned max_in_flight, CallbackTN *callback);
+  ~JobBatch();
+
+  JobInfo *WaitNext();
+  void Wait();
+  Statistics GetStatistics();
+  unsigned max_in_flight() const { return max_in_flight_; }
+
+ private:
+  void Init();
+  void Enqueue();
+  void Complete(JobInfo *info);
+  void AddTransferredBytes(const uint64_t nbytes);
+
+  const unsigned max_in_flight_;
+  CallbackTN *callback_;
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+  std::deque<JobInfo *> completed_;  /**< Not yet collected by WaitNext() */
+  Statistics statistics_;
+  uint64_t timestamp_start_ms_;
+
+  // Only touched by the I/O thread
+  unsigned num_in_flight_;
+  std::deque<JobInfo *> waiting_;  /**< Jobs beyond max_in_flight */
+};
+
+
 /**
  * Note when adding new fields: Clone() probably needs to be adjusted, too.
  */
 class DownloadManager {
   FRIEND_TEST(T_Download, ValidateGeoReply);
   FRIEND_TEST(T_Download, StripDirect);
+  FRIEND_TEST(T_Download, LatencySelection);
 
  public:
   struct ProxyInfo {
@@ -380,6 +578,24 @@ class DownloadManager {
 
   static const unsigned kDnsDefaultRetries = 1;
   static const unsigned kDnsDefaultTimeoutMs = 3000;
+  static const unsigned kDefaultParallelSegment = 4 * 1024 * 1024;
+  /**
+   * With latency-aware selection, the active proxy or host is only replaced
+   * by an endpoint that is faster by at least this margin.
+   */
+  static const unsigned kLatencyHysteresisPercent = 20;
+  /**
+   * Duplicate requests buffer the object in memory up to this size.
+   */
+  static const unsigned kMaxHedgeMemSize = 16 * 1024 * 1024;
+  /**
+   * Requests are hedged once as many times to first byte are known.
+   */
+  static const unsigned kMinHedgeSamples = 16;
+  /**
+   * Upper bound of the hedge budget that can be saved up.
+   */
+  static const unsigned kMaxHedgeTokens = 10;
 
   DownloadManager();
   ~DownloadManager();
@@ -393,6 +609,7 @@ class DownloadManager {
   void Spawn();
   DownloadManager *Clone(perf::StatisticsTemplate statistics);
   Failures Fetch(JobInfo *info);
+  void Submit(JobBatch *batch, JobInfo *info);
 
   void SetCredentialsAttachment(CredentialsAttachment *ca);
   std::string GetDnsServer() const;
@@ -435,6 +652,16 @@ class DownloadManager {
   void SetProxyTemplates(const std::string &direct, const std::string &forced);
   void EnableInfoHeader();
   void EnableRedirects();
+  void SetParallelRanges(const unsigned num_streams,
+                         const unsigned segment_size);
+  bool EnableHttp2();
+  void EnableLatencySelection(const unsigned interval,
+                              const unsigned explore_percent);
+  bool GetEndpointScores(std::vector<std::string> *endpoints,
+                         std::vector<EndpointScores::Score> *scores);
+  void EnableHedging(const unsigned percentile, const unsigned budget_percent);
+  bool SetDnsCache(const std::string &path);
+  void EnableStaleDns(const unsigned max_stale_seconds);
 
   unsigned num_hosts() {
     if (opt_host_chain_) return opt_host_chain_->size();
@@ -449,6 +676,7 @@ class DownloadManager {
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
   static void *MainDownload(void *data);
+  static void *MainDnsRefresh(void *data);
 
   bool StripDirect(const std::string &proxy_list, std::string *cleaned_list);
   bool ValidateGeoReply(const std::string &reply_order,
@@ -457,18 +685,42 @@ class DownloadManager {
   void SwitchHost(JobInfo *info);
   void SwitchProxy(JobInfo *info);
   void RebalanceProxiesUnlocked();
+  unsigned SelectEndpointUnlocked(const std::vector<std::string> &candidates);
+  void SelectProxyUnlocked(const unsigned num_candidates);
+  void SelectHostUnlocked();
   CURL *AcquireCurlHandle();
   void ReleaseCurlHandle(CURL *handle);
   void ReleaseCredential(JobInfo *info);
   void InitializeRequest(JobInfo *info, CURL *handle);
   void SetUrlOptions(JobInfo *info);
   void ValidateProxyIpsUnlocked(const std::string &url, const dns::Host &host);
+  void UpdateProxyHostUnlocked(const std::string &url,
+                               const dns::Host &host,
+                               const dns::Host &resolved_host);
+  dns::NormalResolver *CloneResolverUnlocked();
   void UpdateStatistics(CURL *handle);
+  void UpdateScores(const JobInfo *info, const Failures error);
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
   void SetNocache(JobInfo *info);
   void SetRegularCache(JobInfo *info);
   bool VerifyAndFinalize(const int curl_error, JobInfo *info);
+  bool RewindDestination(JobInfo *info);
+  bool CompleteJob(const int curl_error, JobInfo *info);
+  void StartJob(JobInfo *info);
+  bool FinalizeBatchJob(JobInfo *info);
+  void InitializeRangeParallel(JobInfo *info);
+  bool ScheduleRangeParts();
+  void FinalizeRangePart(const int curl_error, JobInfo *part);
+  void AbortRangeParts(JobInfo *info);
+  bool DrainRangeParts(JobInfo *info);
+  bool FallbackRangeParallel(JobInfo *info);
+  void InitializeHedge(JobInfo *info);
+  bool ScheduleHedges();
+  bool FinalizeHedge(const int curl_error, JobInfo *hedge);
+  void SettleHedge(const int curl_error, JobInfo *info);
+  void DiscardHedge(JobInfo *hedge);
+  void RecordTtfb(CURL *handle);
   void InitHeaders();
   void FiniHeaders();
   void CloneProxyConfig(DownloadManager *clone);
@@ -506,6 +758,59 @@ class DownloadManager {
   bool follow_redirects_;
   bool use_system_proxy_;
 
+  /**
+   * Large objects can be downloaded by several concurrent range requests.  The
+   * first request asks for the first segment and reveals the object size;
+   * the rest of the object is requested in segment-sized parts with at most
+   * opt_parallel_streams_ requests in flight.  Disabled if smaller than 2.
+   */
+  unsigned opt_parallel_streams_;
+  unsigned opt_parallel_segment_;
+  /**
+   * Download jobs in parallel range mode.  Only used by the I/O thread.
+   */
+  std::vector<JobInfo *> range_jobs_;
+
+  /**
+   * With HTTP/2, concurrent requests to the same host share a single
+   * connection as multiplexed streams instead of opening one connection each.
+   * HTTP/2 is negotiated during the TLS handshake, so it applies only to https
+   * hosts.  Plain http requests and requests through proxies use HTTP/1.1.
+   */
+  bool enable_http2_;
+
+  /**
+   * If opt_latency_interval_ is > 0, the proxy within the current
+   * load-balancing group and, without a proxy, the host are selected by their
+   * endpoint scores instead of randomly or in fixed order.  The selection is
+   * reconsidered every opt_latency_interval_ seconds.  Endpoints without
+   * measurements are preferred, so that every endpoint gets measured once.  In
+   * opt_latency_explore_ percent of the selections, a random endpoint is
+   * picked in order to refresh the scores of the others.
+   */
+  unsigned opt_latency_interval_;
+  unsigned opt_latency_explore_;
+  time_t opt_timestamp_latency_;
+  EndpointScores endpoint_scores_;
+
+  /**
+   * If a latency-critical download job did not receive a response within the
+   * opt_hedge_percentile_ percentile of the recent times to first byte, the
+   * same object is requested from the next proxy or host and the first
+   * complete response is taken.  Every latency-critical job adds
+   * opt_hedge_budget_ percent of a token to the hedge budget; a duplicate
+   * request costs one token.  Disabled if opt_hedge_percentile_ is zero.
+   */
+  unsigned opt_hedge_percentile_;
+  unsigned opt_hedge_budget_;
+  /**
+   * Hedging state, only used by the I/O thread.
+   */
+  double hedge_tokens_;
+  unsigned hedge_threshold_ms_;
+  LatencyWindow hedge_ttfb_;
+  std::vector<JobInfo *> hedge_jobs_;  /**< Jobs that may still be hedged */
+
   // Host list
   std::vector<std::string> *opt_host_chain_;
   /**
@@ -549,6 +854,25 @@ class DownloadManager {
    */
   dns::NormalResolver *resolver_;
 
+  /**
+   * Optional on-disk cache of resolved proxy names, see SetDnsCache()
+   */
+  dns::HostCache *dns_cache_;
+
+  /**
+   * Expired proxy addresses are used for up to opt_dns_max_stale_ seconds
+   * while the refresh thread resolves the name again, see EnableStaleDns().
+   * Like the I/O thread, the refresh thread is started by Spawn().
+   * The queue and the pending host ids are protected by lock_options_.
+   */
+  unsigned opt_dns_max_stale_;
+  pthread_t thread_dns_refresh_;
+  bool dns_refresh_spawned_;
+  bool dns_refresh_terminate_;
+  pthread_cond_t cond_dns_refresh_;
+  std::vector<ProxyInfo> dns_refresh_queue_;
+  std::set<int64_t> dns_refresh_pending_;
+
   /**
    * If a proxy has IPv4 and IPv6 addresses, which one to prefer
    */
@@ -7,6 +7,8 @@
 
 #include <unistd.h>
 
+#include <cstring>
+
 #include "backoff.h"
 #include "cache.h"
 #include "clientctx.h"
@@ -48,7 +50,6 @@ void TLSDestructor(void *data) {
  * removes the pointer to it from tls_blocks_.
  */
 void Fetcher::CleanupTls(ThreadLocalStorage *tls) {
-  ClosePipe(tls->pipe_wait);
   delete tls;
 }
 
@@ -64,7 +65,6 @@ Fetcher::ThreadLocalStorage *Fetcher::GetTls() {
 
   tls = new ThreadLocalStorage();
   tls->fetcher = this;
-  MakePipe(tls->pipe_wait);
   tls->download_job.destination = download::kDestinationSink;
   tls->download_job.compressed = true;
   tls->download_job.probe_hosts = true;
@@ -78,6 +78,17 @@ Fetcher::ThreadLocalStorage *Fetcher::GetTls() {
 }
 
 
+/**
+ * The object id is a cryptographic hash, so its first bytes are uniformly
+ * distributed.
+ */
+Fetcher::WaitShard *Fetcher::GetWaitShard(const shash::Any &id) {
+  uint32_t bucket;
+  memcpy(&bucket, id.digest, sizeof(bucket));
+  return &wait_shards_[bucket % kNumWaitShards];
+}
+
+
 int Fetcher::Fetch(
   const shash::Any &id,
   const uint64_t size,
@@ -97,17 +108,21 @@ int Fetcher::Fetch(
   }
 
   ThreadLocalStorage *tls = GetTls();
+  WaitShard *shard = GetWaitShard(id);
 
   // Synchronization point: either act as a master thread for this object or
   // enqueue to the list of waiting threads.
-  pthread_mutex_lock(lock_queues_download_);
-  ThreadQueues::iterator iDownloadQueue = queues_download_.find(id);
-  if (iDownloadQueue != queues_download_.end()) {
+  pthread_mutex_lock(&shard->lock);
+  ThreadQueues::iterator iDownloadQueue = shard->queues.find(id);
+  if (iDownloadQueue != shard->queues.end()) {
     LogCvmfs(kLogCache, kLogDebug, "waiting for download of %s", name.c_str());
 
-    iDownloadQueue->second->push_back(tls->pipe_wait[1]);
-    pthread_mutex_unlock(lock_queues_download_);
-    ReadPipe(tls->pipe_wait[0], &fd_return, sizeof(int));
+    Waiter waiter;
+    iDownloadQueue->second->push_back(&waiter);
+    while (!waiter.done)
+      pthread_cond_wait(&shard->cond, &shard->lock);
+    pthread_mutex_unlock(&shard->lock);
+    fd_return = waiter.fd;
 
     LogCvmfs(kLogCache, kLogDebug, "received from another thread fd %d for %s",
              fd_return, name.c_str());
@@ -116,13 +131,13 @@ int Fetcher::Fetch(
     // Seems we are the first one, check again in the cache (race condition)
     fd_return = OpenSelect(id, name, object_type);
     if (fd_return >= 0) {
-      pthread_mutex_unlock(lock_queues_download_);
+      pthread_mutex_unlock(&shard->lock);
       return fd_return;
     }
 
     // Create a new queue for this chunk
-    queues_download_[id] = &tls->other_pipes_waiting;
-    pthread_mutex_unlock(lock_queues_download_);
+    shard->queues[id] = &tls->other_waiters;
+    pthread_mutex_unlock(&shard->lock);
   }
 
   perf::Inc(n_downloads);
@@ -160,6 +175,13 @@ int Fetcher::Fetch(
   tls->download_job.compressed = (compression_algorithm == zlib::kZlibDefault);
   tls->download_job.range_offset = range_offset;
   tls->download_job.range_size = size;
+  tls->download_job.latency_critical =
+    (object_type == CacheManager::kTypeCatalog) ||
+    (size <= kMaxLatencyCriticalSize);
+  // Catalogs are fetched with an unknown size; they must not be downloaded in
+  // parallel range mode
+  tls->download_job.expected_size =
+    (size == CacheManager::kSizeUnknown) ? 0 : size;
   download_mgr_->Fetch(&tls->download_job);
 
   if (tls->download_job.error_code == download::kFailOk) {
@@ -201,7 +223,6 @@ Fetcher::Fetcher(
   perf::StatisticsTemplate statistics,
   bool external)
   : external_(external)
-  , lock_queues_download_(NULL)
   , lock_tls_blocks_(NULL)
   , cache_mgr_(cache_mgr)
   , download_mgr_(download_mgr)
@@ -210,10 +231,6 @@ Fetcher::Fetcher(
   int retval;
   retval = pthread_key_create(&thread_local_storage_, TLSDestructor);
   assert(retval == 0);
-  lock_queues_download_ = reinterpret_cast<pthread_mutex_t *>(
-    smalloc(sizeof(pthread_mutex_t)));
-  retval = pthread_mutex_init(lock_queues_download_, NULL);
-  assert(retval == 0);
   lock_tls_blocks_ = reinterpret_cast<pthread_mutex_t *>(
     smalloc(sizeof(pthread_mutex_t)));
   retval = pthread_mutex_init(lock_tls_blocks_, NULL);
@@ -236,10 +253,6 @@ Fetcher::~Fetcher() {
   assert(retval == 0);
   free(lock_tls_blocks_);
 
-  retval = pthread_mutex_destroy(lock_queues_download_);
-  assert(retval == 0);
-  free(lock_queues_download_);
-
   retval = pthread_key_delete(thread_local_storage_);
   assert(retval == 0);
 }
@@ -263,18 +276,44 @@ int Fetcher::OpenSelect(
 }
 
 
+/**
+ * Hands out a duplicate of the file descriptor (or the error code) to every
+ * thread that waits for the download of id and wakes them up.
+ */
 void Fetcher::SignalWaitingThreads(
   const int fd,
   const shash::Any &id,
   ThreadLocalStorage *tls)
 {
-  MutexLockGuard m(lock_queues_download_);
-  for (unsigned i = 0, s = tls->other_pipes_waiting.size(); i < s; ++i) {
-    int fd_dup = (fd >= 0) ? cache_mgr_->Dup(fd) : fd;
-    WritePipe(tls->other_pipes_waiting[i], &fd_dup, sizeof(int));
+  WaitShard *shard = GetWaitShard(id);
+  MutexLockGuard m(&shard->lock);
+  for (unsigned i = 0, s = tls->other_waiters.size(); i < s; ++i) {
+    Waiter *waiter = tls->other_waiters[i];
+    waiter->fd = (fd >= 0) ? cache_mgr_->Dup(fd) : fd;
+    waiter->done = true;
   }
-  tls->other_pipes_waiting.clear();
-  queues_download_.erase(id);
+  if (!tls->other_waiters.empty()) {
+    int retval = pthread_cond_broadcast(&shard->cond);
+    assert(retval == 0);
+  }
+  tls->other_waiters.clear();
+  shard->queues.erase(id);
+}
+
+
+Fetcher::WaitShard::WaitShard() {
+  int retval = pthread_mutex_init(&lock, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond, NULL);
+  assert(retval == 0);
+}
+
+
+Fetcher::WaitShard::~WaitShard() {
+  int retval = pthread_cond_destroy(&cond);
+  assert(retval == 0);
+  retval = pthread_mutex_destroy(&lock);
+  assert(retval == 0);
 }
 
 }  // namespace cvmfs
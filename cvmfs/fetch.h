@@ -60,6 +60,7 @@ class TransactionSink : public Sink {
  */
 class Fetcher : SingleCopy {
   FRIEND_TEST(T_Fetcher, GetTls);
+  FRIEND_TEST(T_Fetcher, FetchSizeUnknown);
   FRIEND_TEST(T_Fetcher, SignalWaitingThreads);
   friend void *TestGetTls(void *data);
   friend void *TestFetchCollapse(void *data);
@@ -86,15 +87,25 @@ class Fetcher : SingleCopy {
   download::DownloadManager *download_mgr() { return download_mgr_; }
 
  private:
+  /**
+   * A thread that waits for another thread to download the same object.  The
+   * downloading thread sets the file descriptor and the done flag under the
+   * lock of the wait shard and then wakes up the waiting threads of the shard.
+   */
+  struct Waiter {
+    Waiter() : fd(-1), done(false) { }
+    int fd;
+    bool done;
+  };
+
   /**
    * Multiple threads might want to download the same object at the same time.
    * If that happens, only the first thread performs the download.  The other
-   * threads wait on a pipe for a notification from the first thread.
+   * threads wait on the condition variable of the object's wait shard for a
+   * notification from the first thread.
    */
   struct ThreadLocalStorage {
     ThreadLocalStorage() {
-      pipe_wait[0] = -1;
-      pipe_wait[1] = -1;
       fetcher = NULL;
     }
 
@@ -103,15 +114,9 @@ class Fetcher : SingleCopy {
      */
     Fetcher *fetcher;
     /**
-     * Wait on the reading end if another thread is already downloading the same
-     * object.
-     */
-    int pipe_wait[2];
-    /**
-     * Writer ends of all the pipes of threads that want to download the same
-     * object.
+     * All the threads that want to download the same object.
      */
-    std::vector<int> other_pipes_waiting;
+    std::vector<Waiter *> other_waiters;
     /**
      * It is sufficient to construct the JobInfo object once per thread, not
      * on every call to Fetch().
@@ -120,15 +125,36 @@ class Fetcher : SingleCopy {
   };
 
   /**
-   * Maps currently downloaded chunks to the other_pipes_waiting member of the
+   * Maps currently downloaded chunks to the other_waiters member of the
    * thread local storage of the downloading thread.  This way, a thread can
-   * enqueue itself to such an other_pipes_waiting list and gets informed when
+   * enqueue itself to such an other_waiters list and gets informed when
    * the download is completed.
    */
-  typedef std::map< shash::Any, std::vector<int> * > ThreadQueues;
+  typedef std::map< shash::Any, std::vector<Waiter *> * > ThreadQueues;
+
+  /**
+   * The download queues are distributed over shards by the object id, so that
+   * collapsing the downloads of many different objects does not contend on a
+   * single lock.  Waiting threads sleep on the condition variable of their
+   * shard; no file descriptors are involved.
+   */
+  struct WaitShard {
+    WaitShard();
+    ~WaitShard();
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ThreadQueues queues;
+  };
+  static const unsigned kNumWaitShards = 32;
+  /**
+   * Downloads of catalogs and of objects up to this size are latency-critical,
+   * i.e. they can be hedged by the download manager.
+   */
+  static const uint64_t kMaxLatencyCriticalSize = 128 * 1024;
 
   ThreadLocalStorage *GetTls();
   void CleanupTls(ThreadLocalStorage *tls);
+  WaitShard *GetWaitShard(const shash::Any &id);
   void SignalWaitingThreads(const int fd, const shash::Any &id,
                             ThreadLocalStorage *tls);
   int OpenSelect(const shash::Any &id,
@@ -147,8 +173,7 @@ class Fetcher : SingleCopy {
    */
   pthread_key_t thread_local_storage_;
 
-  ThreadQueues queues_download_;
-  pthread_mutex_t *lock_queues_download_;
+  WaitShard wait_shards_[kNumWaitShards];
 
   /**
    * All the threads register their thread local storage here, so that it can
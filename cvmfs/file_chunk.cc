@@ -66,10 +66,16 @@ shash::Any FileChunkReflist::HashChunkList() {
 
 
 void ChunkTables::InitLocks() {
-  lock =
-    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
-  int retval = pthread_mutex_init(lock, NULL);
-  assert(retval == 0);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    handle_shards[i].lock =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+    int retval = pthread_mutex_init(handle_shards[i].lock, NULL);
+    assert(retval == 0);
+    inode_shards[i].lock =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+    retval = pthread_mutex_init(inode_shards[i].lock, NULL);
+    assert(retval == 0);
+  }
 
   for (unsigned i = 0; i < kNumHandleLocks; ++i) {
     pthread_mutex_t *m =
@@ -82,10 +88,12 @@ void ChunkTables::InitLocks() {
 
 
 void ChunkTables::InitHashmaps() {
-  handle2uniqino.Init(16, 0, hasher_uint64t);
-  handle2fd.Init(16, 0, hasher_uint64t);
-  inode2chunks.Init(16, 0, hasher_uint64t);
-  inode2references.Init(16, 0, hasher_uint64t);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    handle_shards[i].handle2uniqino.Init(16, 0, hasher_uint64t);
+    handle_shards[i].handle2fd.Init(16, 0, hasher_uint64t);
+    inode_shards[i].inode2chunks.Init(16, 0, hasher_uint64t);
+    inode_shards[i].inode2references.Init(16, 0, hasher_uint64t);
+  }
 }
 
 
@@ -98,8 +106,12 @@ ChunkTables::ChunkTables() {
 
 
 ChunkTables::~ChunkTables() {
-  pthread_mutex_destroy(lock);
-  free(lock);
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    pthread_mutex_destroy(handle_shards[i].lock);
+    free(handle_shards[i].lock);
+    pthread_mutex_destroy(inode_shards[i].lock);
+    free(inode_shards[i].lock);
+  }
   for (unsigned i = 0; i < kNumHandleLocks; ++i) {
     pthread_mutex_destroy(handle_locks.At(i));
     free(handle_locks.At(i));
@@ -119,10 +131,12 @@ ChunkTables &ChunkTables::operator= (const ChunkTables &other) {
   if (&other == this)
     return *this;
 
-  handle2uniqino.Clear();
-  handle2fd.Clear();
-  inode2chunks.Clear();
-  inode2references.Clear();
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    handle_shards[i].handle2uniqino.Clear();
+    handle_shards[i].handle2fd.Clear();
+    inode_shards[i].inode2chunks.Clear();
+    inode_shards[i].inode2references.Clear();
+  }
   CopyFrom(other);
   return *this;
 }
@@ -131,10 +145,12 @@ ChunkTables &ChunkTables::operator= (const ChunkTables &other) {
 void ChunkTables::CopyFrom(const ChunkTables &other) {
   assert(version == other.version);
   next_handle = other.next_handle;
-  inode2references = other.inode2references;
-  inode2chunks = other.inode2chunks;
-  handle2fd = other.handle2fd;
-  handle2uniqino = other.handle2uniqino;
+  for (unsigned i = 0; i < kNumShards; ++i) {
+    handle_shards[i].handle2uniqino = other.handle_shards[i].handle2uniqino;
+    handle_shards[i].handle2fd = other.handle_shards[i].handle2fd;
+    inode_shards[i].inode2chunks = other.inode_shards[i].inode2chunks;
+    inode_shards[i].inode2references = other.inode_shards[i].inode2references;
+  }
 }
 
 
@@ -147,6 +163,33 @@ pthread_mutex_t *ChunkTables::Handle2Lock(const uint64_t handle) const {
 }
 
 
+/**
+ * Uses a different seed than the hash maps inside the shard so that the keys
+ * of a shard still spread over the buckets of its maps.
+ */
+ChunkTables::HandleShard *ChunkTables::Handle2Shard(const uint64_t handle) {
+  return &handle_shards[MurmurHash2(&handle, sizeof(handle), 0x1fc2b5e3) %
+                        kNumShards];
+}
+
+
+ChunkTables::InodeShard *ChunkTables::Inode2Shard(const uint64_t inode) {
+  return &inode_shards[MurmurHash2(&inode, sizeof(inode), 0x1fc2b5e3) %
+                       kNumShards];
+}
+
+
+/**
+ * Not synchronized, used for progress messages during reload.
+ */
+uint64_t ChunkTables::GetNumHandles() const {
+  uint64_t result = 0;
+  for (unsigned i = 0; i < kNumShards; ++i)
+    result += handle_shards[i].handle2fd.size();
+  return result;
+}
+
+
 //------------------------------------------------------------------------------
 
 
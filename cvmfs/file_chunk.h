@@ -85,9 +85,52 @@ struct ChunkFd {
 
 
 /**
- * All chunk related data structures in the Fuse module.
+ * All chunk related data structures in the Fuse module.  The hash maps are
+ * split into shards, each with its own lock, so that concurrent reads of
+ * different chunked files do not contend on a single mutex.  The maps keyed by
+ * the chunk handle and the maps keyed by the inode are sharded independently.
+ * Operations that need to be atomic only ever span maps of the same key.
  */
 struct ChunkTables {
+  /**
+   * Maps of the chunk handles that fall into the same shard.
+   */
+  struct HandleShard {
+    inline void Lock() {
+      int retval = pthread_mutex_lock(lock);
+      assert(retval == 0);
+    }
+    inline void Unlock() {
+      int retval = pthread_mutex_unlock(lock);
+      assert(retval == 0);
+    }
+
+    // Versions < 4 of ChunkTables didn't have this map.  Therefore, after a
+    // hot patch a handle can be missing from this map.  In this case, the fuse
+    // module falls back to the inode passed by the kernel.
+    SmallHashDynamic<uint64_t, uint64_t> handle2uniqino;
+    SmallHashDynamic<uint64_t, ChunkFd> handle2fd;
+    pthread_mutex_t *lock;
+  };
+
+  /**
+   * Maps of the inodes that fall into the same shard.
+   */
+  struct InodeShard {
+    inline void Lock() {
+      int retval = pthread_mutex_lock(lock);
+      assert(retval == 0);
+    }
+    inline void Unlock() {
+      int retval = pthread_mutex_unlock(lock);
+      assert(retval == 0);
+    }
+
+    SmallHashDynamic<uint64_t, FileChunkReflist> inode2chunks;
+    SmallHashDynamic<uint64_t, uint32_t> inode2references;
+    pthread_mutex_t *lock;
+  };
+
   ChunkTables();
   ~ChunkTables();
   ChunkTables(const ChunkTables &other);
@@ -97,34 +140,26 @@ struct ChunkTables {
   void InitHashmaps();
 
   pthread_mutex_t *Handle2Lock(const uint64_t handle) const;
-
-  inline void Lock() {
-    int retval = pthread_mutex_lock(lock);
-    assert(retval == 0);
-  }
-
-  inline void Unlock() {
-    int retval = pthread_mutex_unlock(lock);
-    assert(retval == 0);
+  HandleShard *Handle2Shard(const uint64_t handle);
+  InodeShard *Inode2Shard(const uint64_t inode);
+  uint64_t NextHandle() {
+    return static_cast<uint64_t>(atomic_xadd64(&next_handle, 1));
   }
+  uint64_t GetNumHandles() const;
 
   // Version 2 --> 4: add handle2uniqino
-  static const unsigned kVersion = 4;
+  // Version 4 --> 5: sharded hash maps
+  static const unsigned kVersion = 5;
 
   int version;
   static const unsigned kNumHandleLocks = 128;
-  // Versions < 4 of ChunkTables didn't have this map.  Therefore, after a
-  // hot patch a handle can be missing from this map.  In this case, the fuse
-  // module falls back to the inode passed by the kernel.
-  SmallHashDynamic<uint64_t, uint64_t> handle2uniqino;
-  SmallHashDynamic<uint64_t, ChunkFd> handle2fd;
+  static const unsigned kNumShards = 32;
+  HandleShard handle_shards[kNumShards];
+  InodeShard inode_shards[kNumShards];
   // The file descriptors attached to handles need to be locked.
   // Using a hash map to survive with a small, fixed number of locks
   BigVector<pthread_mutex_t *> handle_locks;
-  SmallHashDynamic<uint64_t, FileChunkReflist> inode2chunks;
-  SmallHashDynamic<uint64_t, uint32_t> inode2references;
-  uint64_t next_handle;
-  pthread_mutex_t *lock;
+  atomic_int64 next_handle;
 };
 
 
@@ -143,15 +143,25 @@ void MemoryKvStore::DoFree(MemoryBuffer *buf) {
 }
 
 
-bool MemoryKvStore::CompactMemory() {
+/**
+ * Runs one step of a compaction round if the heap utilization is below the
+ * threshold or if a previous round was interrupted.  With force set, the heap
+ * is compacted completely regardless of its utilization.
+ */
+bool MemoryKvStore::CompactMemory(bool force) {
   double utilization;
   switch (allocator_) {
     case kMallocHeap:
       utilization = heap_->utilization();
       LogCvmfs(kLogKvStore, kLogDebug, "compact requested (%f)", utilization);
-      if (utilization < kCompactThreshold) {
+      if (force || heap_->IsCompacting() ||
+          (utilization < kCompactThreshold))
+      {
         LogCvmfs(kLogKvStore, kLogDebug, "compacting heap");
-        heap_->Compact();
+        if (force)
+          heap_->Compact();
+        else
+          heap_->CompactStep(kCompactStepSize);
         if (heap_->utilization() > utilization) return true;
       }
       return false;
@@ -278,7 +288,7 @@ int MemoryKvStore::DoCommit(const MemoryBuffer &buf) {
   // without a race condition. This is a hint that callers should use the
   // refcount like a lock and not directly modify the numeric value.
 
-  CompactMemory();
+  CompactMemory(false);
 
   MemoryBuffer mem;
   perf::Inc(counters_.n_commit);
@@ -302,7 +312,10 @@ int MemoryKvStore::DoCommit(const MemoryBuffer &buf) {
     LogCvmfs(kLogKvStore, kLogDebug, "too many entries in kvstore");
     return -ENFILE;
   }
-  if (DoMalloc(&mem) < 0) {
+  int retval = DoMalloc(&mem);
+  if ((retval == -ENOMEM) && CompactMemory(true))
+    retval = DoMalloc(&mem);
+  if (retval < 0) {
     LogCvmfs(kLogKvStore, kLogDebug, "failed to allocate %s",
       buf.id.ToString().c_str());
     return -EIO;
@@ -202,13 +202,18 @@ class MemoryKvStore : SingleCopy, public Callbackable<MallocHeap::BlockPtr> {
  private:
   // Compact memory once utilization falls below the threshold
   static const double kCompactThreshold;  // = 0.8
+  /**
+   * A compaction round is spread over several commits, each of which moves at
+   * most this many bytes.  Keeps the time readers are blocked short.
+   */
+  static const uint64_t kCompactStepSize = 16 * 1024 * 1024;
 
   bool DoDelete(const shash::Any &id);
   int DoMalloc(MemoryBuffer *buf);
   void DoFree(MemoryBuffer *buf);
   int DoCommit(const MemoryBuffer &buf);
   void OnBlockMove(const MallocHeap::BlockPtr &ptr);
-  bool CompactMemory();
+  bool CompactMemory(bool force);
 
   MemoryAllocator allocator_;
   size_t used_bytes_;
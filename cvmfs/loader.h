@@ -101,7 +101,9 @@ enum StateId {
   kStateOpenChunksV2,       // >= 2.1.20
   kStateOpenChunksV3,       // >= 2.2.0
   kStateOpenChunksV4,       // >= 2.2.3
-  kStateOpenFiles           // >= 2.4
+  kStateOpenFiles,          // >= 2.4
+  kStateOpenChunksV5,       // >= 2.7
+  kStateOpenDirCursors      // >= 2.7
 
   // Note: kStateOpenFilesXXX was renamed to kStateOpenChunksXXX as of 2.4
 };
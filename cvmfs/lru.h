@@ -47,6 +47,7 @@
 #include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "platform.h"
@@ -871,6 +872,266 @@ class LruCache : SingleCopy {
 #endif
 };  // class LruCache
 
+
+/**
+ * Concurrent alternative to the LruCache with the same interface as far as
+ * the meta-data caches are concerned.  The entries are distributed over
+ * shards by the low bits of the key hash; every shard is protected by a
+ * read-write lock.  Instead of a linked LRU list, eviction uses the CLOCK
+ * (second chance) approximation of LRU.  A hit only sets the reference bit of
+ * the entry, which is done atomically under the read lock.  Thus lookups do
+ * not serialize, neither within a shard nor across shards.  The clock hand of
+ * a shard evicts the first entry whose reference bit is not set and clears
+ * the reference bits it passes on its way.
+ */
+template<class Key, class Value>
+class ClockCache : SingleCopy {
+ public:
+  static const unsigned kNumShards = 32;
+
+  ClockCache(const unsigned   cache_size,
+             const Key       &empty_key,
+             uint32_t (*hasher)(const Key &key),
+             perf::StatisticsTemplate statistics) :
+    counters_(statistics),
+    hasher_(hasher),
+    pause_(0),
+    gauge_(0),
+    cache_size_(cache_size)
+  {
+    assert(cache_size > 0);
+
+    counters_.sz_size->Set(cache_size_);
+    const unsigned shard_size = (cache_size_ + kNumShards - 1) / kNumShards;
+    uint64_t bytes_allocated = 0;
+    for (unsigned i = 0; i < kNumShards; ++i) {
+      shards_[i].Init(shard_size, empty_key, hasher);
+      bytes_allocated += shards_[i].bytes_allocated();
+    }
+    perf::Xadd(counters_.sz_allocated, bytes_allocated);
+  }
+
+  static double GetEntrySize() {
+    return SmallHashFixed<Key, uint32_t>::GetEntrySize() +
+           sizeof(Key) + sizeof(Value) + sizeof(atomic_int32) +
+           sizeof(uint32_t);
+  }
+
+  /**
+   * Insert a new key-value pair.  If the shard of the key is full, the clock
+   * hand of the shard selects an entry for eviction.
+   * @return true on insert, false on update
+   */
+  bool Insert(const Key &key, const Value &value) {
+    if (atomic_read32(&pause_))
+      return false;
+
+    Shard *shard = GetShard(key);
+    shard->WriteLock();
+    uint32_t slot;
+    if (shard->index.Lookup(key, &slot)) {
+      perf::Inc(counters_.n_update);
+      shard->values[slot] = value;
+      atomic_write32(&shard->referenced[slot], 1);
+      shard->Unlock();
+      return false;
+    }
+
+    perf::Inc(counters_.n_insert);
+    if (shard->free_slots.empty()) {
+      perf::Inc(counters_.n_replace);
+      slot = shard->Evict();
+    } else {
+      slot = shard->free_slots.back();
+      shard->free_slots.pop_back();
+      atomic_inc32(&gauge_);
+    }
+    shard->keys[slot] = key;
+    shard->values[slot] = value;
+    atomic_write32(&shard->referenced[slot], 1);
+    shard->index.Insert(key, slot);
+    shard->Unlock();
+    return true;
+  }
+
+  /**
+   * Retrieve an element from the cache.  On a hit, the reference bit of the
+   * entry is set unless update_lru is false.
+   */
+  bool Lookup(const Key &key, Value *value, bool update_lru = true) {
+    if (atomic_read32(&pause_))
+      return false;
+
+    Shard *shard = GetShard(key);
+    shard->ReadLock();
+    uint32_t slot;
+    const bool found = shard->index.Lookup(key, &slot);
+    if (found) {
+      perf::Inc(counters_.n_hit);
+      // Avoid dirtying the cache line if the bit is already set
+      if (update_lru && (atomic_read32(&shard->referenced[slot]) == 0))
+        atomic_cas32(&shard->referenced[slot], 0, 1);
+      *value = shard->values[slot];
+    } else {
+      perf::Inc(counters_.n_miss);
+    }
+    shard->Unlock();
+    return found;
+  }
+
+  bool Forget(const Key &key) {
+    if (atomic_read32(&pause_))
+      return false;
+
+    Shard *shard = GetShard(key);
+    shard->WriteLock();
+    uint32_t slot;
+    const bool found = shard->index.Lookup(key, &slot);
+    if (found) {
+      perf::Inc(counters_.n_forget);
+      shard->index.Erase(key);
+      shard->values[slot] = Value();
+      atomic_write32(&shard->referenced[slot], 0);
+      shard->free_slots.push_back(slot);
+      atomic_dec32(&gauge_);
+    }
+    shard->Unlock();
+    return found;
+  }
+
+  void Drop() {
+    for (unsigned i = 0; i < kNumShards; ++i) {
+      shards_[i].WriteLock();
+      shards_[i].Clear();
+      shards_[i].Unlock();
+    }
+    atomic_init32(&gauge_);
+    perf::Inc(counters_.n_drop);
+  }
+
+  void Pause() { atomic_write32(&pause_, 1); }
+  void Resume() { atomic_write32(&pause_, 0); }
+
+  inline bool IsFull() {
+    return static_cast<unsigned>(atomic_read32(&gauge_)) >= cache_size_;
+  }
+  inline bool IsEmpty() { return atomic_read32(&gauge_) == 0; }
+
+  Counters counters() {
+    counters_.num_collisions = 0;
+    counters_.max_collisions = 0;
+    for (unsigned i = 0; i < kNumShards; ++i) {
+      uint64_t num_collisions;
+      uint32_t max_collisions;
+      shards_[i].ReadLock();
+      shards_[i].index.GetCollisionStats(&num_collisions, &max_collisions);
+      shards_[i].Unlock();
+      counters_.num_collisions += num_collisions;
+      counters_.max_collisions =
+        std::max(counters_.max_collisions, max_collisions);
+    }
+    return counters_;
+  }
+
+ protected:
+  Counters counters_;
+
+ private:
+  /**
+   * A fixed number of slots.  The index maps keys to slots.  Slots are taken
+   * from the list of free slots until the shard is full.
+   */
+  struct Shard {
+    Shard() : capacity(0), hand(0), referenced(NULL) {
+      int retval = pthread_rwlock_init(&rwlock, NULL);
+      assert(retval == 0);
+    }
+    ~Shard() {
+      delete[] referenced;
+      pthread_rwlock_destroy(&rwlock);
+    }
+
+    void Init(const unsigned size, const Key &empty_key,
+              uint32_t (*hasher)(const Key &key))
+    {
+      capacity = size;
+      index.Init(capacity, empty_key, hasher);
+      keys.resize(capacity, empty_key);
+      values.resize(capacity);
+      referenced = new atomic_int32[capacity];
+      Clear();
+    }
+
+    void Clear() {
+      index.Clear();
+      hand = 0;
+      free_slots.clear();
+      for (uint32_t i = 0; i < capacity; ++i) {
+        referenced[i] = 0;
+        free_slots.push_back(capacity - i - 1);
+      }
+    }
+
+    /**
+     * Advances the clock hand to the next entry without reference bit and
+     * removes it from the index.  Requires a full shard and the write lock.
+     */
+    uint32_t Evict() {
+      while (true) {
+        const uint32_t slot = hand;
+        hand = (hand + 1) % capacity;
+        if (atomic_read32(&referenced[slot]) != 0) {
+          atomic_write32(&referenced[slot], 0);
+          continue;
+        }
+        index.Erase(keys[slot]);
+        return slot;
+      }
+    }
+
+    uint64_t bytes_allocated() const {
+      return index.bytes_allocated() +
+             capacity * (sizeof(Key) + sizeof(Value) + sizeof(atomic_int32));
+    }
+
+    void ReadLock() {
+      int retval = pthread_rwlock_rdlock(&rwlock);
+      assert(retval == 0);
+    }
+    void WriteLock() {
+      int retval = pthread_rwlock_wrlock(&rwlock);
+      assert(retval == 0);
+    }
+    void Unlock() {
+      int retval = pthread_rwlock_unlock(&rwlock);
+      assert(retval == 0);
+    }
+
+    pthread_rwlock_t rwlock;
+    uint32_t capacity;
+    uint32_t hand;
+    SmallHashFixed<Key, uint32_t> index;
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    atomic_int32 *referenced;
+    std::vector<uint32_t> free_slots;
+  };
+
+  /**
+   * The hash tables of the shards use the high bits of the hash for their
+   * buckets, so the shard is selected by the low bits.
+   */
+  inline Shard *GetShard(const Key &key) {
+    return &shards_[hasher_(key) % kNumShards];
+  }
+
+  uint32_t (*hasher_)(const Key &key);
+  atomic_int32 pause_;
+  atomic_int32 gauge_;
+  const unsigned cache_size_;
+  Shard shards_[kNumShards];
+};  // class ClockCache
+
 }  // namespace lru
 
 #endif  // CVMFS_LRU_H_
@@ -13,6 +13,8 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+
 #include "atomic.h"
 #include "directory_entry.h"
 #include "duplex_fuse.h"
@@ -21,6 +23,8 @@
 #include "lru.h"
 #include "murmur.h"
 #include "shortstring.h"
+#include "statistics.h"
+#include "util/single_copy.h"
 
 
 namespace lru {
@@ -38,13 +42,118 @@ static inline uint32_t hasher_inode(const fuse_ino_t &inode) {
 // uint32_t hasher_inode(const fuse_ino_t &inode);
 
 
-class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
+/**
+ * Common base of the meta-data caches.  Depending on the concurrent flag, the
+ * entries are kept in a mutex-protected LruCache or in a sharded ClockCache,
+ * whose lookups do not serialize.  Both use the same statistics counters.
+ */
+template<class Key, class Value>
+class MetadataCache : SingleCopy {
+ public:
+  static double GetEntrySize() {
+    return std::max(LruCache<Key, Value>::GetEntrySize(),
+                    ClockCache<Key, Value>::GetEntrySize());
+  }
+
+  virtual ~MetadataCache() {
+    delete lru_cache_;
+    delete clock_cache_;
+  }
+
+  bool Insert(const Key &key, const Value &value) {
+    if (clock_cache_ != NULL)
+      return clock_cache_->Insert(key, value);
+    return lru_cache_->Insert(key, value);
+  }
+
+  bool Lookup(const Key &key, Value *value, bool update_lru = true) {
+    if (clock_cache_ != NULL)
+      return clock_cache_->Lookup(key, value, update_lru);
+    return lru_cache_->Lookup(key, value, update_lru);
+  }
+
+  bool Forget(const Key &key) {
+    if (clock_cache_ != NULL)
+      return clock_cache_->Forget(key);
+    return lru_cache_->Forget(key);
+  }
+
+  void Drop() {
+    if (clock_cache_ != NULL)
+      clock_cache_->Drop();
+    else
+      lru_cache_->Drop();
+  }
+
+  void Pause() {
+    if (clock_cache_ != NULL)
+      clock_cache_->Pause();
+    else
+      lru_cache_->Pause();
+  }
+
+  void Resume() {
+    if (clock_cache_ != NULL)
+      clock_cache_->Resume();
+    else
+      lru_cache_->Resume();
+  }
+
+  bool IsFull() {
+    if (clock_cache_ != NULL)
+      return clock_cache_->IsFull();
+    return lru_cache_->IsFull();
+  }
+
+  bool IsEmpty() {
+    if (clock_cache_ != NULL)
+      return clock_cache_->IsEmpty();
+    return lru_cache_->IsEmpty();
+  }
+
+  Counters counters() {
+    if (clock_cache_ != NULL)
+      return clock_cache_->counters();
+    return lru_cache_->counters();
+  }
+
+  bool IsConcurrent() const { return clock_cache_ != NULL; }
+
+ protected:
+  MetadataCache(const unsigned cache_size,
+                const Key &empty_key,
+                uint32_t (*hasher)(const Key &key),
+                perf::StatisticsTemplate statistics,
+                const bool concurrent)
+    : lru_cache_(NULL)
+    , clock_cache_(NULL)
+  {
+    if (concurrent) {
+      clock_cache_ = new ClockCache<Key, Value>(
+        cache_size, empty_key, hasher, statistics);
+    } else {
+      lru_cache_ = new LruCache<Key, Value>(
+        cache_size, empty_key, hasher, statistics);
+    }
+    n_insert_negative_ = counters().n_insert_negative;
+  }
+
+  perf::Counter *n_insert_negative_;
+
+ private:
+  LruCache<Key, Value> *lru_cache_;
+  ClockCache<Key, Value> *clock_cache_;
+};  // MetadataCache
+
+
+class InodeCache : public MetadataCache<fuse_ino_t, catalog::DirectoryEntry>
 {
  public:
-  explicit InodeCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>(
+  InodeCache(unsigned int cache_size, perf::Statistics *statistics,
+             bool concurrent = false) :
+    MetadataCache<fuse_ino_t, catalog::DirectoryEntry>(
       cache_size, fuse_ino_t(-1), hasher_inode,
-      perf::StatisticsTemplate("inode_cache", statistics))
+      perf::StatisticsTemplate("inode_cache", statistics), concurrent)
   {
   }
 
@@ -52,7 +161,8 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
     LogCvmfs(kLogLru, kLogDebug, "insert inode --> dirent: %u -> '%s'",
              inode, dirent.name().c_str());
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Insert(inode, dirent);
+      MetadataCache<fuse_ino_t, catalog::DirectoryEntry>::Insert(inode,
+                                                                 dirent);
     return result;
   }
 
@@ -60,7 +170,8 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
               bool update_lru = true)
   {
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Lookup(inode, dirent);
+      MetadataCache<fuse_ino_t, catalog::DirectoryEntry>::Lookup(inode,
+                                                                 dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup inode --> dirent: %u (%s)",
              inode, result ? "hit" : "miss");
     return result;
@@ -68,16 +179,18 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping inode cache");
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>::Drop();
+    MetadataCache<fuse_ino_t, catalog::DirectoryEntry>::Drop();
   }
 };  // InodeCache
 
 
-class PathCache : public LruCache<fuse_ino_t, PathString> {
+class PathCache : public MetadataCache<fuse_ino_t, PathString> {
  public:
-  explicit PathCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<fuse_ino_t, PathString>(cache_size, fuse_ino_t(-1), hasher_inode,
-      perf::StatisticsTemplate("path_cache", statistics))
+  PathCache(unsigned int cache_size, perf::Statistics *statistics,
+            bool concurrent = false) :
+    MetadataCache<fuse_ino_t, PathString>(
+      cache_size, fuse_ino_t(-1), hasher_inode,
+      perf::StatisticsTemplate("path_cache", statistics), concurrent)
   {
   }
 
@@ -85,7 +198,7 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
     LogCvmfs(kLogLru, kLogDebug, "insert inode --> path %u -> '%s'",
              inode, path.c_str());
     const bool result =
-      LruCache<fuse_ino_t, PathString>::Insert(inode, path);
+      MetadataCache<fuse_ino_t, PathString>::Insert(inode, path);
     return result;
   }
 
@@ -93,7 +206,7 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
               bool update_lru = true)
   {
     const bool found =
-      LruCache<fuse_ino_t, PathString>::Lookup(inode, path);
+      MetadataCache<fuse_ino_t, PathString>::Lookup(inode, path);
     LogCvmfs(kLogLru, kLogDebug, "lookup inode --> path: %u (%s)",
              inode, found ? "hit" : "miss");
     return found;
@@ -101,19 +214,20 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping path cache");
-    LruCache<fuse_ino_t, PathString>::Drop();
+    MetadataCache<fuse_ino_t, PathString>::Drop();
   }
 };  // PathCache
 
 
 class Md5PathCache :
-  public LruCache<shash::Md5, catalog::DirectoryEntry>
+  public MetadataCache<shash::Md5, catalog::DirectoryEntry>
 {
  public:
-  explicit Md5PathCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<shash::Md5, catalog::DirectoryEntry>(
+  Md5PathCache(unsigned int cache_size, perf::Statistics *statistics,
+               bool concurrent = false) :
+    MetadataCache<shash::Md5, catalog::DirectoryEntry>(
       cache_size, shash::Md5(shash::AsciiPtr("!")), hasher_md5,
-      perf::StatisticsTemplate("md5_path_cache", statistics))
+      perf::StatisticsTemplate("md5_path_cache", statistics), concurrent)
   {
     dirent_negative_ = catalog::DirectoryEntry(catalog::kDirentNegative);
   }
@@ -122,14 +236,14 @@ class Md5PathCache :
     LogCvmfs(kLogLru, kLogDebug, "insert md5 --> dirent: %s -> '%s'",
              hash.ToString().c_str(), dirent.name().c_str());
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Insert(hash, dirent);
+      MetadataCache<shash::Md5, catalog::DirectoryEntry>::Insert(hash, dirent);
     return result;
   }
 
   bool InsertNegative(const shash::Md5 &hash) {
     const bool result = Insert(hash, dirent_negative_);
     if (result)
-      perf::Inc(counters_.n_insert_negative);
+      perf::Inc(n_insert_negative_);
     return result;
   }
 
@@ -137,7 +251,7 @@ class Md5PathCache :
               bool update_lru = true)
   {
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Lookup(hash, dirent);
+      MetadataCache<shash::Md5, catalog::DirectoryEntry>::Lookup(hash, dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup md5 --> dirent: %s (%s)",
              hash.ToString().c_str(), result ? "hit" : "miss");
     return result;
@@ -146,12 +260,12 @@ class Md5PathCache :
   bool Forget(const shash::Md5 &hash) {
     LogCvmfs(kLogLru, kLogDebug, "forget md5: %s",
              hash.ToString().c_str());
-    return LruCache<shash::Md5, catalog::DirectoryEntry>::Forget(hash);
+    return MetadataCache<shash::Md5, catalog::DirectoryEntry>::Forget(hash);
   }
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping md5path cache");
-    LruCache<shash::Md5, catalog::DirectoryEntry>::Drop();
+    MetadataCache<shash::Md5, catalog::DirectoryEntry>::Drop();
   }
 
  private:
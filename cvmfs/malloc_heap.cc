@@ -36,17 +36,39 @@ void *MallocHeap::Allocate(
 }
 
 
+/**
+ * Compacts the entire heap.  A round started by CompactStep() only looks at the
+ * heap behind its current position.  So a pending round is finished first and
+ * followed by a complete round that also covers blocks freed in front of it.
+ */
 void MallocHeap::Compact() {
+  if (IsCompacting())
+    CompactStep(0);
+  CompactStep(0);
+}
+
+
+/**
+ * Runs a compaction round until at least max_move bytes have been moved (or
+ * until the end of the heap if max_move is zero).  Returns true if the round
+ * is complete and false if it has to be continued by another call.
+ */
+bool MallocHeap::CompactStep(uint64_t max_move) {
   if (gauge_ == 0)
-    return;
+    return true;
 
   // Not really a tag, just the top memory address
   Tag *heap_top = reinterpret_cast<Tag *>(heap_ + gauge_);
-  Tag *current_tag = reinterpret_cast<Tag *>(heap_);
+  Tag *current_tag = reinterpret_cast<Tag *>(heap_ + compact_pos_);
   Tag *next_tag = current_tag->JumpToNext();
+  uint64_t moved = 0;
   // Move a sliding window of two blocks over the heap and compact where
   // possible
   while (next_tag < heap_top) {
+    if ((max_move > 0) && (moved >= max_move)) {
+      compact_pos_ = reinterpret_cast<unsigned char *>(current_tag) - heap_;
+      return false;
+    }
     if (current_tag->IsFree()) {
       if (next_tag->IsFree()) {
         // Adjacent free blocks, merge and try again
@@ -60,6 +82,7 @@ void MallocHeap::Compact() {
         memmove(current_tag->GetBlock(),
                 next_tag->GetBlock(), next_tag->GetSize());
         (*callback_ptr_)(BlockPtr(current_tag->GetBlock()));
+        moved += next_tag->GetSize();
         next_tag = current_tag->JumpToNext();
         next_tag->size = free_space;
       }
@@ -73,6 +96,8 @@ void MallocHeap::Compact() {
   gauge_ = (reinterpret_cast<unsigned char *>(current_tag) - heap_);
   if (!current_tag->IsFree())
     gauge_ += sizeof(Tag) + current_tag->GetSize();
+  compact_pos_ = 0;
+  return true;
 }
 
 
@@ -116,6 +141,7 @@ MallocHeap::MallocHeap(uint64_t capacity, CallbackPtr callback_ptr)
   , gauge_(0)
   , stored_(0)
   , num_blocks_(0)
+  , compact_pos_(0)
 {
   assert(capacity_ > kMinCapacity);
   // Ensure 8-byte alignment
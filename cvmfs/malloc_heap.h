@@ -32,6 +32,10 @@
  *
  * All memory blocks are 8-byte aligned and they have an 8-byte header
  * containing their size.  The size is negative for free blocks.
+ *
+ * Compaction can be split into several steps with CompactStep().  Between the
+ * steps, blocks can be allocated and freed.  Blocks in front of the compaction
+ * position that are freed in the meantime are collected in the next round.
  */
 class MallocHeap {
  public:
@@ -53,6 +57,7 @@ class MallocHeap {
   void MarkFree(void *block);
   uint64_t GetSize(void *block);
   void Compact();
+  bool CompactStep(uint64_t max_move);
 
   inline uint64_t num_blocks() { return num_blocks_; }
   inline uint64_t used_bytes() { return gauge_; }
@@ -64,6 +69,7 @@ class MallocHeap {
   inline double utilization() {
     return static_cast<double>(stored_) / static_cast<double>(gauge_);
   }
+  inline bool IsCompacting() { return compact_pos_ > 0; }
   bool HasSpaceFor(uint64_t nbytes);
 
  private:
@@ -117,6 +123,11 @@ class MallocHeap {
    * Number of reserved blocks
    */
   uint64_t num_blocks_;
+  /**
+   * Offset of the tag where an interrupted compaction round continues, zero if
+   * no round is in progress.
+   */
+  uint64_t compact_pos_;
   /**
    * The big mmap'd memory block used to serve allocation requests.
    */
@@ -48,6 +48,8 @@ static Failures DoFetch(
   string certificate_url = base_url + "/";  // rest is in manifest
   download::JobInfo download_certificate(&certificate_url, true, probe_hosts,
                                          &certificate_hash);
+  download_manifest.latency_critical = true;
+  download_certificate.latency_critical = true;
 
   retval_dl = download_manager->Fetch(&download_manifest);
   if (retval_dl != download::kFailOk) {
@@ -37,6 +37,7 @@
 #include "cache_tiered.h"
 #include "catalog.h"
 #include "catalog_mgr_client.h"
+#include "chunk_prefetch.h"
 #include "clientctx.h"
 #include "download.h"
 #include "duplex_sqlite3.h"
@@ -58,6 +59,7 @@
 #endif
 #include "options.h"
 #include "platform.h"
+#include "quota_policy.h"
 #include "quota_posix.h"
 #include "resolv_conf_event_handler.h"
 #include "signature.h"
@@ -133,6 +135,35 @@ bool FileSystem::CheckPosixCacheSettings(
     return false;
   }
 
+  if (!settings.quota_index.empty() && (settings.quota_index != "sqlite") &&
+      (settings.quota_index != "journal"))
+  {
+    boot_error_ = "invalid quota index '" + settings.quota_index + "', "
+                  "expected 'sqlite' or 'journal'";
+    boot_status_ = loader::kFailOptions;
+    return false;
+  }
+
+  EvictionPolicy::Type eviction_type;
+  if (!EvictionPolicy::ParseType(settings.eviction_policy, &eviction_type)) {
+    boot_error_ = "invalid eviction policy '" + settings.eviction_policy +
+                  "', expected 'lru' or 'tinylfu'";
+    boot_status_ = loader::kFailOptions;
+    return false;
+  }
+
+  // The cleanup threshold is at 50% of the quota limit
+  if ((settings.cleanup_watermark != 0) &&
+      ((settings.cleanup_watermark <= 50) ||
+       (settings.cleanup_watermark >= 100)))
+  {
+    boot_error_ = "invalid cleanup watermark " +
+                  StringifyInt(settings.cleanup_watermark) + ", "
+                  "expected a percentage of the quota limit between 51 and 99";
+    boot_status_ = loader::kFailOptions;
+    return false;
+  }
+
   return true;
 }
 
@@ -205,6 +236,8 @@ void FileSystem::CreateStatistics() {
                                                 "Number of negative lookups");
   n_fs_stat_ = statistics_->Register("cvmfs.n_fs_stat", "Number of stats");
   n_fs_read_ = statistics_->Register("cvmfs.n_fs_read", "Number of files read");
+  n_fs_read_splice_ = statistics_->Register("cvmfs.n_fs_read_splice",
+                      "Number of reads handed to the kernel without copying");
   n_fs_readlink_ = statistics_->Register("cvmfs.n_fs_readlink",
                                          "Number of links read");
   n_fs_forget_ = statistics_->Register("cvmfs.n_fs_forget",
@@ -250,6 +283,32 @@ FileSystem::PosixCacheSettings FileSystem::DeterminePosixCacheSettings(
   }
   if (settings.quota_limit > 0)
     settings.is_managed = true;
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_QUOTA_INDEX", instance),
+                             &optarg))
+  {
+    settings.quota_index = optarg;
+  }
+  if (options_mgr_->GetValue(
+        MkCacheParm("CVMFS_CACHE_EVICTION_POLICY", instance), &optarg))
+  {
+    settings.eviction_policy = optarg;
+  }
+  if (options_mgr_->GetValue(
+        MkCacheParm("CVMFS_CACHE_CLEANUP_WATERMARK", instance), &optarg))
+  {
+    settings.cleanup_watermark = String2Uint64(optarg);
+  }
+  settings.unlink_rate = PosixQuotaManager::kDefaultUnlinkRate;
+  if (options_mgr_->GetValue(
+        MkCacheParm("CVMFS_CACHE_CLEANUP_UNLINK_RATE", instance), &optarg))
+  {
+    settings.unlink_rate = String2Uint64(optarg);
+  }
+  if (options_mgr_->GetValue(
+        MkCacheParm("CVMFS_CACHE_DIRECT_IO_THRESHOLD", instance), &optarg))
+  {
+    settings.direct_io_threshold = String2Uint64(optarg) * 1024 * 1024;
+  }
 
   settings.cache_path = kDefaultCacheBase;
   if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_BASE", instance),
@@ -334,6 +393,7 @@ FileSystem::FileSystem(const FileSystem::FileSystemInfo &fs_info)
   , n_fs_lookup_negative_(NULL)
   , n_fs_stat_(NULL)
   , n_fs_read_(NULL)
+  , n_fs_read_splice_(NULL)
   , n_fs_readlink_(NULL)
   , n_fs_forget_(NULL)
   , n_io_error_(NULL)
@@ -576,6 +636,20 @@ CacheManager *FileSystem::SetupExternalCacheMgr(const string &instance) {
     boot_status_ = loader::kFailCacheDir;
     return NULL;
   }
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_INFLIGHT_READS",
+                                         instance), &optarg))
+  {
+    unsigned inflight = String2Uint64(optarg);
+    if ((inflight == 0) ||
+        (inflight > ExternalCacheManager::kMaxInflightReads))
+    {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "%u read requests in flight out of range, using %u", inflight,
+               ExternalCacheManager::kMaxInflightReads);
+      inflight = ExternalCacheManager::kMaxInflightReads;
+    }
+    cache_mgr->set_max_inflight_reads(inflight);
+  }
   cache_mgr->AcquireQuotaManager(ExternalQuotaManager::Create(cache_mgr));
   return cache_mgr;
 }
@@ -597,6 +671,7 @@ CacheManager *FileSystem::SetupPosixCacheMgr(const string &instance) {
     boot_status_ = loader::kFailCacheDir;
     return NULL;
   }
+  cache_mgr->SetDirectIoThreshold(settings.direct_io_threshold);
 
   // Sentinel file for future use
   // Might be a read-only cache
@@ -644,13 +719,26 @@ CacheManager *FileSystem::SetupRamCacheMgr(const string &instance) {
       return NULL;
     }
   }
+  unsigned num_shards = 1;
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_SHARDS", instance),
+                             &optarg))
+  {
+    num_shards = String2Uint64(optarg);
+    if ((num_shards == 0) || (num_shards > RamCacheManager::kMaxShards)) {
+      boot_error_ = "Failure: invalid number of shards " +
+                    MkCacheParm("CVMFS_CACHE_SHARDS", instance) + "=" + optarg;
+      boot_status_ = loader::kFailOptions;
+      return NULL;
+    }
+  }
   sz_cache_bytes = RoundUp8(std::max(static_cast<uint64_t>(200 * 1024 * 1024),
                                      sz_cache_bytes));
   RamCacheManager *cache_mgr = new RamCacheManager(
         sz_cache_bytes,
         nfiles,
         alloc,
-        perf::StatisticsTemplate("cache." + instance, statistics_));
+        perf::StatisticsTemplate("cache." + instance, statistics_),
+        num_shards);
   if (cache_mgr == NULL) {
     boot_error_ = "failed to create ram cache manager for " + instance;
     boot_status_ = loader::kFailCacheDir;
@@ -698,6 +786,20 @@ CacheManager *FileSystem::SetupTieredCacheMgr(const string &instance) {
   {
     static_cast<TieredCacheManager*>(tiered)->SetLowerReadOnly();
   }
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_ASYNC", instance),
+                             &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    uint64_t max_queue_bytes = TieredCacheManager::kDefaultMaxQueueBytes;
+    if (options_mgr_->GetValue(
+          MkCacheParm("CVMFS_CACHE_ASYNC_QUEUE", instance), &optarg))
+    {
+      max_queue_bytes = String2Uint64(optarg) * 1024 * 1024;
+    }
+    static_cast<TieredCacheManager*>(tiered)->SetAsync(
+      max_queue_bytes,
+      perf::StatisticsTemplate("cache." + instance, statistics_));
+  }
   return tiered;
 }
 
@@ -874,6 +976,14 @@ bool FileSystem::SetupPosixQuotaMgr(
              settings.workspace.c_str(), settings.cache_path.c_str());
     cache_workspace += ":" + settings.workspace;
   }
+  const PosixQuotaManager::IndexType index_type =
+    (settings.quota_index == "journal") ? PosixQuotaManager::kIndexJournal
+                                        : PosixQuotaManager::kIndexSqlite;
+  // Validated in CheckPosixCacheSettings()
+  EvictionPolicy::Type eviction_type = EvictionPolicy::kLru;
+  EvictionPolicy::ParseType(settings.eviction_policy, &eviction_type);
+  const uint64_t cleanup_watermark =
+    settings.quota_limit / 100 * settings.cleanup_watermark;
   PosixQuotaManager *quota_mgr;
 
   if (settings.is_shared) {
@@ -882,7 +992,11 @@ bool FileSystem::SetupPosixQuotaMgr(
                   cache_workspace,
                   settings.quota_limit,
                   quota_threshold,
-                  foreground_);
+                  foreground_,
+                  index_type,
+                  eviction_type,
+                  cleanup_watermark,
+                  settings.unlink_rate);
     if (quota_mgr == NULL) {
       boot_error_ = "Failed to initialize shared lru cache";
       boot_status_ = loader::kFailQuota;
@@ -893,7 +1007,11 @@ bool FileSystem::SetupPosixQuotaMgr(
                   cache_workspace,
                   settings.quota_limit,
                   quota_threshold,
-                  found_previous_crash_);
+                  found_previous_crash_,
+                  index_type,
+                  eviction_type,
+                  cleanup_watermark,
+                  settings.unlink_rate);
     if (quota_mgr == NULL) {
       boot_error_ = "Failed to initialize lru cache";
       boot_status_ = loader::kFailQuota;
@@ -1123,6 +1241,7 @@ MountPoint *MountPoint::Create(
     return mountpoint.Release();
   }
   mountpoint->CreateFetchers();
+  mountpoint->CreateChunkPrefetcher();
   if (!mountpoint->CreateCatalogManager())
     return mountpoint.Release();
   if (!mountpoint->CreateTracer())
@@ -1167,6 +1286,21 @@ bool MountPoint::CreateCatalogManager() {
   string optarg;
 
   catalog_mgr_ = new catalog::ClientCatalogManager(this);
+  if (options_mgr_->GetValue("CVMFS_CATALOG_INDEX", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    catalog_mgr_->set_use_index(true);
+  }
+  if (options_mgr_->GetValue("CVMFS_CATALOG_BLOOM_BITS", &optarg)) {
+    unsigned bits = String2Uint64(optarg);
+    if (bits > catalog::ClientCatalogManager::kMaxPathFilterBits) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "catalog Bloom filter of %u bits per entry too large, using %u",
+               bits, catalog::ClientCatalogManager::kMaxPathFilterBits);
+      bits = catalog::ClientCatalogManager::kMaxPathFilterBits;
+    }
+    catalog_mgr_->set_path_filter_bits(bits);
+  }
 
   SetupInodeAnnotation();
   if (!SetupOwnerMaps())
@@ -1220,6 +1354,34 @@ bool MountPoint::CreateCatalogManager() {
 }
 
 
+void MountPoint::CreateChunkPrefetcher() {
+  if (file_system_->type() != FileSystem::kFsFuse)
+    return;
+
+  string optarg;
+  unsigned depth = 0;
+  if (options_mgr_->GetValue("CVMFS_CHUNK_PREFETCH_DEPTH", &optarg))
+    depth = String2Uint64(optarg);
+  if (depth == 0)
+    return;
+  if (depth > cvmfs::ChunkPrefetcher::kMaxDepth) {
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+             "chunk prefetch depth %u too large, using %u", depth,
+             cvmfs::ChunkPrefetcher::kMaxDepth);
+    depth = cvmfs::ChunkPrefetcher::kMaxDepth;
+  }
+
+  const unsigned max_threads = cvmfs::ChunkPrefetcher::kMaxThreads;
+  const unsigned num_threads = (depth < max_threads) ? depth : max_threads;
+  chunk_prefetcher_ = new cvmfs::ChunkPrefetcher(
+    fetcher_,
+    external_fetcher_,
+    depth,
+    num_threads,
+    perf::StatisticsTemplate("prefetch", statistics_));
+}
+
+
 bool MountPoint::CreateDownloadManagers() {
   string optarg;
   download_mgr_ = new download::DownloadManager();
@@ -1395,10 +1557,40 @@ void MountPoint::CreateTables() {
     mem_cache_size / static_cast<unsigned>(memcache_unit_size);
   // Number of cache entries must be a multiple of 64
   const unsigned mask_64 = ~((1 << 6) - 1);
-  inode_cache_ = new lru::InodeCache(memcache_num_units & mask_64, statistics_);
-  path_cache_ = new lru::PathCache(memcache_num_units & mask_64, statistics_);
+
+  // Either "on" for all meta-data caches or a list of the caches that should
+  // use the sharded, concurrent implementation
+  bool concurrent_inode = false;
+  bool concurrent_path = false;
+  bool concurrent_md5path = false;
+  if (options_mgr_->GetValue("CVMFS_MEMCACHE_CONCURRENT", &optarg)) {
+    if (options_mgr_->IsOn(optarg)) {
+      concurrent_inode = concurrent_path = concurrent_md5path = true;
+    } else {
+      const vector<string> caches = SplitString(optarg, ',');
+      for (unsigned i = 0; i < caches.size(); ++i) {
+        const string cache = Trim(caches[i]);
+        if (cache == "inode") {
+          concurrent_inode = true;
+        } else if (cache == "path") {
+          concurrent_path = true;
+        } else if (cache == "md5path") {
+          concurrent_md5path = true;
+        } else if (!cache.empty()) {
+          LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+                   "unknown meta-data cache '%s' in "
+                   "CVMFS_MEMCACHE_CONCURRENT", cache.c_str());
+        }
+      }
+    }
+  }
+
+  inode_cache_ = new lru::InodeCache(memcache_num_units & mask_64, statistics_,
+                                     concurrent_inode);
+  path_cache_ = new lru::PathCache(memcache_num_units & mask_64, statistics_,
+                                   concurrent_path);
   md5path_cache_ = new lru::Md5PathCache((memcache_num_units * 7) & mask_64,
-                                         statistics_);
+                                         statistics_, concurrent_md5path);
 
   inode_tracker_ = new glue::InodeTracker();
 }
@@ -1590,6 +1782,7 @@ MountPoint::MountPoint(
   , external_download_mgr_(NULL)
   , fetcher_(NULL)
   , external_fetcher_(NULL)
+  , chunk_prefetcher_(NULL)
   , inode_annotation_(NULL)
   , catalog_mgr_(NULL)
   , chunk_tables_(NULL)
@@ -1624,6 +1817,7 @@ MountPoint::~MountPoint() {
 
   delete catalog_mgr_;
   delete inode_annotation_;
+  delete chunk_prefetcher_;
   delete external_fetcher_;
   delete fetcher_;
   if (external_download_mgr_ != NULL) {
@@ -1732,6 +1926,18 @@ void MountPoint::SetupDnsTuning(download::DownloadManager *manager) {
   }
   if (options_mgr_->GetValue("CVMFS_MAX_IPADDR_PER_PROXY", &optarg))
     manager->SetMaxIpaddrPerProxy(String2Uint64(optarg));
+
+  if (options_mgr_->GetValue("CVMFS_DNS_CACHE", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    const string path = file_system_->workspace() + "/dnscache";
+    if (!manager->SetDnsCache(path)) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "failed to set up DNS cache %s", path.c_str());
+    }
+  }
+  if (options_mgr_->GetValue("CVMFS_DNS_MAX_STALE", &optarg))
+    manager->EnableStaleDns(String2Uint64(optarg));
 }
 
 
@@ -1837,6 +2043,38 @@ void MountPoint::SetupHttpTuning() {
   {
     download_mgr_->EnableInfoHeader();
   }
+  if (options_mgr_->GetValue("CVMFS_PARALLEL_RANGES", &optarg)) {
+    unsigned segment_size = 0;
+    string optarg_segment;
+    if (options_mgr_->GetValue("CVMFS_PARALLEL_RANGE_SIZE", &optarg_segment))
+      segment_size = String2Uint64(optarg_segment) * 1024 * 1024;
+    download_mgr_->SetParallelRanges(String2Uint64(optarg), segment_size);
+  }
+  // No effect without a libcurl built with nghttp2, such as the bundled one,
+  // and for requests through proxies; see DownloadManager::EnableHttp2()
+  if (options_mgr_->GetValue("CVMFS_HTTP2", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    download_mgr_->EnableHttp2();
+  }
+  if (options_mgr_->GetValue("CVMFS_LATENCY_SELECTION", &optarg)) {
+    unsigned explore_percent = kDefaultLatencyExplorePercent;
+    string optarg_explore;
+    if (options_mgr_->GetValue("CVMFS_LATENCY_SELECTION_EXPLORE",
+                               &optarg_explore))
+    {
+      explore_percent = String2Uint64(optarg_explore);
+    }
+    download_mgr_->EnableLatencySelection(String2Uint64(optarg),
+                                          explore_percent);
+  }
+  if (options_mgr_->GetValue("CVMFS_HEDGE_PERCENTILE", &optarg)) {
+    unsigned budget_percent = kDefaultHedgeBudgetPercent;
+    string optarg_budget;
+    if (options_mgr_->GetValue("CVMFS_HEDGE_BUDGET", &optarg_budget))
+      budget_percent = String2Uint64(optarg_budget);
+    download_mgr_->EnableHedging(String2Uint64(optarg), budget_percent);
+  }
 }
 
 
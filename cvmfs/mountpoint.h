@@ -33,6 +33,7 @@ class InodeGenerationAnnotation;
 }
 struct ChunkTables;
 namespace cvmfs {
+class ChunkPrefetcher;
 class Fetcher;
 class Uuid;
 }
@@ -177,6 +178,7 @@ class FileSystem : SingleCopy, public BootFactory {
   perf::Counter *n_fs_lookup_negative() { return n_fs_lookup_negative_; }
   perf::Counter *n_fs_open() { return n_fs_open_; }
   perf::Counter *n_fs_read() { return n_fs_read_; }
+  perf::Counter *n_fs_read_splice() { return n_fs_read_splice_; }
   perf::Counter *n_fs_readlink() { return n_fs_readlink_; }
   perf::Counter *n_fs_stat() { return n_fs_stat_; }
   perf::Counter *n_io_error() { return n_io_error_; }
@@ -204,7 +206,8 @@ class FileSystem : SingleCopy, public BootFactory {
     PosixCacheSettings() :
       is_shared(false), is_alien(false), is_managed(false),
       avoid_rename(false), cache_base_defined(false), cache_dir_defined(false),
-      quota_limit(0)
+      quota_limit(0), cleanup_watermark(0), unlink_rate(0),
+      direct_io_threshold(0)
       { }
     bool is_shared;
     bool is_alien;
@@ -217,6 +220,28 @@ class FileSystem : SingleCopy, public BootFactory {
      * cache when the limit is exceeded.
      */
     int64_t quota_limit;
+    /**
+     * Quota manager backend, "sqlite" (default) or "journal"
+     */
+    std::string quota_index;
+    /**
+     * Cache cleanup order, "lru" (default) or "tinylfu"
+     */
+    std::string eviction_policy;
+    /**
+     * Cache size in percent of quota_limit that starts the background cleanup,
+     * zero if the cache is only cleaned up when it hits the limit
+     */
+    unsigned cleanup_watermark;
+    /**
+     * Files per second evicted by the background cleanup, zero for unlimited
+     */
+    unsigned unlink_rate;
+    /**
+     * Objects of at least this many bytes bypass the page cache when they are
+     * written to the cache, zero to always write through the page cache
+     */
+    uint64_t direct_io_threshold;
     std::string cache_path;
     /**
      * Different from cache_path only if CVMFS_WORKSPACE or
@@ -273,6 +298,7 @@ class FileSystem : SingleCopy, public BootFactory {
   perf::Counter *n_fs_lookup_negative_;
   perf::Counter *n_fs_stat_;
   perf::Counter *n_fs_read_;
+  perf::Counter *n_fs_read_splice_;
   perf::Counter *n_fs_readlink_;
   perf::Counter *n_fs_forget_;
   perf::Counter *n_io_error_;
@@ -379,6 +405,7 @@ class MountPoint : SingleCopy, public BootFactory {
   AuthzSessionManager *authz_session_mgr() { return authz_session_mgr_; }
   BackoffThrottle *backoff_throttle() { return backoff_throttle_; }
   catalog::ClientCatalogManager *catalog_mgr() { return catalog_mgr_; }
+  cvmfs::ChunkPrefetcher *chunk_prefetcher() { return chunk_prefetcher_; }
   ChunkTables *chunk_tables() { return chunk_tables_; }
   download::DownloadManager *download_mgr() { return download_mgr_; }
   download::DownloadManager *external_download_mgr() {
@@ -449,6 +476,16 @@ class MountPoint : SingleCopy, public BootFactory {
   static const unsigned kDefaultRetries = 1;
   static const unsigned kDefaultBackoffInitMs = 2000;
   static const unsigned kDefaultBackoffMaxMs = 10000;
+  /**
+   * Share of latency-aware proxy and host selections that try a random
+   * endpoint, if CVMFS_LATENCY_SELECTION is set
+   */
+  static const unsigned kDefaultLatencyExplorePercent = 10;
+  /**
+   * Share of latency-critical downloads that may be hedged, if
+   * CVMFS_HEDGE_PERCENTILE is set
+   */
+  static const unsigned kDefaultHedgeBudgetPercent = 5;
   /**
    * Memory buffer sizes for an activated tracer
    */
@@ -467,6 +504,7 @@ class MountPoint : SingleCopy, public BootFactory {
   bool CreateDownloadManagers();
   bool CreateResolvConfWatcher();
   void CreateFetchers();
+  void CreateChunkPrefetcher();
   bool CreateCatalogManager();
   void CreateTables();
   bool CreateTracer();
@@ -502,6 +540,7 @@ class MountPoint : SingleCopy, public BootFactory {
   download::DownloadManager *external_download_mgr_;
   cvmfs::Fetcher *fetcher_;
   cvmfs::Fetcher *external_fetcher_;
+  cvmfs::ChunkPrefetcher *chunk_prefetcher_;
   catalog::InodeGenerationAnnotation *inode_annotation_;
   catalog::ClientCatalogManager *catalog_mgr_;
   ChunkTables *chunk_tables_;
@@ -276,6 +276,19 @@ inline int platform_readahead(int filedes) {
   return readahead(filedes, 0, static_cast<size_t>(-1));
 }
 
+/**
+ * Switches O_DIRECT on or off for an open file.  Direct writes bypass the page
+ * cache but need buffers, sizes, and file offsets that are aligned to the
+ * block size of the file system.
+ */
+inline int platform_set_direct_io(int filedes, bool enable) {
+  int flags = fcntl(filedes, F_GETFL);
+  if (flags == -1)
+    return -1;
+  flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+  return fcntl(filedes, F_SETFL, flags);
+}
+
 /**
  * Advises the kernel to evict the given file region from the page cache.
  *
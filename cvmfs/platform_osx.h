@@ -232,6 +232,13 @@ inline int platform_readahead(int filedes) {
   return 0;
 }
 
+/**
+ * F_NOCACHE is the closest equivalent of O_DIRECT
+ */
+inline int platform_set_direct_io(int filedes, bool enable) {
+  return fcntl(filedes, F_NOCACHE, enable ? 1 : 0);
+}
+
 inline bool read_line(FILE *f, std::string *line) {
   char *buffer_line = NULL;
   size_t buffer_size = 0;
@@ -41,6 +41,12 @@ class QuotaManager : SingleCopy {
    *  - backchannel command 'R': release pinned files if possible
    * Revision 2:
    *  - add kCleanupRate command
+   * Revision 3:
+   *  - asynchronous commands through a shared memory ring, kWakeup command
+   * Revision 4:
+   *  - add kCleanupStatus command
+   * Revision 5:
+   *  - client id in kReserve and kUnpin, pins are released by the last client
    */
   static const uint32_t kProtocolRevision;
 
@@ -52,6 +58,30 @@ class QuotaManager : SingleCopy {
     kCapListeners,
   };
 
+  /**
+   * Progress of the cleanup that runs ahead of the cache limit.  A watermark of
+   * zero means that the cache is only cleaned up when it hits its limit.
+   */
+  struct CleanupStatus {
+    CleanupStatus()
+      : watermark(0)
+      , unlink_rate(0)
+      , num_evicted(0)
+      , num_unlinked(0)
+      , backlog_files(0)
+      , backlog_bytes(0)
+    { }
+    uint64_t watermark;
+    uint64_t unlink_rate;  /**< files per second, zero for unlimited */
+    uint64_t num_evicted;
+    uint64_t num_unlinked;
+    /**
+     * Evicted files that are not yet unlinked
+     */
+    uint64_t backlog_files;
+    uint64_t backlog_bytes;
+  };
+
   QuotaManager();
   virtual ~QuotaManager();
   virtual bool HasCapability(Capabilities capability) = 0;
@@ -76,6 +106,7 @@ class QuotaManager : SingleCopy {
   virtual uint64_t GetSize() = 0;
   virtual uint64_t GetSizePinned() = 0;
   virtual uint64_t GetCleanupRate(uint64_t period_s) = 0;
+  virtual bool GetCleanupStatus(CleanupStatus *status) = 0;
 
   virtual void Spawn() = 0;
   virtual pid_t GetPid() = 0;
@@ -152,6 +183,7 @@ class NoopQuotaManager : public QuotaManager {
   virtual uint64_t GetSize() { return 0; }
   virtual uint64_t GetSizePinned() { return 0; }
   virtual uint64_t GetCleanupRate(uint64_t period_s) { return 0; }
+  virtual bool GetCleanupStatus(CleanupStatus *status) { return false; }
 
   virtual void Spawn() { }
   virtual pid_t GetPid() { return getpid(); }
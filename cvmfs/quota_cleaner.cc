@@ -0,0 +1,199 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "quota_cleaner.h"
+
+#include <errno.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+void GetTimespecRel(const unsigned ms, struct timespec *ts) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  int64_t nsecs = now.tv_usec * 1000 + (ms % 1000) * 1000 * 1000;
+  int carry = 0;
+  if (nsecs >= 1000 * 1000 * 1000) {
+    carry = 1;
+    nsecs -= 1000 * 1000 * 1000;
+  }
+  ts->tv_sec = now.tv_sec + ms / 1000 + carry;
+  ts->tv_nsec = nsecs;
+}
+
+}  // anonymous namespace
+
+
+BackgroundCleaner::BackgroundCleaner(const unsigned rate)
+  : rate_(rate)
+  , batch_size_(0)
+  , tick_ms_(kTickMs)
+  , backlog_bytes_(0)
+  , num_in_flight_(0)
+  , num_unlinked_(0)
+  , spawned_(false)
+  , terminate_(false)
+{
+  if (rate_ > 0) {
+    batch_size_ = rate_ * kTickMs / 1000;
+    if (batch_size_ == 0) {
+      batch_size_ = 1;
+      tick_ms_ = 1000 / rate_;
+    }
+  }
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_, NULL);
+  assert(retval == 0);
+}
+
+
+/**
+ * Stops the cleaner thread and unlinks the rest of the backlog.  Otherwise the
+ * files would stay in the cache directory without a cache catalog entry.
+ */
+BackgroundCleaner::~BackgroundCleaner() {
+  if (spawned_) {
+    {
+      MutexLockGuard m(&lock_);
+      terminate_ = true;
+      pthread_cond_broadcast(&cond_);
+    }
+    pthread_join(thread_cleaner_, NULL);
+  }
+  UnlinkBatch(0);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Unlinks the entire backlog before it returns.  Called by the quota manager
+ * when the cache reaches its hard limit.
+ */
+void BackgroundCleaner::Drain() {
+  UnlinkBatch(0);
+  MutexLockGuard m(&lock_);
+  while (num_in_flight_ > 0)
+    pthread_cond_wait(&cond_, &lock_);
+}
+
+
+void BackgroundCleaner::Enqueue(const vector<Entry> &entries) {
+  if (entries.empty())
+    return;
+  MutexLockGuard m(&lock_);
+  for (unsigned i = 0; i < entries.size(); ++i) {
+    backlog_.push_back(entries[i]);
+    backlog_bytes_ += entries[i].size;
+  }
+  pthread_cond_broadcast(&cond_);
+}
+
+
+void BackgroundCleaner::GetBacklog(uint64_t *num_files, uint64_t *num_bytes) {
+  MutexLockGuard m(&lock_);
+  *num_files = backlog_.size() + num_in_flight_;
+  *num_bytes = backlog_bytes_;
+}
+
+
+uint64_t BackgroundCleaner::GetNumUnlinked() {
+  MutexLockGuard m(&lock_);
+  return num_unlinked_;
+}
+
+
+void *BackgroundCleaner::MainCleaner(void *data) {
+  BackgroundCleaner *cleaner = reinterpret_cast<BackgroundCleaner *>(data);
+  LogCvmfs(kLogQuota, kLogDebug, "starting background cleaner (%u files/s)",
+           cleaner->rate_);
+
+  pthread_mutex_lock(&cleaner->lock_);
+  while (true) {
+    while (cleaner->backlog_.empty() && !cleaner->terminate_)
+      pthread_cond_wait(&cleaner->cond_, &cleaner->lock_);
+    if (cleaner->terminate_)
+      break;
+
+    pthread_mutex_unlock(&cleaner->lock_);
+    cleaner->UnlinkBatch(cleaner->batch_size_);
+    pthread_mutex_lock(&cleaner->lock_);
+
+    if (cleaner->batch_size_ == 0)
+      continue;
+    // Throttle: wait for the end of the tick unless asked to terminate
+    struct timespec deadline;
+    GetTimespecRel(cleaner->tick_ms_, &deadline);
+    while (!cleaner->terminate_) {
+      int retval = pthread_cond_timedwait(&cleaner->cond_, &cleaner->lock_,
+                                          &deadline);
+      if (retval == ETIMEDOUT)
+        break;
+      assert(retval == 0);
+    }
+  }
+  pthread_mutex_unlock(&cleaner->lock_);
+
+  LogCvmfs(kLogQuota, kLogDebug, "stopping background cleaner");
+  return NULL;
+}
+
+
+void BackgroundCleaner::Spawn() {
+  assert(!spawned_);
+  int retval = pthread_create(&thread_cleaner_, NULL, MainCleaner, this);
+  if (retval != 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "could not create background cleaner thread");
+    abort();
+  }
+  spawned_ = true;
+}
+
+
+/**
+ * Unlinks up to max_files files from the head of the backlog, all of them if
+ * max_files is zero.  The lock is not held while unlinking.
+ */
+void BackgroundCleaner::UnlinkBatch(const unsigned max_files) {
+  vector<Entry> batch;
+  {
+    MutexLockGuard m(&lock_);
+    while (!backlog_.empty() &&
+           ((max_files == 0) || (batch.size() < max_files)))
+    {
+      batch.push_back(backlog_.front());
+      backlog_.pop_front();
+    }
+    num_in_flight_ += batch.size();
+  }
+  if (batch.empty())
+    return;
+
+  uint64_t batch_bytes = 0;
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    LogCvmfs(kLogQuota, kLogDebug, "unlink %s", batch[i].path.c_str());
+    unlink(batch[i].path.c_str());
+    batch_bytes += batch[i].size;
+  }
+
+  MutexLockGuard m(&lock_);
+  num_in_flight_ -= batch.size();
+  num_unlinked_ += batch.size();
+  backlog_bytes_ -= batch_bytes;
+  pthread_cond_broadcast(&cond_);
+}
@@ -0,0 +1,93 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_QUOTA_CLEANER_H_
+#define CVMFS_QUOTA_CLEANER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "util/single_copy.h"
+
+/**
+ * Unlinks evicted cache files in a separate thread.  The quota manager removes
+ * the entries from its cache catalog and hands over the file paths.  The
+ * thread unlinks at most rate files per second in batches every kTickMs (one
+ * file per longer tick for rates below 1000 / kTickMs files per second), so
+ * that a large cleanup does not saturate the cache disk.  Files in the backlog
+ * still occupy disk space.  Once the cache hits its hard limit, the quota
+ * manager drains the backlog synchronously.
+ *
+ * The quota manager moves the evicted files into its trash directory before
+ * it hands them over, so the backlog only contains trash paths.  A file that
+ * is re-inserted under its old cache path is therefore never unlinked by the
+ * cleaner.
+ */
+class BackgroundCleaner : SingleCopy {
+ public:
+  static const unsigned kTickMs = 100;
+
+  struct Entry {
+    Entry(const std::string &p, const uint64_t s) : path(p), size(s) { }
+    std::string path;
+    uint64_t size;
+  };
+
+  /**
+   * A rate of zero unlinks the backlog as fast as possible.
+   */
+  explicit BackgroundCleaner(const unsigned rate);
+  ~BackgroundCleaner();
+  void Spawn();
+
+  void Enqueue(const std::vector<Entry> &entries);
+  void Drain();
+  void GetBacklog(uint64_t *num_files, uint64_t *num_bytes);
+  uint64_t GetNumUnlinked();
+
+  unsigned rate() const { return rate_; }
+  unsigned batch_size() const { return batch_size_; }
+  unsigned tick_ms() const { return tick_ms_; }
+
+ private:
+  static void *MainCleaner(void *data);
+  void UnlinkBatch(const unsigned max_files);
+
+  unsigned rate_;
+  /**
+   * Number of files unlinked per tick, unlimited if zero
+   */
+  unsigned batch_size_;
+  /**
+   * Pause between two batches
+   */
+  unsigned tick_ms_;
+
+  /**
+   * Protects the backlog and the counters
+   */
+  pthread_mutex_t lock_;
+  /**
+   * Signals new entries and termination to the cleaner thread and finished
+   * batches to Drain()
+   */
+  pthread_cond_t cond_;
+  std::deque<Entry> backlog_;
+  /**
+   * Includes the files that are taken from the backlog but not yet unlinked
+   */
+  uint64_t backlog_bytes_;
+  unsigned num_in_flight_;
+  uint64_t num_unlinked_;
+
+  pthread_t thread_cleaner_;
+  bool spawned_;
+  bool terminate_;
+};
+
+#endif  // CVMFS_QUOTA_CLEANER_H_
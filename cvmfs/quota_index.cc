@@ -0,0 +1,535 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "quota_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "logging.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+template <class IteratorT>
+struct RowidLess {
+  bool operator() (const IteratorT &a, const IteratorT &b) const {
+    return a->second.rowid < b->second.rowid;
+  }
+};
+
+}  // anonymous namespace
+
+
+/**
+ * Loads the snapshot and the journal from path and path.journal.  Returns
+ * NULL if the files cannot be opened or if the snapshot is corrupted.
+ */
+QuotaIndex *QuotaIndex::Create(const string &path) {
+  UniquePtr<QuotaIndex> index(new QuotaIndex(path));
+  if (!index->Load())
+    return NULL;
+  LogCvmfs(kLogQuota, kLogDebug,
+           "loaded quota index %s, %lu entries, gauge %" PRIu64,
+           path.c_str(), index->size(), index->gauge());
+  return index.Release();
+}
+
+
+QuotaIndex::QuotaIndex(const string &path)
+  : path_(path)
+  , fd_journal_(-1)
+  , gauge_(0)
+  , max_seq_(0)
+  , next_rowid_(0)
+  , num_journal_records_(0)
+{ }
+
+
+QuotaIndex::~QuotaIndex() {
+  if (fd_journal_ < 0)
+    return;
+  if (!journal_buffer_.empty())
+    SafeWrite(fd_journal_, journal_buffer_.data(), journal_buffer_.size());
+  close(fd_journal_);
+}
+
+
+void QuotaIndex::Apply(const Record &record, const string &path) {
+  shash::Any hash(static_cast<shash::Algorithms>(record.algorithm));
+  memcpy(hash.digest, record.digest, shash::kDigestSizes[hash.algorithm]);
+  EntryMap::iterator iter;
+  switch (record.type) {
+    case kRecordInsert:
+      DoInsert(hash, record.size, record.acseq, path, record.is_catalog,
+               kUnpinned);
+      break;
+    case kRecordTouch:
+      iter = entries_.find(hash);
+      if (iter != entries_.end())
+        DoTouch(iter, record.acseq);
+      break;
+    case kRecordRemove:
+      iter = entries_.find(hash);
+      if (iter != entries_.end())
+        DoRemove(iter);
+      break;
+    default:
+      abort();
+  }
+}
+
+
+void QuotaIndex::AppendRecord(
+  const RecordType type,
+  const shash::Any &hash,
+  const Entry &entry)
+{
+  MkRecord(type, hash, entry, &journal_buffer_);
+  num_journal_records_++;
+}
+
+
+void QuotaIndex::Block(const shash::Any &hash) {
+  DoBlock(hash, kBlocked);
+}
+
+
+void QuotaIndex::Defer(const shash::Any &hash) {
+  DoBlock(hash, kDeferred);
+}
+
+
+void QuotaIndex::DoBlock(const shash::Any &hash, const PinState state) {
+  EntryMap::iterator iter = entries_.find(hash);
+  if ((iter == entries_.end()) || IsBlocked(iter->second.pinned))
+    return;
+  lru_.erase(iter->second.acseq);
+  iter->second.pinned = state;
+  blocked_.push_back(hash);
+}
+
+
+/**
+ * Removes all entries, the snapshot, and the journal.
+ */
+void QuotaIndex::Clear() {
+  entries_.clear();
+  lru_.clear();
+  blocked_.clear();
+  gauge_ = 0;
+  max_seq_ = 0;
+  next_rowid_ = 0;
+  journal_buffer_.clear();
+  num_journal_records_ = 0;
+  unlink(path_.c_str());
+  const uint32_t magic = kMagic;
+  if ((ftruncate(fd_journal_, 0) != 0) ||
+      !SafeWrite(fd_journal_, &magic, sizeof(magic)))
+  {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to reset quota journal %s.journal (%d)",
+             path_.c_str(), errno);
+  }
+}
+
+
+bool QuotaIndex::Contains(const shash::Any &hash) {
+  return entries_.find(hash) != entries_.end();
+}
+
+
+void QuotaIndex::DoInsert(
+  const shash::Any &hash,
+  const uint64_t size,
+  const int64_t acseq,
+  const string &path,
+  const bool is_catalog,
+  const unsigned char pinned)
+{
+  EntryMap::iterator iter = entries_.find(hash);
+  if (iter != entries_.end())
+    DoRemove(iter);
+
+  Entry *entry = &entries_[hash];
+  entry->size = size;
+  entry->acseq = acseq;
+  entry->rowid = next_rowid_++;
+  entry->path = path;
+  entry->is_catalog = is_catalog;
+  entry->pinned = pinned;
+  lru_[acseq] = hash;
+  gauge_ += size;
+  max_seq_ = max(max_seq_, static_cast<uint64_t>(acseq) & ~kVolatileFlag);
+}
+
+
+void QuotaIndex::DoRemove(EntryMap::iterator iter) {
+  if (!IsBlocked(iter->second.pinned))
+    lru_.erase(iter->second.acseq);
+  gauge_ -= iter->second.size;
+  entries_.erase(iter);
+}
+
+
+void QuotaIndex::DoTouch(EntryMap::iterator iter, const int64_t acseq) {
+  if (!IsBlocked(iter->second.pinned)) {
+    lru_.erase(iter->second.acseq);
+    lru_[acseq] = iter->first;
+  }
+  iter->second.acseq = acseq;
+  max_seq_ = max(max_seq_, static_cast<uint64_t>(acseq) & ~kVolatileFlag);
+}
+
+
+/**
+ * Returns the least recently used entry that is not blocked.
+ */
+bool QuotaIndex::GetLru(shash::Any *hash, uint64_t *size) {
+  if (lru_.empty())
+    return false;
+  *hash = lru_.begin()->second;
+  *size = entries_[*hash].size;
+  return true;
+}
+
+
+/**
+ * Inserts or replaces an entry.
+ */
+void QuotaIndex::Insert(
+  const shash::Any &hash,
+  const uint64_t size,
+  const int64_t acseq,
+  const string &path,
+  const bool is_catalog,
+  const bool is_pinned)
+{
+  DoInsert(hash, size, acseq, path, is_catalog,
+           is_pinned ? kPinned : kUnpinned);
+  AppendRecord(kRecordInsert, hash, entries_[hash]);
+}
+
+
+/**
+ * Paths of the entries that match the filter in insertion order.
+ */
+vector<string> QuotaIndex::List(const ListFilter filter) {
+  vector<EntryMap::const_iterator> matches;
+  for (EntryMap::const_iterator i = entries_.begin(), iEnd = entries_.end();
+       i != iEnd; ++i)
+  {
+    bool match = false;
+    switch (filter) {
+      case kListRegular:
+        match = !i->second.is_catalog;
+        break;
+      case kListCatalogs:
+        match = i->second.is_catalog;
+        break;
+      case kListPinned:
+        match = (i->second.pinned == kPinned) ||
+                (i->second.pinned == kBlocked);
+        break;
+      case kListVolatile:
+        match = i->second.acseq < 0;
+        break;
+      default:
+        abort();
+    }
+    if (match)
+      matches.push_back(i);
+  }
+  sort(matches.begin(), matches.end(),
+       RowidLess<EntryMap::const_iterator>());
+
+  vector<string> result;
+  result.reserve(matches.size());
+  for (unsigned i = 0; i < matches.size(); ++i)
+    result.push_back(matches[i]->second.path);
+  return result;
+}
+
+
+bool QuotaIndex::Load() {
+  uint64_t good_size;
+  FILE *f = fopen(path_.c_str(), "r");
+  if (f != NULL) {
+    bool retval = Replay(f, false, &good_size);
+    fclose(f);
+    if (!retval) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+               "quota index snapshot %s corrupted", path_.c_str());
+      return false;
+    }
+  } else if (errno != ENOENT) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open %s (%d)",
+             path_.c_str(), errno);
+    return false;
+  }
+
+  const string journal_path = path_ + ".journal";
+  good_size = 0;
+  f = fopen(journal_path.c_str(), "r");
+  if (f != NULL) {
+    bool retval = Replay(f, true, &good_size);
+    fclose(f);
+    if (!retval) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+               "quota index journal %s corrupted", journal_path.c_str());
+      return false;
+    }
+  }
+
+  fd_journal_ = open(journal_path.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                     0600);
+  if (fd_journal_ < 0) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open %s (%d)",
+             journal_path.c_str(), errno);
+    return false;
+  }
+  // Drop a torn record at the end of the journal
+  if (ftruncate(fd_journal_, good_size) != 0) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to truncate %s (%d)",
+             journal_path.c_str(), errno);
+    return false;
+  }
+  if (good_size == 0) {
+    const uint32_t magic = kMagic;
+    if (!SafeWrite(fd_journal_, &magic, sizeof(magic))) {
+      LogCvmfs(kLogQuota, kLogDebug, "failed to write %s (%d)",
+               journal_path.c_str(), errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool QuotaIndex::Lookup(
+  const shash::Any &hash,
+  uint64_t *size,
+  bool *is_pinned)
+{
+  EntryMap::const_iterator iter = entries_.find(hash);
+  if (iter == entries_.end())
+    return false;
+  *size = iter->second.size;
+  *is_pinned = (iter->second.pinned == kPinned) ||
+               (iter->second.pinned == kBlocked);
+  return true;
+}
+
+
+void QuotaIndex::MkRecord(
+  const RecordType type,
+  const shash::Any &hash,
+  const Entry &entry,
+  string *buffer)
+{
+  Record record;
+  memset(&record, 0, sizeof(record));
+  record.acseq = entry.acseq;
+  record.size = entry.size;
+  memcpy(record.digest, hash.digest, hash.GetDigestSize());
+  record.type = type;
+  record.algorithm = hash.algorithm;
+  record.is_catalog = entry.is_catalog;
+  if (type == kRecordInsert) {
+    record.path_length =
+      min(entry.path.length(), static_cast<size_t>(UINT16_MAX));
+  }
+  buffer->append(reinterpret_cast<char *>(&record), sizeof(record));
+  buffer->append(entry.path.data(), record.path_length);
+}
+
+
+/**
+ * Returns true if the entry was found.
+ */
+bool QuotaIndex::Remove(const shash::Any &hash) {
+  EntryMap::iterator iter = entries_.find(hash);
+  if (iter == entries_.end())
+    return false;
+  DoRemove(iter);
+  AppendRecord(kRecordRemove, hash, Entry());
+  return true;
+}
+
+
+/**
+ * Applies the records of a snapshot or a journal file.  The journal may end
+ * in a torn record; good_size is set to the length of the valid prefix.
+ */
+bool QuotaIndex::Replay(FILE *f, bool is_journal, uint64_t *good_size) {
+  *good_size = 0;
+  uint32_t magic;
+  if (fread(&magic, sizeof(magic), 1, f) != 1)
+    return is_journal;
+  if (magic != kMagic)
+    return false;
+  *good_size = sizeof(magic);
+
+  Record record;
+  string path;
+  while (fread(&record, sizeof(record), 1, f) == 1) {
+    if ((record.type > kRecordRemove) || (record.algorithm >= shash::kAny) ||
+        (!is_journal && (record.type != kRecordInsert)))
+    {
+      break;
+    }
+    path.resize(record.path_length);
+    if ((record.path_length > 0) &&
+        (fread(&path[0], record.path_length, 1, f) != 1))
+    {
+      break;
+    }
+    Apply(record, path);
+    *good_size += sizeof(record) + record.path_length;
+    if (is_journal)
+      num_journal_records_++;
+  }
+
+  if (is_journal)
+    return true;
+  return !ferror(f) && feof(f) &&
+         (static_cast<uint64_t>(ftello(f)) == *good_size);
+}
+
+
+/**
+ * Writes the entire index into a new snapshot, which supersedes the journal.
+ */
+bool QuotaIndex::Snapshot() {
+  const string tmp_path = path_ + ".tmp";
+  FILE *f = fopen(tmp_path.c_str(), "w");
+  if (f == NULL) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to create quota index snapshot %s (%d)",
+             tmp_path.c_str(), errno);
+    return false;
+  }
+
+  vector<EntryMap::const_iterator> ordered;
+  ordered.reserve(entries_.size());
+  for (EntryMap::const_iterator i = entries_.begin(), iEnd = entries_.end();
+       i != iEnd; ++i)
+  {
+    ordered.push_back(i);
+  }
+  sort(ordered.begin(), ordered.end(),
+       RowidLess<EntryMap::const_iterator>());
+
+  const uint32_t magic = kMagic;
+  bool retval = (fwrite(&magic, sizeof(magic), 1, f) == 1);
+  string buffer;
+  for (unsigned i = 0; retval && (i < ordered.size()); ++i) {
+    buffer.clear();
+    MkRecord(kRecordInsert, ordered[i]->first, ordered[i]->second, &buffer);
+    retval = (fwrite(buffer.data(), buffer.size(), 1, f) == 1);
+  }
+  retval = retval && (fflush(f) == 0) && (fsync(fileno(f)) == 0);
+  fclose(f);
+  if (!retval || (rename(tmp_path.c_str(), path_.c_str()) != 0)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to write quota index snapshot %s (%d)",
+             tmp_path.c_str(), errno);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  journal_buffer_.clear();
+  num_journal_records_ = 0;
+  if ((ftruncate(fd_journal_, 0) != 0) ||
+      !SafeWrite(fd_journal_, &magic, sizeof(magic)))
+  {
+    // Replaying the old journal on top of the new snapshot is harmless
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to truncate quota journal %s.journal (%d)",
+             path_.c_str(), errno);
+  }
+  LogCvmfs(kLogQuota, kLogDebug, "written quota index snapshot, %lu entries",
+           entries_.size());
+  return true;
+}
+
+
+/**
+ * Writes pending records to the journal.  Compacts the journal into a new
+ * snapshot if it grew too large.
+ */
+bool QuotaIndex::Sync() {
+  if (!journal_buffer_.empty()) {
+    if (!SafeWrite(fd_journal_, journal_buffer_.data(),
+                   journal_buffer_.size()))
+    {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "failed to write quota journal %s.journal (%d)",
+               path_.c_str(), errno);
+      return false;
+    }
+    journal_buffer_.clear();
+  }
+  if ((num_journal_records_ > kMinJournalRecords) &&
+      (num_journal_records_ > entries_.size()))
+  {
+    return Snapshot();
+  }
+  return true;
+}
+
+
+/**
+ * Updates the sequence number, keeps the volatile flag.
+ */
+void QuotaIndex::Touch(const shash::Any &hash, const uint64_t seq) {
+  EntryMap::iterator iter = entries_.find(hash);
+  if (iter == entries_.end())
+    return;
+  const int64_t acseq = static_cast<int64_t>(
+    seq | (static_cast<uint64_t>(iter->second.acseq) & kVolatileFlag));
+  DoTouch(iter, acseq);
+  AppendRecord(kRecordTouch, hash, iter->second);
+}
+
+
+void QuotaIndex::UnblockAll() {
+  for (unsigned i = 0; i < blocked_.size(); ++i) {
+    EntryMap::iterator iter = entries_.find(blocked_[i]);
+    if ((iter == entries_.end()) || !IsBlocked(iter->second.pinned))
+      continue;
+    iter->second.pinned =
+      (iter->second.pinned == kBlocked) ? kPinned : kUnpinned;
+    lru_[iter->second.acseq] = iter->first;
+  }
+  blocked_.clear();
+}
+
+
+void QuotaIndex::Unpin(const shash::Any &hash) {
+  EntryMap::iterator iter = entries_.find(hash);
+  if (iter == entries_.end())
+    return;
+  if (IsBlocked(iter->second.pinned))
+    lru_[iter->second.acseq] = iter->first;
+  iter->second.pinned = kUnpinned;
+}
@@ -0,0 +1,167 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_QUOTA_INDEX_H_
+#define CVMFS_QUOTA_INDEX_H_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "util/single_copy.h"
+
+/**
+ * In-memory alternative to the SQLite cache catalog of the PosixQuotaManager.
+ * Entries are kept in a map keyed by content hash; the LRU order is a second
+ * map from the access sequence number to the content hash.  Volatile entries
+ * have the highest bit of their sequence number set, i.e. a negative sequence
+ * number, and are thus the first ones in the LRU order.
+ *
+ * Changes are appended to a journal file (<path>.journal).  Once the journal
+ * has more records than the index has entries, the entire index is written
+ * into a snapshot file (<path>) and the journal is truncated.  On startup, the
+ * snapshot is loaded and the journal is replayed on top of it.  Every record
+ * sets the state of a single entry, so replaying a journal twice is harmless;
+ * this covers a crash between writing the snapshot and truncating the
+ * journal.  A torn record at the end of the journal is dropped.
+ *
+ * As with the SQLite database, pinned flags are not persisted and the journal
+ * is not synced to disk.
+ */
+class QuotaIndex : SingleCopy {
+ public:
+  enum ListFilter {
+    kListRegular = 0,
+    kListCatalogs,
+    kListPinned,
+    kListVolatile,
+  };
+
+  static QuotaIndex *Create(const std::string &path);
+  ~QuotaIndex();
+
+  bool Contains(const shash::Any &hash);
+  bool Lookup(const shash::Any &hash, uint64_t *size, bool *is_pinned);
+  void Insert(const shash::Any &hash, const uint64_t size, const int64_t acseq,
+              const std::string &path, const bool is_catalog,
+              const bool is_pinned);
+  void Touch(const shash::Any &hash, const uint64_t seq);
+  void Unpin(const shash::Any &hash);
+  bool Remove(const shash::Any &hash);
+  void Clear();
+
+  bool GetLru(shash::Any *hash, uint64_t *size);
+  void Block(const shash::Any &hash);
+  void Defer(const shash::Any &hash);
+  void UnblockAll();
+
+  std::vector<std::string> List(const ListFilter filter);
+
+  bool Sync();
+  bool Snapshot();
+
+  uint64_t gauge() const { return gauge_; }
+  uint64_t max_seq() const { return max_seq_; }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  enum PinState {
+    kUnpinned = 0,
+    kPinned,
+    /**
+     * Pinned entries encountered during a cleanup are taken out of the LRU
+     * order until the cleanup is finished.
+     */
+    kBlocked,
+    /**
+     * Unpinned entries that the eviction policy spared in the first pass of a
+     * cleanup; unpinned again when the cleanup is finished.
+     */
+    kDeferred,
+  };
+
+  enum RecordType {
+    kRecordInsert = 0,
+    kRecordTouch,
+    kRecordRemove,
+  };
+
+  struct Entry {
+    Entry() : size(0), acseq(0), rowid(0), is_catalog(false), pinned(0) { }
+    uint64_t size;
+    int64_t acseq;
+    /**
+     * Insertion order, used for listings.  Like the SQLite rowid, it changes
+     * when an entry is replaced.
+     */
+    uint64_t rowid;
+    std::string path;
+    bool is_catalog;
+    unsigned char pinned;
+  };
+
+  /**
+   * Fixed-size part of snapshot and journal records, followed by path_length
+   * bytes of the path.
+   */
+  struct Record {
+    int64_t acseq;
+    uint64_t size;
+    unsigned char digest[shash::kMaxDigestSize];
+    uint16_t path_length;
+    unsigned char type;
+    unsigned char algorithm;
+    unsigned char is_catalog;
+  };
+
+  typedef std::map<shash::Any, Entry> EntryMap;
+
+  static const uint32_t kMagic = 0x4c524931;  // "LRI1"
+
+  /**
+   * The journal is compacted into a snapshot once it has more records than
+   * this and more records than there are entries in the index.
+   */
+  static const unsigned kMinJournalRecords = 64 * 1024;
+
+  static const uint64_t kVolatileFlag = 1ULL << 63;
+
+  explicit QuotaIndex(const std::string &path);
+  bool Load();
+  bool Replay(FILE *f, bool is_journal, uint64_t *good_size);
+  void Apply(const Record &record, const std::string &path);
+  void DoInsert(const shash::Any &hash, const uint64_t size,
+                const int64_t acseq, const std::string &path,
+                const bool is_catalog, const unsigned char pinned);
+  void DoTouch(EntryMap::iterator iter, const int64_t acseq);
+  void DoRemove(EntryMap::iterator iter);
+  void DoBlock(const shash::Any &hash, const PinState state);
+  static bool IsBlocked(const unsigned char pinned) {
+    return (pinned == kBlocked) || (pinned == kDeferred);
+  }
+  void AppendRecord(const RecordType type, const shash::Any &hash,
+                    const Entry &entry);
+  static void MkRecord(const RecordType type, const shash::Any &hash,
+                       const Entry &entry, std::string *buffer);
+
+  std::string path_;
+  int fd_journal_;
+  EntryMap entries_;
+  std::map<int64_t, shash::Any> lru_;
+  std::vector<shash::Any> blocked_;
+  uint64_t gauge_;
+  uint64_t max_seq_;
+  uint64_t next_rowid_;
+  /**
+   * Records that are not yet written to the journal
+   */
+  std::string journal_buffer_;
+  uint64_t num_journal_records_;
+};  // class QuotaIndex
+
+#endif  // CVMFS_QUOTA_INDEX_H_
@@ -0,0 +1,265 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "quota_policy.h"
+
+#include <cassert>
+#include <string>
+
+#include "murmur.h"
+
+using namespace std;  // NOLINT
+
+FrequencySketch::FrequencySketch(const unsigned width_log2)
+  : width_(1U << width_log2)
+  , counters_(kNumRows * (1U << width_log2) / 2, 0)
+  , sample_size_(10 * static_cast<uint64_t>(1U << width_log2))
+  , num_increments_(0)
+{
+  assert((width_log2 > 0) && (width_log2 < 32));
+}
+
+
+/**
+ * Halves all counters, two at a time.
+ */
+void FrequencySketch::Age() {
+  for (unsigned i = 0; i < counters_.size(); ++i)
+    counters_[i] = (counters_[i] >> 1) & 0x77;
+  num_increments_ /= 2;
+}
+
+
+void FrequencySketch::Clear() {
+  counters_.assign(counters_.size(), 0);
+  num_increments_ = 0;
+}
+
+
+unsigned FrequencySketch::Estimate(const shash::Any &hash) const {
+  const uint64_t h = GetHash(hash);
+  unsigned result = kMaxFrequency;
+  for (unsigned row = 0; row < kNumRows; ++row) {
+    const unsigned value = GetCounter(row, GetIndex(h, row));
+    if (value < result)
+      result = value;
+  }
+  return result;
+}
+
+
+unsigned FrequencySketch::GetCounter(
+  const unsigned row,
+  const unsigned index) const
+{
+  const unsigned pos = row * width_ + index;
+  return (counters_[pos / 2] >> ((pos % 2) * 4)) & 0x0F;
+}
+
+
+/**
+ * Content hashes of the cache are already uniformly distributed but the digest
+ * is mixed anyway so that arbitrary keys work, too.
+ */
+uint64_t FrequencySketch::GetHash(const shash::Any &hash) {
+  return MurmurHash64A(hash.digest, hash.GetDigestSize(), hash.algorithm);
+}
+
+
+/**
+ * Double hashing: the rows use different linear combinations of the two
+ * halves of the hash.
+ */
+unsigned FrequencySketch::GetIndex(const uint64_t hash,
+                                   const unsigned row) const
+{
+  const uint32_t h1 = hash & 0xFFFFFFFF;
+  const uint32_t h2 = hash >> 32;
+  return (h1 + row * h2) & (width_ - 1);
+}
+
+
+/**
+ * Conservative update: only the smallest counters are incremented, which
+ * reduces the overestimation of the count-min sketch.
+ */
+void FrequencySketch::Increment(const shash::Any &hash) {
+  const uint64_t h = GetHash(hash);
+  unsigned indexes[kNumRows];
+  unsigned min_value = kMaxFrequency;
+  for (unsigned row = 0; row < kNumRows; ++row) {
+    indexes[row] = GetIndex(h, row);
+    const unsigned value = GetCounter(row, indexes[row]);
+    if (value < min_value)
+      min_value = value;
+  }
+  if (min_value < kMaxFrequency) {
+    for (unsigned row = 0; row < kNumRows; ++row) {
+      if (GetCounter(row, indexes[row]) == min_value)
+        SetCounter(row, indexes[row], min_value + 1);
+    }
+  }
+
+  if (++num_increments_ >= sample_size_)
+    Age();
+}
+
+
+void FrequencySketch::SetCounter(
+  const unsigned row,
+  const unsigned index,
+  const unsigned value)
+{
+  const unsigned pos = row * width_ + index;
+  const unsigned shift = (pos % 2) * 4;
+  counters_[pos / 2] =
+    (counters_[pos / 2] & ~(0x0F << shift)) | ((value & 0x0F) << shift);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+EvictionPolicy *EvictionPolicy::Create(const Type type) {
+  switch (type) {
+    case kTinyLfu:
+      return new TinyLfuPolicy();
+    default:
+      return new LruPolicy();
+  }
+}
+
+
+bool EvictionPolicy::ParseType(const string &name, Type *type) {
+  if ((name == "") || (name == "lru")) {
+    *type = kLru;
+    return true;
+  }
+  if (name == "tinylfu") {
+    *type = kTinyLfu;
+    return true;
+  }
+  return false;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+bool TinyLfuPolicy::Defer(const shash::Any &hash, const uint64_t size) {
+  return sketch_.Estimate(hash) >= GetRequiredFrequency(size);
+}
+
+
+bool TinyLfuPolicy::Admit(
+  const shash::Any &candidate,
+  const shash::Any &victim)
+{
+  return sketch_.Estimate(candidate) > sketch_.Estimate(victim);
+}
+
+
+unsigned TinyLfuPolicy::GetRequiredFrequency(const uint64_t size) {
+  unsigned result = kMinFrequency;
+  for (uint64_t s = size / kSizeUnit; s > 1; s /= 2)
+    ++result;
+  return (result > FrequencySketch::kMaxFrequency) ?
+         FrequencySketch::kMaxFrequency : result;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+CacheSimulator::CacheSimulator(
+  EvictionPolicy *policy,
+  const uint64_t limit,
+  const uint64_t cleanup_threshold)
+  : policy_(policy)
+  , limit_(limit)
+  , cleanup_threshold_(cleanup_threshold)
+  , gauge_(0)
+  , num_hits_(0)
+  , num_misses_(0)
+  , hit_bytes_(0)
+  , miss_bytes_(0)
+  , num_cleanups_(0)
+{ }
+
+
+/**
+ * Returns true on a cache hit.  On a miss, the object is inserted.  Objects
+ * larger than the limit are not cached, like in the PosixCacheManager.  Objects
+ * that the policy does not admit become volatile, like in the
+ * PosixQuotaManager.
+ */
+bool CacheSimulator::Access(const shash::Any &hash, const uint64_t size) {
+  policy_->Access(hash);
+
+  map<shash::Any, Entry>::iterator iter = entries_.find(hash);
+  if (iter != entries_.end()) {
+    num_hits_++;
+    hit_bytes_ += iter->second.size;
+    list<shash::Any> *lru = iter->second.is_volatile ? &lru_volatile_ : &lru_;
+    lru->splice(lru->end(), *lru, iter->second.lru_pos);
+    return true;
+  }
+
+  num_misses_++;
+  miss_bytes_ += size;
+  if (size > limit_ - cleanup_threshold_)
+    return false;
+  bool admit = true;
+  if (gauge_ + size > limit_) {
+    if (!lru_volatile_.empty())
+      admit = policy_->Admit(hash, lru_volatile_.front());
+    else if (!lru_.empty())
+      admit = policy_->Admit(hash, lru_.front());
+    Cleanup();
+  }
+  list<shash::Any> *lru = admit ? &lru_ : &lru_volatile_;
+  Entry entry;
+  entry.size = size;
+  entry.is_volatile = !admit;
+  entry.lru_pos = lru->insert(lru->end(), hash);
+  entries_[hash] = entry;
+  gauge_ += size;
+  return false;
+}
+
+
+/**
+ * Same two passes as PosixQuotaManager::DoCleanup(), volatile entries first
+ */
+void CacheSimulator::Cleanup() {
+  num_cleanups_++;
+  const uint64_t leave_size = cleanup_threshold_;
+  uint64_t deferred_size = 0;
+  list<shash::Any> *lrus[] = {&lru_volatile_, &lru_};
+  for (unsigned i = 0; i < 2; ++i) {
+    list<shash::Any>::iterator iter = lrus[i]->begin();
+    while ((gauge_ > leave_size) && (iter != lrus[i]->end())) {
+      map<shash::Any, Entry>::iterator entry = entries_.find(*iter);
+      if ((deferred_size < leave_size) &&
+          policy_->Defer(*iter, entry->second.size))
+      {
+        deferred_size += entry->second.size;
+        ++iter;
+        continue;
+      }
+      gauge_ -= entry->second.size;
+      entries_.erase(entry);
+      iter = lrus[i]->erase(iter);
+    }
+  }
+
+  while (gauge_ > leave_size) {
+    list<shash::Any> *lru = lru_volatile_.empty() ? &lru_ : &lru_volatile_;
+    map<shash::Any, Entry>::iterator entry = entries_.find(lru->front());
+    gauge_ -= entry->second.size;
+    entries_.erase(entry);
+    lru->pop_front();
+  }
+}
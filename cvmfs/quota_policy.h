@@ -0,0 +1,184 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_QUOTA_POLICY_H_
+#define CVMFS_QUOTA_POLICY_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "util/single_copy.h"
+
+/**
+ * Count-min sketch with four rows of saturating 4 bit counters that estimates
+ * how often a content hash was accessed recently.  Once the number of
+ * increments reaches the sample size, all counters are halved.  Thus
+ * frequencies of entries that are not accessed anymore decay over time
+ * (TinyLFU, Einziger et al.).
+ */
+class FrequencySketch : SingleCopy {
+ public:
+  static const unsigned kMaxFrequency = 15;
+
+  explicit FrequencySketch(const unsigned width_log2);
+  void Increment(const shash::Any &hash);
+  unsigned Estimate(const shash::Any &hash) const;
+  void Clear();
+
+  unsigned width() const { return width_; }
+  uint64_t sample_size() const { return sample_size_; }
+
+ private:
+  static const unsigned kNumRows = 4;
+
+  static uint64_t GetHash(const shash::Any &hash);
+  unsigned GetIndex(const uint64_t hash, const unsigned row) const;
+  unsigned GetCounter(const unsigned row, const unsigned index) const;
+  void SetCounter(const unsigned row, const unsigned index,
+                  const unsigned value);
+  void Age();
+
+  unsigned width_;
+  /**
+   * Two counters per byte, kNumRows * width_ counters in total
+   */
+  std::vector<unsigned char> counters_;
+  uint64_t sample_size_;
+  uint64_t num_increments_;
+};
+
+
+/**
+ * Decides which entries a cache cleanup should spare.  The cleanup walks the
+ * cache entries in LRU order.  In a first pass, it skips the entries that the
+ * policy defers.  Only if that does not free enough space, a second pass
+ * evicts in plain LRU order.
+ */
+class EvictionPolicy : SingleCopy {
+ public:
+  enum Type {
+    kLru = 0,
+    kTinyLfu,
+  };
+
+  static EvictionPolicy *Create(const Type type);
+  static bool ParseType(const std::string &name, Type *type);
+  virtual ~EvictionPolicy() { }
+
+  virtual Type GetType() const = 0;
+  /**
+   * Called on every insert and touch of a cache entry
+   */
+  virtual void Access(const shash::Any &hash) = 0;
+  virtual bool Defer(const shash::Any &hash, const uint64_t size) = 0;
+  /**
+   * Called before a new entry displaces the least recently used entry of a
+   * full cache.  If false, the new entry is inserted as volatile, so that it
+   * is evicted before the regular entries.
+   */
+  virtual bool Admit(const shash::Any &candidate,
+                     const shash::Any &victim) = 0;
+};
+
+
+/**
+ * Plain LRU, never defers an entry.
+ */
+class LruPolicy : public EvictionPolicy {
+ public:
+  virtual Type GetType() const { return kLru; }
+  virtual void Access(const shash::Any & /* hash */) { }
+  virtual bool Defer(const shash::Any & /* hash */, const uint64_t /* size */)
+  {
+    return false;
+  }
+  virtual bool Admit(const shash::Any & /* candidate */,
+                     const shash::Any & /* victim */)
+  {
+    return true;
+  }
+};
+
+
+/**
+ * Defers entries that were accessed frequently.  Entries that were accessed
+ * only once, e.g. by a scan through a large data set, are evicted first, even
+ * if they are more recent than the working set.  Larger entries need
+ * proportionally more accesses: an entry of size s needs at least
+ * kMinFrequency + log2(s / kSizeUnit) accesses.  A new entry of a full cache
+ * is admitted only if it was accessed more often than the entry it displaces.
+ */
+class TinyLfuPolicy : public EvictionPolicy {
+ public:
+  static const unsigned kMinFrequency = 2;
+  static const uint64_t kSizeUnit = 1024 * 1024;
+
+  explicit TinyLfuPolicy(const unsigned sketch_width_log2 = 18)
+    : sketch_(sketch_width_log2) { }
+  virtual Type GetType() const { return kTinyLfu; }
+  virtual void Access(const shash::Any &hash) { sketch_.Increment(hash); }
+  virtual bool Defer(const shash::Any &hash, const uint64_t size);
+  virtual bool Admit(const shash::Any &candidate, const shash::Any &victim);
+
+  static unsigned GetRequiredFrequency(const uint64_t size);
+
+ private:
+  FrequencySketch sketch_;
+};
+
+
+/**
+ * Replays accesses against an in-memory cache with the cleanup logic of the
+ * PosixQuotaManager in order to compare eviction policies offline.  Like the
+ * quota manager, the simulated cache is cleaned up to the threshold once an
+ * insert exceeds the limit.
+ */
+class CacheSimulator : SingleCopy {
+ public:
+  CacheSimulator(EvictionPolicy *policy, const uint64_t limit,
+                 const uint64_t cleanup_threshold);
+  bool Access(const shash::Any &hash, const uint64_t size);
+
+  uint64_t num_hits() const { return num_hits_; }
+  uint64_t num_misses() const { return num_misses_; }
+  uint64_t hit_bytes() const { return hit_bytes_; }
+  uint64_t miss_bytes() const { return miss_bytes_; }
+  uint64_t num_cleanups() const { return num_cleanups_; }
+  uint64_t gauge() const { return gauge_; }
+
+ private:
+  struct Entry {
+    uint64_t size;
+    bool is_volatile;
+    std::list<shash::Any>::iterator lru_pos;
+  };
+
+  void Cleanup();
+
+  EvictionPolicy *policy_;
+  uint64_t limit_;
+  uint64_t cleanup_threshold_;
+  uint64_t gauge_;
+  /**
+   * Least recently used entry first
+   */
+  std::list<shash::Any> lru_;
+  /**
+   * Entries that were not admitted, evicted before the entries of lru_
+   */
+  std::list<shash::Any> lru_volatile_;
+  std::map<shash::Any, Entry> entries_;
+  uint64_t num_hits_;
+  uint64_t num_misses_;
+  uint64_t hit_bytes_;
+  uint64_t miss_bytes_;
+  uint64_t num_cleanups_;
+};
+
+#endif  // CVMFS_QUOTA_POLICY_H_
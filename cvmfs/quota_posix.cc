@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
@@ -31,6 +32,7 @@
 #include <sys/statfs.h>
 #endif
 #include <sys/statvfs.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -40,6 +42,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -50,6 +53,9 @@
 #include "logging.h"
 #include "monitor.h"
 #include "platform.h"
+#include "prng.h"
+#include "quota_index.h"
+#include "quota_ring.h"
 #include "smalloc.h"
 #include "statistics.h"
 #include "util/pointer.h"
@@ -59,6 +65,45 @@
 
 using namespace std;  // NOLINT
 
+const char *PosixQuotaManager::kTrashDir = "trash";
+
+namespace {
+
+/**
+ * A file found in the cache directory during RebuildIndex()
+ */
+struct RebuildEntry {
+  RebuildEntry(const time_t a, const shash::Any &h, const uint64_t s)
+    : atime(a), hash(h), size(s) { }
+  bool operator <(const RebuildEntry &other) const {
+    return atime < other.atime;
+  }
+  time_t atime;
+  shash::Any hash;
+  uint64_t size;
+};
+
+uint64_t GetTimeMs() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+}  // anonymous namespace
+
+
+/**
+ * Clients of a shared cache manager with protocol revision 3 or newer send
+ * asynchronous commands through the shared memory ring, if it is available.
+ */
+void PosixQuotaManager::AttachCommandRing() {
+  if (protocol_revision_ < 3)
+    return;
+  command_ring_ = CommandRing::Attach(workspace_dir_ + "/cachemgr.ring");
+  LogCvmfs(kLogQuota, kLogDebug, "shared memory command ring %s",
+           (command_ring_ != NULL) ? "attached" : "not available");
+}
+
 
 int PosixQuotaManager::BindReturnPipe(int pipe_wronly) {
   if (!shared_)
@@ -85,6 +130,128 @@ void PosixQuotaManager::CheckHighPinWatermark() {
              "high watermark of pinned files (%" PRIu64 "M > %" PRIu64 "M)",
              pinned_/(1024*1024), watermark/(1024*1024));
     BroadcastBackchannels("R");  // clients: please release pinned catalogs
+    CollectDeadPinClients();
+  }
+}
+
+
+/**
+ * Registers the client as a holder of the pin.  Clients of protocol revisions
+ * before 5 send no id and hold no reference.
+ */
+void PosixQuotaManager::AddPinClient(
+  const shash::Any &hash,
+  const uint32_t client_id)
+{
+  if (client_id == 0)
+    return;
+  pin_clients_[hash].insert(client_id);
+}
+
+
+/**
+ * Returns true if the pin can be released, i.e. no other client holds it.
+ */
+bool PosixQuotaManager::RemovePinClient(
+  const shash::Any &hash,
+  const uint32_t client_id)
+{
+  map<shash::Any, set<uint32_t> >::iterator iter = pin_clients_.find(hash);
+  if (iter == pin_clients_.end())
+    return true;
+  if (client_id != 0) {
+    iter->second.erase(client_id);
+    if (!iter->second.empty())
+      return false;
+  }
+  pin_clients_.erase(iter);
+  return true;
+}
+
+
+/**
+ * Queues the clients whose back channels were removed by a failed broadcast.
+ */
+void PosixQuotaManager::CollectDeadPinClients() {
+  MutexLockGuard lock_guard(*lock_back_channels_);
+  map<shash::Md5, uint32_t>::iterator i = back_channel_clients_.begin();
+  while (i != back_channel_clients_.end()) {
+    if (back_channels_.find(i->first) != back_channels_.end()) {
+      ++i;
+      continue;
+    }
+    dead_pin_clients_.push_back(i->second);
+    back_channel_clients_.erase(i++);
+  }
+}
+
+
+/**
+ * Releases the pins of clients that went away without unpinning, unless the
+ * client still has another back channel.  Without this, the pins of a crashed
+ * client would stay forever.
+ */
+void PosixQuotaManager::DropPinClients() {
+  set<uint32_t> alive;
+  {
+    MutexLockGuard lock_guard(*lock_back_channels_);
+    for (map<shash::Md5, uint32_t>::const_iterator i =
+         back_channel_clients_.begin(), iend = back_channel_clients_.end();
+         i != iend; ++i)
+    {
+      alive.insert(i->second);
+    }
+  }
+
+  for (unsigned i = 0; i < dead_pin_clients_.size(); ++i) {
+    const uint32_t client_id = dead_pin_clients_[i];
+    if (alive.find(client_id) != alive.end())
+      continue;
+    unsigned num_released = 0;
+    map<shash::Any, set<uint32_t> >::iterator iter = pin_clients_.begin();
+    while (iter != pin_clients_.end()) {
+      if ((iter->second.erase(client_id) == 0) || !iter->second.empty()) {
+        ++iter;
+        continue;
+      }
+      const shash::Any hash = iter->first;
+      pin_clients_.erase(iter++);
+      ReleasePin(hash);
+      if (!UnpinEntry(hash))
+        abort();
+      num_released++;
+    }
+    LogCvmfs(kLogQuota, kLogDebug, "dropped client %u, released %u pins",
+             client_id, num_released);
+  }
+  dead_pin_clients_.clear();
+}
+
+
+/**
+ * Updates the pinned gauge once the last client released the pin.  The
+ * database entry is unpinned separately.
+ */
+void PosixQuotaManager::ReleasePin(const shash::Any &hash) {
+  map<shash::Any, uint64_t>::iterator iter = pinned_chunks_.find(hash);
+  if (iter == pinned_chunks_.end()) {
+    LogCvmfs(kLogQuota, kLogDebug, "this chunk was not pinned");
+    return;
+  }
+
+  pinned_ -= iter->second;
+  pinned_chunks_.erase(iter);
+  // It can happen that files get pinned that were removed from the cache
+  // (see cache.cc).  We fix this at this point, where we remove such
+  // entries from the cache database.
+  if (!FileExists(cache_dir_ + "/" + hash.MakePathWithoutSuffix())) {
+    LogCvmfs(kLogQuota, kLogDebug,
+             "remove orphaned pinned hash %s from cache database",
+             hash.ToString().c_str());
+    uint64_t size;
+    bool is_pinned;
+    if (LookupEntry(hash, &size, &is_pinned) && RemoveEntry(hash))
+      gauge_ -= size;
   }
 }
 
@@ -143,6 +310,12 @@ bool PosixQuotaManager::Cleanup(const uint64_t leave_size) {
 
 
 void PosixQuotaManager::CloseDatabase() {
+  if (index_ != NULL) {
+    // Startup then only needs to load the snapshot
+    index_->Snapshot();
+    delete index_;
+    index_ = NULL;
+  }
   if (stmt_list_catalogs_) sqlite3_finalize(stmt_list_catalogs_);
   if (stmt_list_pinned_) sqlite3_finalize(stmt_list_pinned_);
   if (stmt_list_volatile_) sqlite3_finalize(stmt_list_volatile_);
@@ -153,6 +326,7 @@ void PosixQuotaManager::CloseDatabase() {
   if (stmt_touch_) sqlite3_finalize(stmt_touch_);
   if (stmt_unpin_) sqlite3_finalize(stmt_unpin_);
   if (stmt_block_) sqlite3_finalize(stmt_block_);
+  if (stmt_defer_) sqlite3_finalize(stmt_defer_);
   if (stmt_unblock_) sqlite3_finalize(stmt_unblock_);
   if (stmt_new_) sqlite3_finalize(stmt_new_);
   if (database_) sqlite3_close(database_);
@@ -167,11 +341,13 @@ void PosixQuotaManager::CloseDatabase() {
   stmt_touch_ = NULL;
   stmt_unpin_ = NULL;
   stmt_block_ = NULL;
+  stmt_defer_ = NULL;
   stmt_unblock_ = NULL;
   stmt_new_ = NULL;
   database_ = NULL;
 
   pinned_chunks_.clear();
+  pin_clients_.clear();
 }
 
 
@@ -188,11 +364,15 @@ void PosixQuotaManager::CloseReturnPipe(int pipe[2]) {
 bool PosixQuotaManager::Contains(const string &hash_str) {
   bool result = false;
 
-  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
-                    SQLITE_STATIC);
-  if (sqlite3_step(stmt_size_) == SQLITE_ROW)
-    result = true;
-  sqlite3_reset(stmt_size_);
+  if (index_ != NULL) {
+    result = index_->Contains(shash::MkFromHexPtr(shash::HexPtr(hash_str)));
+  } else {
+    sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
+                      SQLITE_STATIC);
+    if (sqlite3_step(stmt_size_) == SQLITE_ROW)
+      result = true;
+    sqlite3_reset(stmt_size_);
+  }
   LogCvmfs(kLogQuota, kLogDebug, "contains %s returns %d",
            hash_str.c_str(), result);
 
@@ -230,16 +410,32 @@ PosixQuotaManager *PosixQuotaManager::Create(
   const string &cache_workspace,
   const uint64_t limit,
   const uint64_t cleanup_threshold,
-  const bool rebuild_database)
+  const bool rebuild_database,
+  const IndexType index_type,
+  const EvictionPolicy::Type eviction_type,
+  const uint64_t cleanup_watermark,
+  const unsigned unlink_rate)
 {
   if (cleanup_threshold >= limit) {
     LogCvmfs(kLogQuota, kLogDebug, "invalid parameters: limit %" PRIu64 ", "
              "cleanup_threshold %" PRIu64, limit, cleanup_threshold);
     return NULL;
   }
+  if ((cleanup_watermark > 0) &&
+      ((cleanup_watermark <= cleanup_threshold) ||
+       (cleanup_watermark >= limit)))
+  {
+    LogCvmfs(kLogQuota, kLogDebug, "invalid parameters: watermark %" PRIu64
+             " not between threshold and limit", cleanup_watermark);
+    return NULL;
+  }
 
   PosixQuotaManager *quota_manager =
     new PosixQuotaManager(limit, cleanup_threshold, cache_workspace);
+  quota_manager->index_type_ = index_type;
+  quota_manager->eviction_policy_ = EvictionPolicy::Create(eviction_type);
+  quota_manager->cleanup_watermark_ = cleanup_watermark;
+  quota_manager->unlink_rate_ = unlink_rate;
 
   // Initialize cache catalog
   if (!quota_manager->InitDatabase(rebuild_database)) {
@@ -263,7 +459,11 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
   const std::string &cache_workspace,
   const uint64_t limit,
   const uint64_t cleanup_threshold,
-  bool foreground)
+  bool foreground,
+  const IndexType index_type,
+  const EvictionPolicy::Type eviction_type,
+  const uint64_t cleanup_watermark,
+  const unsigned unlink_rate)
 {
   string cache_dir;
   string workspace_dir;
@@ -302,6 +502,7 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
     } else {
       LogCvmfs(kLogQuota, kLogDebug, "connected to ancient cache manager");
     }
+    quota_mgr->AttachCommandRing();
     return quota_mgr;
   }
   const int connect_error = errno;
@@ -350,6 +551,10 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
   command_line.push_back(StringifyInt(GetLogSyslogLevel()));
   command_line.push_back(StringifyInt(GetLogSyslogFacility()));
   command_line.push_back(GetLogDebugFile() + ":" + GetLogMicroSyslog());
+  command_line.push_back(StringifyInt(index_type));
+  command_line.push_back(StringifyInt(eviction_type));
+  command_line.push_back(StringifyInt(cleanup_watermark));
+  command_line.push_back(StringifyInt(unlink_rate));
 
   set<int> preserve_filedes;
   preserve_filedes.insert(0);
@@ -408,6 +613,7 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
   Nonblock2Block(quota_mgr->pipe_lru_[1]);
   LogCvmfs(kLogQuota, kLogDebug, "connected to a new cache manager");
   quota_mgr->protocol_revision_ = kProtocolRevision;
+  quota_mgr->AttachCommandRing();
 
   UnlockFile(fd_lockfile);
 
@@ -420,9 +626,71 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
 }
 
 
+/**
+ * Called once per tick by the command server if background cleanup is enabled.
+ * Evicts at most one batch of entries.  The cleaner thread unlinks the files.
+ */
+void PosixQuotaManager::DoBackgroundCleanup() {
+  if (!background_cleanup_) {
+    if (gauge_ <= cleanup_watermark_)
+      return;
+    LogCvmfs(kLogQuota, kLogSyslog,
+             "cache above watermark, clean up in the background until at most "
+             "%lu KB is used", cleanup_threshold_ / 1024);
+    cleanup_recorder_.Tick();
+    background_cleanup_ = true;
+  }
+
+  if (gauge_ > cleanup_threshold_) {
+    uint64_t backlog_files;
+    uint64_t backlog_bytes;
+    cleaner_->GetBacklog(&backlog_files, &backlog_bytes);
+    const unsigned batch_size = cleaner_->batch_size();
+    if ((batch_size > 0) && (backlog_files >= kMaxBacklogTicks * batch_size)) {
+      LogCvmfs(kLogQuota, kLogDebug, "waiting for cleaner, backlog %" PRIu64,
+               backlog_files);
+      return;
+    }
+
+    vector<BackgroundCleaner::Entry> trash;
+    int retval;
+    if (index_ == NULL) {
+      retval = sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
+      assert(retval == SQLITE_OK);
+    }
+    if (!EvictEntries(cleanup_threshold_, batch_size, &trash))
+      abort();
+    if (index_ != NULL) {
+      index_->Sync();
+    } else {
+      retval = sqlite3_exec(database_, "COMMIT", NULL, NULL, NULL);
+      if (retval != SQLITE_OK) {
+        LogCvmfs(kLogQuota, kLogSyslogErr,
+                 "failed to commit to cachedb, error %d", retval);
+        abort();
+      }
+    }
+    num_background_evictions_ += trash.size();
+    MoveToTrash(&trash);
+    cleaner_->Enqueue(trash);
+  }
+
+  if (gauge_ <= cleanup_threshold_) {
+    LogCvmfs(kLogQuota, kLogDebug, "background cleanup done, gauge %" PRIu64,
+             gauge_);
+    background_cleanup_ = false;
+  }
+}
+
+
 bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
-  if (gauge_ <= leave_size)
+  if (gauge_ <= leave_size) {
+    // Files in the backlog of the cleaner can still push the cache over the
+    // limit
+    if (cleaner_.IsValid())
+      cleaner_->Drain();
     return true;
+  }
 
   // TODO(jblomer) transaction
   LogCvmfs(kLogQuota, kLogSyslog,
@@ -430,59 +698,19 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
   LogCvmfs(kLogQuota, kLogDebug, "gauge %" PRIu64, gauge_);
   cleanup_recorder_.Tick();
 
-  bool result;
-  string hash_str;
-  vector<string> trash;
-
-  do {
-    sqlite3_reset(stmt_lru_);
-    if (sqlite3_step(stmt_lru_) != SQLITE_ROW) {
-      LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
-      break;
-    }
-
-    hash_str = string(reinterpret_cast<const char *>(
-                      sqlite3_column_text(stmt_lru_, 0)));
-    LogCvmfs(kLogQuota, kLogDebug, "removing %s", hash_str.c_str());
-    shash::Any hash = shash::MkFromHexPtr(shash::HexPtr(hash_str));
-
-    // That's a critical condition.  We must not delete a not yet inserted
-    // pinned file as it is already reserved (but will be inserted later).
-    // Instead, set the pin bit in the db to not run into an endless loop
-    if (pinned_chunks_.find(hash) == pinned_chunks_.end()) {
-      trash.push_back(cache_dir_ + "/" + hash.MakePathWithoutSuffix());
-      gauge_ -= sqlite3_column_int64(stmt_lru_, 1);
-      LogCvmfs(kLogQuota, kLogDebug, "lru cleanup %s, new gauge %" PRIu64,
-               hash_str.c_str(), gauge_);
-
-      sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
-                        SQLITE_STATIC);
-      result = (sqlite3_step(stmt_rm_) == SQLITE_DONE);
-      sqlite3_reset(stmt_rm_);
-
-      if (!result) {
-        LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
-                 "failed to find %s in cache database (%d). "
-                 "Cache database is out of sync. "
-                 "Restart cvmfs with clean cache.", hash_str.c_str(), result);
-        return false;
-      }
-    } else {
-      sqlite3_bind_text(stmt_block_, 1, &hash_str[0], hash_str.length(),
-                        SQLITE_STATIC);
-      result = (sqlite3_step(stmt_block_) == SQLITE_DONE);
-      sqlite3_reset(stmt_block_);
-      assert(result);
-    }
-  } while (gauge_ > leave_size);
-
-  result = (sqlite3_step(stmt_unblock_) == SQLITE_DONE);
-  sqlite3_reset(stmt_unblock_);
-  assert(result);
+  vector<BackgroundCleaner::Entry> trash;
+  if (!EvictEntries(leave_size, 0, &trash))
+    return false;
 
-  // Double fork avoids zombie, forked removal process must not flush file
-  // buffers
-  if (!trash.empty()) {
+  if (cleaner_.IsValid()) {
+    // The cache hit its limit although it is cleaned up in the background.
+    // Writers have to wait until the disk space is actually freed.
+    MoveToTrash(&trash);
+    cleaner_->Enqueue(trash);
+    cleaner_->Drain();
+  } else if (!trash.empty()) {
+    // Double fork avoids zombie, forked removal process must not flush file
+    // buffers
     if (async_delete_) {
       pid_t pid;
       int statloc;
@@ -497,8 +725,9 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
 #endif
         if (fork() == 0) {
           for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
-            LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
-            unlink(trash[i].c_str());
+            LogCvmfs(kLogQuota, kLogDebug, "unlink %s",
+                     trash[i].path.c_str());
+            unlink(trash[i].path.c_str());
           }
           _exit(0);
         }
@@ -511,8 +740,8 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
       }
     } else {  // !async_delete_
       for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
-        LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
-        unlink(trash[i].c_str());
+        LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].path.c_str());
+        unlink(trash[i].path.c_str());
       }
     }
   }
@@ -527,6 +756,103 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
 }
 
 
+/**
+ * Renames the evicted files into the trash directory.  The background cleaner
+ * unlinks only trash paths, so it does not remove a file that is inserted again
+ * under its old cache path while the eviction waits in the backlog.  Files
+ * that are already gone are dropped.  Files that cannot be moved keep their
+ * cache path and are subject to the race with re-insertion.
+ */
+void PosixQuotaManager::MoveToTrash(vector<BackgroundCleaner::Entry> *trash) {
+  const string trash_dir = cache_dir_ + "/" + kTrashDir;
+  vector<BackgroundCleaner::Entry> moved;
+  moved.reserve(trash->size());
+  for (unsigned i = 0; i < trash->size(); ++i) {
+    const string &path = (*trash)[i].path;
+    const string trash_path = trash_dir + "/" + GetFileName(path) + "." +
+                              StringifyInt(num_trashed_++);
+    if (rename(path.c_str(), trash_path.c_str()) == 0) {
+      moved.push_back(BackgroundCleaner::Entry(trash_path, (*trash)[i].size));
+      continue;
+    }
+    if (errno == ENOENT) {
+      LogCvmfs(kLogQuota, kLogDebug, "evicted file %s not found",
+               path.c_str());
+      continue;
+    }
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to move %s to trash (%d)", path.c_str(), errno);
+    moved.push_back((*trash)[i]);
+  }
+  trash->swap(moved);
+}
+
+
+/**
+ * Creates the trash directory and starts the background cleaner.  Files that
+ * were left in the trash directory by a previous run are unlinked first.
+ */
+void PosixQuotaManager::SpawnCleaner() {
+  const string trash_dir = cache_dir_ + "/" + kTrashDir;
+  if (!MkdirDeep(trash_dir, 0700, false)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to create %s, evicted files are unlinked in place",
+             trash_dir.c_str());
+  }
+  cleaner_ = new BackgroundCleaner(unlink_rate_);
+
+  vector<string> leftovers = FindFilesByPrefix(trash_dir, "");
+  vector<BackgroundCleaner::Entry> entries;
+  for (unsigned i = 0; i < leftovers.size(); ++i) {
+    if (!FileExists(leftovers[i]))
+      continue;
+    const int64_t size = GetFileSize(leftovers[i]);
+    if (size < 0)
+      continue;
+    entries.push_back(BackgroundCleaner::Entry(leftovers[i], size));
+    // Do not reuse the names of the leftovers
+    const string name = GetFileName(leftovers[i]);
+    const size_t pos_seq = name.rfind('.');
+    if (pos_seq != string::npos) {
+      num_trashed_ = std::max(num_trashed_,
+                              String2Uint64(name.substr(pos_seq + 1)) + 1);
+    }
+  }
+  if (!entries.empty()) {
+    LogCvmfs(kLogQuota, kLogDebug, "%u files left in trash",
+             static_cast<unsigned>(entries.size()));
+  }
+  cleaner_->Enqueue(entries);
+  cleaner_->Spawn();
+}
+
+
+/**
+ * Bytes of evicted files that the background cleaner did not yet unlink.  They
+ * are not part of gauge_ but still occupy the cache disk.
+ */
+uint64_t PosixQuotaManager::GetBacklogBytes() {
+  if (!cleaner_.IsValid())
+    return 0;
+  uint64_t backlog_files;
+  uint64_t backlog_bytes;
+  cleaner_->GetBacklog(&backlog_files, &backlog_bytes);
+  return backlog_bytes;
+}
+
+
+void PosixQuotaManager::DoGetCleanupStatus(CleanupStatus *status) {
+  *status = CleanupStatus();
+  status->watermark = cleanup_watermark_;
+  status->unlink_rate = unlink_rate_;
+  status->num_evicted = num_background_evictions_;
+  if (cleaner_.IsValid()) {
+    status->num_unlinked = cleaner_->GetNumUnlinked();
+    cleaner_->GetBacklog(&status->backlog_files, &status->backlog_bytes);
+  }
+}
+
+
 void PosixQuotaManager::DoInsert(
   const shash::Any &hash,
   const uint64_t size,
@@ -548,7 +874,7 @@ void PosixQuotaManager::DoInsert(
   cmd->desc_length = desc_length;
   memcpy(reinterpret_cast<char *>(cmd)+sizeof(LruCommand),
          &description[0], desc_length);
-  WritePipe(pipe_lru_[1], cmd, sizeof(LruCommand) + desc_length);
+  SendCommand(cmd, sizeof(LruCommand) + desc_length);
 }
 
 
@@ -578,6 +904,97 @@ vector<string> PosixQuotaManager::DoList(const CommandType list_command) {
 }
 
 
+/**
+ * Removes entries from the cache catalog in LRU order until at most leave_size
+ * bytes are left or max_entries entries are evicted (no limit if zero).  The
+ * paths of the evicted files are appended to trash, the files themselves are
+ * not touched.
+ *
+ * \return False if the cache catalog is out of sync
+ */
+bool PosixQuotaManager::EvictEntries(
+  const uint64_t leave_size,
+  const unsigned max_entries,
+  vector<BackgroundCleaner::Entry> *trash)
+{
+  bool result;
+  string hash_str;
+  shash::Any hash;
+  uint64_t size;
+  // In the first pass, entries that the eviction policy defers are blocked
+  // like pinned entries.  If that does not free enough space, they are
+  // unblocked and the second pass evicts in LRU order.  Deferring more than
+  // leave_size is futile.
+  bool first_pass = true;
+  unsigned num_deferred = 0;
+  uint64_t deferred_size = 0;
+  unsigned num_evicted = 0;
+
+  do {
+    if (!GetLruEntry(&hash, &size)) {
+      if (first_pass && (num_deferred > 0)) {
+        LogCvmfs(kLogQuota, kLogDebug, "evicting %u deferred entries",
+                 num_deferred);
+        first_pass = false;
+        UnblockAll();
+        continue;
+      }
+      LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
+      break;
+    }
+    hash_str = hash.ToString();
+    LogCvmfs(kLogQuota, kLogDebug, "removing %s", hash_str.c_str());
+
+    // That's a critical condition.  We must not delete a not yet inserted
+    // pinned file as it is already reserved (but will be inserted later).
+    // Instead, set the pin bit in the db to not run into an endless loop
+    const bool is_pinned = (pinned_chunks_.find(hash) != pinned_chunks_.end());
+    const bool defer = !is_pinned && first_pass &&
+                       (deferred_size < leave_size) &&
+                       eviction_policy_->Defer(hash, size);
+    if (defer) {
+      LogCvmfs(kLogQuota, kLogDebug, "deferring eviction of %s",
+               hash_str.c_str());
+      num_deferred++;
+      deferred_size += size;
+    }
+    if (!is_pinned && !defer) {
+      trash->push_back(BackgroundCleaner::Entry(
+        cache_dir_ + "/" + hash.MakePathWithoutSuffix(), size));
+      num_evicted++;
+      gauge_ -= size;
+      LogCvmfs(kLogQuota, kLogDebug, "lru cleanup %s, new gauge %" PRIu64,
+               hash_str.c_str(), gauge_);
+
+      result = RemoveEntry(hash);
+      if (!result) {
+        LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+                 "failed to find %s in cache database (%d). "
+                 "Cache database is out of sync. "
+                 "Restart cvmfs with clean cache.", hash_str.c_str(), result);
+        return false;
+      }
+    } else if (index_ != NULL) {
+      if (defer)
+        index_->Defer(hash);
+      else
+        index_->Block(hash);
+    } else {
+      sqlite3_stmt *stmt = defer ? stmt_defer_ : stmt_block_;
+      sqlite3_bind_text(stmt, 1, &hash_str[0], hash_str.length(),
+                        SQLITE_STATIC);
+      result = (sqlite3_step(stmt) == SQLITE_DONE);
+      sqlite3_reset(stmt);
+      assert(result);
+    }
+  } while ((gauge_ > leave_size) &&
+           ((max_entries == 0) || (num_evicted < max_entries)));
+
+  UnblockAll();
+  return true;
+}
+
+
 uint64_t PosixQuotaManager::GetCapacity() {
   if (limit_ != (uint64_t)(-1))
     return limit_;
@@ -704,6 +1121,26 @@ uint64_t PosixQuotaManager::GetCleanupRate(uint64_t period_s) {
 }
 
 
+bool PosixQuotaManager::GetCleanupStatus(CleanupStatus *status) {
+  if (!spawned_) {
+    DoGetCleanupStatus(status);
+    return true;
+  }
+  if (protocol_revision_ < 4)
+    return false;
+
+  int pipe_cleanup_status[2];
+  MakeReturnPipe(pipe_cleanup_status);
+  LruCommand cmd;
+  cmd.command_type = kCleanupStatus;
+  cmd.return_pipe = pipe_cleanup_status[1];
+  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+  ReadHalfPipe(pipe_cleanup_status[0], status, sizeof(*status));
+  CloseReturnPipe(pipe_cleanup_status);
+  return true;
+}
+
+
 bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
   string sql;
   sqlite3_stmt *stmt;
@@ -713,9 +1150,14 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
     LogCvmfs(kLogQuota, kLogDebug, "failed to create cachedb lock");
     return false;
   }
+  if (index_type_ == kIndexJournal)
+    return InitIndex(rebuild_database);
 
   bool retry = false;
   const string db_file = cache_dir_ + "/cachedb";
+  // A left-over index would be outdated when switching back to it later on
+  unlink((db_file + ".lru").c_str());
+  unlink((db_file + ".lru.journal").c_str());
   if (rebuild_database) {
     LogCvmfs(kLogQuota, kLogDebug, "rebuild database, unlinking existing (%s)",
              db_file.c_str());
@@ -845,8 +1287,12 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
                      "WHERE sha1=:sha1;", -1, &stmt_unpin_, NULL);
   sqlite3_prepare_v2(database_, "UPDATE cache_catalog SET pinned=2 "
                      "WHERE sha1=:sha1;", -1, &stmt_block_, NULL);
-  sqlite3_prepare_v2(database_, "UPDATE cache_catalog SET pinned=1 "
-                     "WHERE pinned=2;", -1, &stmt_unblock_, NULL);
+  // Entries deferred by the eviction policy are temporarily marked with 3
+  sqlite3_prepare_v2(database_, "UPDATE cache_catalog SET pinned=3 "
+                     "WHERE sha1=:sha1;", -1, &stmt_defer_, NULL);
+  sqlite3_prepare_v2(database_, "UPDATE cache_catalog SET "
+                     "pinned=CASE pinned WHEN 2 THEN 1 ELSE 0 END "
+                     "WHERE pinned>1;", -1, &stmt_unblock_, NULL);
   sqlite3_prepare_v2(database_,
                      "INSERT OR REPLACE INTO cache_catalog "
                      "(sha1, size, acseq, path, type, pinned) "
@@ -860,7 +1306,7 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
   sqlite3_prepare_v2(database_,
                      "SELECT sha1, size FROM cache_catalog WHERE "
                      "acseq=(SELECT min(acseq) "
-                     "FROM cache_catalog WHERE pinned<>2);",
+                     "FROM cache_catalog WHERE pinned<2);",
                      -1, &stmt_lru_, NULL);
   sqlite3_prepare_v2(database_,
                      ("SELECT path FROM cache_catalog WHERE type=" +
@@ -886,6 +1332,150 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
 }
 
 
+/**
+ * Counterpart of InitDatabase() for the in-memory index.  Expects the cache
+ * database lock to be taken.
+ */
+bool PosixQuotaManager::InitIndex(const bool rebuild_database) {
+  const string db_file = cache_dir_ + "/cachedb";
+  // The SQLite database would be outdated when switching back to it later on
+  unlink(db_file.c_str());
+  unlink((db_file + "-journal").c_str());
+
+  const string index_file = db_file + ".lru";
+  if (rebuild_database) {
+    LogCvmfs(kLogQuota, kLogDebug, "rebuild index, unlinking existing (%s)",
+             index_file.c_str());
+    unlink(index_file.c_str());
+    unlink((index_file + ".journal").c_str());
+  }
+
+  index_ = QuotaIndex::Create(index_file);
+  if (index_ == NULL) {
+    LogCvmfs(kLogQuota, kLogSyslogWarn, "LRU index corrupted, re-building");
+    unlink(index_file.c_str());
+    unlink((index_file + ".journal").c_str());
+    index_ = QuotaIndex::Create(index_file);
+    if (index_ == NULL) {
+      LogCvmfs(kLogQuota, kLogDebug, "could not init cache index %s",
+               index_file.c_str());
+      UnlockFile(fd_lock_cachedb_);
+      return false;
+    }
+  }
+
+  // If the index is empty, recreate from file system
+  if ((index_->size() == 0) || rebuild_database) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "CernVM-FS: building lru cache index...");
+    if (!RebuildIndex()) {
+      LogCvmfs(kLogQuota, kLogDebug,
+               "could not build cache index from file system");
+      delete index_;
+      index_ = NULL;
+      UnlockFile(fd_lock_cachedb_);
+      return false;
+    }
+  }
+
+  gauge_ = index_->gauge();
+  seq_ = index_->max_seq() + 1;
+  return true;
+}
+
+
+/**
+ * Inserts or replaces an entry in the SQLite database or in the index.
+ *
+ * \return False if the database could not be updated
+ */
+bool PosixQuotaManager::InsertEntry(
+  const shash::Any &hash,
+  const uint64_t size,
+  const uint64_t acseq,
+  const char *description,
+  const unsigned desc_length,
+  const FileTypes type,
+  const bool is_pinned)
+{
+  if (index_ != NULL) {
+    index_->Insert(hash, size, static_cast<int64_t>(acseq),
+                   string(description, desc_length), type == kFileCatalog,
+                   is_pinned);
+    return true;
+  }
+
+  const string hash_str = hash.ToString();
+  sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  sqlite3_bind_int64(stmt_new_, 2, size);
+  sqlite3_bind_int64(stmt_new_, 3, acseq);
+  sqlite3_bind_text(stmt_new_, 4, description, desc_length, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt_new_, 5, type);
+  sqlite3_bind_int64(stmt_new_, 6, is_pinned ? 1 : 0);
+  int retval = sqlite3_step(stmt_new_);
+  sqlite3_reset(stmt_new_);
+  LogCvmfs(kLogQuota, kLogDebug, "insert or replace %s: %d",
+           hash_str.c_str(), retval);
+  if ((retval != SQLITE_DONE) && (retval != SQLITE_OK)) {
+    LogCvmfs(kLogQuota, kLogSyslogErr,
+             "failed to insert %s in cachedb, error %d",
+             hash_str.c_str(), retval);
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Retrieves the least recently used entry that is not blocked from the SQLite
+ * database or from the index.
+ *
+ * \return False if there is no such entry
+ */
+bool PosixQuotaManager::GetLruEntry(shash::Any *hash, uint64_t *size) {
+  if (index_ != NULL)
+    return index_->GetLru(hash, size);
+
+  sqlite3_reset(stmt_lru_);
+  if (sqlite3_step(stmt_lru_) != SQLITE_ROW)
+    return false;
+  const string hash_str(reinterpret_cast<const char *>(
+                        sqlite3_column_text(stmt_lru_, 0)));
+  *hash = shash::MkFromHexPtr(shash::HexPtr(hash_str));
+  *size = sqlite3_column_int64(stmt_lru_, 1);
+  sqlite3_reset(stmt_lru_);
+  return true;
+}
+
+
+/**
+ * Looks up size and pin state of an entry in the SQLite database or in the
+ * index.
+ *
+ * \return False if the entry does not exist
+ */
+bool PosixQuotaManager::LookupEntry(
+  const shash::Any &hash,
+  uint64_t *size,
+  bool *is_pinned)
+{
+  if (index_ != NULL)
+    return index_->Lookup(hash, size, is_pinned);
+
+  bool result = false;
+  const string hash_str = hash.ToString();
+  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  if (sqlite3_step(stmt_size_) == SQLITE_ROW) {
+    *size = sqlite3_column_int64(stmt_size_, 0);
+    *is_pinned = (sqlite3_column_int64(stmt_size_, 1) != 0);
+    result = true;
+  }
+  sqlite3_reset(stmt_size_);
+  return result;
+}
+
+
 /**
  * Inserts a new file into cache catalog.  This file gets a new,
  * highest sequence number. Does cache cleanup if necessary.
@@ -973,6 +1563,18 @@ int PosixQuotaManager::MainCacheManager(int argc, char **argv) {
   int syslog_level = String2Int64(argv[8]);
   int syslog_facility = String2Int64(argv[9]);
   vector<string> logfiles = SplitString(argv[10], ':');
+  if (argc > 11) {
+    shared_manager.index_type_ =
+      static_cast<IndexType>(String2Int64(argv[11]));
+  }
+  if (argc > 12) {
+    shared_manager.eviction_policy_ = EvictionPolicy::Create(
+      static_cast<EvictionPolicy::Type>(String2Int64(argv[12])));
+  }
+  if (argc > 14) {
+    shared_manager.cleanup_watermark_ = String2Uint64(argv[13]);
+    shared_manager.unlink_rate_ = String2Uint64(argv[14]);
+  }
 
   SetLogSyslogLevel(syslog_level);
   SetLogSyslogFacility(syslog_facility);
@@ -1042,6 +1644,11 @@ int PosixQuotaManager::MainCacheManager(int argc, char **argv) {
     return 1;
   }
 
+  // Clients fall back to the FIFO if the ring cannot be created
+  const string ring_path = shared_manager.workspace_dir_ + "/cachemgr.ring";
+  shared_manager.command_ring_ =
+    CommandRing::Create(ring_path, kCommandRingSlots);
+
   const string fifo_path = shared_manager.workspace_dir_ + "/cachemgr";
   shared_manager.pipe_lru_[0] = open(fifo_path.c_str(), O_RDONLY | O_NONBLOCK);
   if (shared_manager.pipe_lru_[0] < 0) {
@@ -1066,9 +1673,29 @@ int PosixQuotaManager::MainCacheManager(int argc, char **argv) {
   // Don't let Ctrl-C ungracefully kill interactive session
   signal(SIGINT, SIG_IGN);
 
+  // Not before daemonizing, the cleaner is a thread
+  if (shared_manager.cleanup_watermark_ > 0) {
+    if ((shared_manager.cleanup_watermark_ <=
+         shared_manager.cleanup_threshold_) ||
+        (shared_manager.cleanup_watermark_ >= shared_manager.limit_))
+    {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+               "ignoring cleanup watermark %" PRIu64 " outside of cleanup "
+               "threshold and limit", shared_manager.cleanup_watermark_);
+      shared_manager.cleanup_watermark_ = 0;
+    } else {
+      shared_manager.SpawnCleaner();
+    }
+  }
+
   shared_manager.MainCommandServer(&shared_manager);
+  // Unlinks the remaining backlog
+  shared_manager.cleaner_.Destroy();
   unlink(fifo_path.c_str());
   unlink(protocol_revision_path.c_str());
+  unlink(ring_path.c_str());
+  delete shared_manager.command_ring_;
+  shared_manager.command_ring_ = NULL;
   shared_manager.CloseDatabase();
   unlink(crash_guard.c_str());
   UnlockFile(fd_lockfile_fifo);
@@ -1091,22 +1718,46 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
   LruCommand command_buffer[kCommandBufferSize];
   char description_buffer[kCommandBufferSize*kMaxDescription];
   unsigned num_commands = 0;
+  uint64_t next_tick_ms = 0;
+
+  while (true) {
+    // Buffered commands of a dead client go to the database before its pins
+    // are released
+    if (!quota_mgr->dead_pin_clients_.empty()) {
+      if (num_commands > 0) {
+        quota_mgr->ProcessCommandBunch(num_commands, command_buffer,
+                                       description_buffer);
+        num_commands = 0;
+      }
+      quota_mgr->DropPinClients();
+    }
 
-  while (read(quota_mgr->pipe_lru_[0], &command_buffer[num_commands],
-              sizeof(command_buffer[0])) == sizeof(command_buffer[0]))
-  {
-    const CommandType command_type = command_buffer[num_commands].command_type;
-    LogCvmfs(kLogQuota, kLogDebug, "received command %d", command_type);
-    const uint64_t size = command_buffer[num_commands].GetSize();
+    // Background cleanup steps once per tick, even if the commands keep coming
+    if (quota_mgr->NeedsBackgroundCleanup()) {
+      const uint64_t now_ms = GetTimeMs();
+      const unsigned timeout_ms = (next_tick_ms > now_ms) ?
+        min(next_tick_ms - now_ms, uint64_t(BackgroundCleaner::kTickMs)) : 0;
+      if ((timeout_ms == 0) || !quota_mgr->WaitForCommand(timeout_ms)) {
+        if (num_commands > 0) {
+          quota_mgr->ProcessCommandBunch(num_commands, command_buffer,
+                                         description_buffer);
+          num_commands = 0;
+        }
+        quota_mgr->DoBackgroundCleanup();
+        next_tick_ms = GetTimeMs() + BackgroundCleaner::kTickMs;
+        continue;
+      }
+    }
 
-    // Inserts and pins come with a description (usually a path)
-    if ((command_type == kInsert) || (command_type == kInsertVolatile) ||
-        (command_type == kPin) || (command_type == kPinRegular))
+    if (!quota_mgr->RecvCommand(
+           &command_buffer[num_commands],
+           &description_buffer[kMaxDescription*num_commands]))
     {
-      const int desc_length = command_buffer[num_commands].desc_length;
-      ReadPipe(quota_mgr->pipe_lru_[0],
-               &description_buffer[kMaxDescription*num_commands], desc_length);
+      break;
     }
+    const CommandType command_type = command_buffer[num_commands].command_type;
+    LogCvmfs(kLogQuota, kLogDebug, "received command %d", command_type);
+    const uint64_t size = command_buffer[num_commands].GetSize();
 
     // The protocol revision is returned immediately
     if (command_type == kGetProtocolRevision) {
@@ -1133,6 +1784,19 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
       continue;
     }
 
+    // So is the progress of the background cleanup
+    if (command_type == kCleanupStatus) {
+      int return_pipe =
+        quota_mgr->BindReturnPipe(command_buffer[num_commands].return_pipe);
+      if (return_pipe < 0)
+        continue;
+      CleanupStatus status;
+      quota_mgr->DoGetCleanupStatus(&status);
+      WritePipe(return_pipe, &status, sizeof(status));
+      quota_mgr->UnbindReturnPipe(return_pipe);
+      continue;
+    }
+
     // Reservations are handled immediately and "out of band"
     if (command_type == kReserve) {
       bool success = true;
@@ -1159,6 +1823,10 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
           quota_mgr->CheckHighPinWatermark();
         }
       }
+      if (success) {
+        quota_mgr->AddPinClient(hash,
+                                command_buffer[num_commands].client_id);
+      }
 
       WritePipe(return_pipe, &success, sizeof(success));
       quota_mgr->UnbindReturnPipe(return_pipe);
@@ -1187,6 +1855,16 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
         close(iter->second);
       }
       quota_mgr->back_channels_[hash] = return_pipe;
+      const uint32_t client_id = command_buffer[num_commands].client_id;
+      map<shash::Md5, uint32_t>::iterator iter_client =
+        quota_mgr->back_channel_clients_.find(hash);
+      if (iter_client != quota_mgr->back_channel_clients_.end()) {
+        if (iter_client->second != client_id)
+          quota_mgr->dead_pin_clients_.push_back(iter_client->second);
+        quota_mgr->back_channel_clients_.erase(iter_client);
+      }
+      if (client_id != 0)
+        quota_mgr->back_channel_clients_[hash] = client_id;
       quota_mgr->UnlockBackChannels();
 
       char success = 'S';
@@ -1214,6 +1892,12 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
         LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
                  "did not find back channel %s", hash.ToString().c_str());
       }
+      map<shash::Md5, uint32_t>::iterator iter_client =
+        quota_mgr->back_channel_clients_.find(hash);
+      if (iter_client != quota_mgr->back_channel_clients_.end()) {
+        quota_mgr->dead_pin_clients_.push_back(iter_client->second);
+        quota_mgr->back_channel_clients_.erase(iter_client);
+      }
       quota_mgr->UnlockBackChannels();
 
       continue;
@@ -1223,42 +1907,15 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
     if (command_type == kUnpin) {
       const shash::Any hash = command_buffer[num_commands].RetrieveHash();
       const string hash_str(hash.ToString());
-
-      map<shash::Any, uint64_t>::iterator iter =
-        quota_mgr->pinned_chunks_.find(hash);
-      if (iter != quota_mgr->pinned_chunks_.end()) {
-        quota_mgr->pinned_ -= iter->second;
-        quota_mgr->pinned_chunks_.erase(iter);
-        // It can happen that files get pinned that were removed from the cache
-        // (see cache.cc).  We fix this at this point, where we remove such
-        // entries from the cache database.
-        if (!FileExists(quota_mgr->cache_dir_ + "/" +
-                        hash.MakePathWithoutSuffix()))
-        {
-          LogCvmfs(kLogQuota, kLogDebug,
-                   "remove orphaned pinned hash %s from cache database",
-                   hash_str.c_str());
-          sqlite3_bind_text(quota_mgr->stmt_size_, 1, &hash_str[0],
-                            hash_str.length(), SQLITE_STATIC);
-          int retval;
-          if ((retval = sqlite3_step(quota_mgr->stmt_size_)) == SQLITE_ROW) {
-            uint64_t size = sqlite3_column_int64(quota_mgr->stmt_size_, 0);
-            sqlite3_bind_text(quota_mgr->stmt_rm_, 1, &(hash_str[0]),
-                              hash_str.length(), SQLITE_STATIC);
-            retval = sqlite3_step(quota_mgr->stmt_rm_);
-            if ((retval == SQLITE_DONE) || (retval == SQLITE_OK)) {
-              quota_mgr->gauge_ -= size;
-            } else {
-              LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
-                       "failed to delete %s (%d)", hash_str.c_str(), retval);
-            }
-            sqlite3_reset(quota_mgr->stmt_rm_);
-          }
-          sqlite3_reset(quota_mgr->stmt_size_);
-        }
-      } else {
-        LogCvmfs(kLogQuota, kLogDebug, "this chunk was not pinned");
+      if (!quota_mgr->RemovePinClient(hash,
+                                      command_buffer[num_commands].client_id))
+      {
+        LogCvmfs(kLogQuota, kLogDebug, "%s remains pinned by other clients",
+                 hash_str.c_str());
+        continue;
       }
+
+      quota_mgr->ReleasePin(hash);
     }
 
     // Immediate commands trigger flushing of the buffer
@@ -1295,33 +1952,22 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
                    hash_str.c_str());
           bool success = false;
 
-          sqlite3_bind_text(quota_mgr->stmt_size_, 1, &hash_str[0],
-                            hash_str.length(), SQLITE_STATIC);
-          int retval;
-          if ((retval = sqlite3_step(quota_mgr->stmt_size_)) == SQLITE_ROW) {
-            uint64_t size = sqlite3_column_int64(quota_mgr->stmt_size_, 0);
-            uint64_t is_pinned = sqlite3_column_int64(quota_mgr->stmt_size_, 1);
-
-            sqlite3_bind_text(quota_mgr->stmt_rm_, 1, &(hash_str[0]),
-                              hash_str.length(), SQLITE_STATIC);
-            retval = sqlite3_step(quota_mgr->stmt_rm_);
-            if ((retval == SQLITE_DONE) || (retval == SQLITE_OK)) {
+          uint64_t size;
+          bool is_pinned;
+          if (quota_mgr->LookupEntry(hash, &size, &is_pinned)) {
+            if (quota_mgr->RemoveEntry(hash)) {
               success = true;
               quota_mgr->gauge_ -= size;
               if (is_pinned) {
                 quota_mgr->pinned_chunks_.erase(hash);
+                quota_mgr->pin_clients_.erase(hash);
                 quota_mgr->pinned_ -= size;
               }
-            } else {
-              LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
-                       "failed to delete %s (%d)", hash_str.c_str(), retval);
             }
-            sqlite3_reset(quota_mgr->stmt_rm_);
           } else {
             // File does not exist
             success = true;
           }
-          sqlite3_reset(quota_mgr->stmt_size_);
 
           WritePipe(return_pipe, &success, sizeof(success));
           break; }
@@ -1340,21 +1986,38 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
 
           // Pipe back the list, one by one
           int length;
-          while (sqlite3_step(this_stmt_list) == SQLITE_ROW) {
-            string path = "(NULL)";
-            if (sqlite3_column_type(this_stmt_list, 0) != SQLITE_NULL) {
-              path = string(
-                reinterpret_cast<const char *>(
-                  sqlite3_column_text(this_stmt_list, 0)));
+          if (quota_mgr->index_ != NULL) {
+            QuotaIndex::ListFilter filter = QuotaIndex::kListRegular;
+            if (command_type == kListPinned)
+              filter = QuotaIndex::kListPinned;
+            else if (command_type == kListCatalogs)
+              filter = QuotaIndex::kListCatalogs;
+            else if (command_type == kListVolatile)
+              filter = QuotaIndex::kListVolatile;
+            const vector<string> paths = quota_mgr->index_->List(filter);
+            for (unsigned i = 0; i < paths.size(); ++i) {
+              length = paths[i].length();
+              WritePipe(return_pipe, &length, sizeof(length));
+              if (length > 0)
+                WritePipe(return_pipe, paths[i].data(), length);
+            }
+          } else {
+            while (sqlite3_step(this_stmt_list) == SQLITE_ROW) {
+              string path = "(NULL)";
+              if (sqlite3_column_type(this_stmt_list, 0) != SQLITE_NULL) {
+                path = string(
+                  reinterpret_cast<const char *>(
+                    sqlite3_column_text(this_stmt_list, 0)));
+              }
+              length = path.length();
+              WritePipe(return_pipe, &length, sizeof(length));
+              if (length > 0)
+                WritePipe(return_pipe, &path[0], length);
             }
-            length = path.length();
-            WritePipe(return_pipe, &length, sizeof(length));
-            if (length > 0)
-              WritePipe(return_pipe, &path[0], length);
+            sqlite3_reset(this_stmt_list);
           }
           length = -1;
           WritePipe(return_pipe, &length, sizeof(length));
-          sqlite3_reset(this_stmt_list);
           break;
         case kStatus:
           WritePipe(return_pipe, &quota_mgr->gauge_, sizeof(quota_mgr->gauge_));
@@ -1376,6 +2039,9 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
       }
       quota_mgr->UnbindReturnPipe(return_pipe);
       num_commands = 0;
+      // Removals and cleanups go to the journal once the client is served
+      if (quota_mgr->index_ != NULL)
+        quota_mgr->index_->Sync();
     }
   }
 
@@ -1398,6 +2064,16 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
 }
 
 
+/**
+ * Synchronous commands wait for the reply on a return pipe, in case of the
+ * shared cache manager on a named FIFO in the workspace.  They do not use the
+ * command ring.  The clients send them when they load a catalog, pin a file,
+ * or on cvmfs_talk requests, not on the cache miss path.  A FIFO round trip
+ * takes some 35us, of which some 30us are creating, binding and unlinking
+ * the FIFO (BM_Quota micro benchmarks).  Shared memory reply slots would save
+ * these 30us per catalog load, but they would need their own protocol to
+ * detect a dead cache manager, and the lists do not fit into a fixed slot.
+ */
 void PosixQuotaManager::MakeReturnPipe(int pipe[2]) {
   if (!shared_) {
     MakePipe(pipe);
@@ -1422,6 +2098,17 @@ void PosixQuotaManager::MakeReturnPipe(int pipe[2]) {
 }
 
 
+/**
+ * True if the command server should run background cleanup steps.  That is
+ * while a background cleanup is ongoing or can be started.
+ */
+bool PosixQuotaManager::NeedsBackgroundCleanup() {
+  if (!cleaner_.IsValid())
+    return false;
+  return background_cleanup_ || (gauge_ > cleanup_watermark_);
+}
+
+
 void PosixQuotaManager::ParseDirectories(
   const std::string cache_workspace,
   std::string *cache_dir,
@@ -1473,24 +2160,18 @@ bool PosixQuotaManager::Pin(
         CheckHighPinWatermark();
       }
     }
+    AddPinClient(hash, client_id_);
     bool exists = Contains(hash_str);
-    if (!exists && (gauge_ + size > limit_)) {
+    if (!exists && (gauge_ + GetBacklogBytes() + size > limit_)) {
       LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
                gauge_, size);
       int retval = DoCleanup(cleanup_threshold_);
       assert(retval != 0);
     }
-    sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
-                      SQLITE_STATIC);
-    sqlite3_bind_int64(stmt_new_, 2, size);
-    sqlite3_bind_int64(stmt_new_, 3, seq_++);
-    sqlite3_bind_text(stmt_new_, 4, &description[0], description.length(),
-                      SQLITE_STATIC);
-    sqlite3_bind_int64(stmt_new_, 5, is_catalog ? kFileCatalog : kFileRegular);
-    sqlite3_bind_int64(stmt_new_, 6, 1);
-    int retval = sqlite3_step(stmt_new_);
-    assert((retval == SQLITE_DONE) || (retval == SQLITE_OK));
-    sqlite3_reset(stmt_new_);
+    bool retval = InsertEntry(hash, size, seq_++, description.data(),
+                              description.length(),
+                              is_catalog ? kFileCatalog : kFileRegular, true);
+    assert(retval);
     if (!exists) gauge_ += size;
     return true;
   }
@@ -1502,6 +2183,7 @@ bool PosixQuotaManager::Pin(
   cmd.command_type = kReserve;
   cmd.SetSize(size);
   cmd.StoreHash(hash);
+  cmd.client_id = client_id_;
   cmd.return_pipe = pipe_reserve[1];
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
   bool result;
@@ -1530,10 +2212,22 @@ PosixQuotaManager::PosixQuotaManager(
   , workspace_dir_()  // initialized in body
   , fd_lock_cachedb_(-1)
   , async_delete_(true)
+  , cleanup_watermark_(0)
+  , unlink_rate_(kDefaultUnlinkRate)
+  , background_cleanup_(false)
+  , num_background_evictions_(0)
+  , num_trashed_(0)
+  , index_type_(kIndexSqlite)
+  , index_(NULL)
+  , eviction_policy_(new LruPolicy())
+  , command_ring_(NULL)
+  , lock_ring_fallback_(NULL)
+  , fifo_closed_(false)
   , database_(NULL)
   , stmt_touch_(NULL)
   , stmt_unpin_(NULL)
   , stmt_block_(NULL)
+  , stmt_defer_(NULL)
   , stmt_unblock_(NULL)
   , stmt_new_(NULL)
   , stmt_lru_(NULL)
@@ -1547,6 +2241,17 @@ PosixQuotaManager::PosixQuotaManager(
 {
   ParseDirectories(cache_workspace, &cache_dir_, &workspace_dir_);
   pipe_lru_[0] = pipe_lru_[1] = -1;
+  struct timeval tv_now;
+  gettimeofday(&tv_now, NULL);
+  Prng prng;
+  prng.InitSeed((static_cast<uint64_t>(getpid()) << 40) ^
+                (tv_now.tv_sec * 1000000 + tv_now.tv_usec));
+  client_id_ = 1 + prng.Next(0xFFFFFFFFU);
+  atomic_init32(&ring_fallback_);
+  lock_ring_fallback_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  int retval = pthread_mutex_init(lock_ring_fallback_, NULL);
+  assert(retval == 0);
   cleanup_recorder_.AddRecorder(1, 90);  // last 1.5 min with second resolution
   // last 1.5 h with minute resolution
   cleanup_recorder_.AddRecorder(60, 90*60);
@@ -1558,10 +2263,13 @@ PosixQuotaManager::PosixQuotaManager(
 
 
 PosixQuotaManager::~PosixQuotaManager() {
+  pthread_mutex_destroy(lock_ring_fallback_);
+  free(lock_ring_fallback_);
   if (!initialized_) return;
 
   if (shared_) {
     // Most of cleanup is done elsewhen by shared cache manager
+    delete command_ring_;
     close(pipe_lru_[1]);
     return;
   }
@@ -1571,6 +2279,7 @@ PosixQuotaManager::~PosixQuotaManager() {
     WritePipe(pipe_lru_[1], &fin, 1);
     close(pipe_lru_[1]);
     pthread_join(thread_lru_, NULL);
+    cleaner_.Destroy();
   } else {
     ClosePipe(pipe_lru_);
   }
@@ -1579,13 +2288,41 @@ PosixQuotaManager::~PosixQuotaManager() {
 }
 
 
+/**
+ * Clears the pinned flag of the entry in the cache database.
+ */
+bool PosixQuotaManager::UnpinEntry(const shash::Any &hash) {
+  if (index_ != NULL) {
+    index_->Unpin(hash);
+    return true;
+  }
+
+  const string hash_str = hash.ToString();
+  sqlite3_bind_text(stmt_unpin_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  int retval = sqlite3_step(stmt_unpin_);
+  LogCvmfs(kLogQuota, kLogDebug, "unpinning %s: %d", hash_str.c_str(), retval);
+  sqlite3_reset(stmt_unpin_);
+  if ((retval != SQLITE_DONE) && (retval != SQLITE_OK)) {
+    LogCvmfs(kLogQuota, kLogSyslogErr,
+             "failed to unpin %s in cachedb, error %d",
+             hash_str.c_str(), retval);
+    return false;
+  }
+  return true;
+}
+
+
 void PosixQuotaManager::ProcessCommandBunch(
   const unsigned num,
   const LruCommand *commands,
   const char *descriptions)
 {
-  int retval = sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
-  assert(retval == SQLITE_OK);
+  int retval;
+  if (index_ == NULL) {
+    retval = sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
+    assert(retval == SQLITE_OK);
+  }
 
   for (unsigned i = 0; i < num; ++i) {
     const shash::Any hash = commands[i].RetrieveHash();
@@ -1595,8 +2332,16 @@ void PosixQuotaManager::ProcessCommandBunch(
              hash_str.c_str(), commands[i].command_type);
 
     bool exists;
+    bool is_volatile;
+    shash::Any victim;
+    uint64_t victim_size;
     switch (commands[i].command_type) {
       case kTouch:
+        eviction_policy_->Access(hash);
+        if (index_ != NULL) {
+          index_->Touch(hash, seq_++);
+          break;
+        }
         sqlite3_bind_int64(stmt_touch_, 1, seq_++);
         sqlite3_bind_text(stmt_touch_, 2, &hash_str[0], hash_str.length(),
                           SQLITE_STATIC);
@@ -1612,60 +2357,46 @@ void PosixQuotaManager::ProcessCommandBunch(
         sqlite3_reset(stmt_touch_);
         break;
       case kUnpin:
-        sqlite3_bind_text(stmt_unpin_, 1, &hash_str[0], hash_str.length(),
-                          SQLITE_STATIC);
-        retval = sqlite3_step(stmt_unpin_);
-        LogCvmfs(kLogQuota, kLogDebug, "unpinning %s: %d",
-                 hash_str.c_str(), retval);
-        if ((retval != SQLITE_DONE) && (retval != SQLITE_OK)) {
-          LogCvmfs(kLogQuota, kLogSyslogErr,
-                   "failed to unpin %s in cachedb, error %d",
-                   hash_str.c_str(), retval);
+        if (!UnpinEntry(hash))
           abort();
-        }
-        sqlite3_reset(stmt_unpin_);
         break;
       case kPin:
       case kPinRegular:
       case kInsert:
       case kInsertVolatile:
+        eviction_policy_->Access(hash);
         // It could already be in, check
         exists = Contains(hash_str);
 
+        is_volatile = (commands[i].command_type == kInsertVolatile);
         // Cleanup, move to trash and unlink
-        if (!exists && (gauge_ + size > limit_)) {
+        if (!exists && (gauge_ + GetBacklogBytes() + size > limit_)) {
           LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
                    gauge_, size);
+          // A new entry that is not admitted in place of the least recently
+          // used one is evicted first by the next cleanup
+          if ((commands[i].command_type == kInsert) &&
+              GetLruEntry(&victim, &victim_size) &&
+              !eviction_policy_->Admit(hash, victim))
+          {
+            LogCvmfs(kLogQuota, kLogDebug, "inserting %s as volatile",
+                     hash_str.c_str());
+            is_volatile = true;
+          }
           retval = DoCleanup(cleanup_threshold_);
           assert(retval != 0);
         }
 
         // Insert or replace
-        sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
-                          SQLITE_STATIC);
-        sqlite3_bind_int64(stmt_new_, 2, size);
-        if (commands[i].command_type == kInsertVolatile) {
-          sqlite3_bind_int64(stmt_new_, 3, (seq_++) | kVolatileFlag);
-        } else {
-          sqlite3_bind_int64(stmt_new_, 3, seq_++);
-        }
-        sqlite3_bind_text(stmt_new_, 4, &descriptions[i*kMaxDescription],
-                          commands[i].desc_length, SQLITE_STATIC);
-        sqlite3_bind_int64(stmt_new_, 5, (commands[i].command_type == kPin) ?
-                           kFileCatalog : kFileRegular);
-        sqlite3_bind_int64(stmt_new_, 6,
-          ((commands[i].command_type == kPin) ||
-           (commands[i].command_type == kPinRegular)) ? 1 : 0);
-        retval = sqlite3_step(stmt_new_);
-        LogCvmfs(kLogQuota, kLogDebug, "insert or replace %s, method %d: %d",
-                 hash_str.c_str(), commands[i].command_type, retval);
-        if ((retval != SQLITE_DONE) && (retval != SQLITE_OK)) {
-          LogCvmfs(kLogQuota, kLogSyslogErr,
-                   "failed to insert %s in cachedb, error %d",
-                   hash_str.c_str(), retval);
+        if (!InsertEntry(hash, size,
+              is_volatile ? ((seq_++) | kVolatileFlag) : seq_++,
+              &descriptions[i*kMaxDescription], commands[i].desc_length,
+              (commands[i].command_type == kPin) ? kFileCatalog : kFileRegular,
+              (commands[i].command_type == kPin) ||
+              (commands[i].command_type == kPinRegular)))
+        {
           abort();
         }
-        sqlite3_reset(stmt_new_);
 
         if (!exists) gauge_ += size;
         break;
@@ -1674,6 +2405,10 @@ void PosixQuotaManager::ProcessCommandBunch(
     }
   }
 
+  if (index_ != NULL) {
+    index_->Sync();
+    return;
+  }
   retval = sqlite3_exec(database_, "COMMIT", NULL, NULL, NULL);
   if (retval != SQLITE_OK) {
     LogCvmfs(kLogQuota, kLogSyslogErr,
@@ -1808,6 +2543,149 @@ bool PosixQuotaManager::RebuildDatabase() {
 }
 
 
+/**
+ * Counterpart of RebuildDatabase() for the in-memory index.  The files found
+ * in the cache directory are inserted in the order of their access time.
+ */
+bool PosixQuotaManager::RebuildIndex() {
+  char hex[4];
+  struct stat info;
+  platform_dirent64 *d;
+  vector<RebuildEntry> files;
+
+  LogCvmfs(kLogQuota, kLogSyslog | kLogDebug, "re-building cache index");
+  index_->Clear();
+  gauge_ = 0;
+
+  // Collect files from cache sub-directories 00 - ff
+  for (int i = 0; i <= 0xff; i++) {
+    snprintf(hex, sizeof(hex), "%02x", i);
+    const string path = cache_dir_ + "/" + string(hex);
+    DIR *dirp = opendir(path.c_str());
+    if (dirp == NULL) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "failed to open directory %s (tmpwatch interfering?)",
+               path.c_str());
+      return false;
+    }
+    while ((d = platform_readdir(dirp)) != NULL) {
+      const string file_path = path + "/" + string(d->d_name);
+      if (stat(file_path.c_str(), &info) != 0) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not stat %s", file_path.c_str());
+        continue;
+      }
+      if (!S_ISREG(info.st_mode))
+        continue;
+      if (info.st_size == 0) {
+        LogCvmfs(kLogQuota, kLogSyslog | kLogDebug,
+                 "removing empty file %s during automatic cache db rebuild",
+                 file_path.c_str());
+        unlink(file_path.c_str());
+        continue;
+      }
+
+      const string hash_str = string(hex) + string(d->d_name);
+      const shash::HexPtr hex_ptr(hash_str);
+      if (!hex_ptr.IsValid()) {
+        LogCvmfs(kLogQuota, kLogDebug, "ignoring %s", file_path.c_str());
+        continue;
+      }
+      files.push_back(RebuildEntry(info.st_atime, shash::MkFromHexPtr(hex_ptr),
+                                   info.st_size));
+    }
+    closedir(dirp);
+  }
+
+  sort(files.begin(), files.end());
+  uint64_t seq = 0;
+  for (unsigned i = 0; i < files.size(); ++i) {
+    // Might also be a catalog (information is lost)
+    index_->Insert(files[i].hash, files[i].size, seq++,
+                   "unknown (automatic rebuild)", false, false);
+    // Keeps the journal buffer small, the journal is compacted at the end
+    if ((i % 4096) == 4095)
+      index_->Sync();
+  }
+  if (!index_->Snapshot()) {
+    // If the file system hosting the cache is full, we'll likely notice here
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "could not write cache index snapshot");
+    return false;
+  }
+
+  gauge_ = index_->gauge();
+  seq_ = seq;
+  LogCvmfs(kLogQuota, kLogDebug,
+           "rebuilding finished, seqence %" PRIu64 ", gauge %" PRIu64,
+           seq_, gauge_);
+  return true;
+}
+
+
+/**
+ * Receives the next command and, for inserts and pins, its description
+ * (usually a path).  A command from the FIFO is held back until the ring is
+ * empty.  Thus asynchronous commands that a client put into the ring are
+ * processed before the client's subsequent commands through the FIFO.
+ *
+ * \return false once all clients closed the FIFO and the ring is drained
+ */
+bool PosixQuotaManager::RecvCommand(LruCommand *cmd, char *description) {
+  while (true) {
+    if (command_ring_ != NULL) {
+      char message[CommandRing::kMaxMessageSize];
+      unsigned size;
+      if (command_ring_->Dequeue(message, &size)) {
+        if (size < sizeof(LruCommand)) {
+          LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+                   "ignoring truncated command from ring");
+          continue;
+        }
+        memcpy(cmd, message, sizeof(LruCommand));
+        cmd->desc_length = size - sizeof(LruCommand);
+        memcpy(description, message + sizeof(LruCommand), cmd->desc_length);
+        return true;
+      }
+    }
+
+    if (!pending_command_.empty()) {
+      memcpy(cmd, pending_command_.data(), sizeof(LruCommand));
+      memcpy(description, pending_command_.data() + sizeof(LruCommand),
+             cmd->desc_length);
+      pending_command_.clear();
+      return true;
+    }
+    if (fifo_closed_)
+      return false;
+
+    // Producers that find the sleeping flag send a kWakeup through the FIFO
+    if ((command_ring_ != NULL) && !command_ring_->PrepareSleep())
+      continue;
+    const ssize_t nbytes = read(pipe_lru_[0], cmd, sizeof(LruCommand));
+    if (command_ring_ != NULL)
+      command_ring_->Awake();
+    if (nbytes != sizeof(LruCommand)) {
+      fifo_closed_ = true;
+      continue;
+    }
+    if (cmd->command_type == kWakeup)
+      continue;
+
+    if ((cmd->command_type == kInsert) || (cmd->command_type == kInsertVolatile)
+        || (cmd->command_type == kPin) || (cmd->command_type == kPinRegular))
+    {
+      ReadPipe(pipe_lru_[0], description, cmd->desc_length);
+    } else {
+      cmd->desc_length = 0;
+    }
+    if (command_ring_ == NULL)
+      return true;
+    pending_command_.assign(reinterpret_cast<char *>(cmd), sizeof(LruCommand));
+    pending_command_.append(description, cmd->desc_length);
+  }
+}
+
+
 /**
  * Register a channel that allows the cache manager to trigger action to its
  * clients.  Currently used for releasing pinned catalogs.
@@ -1823,6 +2701,7 @@ void PosixQuotaManager::RegisterBackChannel(
     LruCommand cmd;
     cmd.command_type = kRegisterBackChannel;
     cmd.return_pipe = back_channel[1];
+    cmd.client_id = client_id_;
     // Not StoreHash().  This is an MD5 hash.
     memcpy(cmd.digest, hash.digest, hash.GetDigestSize());
     WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
@@ -1865,10 +2744,77 @@ void PosixQuotaManager::Remove(const shash::Any &hash) {
 }
 
 
+/**
+ * Removes an entry from the SQLite database or from the index.
+ *
+ * \return False if the database could not be updated
+ */
+bool PosixQuotaManager::RemoveEntry(const shash::Any &hash) {
+  if (index_ != NULL) {
+    index_->Remove(hash);
+    return true;
+  }
+
+  const string hash_str = hash.ToString();
+  sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  int retval = sqlite3_step(stmt_rm_);
+  sqlite3_reset(stmt_rm_);
+  if ((retval != SQLITE_DONE) && (retval != SQLITE_OK)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to delete %s (%d)", hash_str.c_str(), retval);
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Sends an asynchronous command, i.e. one without return pipe.  Uses the
+ * shared memory ring if available and not full, the FIFO otherwise.  After a
+ * fallback to the FIFO, the client stays on the FIFO until the ring drained.
+ */
+void PosixQuotaManager::SendCommand(
+  const LruCommand *cmd,
+  const unsigned size)
+{
+  if (command_ring_ == NULL) {
+    WritePipe(pipe_lru_[1], cmd, size);
+    return;
+  }
+
+  if (atomic_read32(&ring_fallback_) == 0) {
+    bool wakeup;
+    if (command_ring_->Enqueue(cmd, size, &wakeup)) {
+      if (wakeup) {
+        LruCommand wakeup_cmd;
+        wakeup_cmd.command_type = kWakeup;
+        WritePipe(pipe_lru_[1], &wakeup_cmd, sizeof(wakeup_cmd));
+      }
+      return;
+    }
+  }
+
+  // The cache manager takes commands from the ring before the ones from the
+  // FIFO.  Once the ring drained, a synchronous command through the FIFO makes
+  // sure that the cache manager received our previous FIFO commands, too.
+  MutexLockGuard guard(*lock_ring_fallback_);
+  atomic_write32(&ring_fallback_, 1);
+  WritePipe(pipe_lru_[1], cmd, size);
+  if (command_ring_->IsEmpty()) {
+    GetPid();
+    atomic_write32(&ring_fallback_, 0);
+  }
+}
+
+
 void PosixQuotaManager::Spawn() {
   if (spawned_)
     return;
 
+  if (cleanup_watermark_ > 0)
+    SpawnCleaner();
+
   if (pthread_create(&thread_lru_, NULL, MainCommandServer,
       static_cast<void *>(this)) != 0)
   {
@@ -1887,7 +2833,7 @@ void PosixQuotaManager::Touch(const shash::Any &hash) {
   LruCommand cmd;
   cmd.command_type = kTouch;
   cmd.StoreHash(hash);
-  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+  SendCommand(&cmd, sizeof(cmd));
 }
 
 
@@ -1903,13 +2849,29 @@ void PosixQuotaManager::UnlinkReturnPipe(int pipe_wronly) {
 }
 
 
+/**
+ * Clears the blocked state of the pinned and deferred entries encountered
+ * during a cleanup.
+ */
+void PosixQuotaManager::UnblockAll() {
+  if (index_ != NULL) {
+    index_->UnblockAll();
+    return;
+  }
+  const bool result = (sqlite3_step(stmt_unblock_) == SQLITE_DONE);
+  sqlite3_reset(stmt_unblock_);
+  assert(result);
+}
+
+
 void PosixQuotaManager::Unpin(const shash::Any &hash) {
   LogCvmfs(kLogQuota, kLogDebug, "Unpin %s", hash.ToString().c_str());
 
   LruCommand cmd;
   cmd.command_type = kUnpin;
   cmd.StoreHash(hash);
-  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+  cmd.client_id = client_id_;
+  SendCommand(&cmd, sizeof(cmd));
 }
 
 
@@ -1932,3 +2894,30 @@ void PosixQuotaManager::UnregisterBackChannel(
     ClosePipe(back_channel);
   }
 }
+
+
+/**
+ * Waits until the next command can be received without blocking or the
+ * timeout expires.  Used by the command server in between background cleanup
+ * steps.
+ *
+ * \return false on timeout
+ */
+bool PosixQuotaManager::WaitForCommand(const unsigned timeout_ms) {
+  if (!pending_command_.empty() || fifo_closed_)
+    return true;
+  if ((command_ring_ != NULL) && !command_ring_->PrepareSleep())
+    return true;
+
+  struct pollfd watch_fifo;
+  watch_fifo.fd = pipe_lru_[0];
+  watch_fifo.events = POLLIN;
+  watch_fifo.revents = 0;
+  const int retval = poll(&watch_fifo, 1, timeout_ms);
+  if (command_ring_ != NULL)
+    command_ring_->Awake();
+  if ((retval < 0) && (errno == EINTR))
+    return false;
+  // On errors, RecvCommand() takes over
+  return retval != 0;
+}
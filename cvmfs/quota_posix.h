@@ -11,24 +11,32 @@
 #include <unistd.h>
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "duplex_sqlite3.h"
 #include "gtest/gtest_prod.h"
 #include "hash.h"
 #include "quota.h"
+#include "quota_cleaner.h"
+#include "quota_policy.h"
 #include "statistics.h"
+#include "util/pointer.h"
 #include "util/single_copy.h"
 #include "util/string.h"
 
 namespace perf {
 class Recorder;
 }
+class CommandRing;
+class QuotaIndex;
 
 /**
- * Works with the PosixCacheManager.  Uses an SQlite database for cache contents
- * tracking.  Tracking is asynchronously.
+ * Works with the PosixCacheManager.  Uses an SQlite database or, optionally,
+ * an in-memory index with an append-only journal (QuotaIndex) for cache
+ * contents tracking.  Tracking is asynchronously.
  *
  * TODO(jblomer): split into client, server, and protocol classes.
  */
@@ -38,17 +46,40 @@ class PosixQuotaManager : public QuotaManager {
   FRIEND_TEST(T_QuotaManager, Contains);
   FRIEND_TEST(T_QuotaManager, InitDatabase);
   FRIEND_TEST(T_QuotaManager, MakeReturnPipe);
+  FRIEND_TEST(T_QuotaManager, PinClients);
+  FRIEND_TEST(T_QuotaManager, DropPinClients);
+  FRIEND_TEST(T_QuotaManager, RingFallback);
 
  public:
+  /**
+   * Backend that keeps track of the cache contents
+   */
+  enum IndexType {
+    kIndexSqlite = 0,
+    kIndexJournal,
+  };
+
+  /**
+   * Files per second that are evicted and unlinked by the background cleanup
+   */
+  static const unsigned kDefaultUnlinkRate = 1000;
+
   static PosixQuotaManager *Create(const std::string &cache_workspace,
     const uint64_t limit, const uint64_t cleanup_threshold,
-    const bool rebuild_database);
+    const bool rebuild_database, const IndexType index_type = kIndexSqlite,
+    const EvictionPolicy::Type eviction_type = EvictionPolicy::kLru,
+    const uint64_t cleanup_watermark = 0,
+    const unsigned unlink_rate = kDefaultUnlinkRate);
   static PosixQuotaManager *CreateShared(
     const std::string &exe_path,
     const std::string &cache_workspace,
     const uint64_t limit,
     const uint64_t cleanup_threshold,
-    bool foreground);
+    bool foreground,
+    const IndexType index_type = kIndexSqlite,
+    const EvictionPolicy::Type eviction_type = EvictionPolicy::kLru,
+    const uint64_t cleanup_watermark = 0,
+    const unsigned unlink_rate = kDefaultUnlinkRate);
   static int MainCacheManager(int argc, char **argv);
 
   virtual ~PosixQuotaManager();
@@ -79,6 +110,7 @@ class PosixQuotaManager : public QuotaManager {
   virtual uint64_t GetSize();
   virtual uint64_t GetSizePinned();
   virtual uint64_t GetCleanupRate(uint64_t period_s);
+  virtual bool GetCleanupStatus(CleanupStatus *status);
 
   virtual void Spawn();
   virtual pid_t GetPid();
@@ -118,6 +150,10 @@ class PosixQuotaManager : public QuotaManager {
     // as of protocol revision 2
     kListVolatile,
     kCleanupRate,
+    // as of protocol revision 3
+    kWakeup,
+    // as of protocol revision 4
+    kCleanupStatus,
   };
 
   /**
@@ -135,12 +171,19 @@ class PosixQuotaManager : public QuotaManager {
      * operations.
      */
     uint16_t desc_length;
+    /**
+     * Identifies the client in kReserve and kUnpin, as of protocol revision 5.
+     * Fills the padding after desc_length, so the memory layout is unchanged.
+     * Zero for clients that do not set it.
+     */
+    uint32_t client_id;
 
     LruCommand()
       : command_type(static_cast<CommandType>(0))
       , size(0)
       , return_pipe(-1)
       , desc_length(0)
+      , client_id(0)
     {
       memset(digest, 0, shash::kMaxDigestSize);
     }
@@ -184,6 +227,11 @@ class PosixQuotaManager : public QuotaManager {
    */
   static const unsigned kCommandBufferSize = 32;
 
+  /**
+   * Number of slots in the shared memory ring of the shared cache manager
+   */
+  static const unsigned kCommandRingSlots = 1024;
+
   /**
    * Make sure that the amount of data transferred through the RPC pipe is
    * within the OS's guarantees for atomiticity.
@@ -203,11 +251,41 @@ class PosixQuotaManager : public QuotaManager {
    */
   static const uint64_t kVolatileFlag = 1ULL << 63;
 
+  /**
+   * Background cleanup pauses while the backlog of the cleaner thread holds
+   * more than the files of that many ticks.
+   */
+  static const unsigned kMaxBacklogTicks = 10;
+
+  /**
+   * Evicted files are moved to this subdirectory of the cache directory before
+   * they are handed over to the background cleaner.
+   */
+  static const char *kTrashDir;
+
   bool InitDatabase(const bool rebuild_database);
+  bool InitIndex(const bool rebuild_database);
   bool RebuildDatabase();
+  bool RebuildIndex();
   void CloseDatabase();
   bool Contains(const std::string &hash_str);
+  bool LookupEntry(const shash::Any &hash, uint64_t *size, bool *is_pinned);
+  bool GetLruEntry(shash::Any *hash, uint64_t *size);
+  bool RemoveEntry(const shash::Any &hash);
+  bool InsertEntry(const shash::Any &hash, const uint64_t size,
+                   const uint64_t acseq, const char *description,
+                   const unsigned desc_length, const FileTypes type,
+                   const bool is_pinned);
+  void UnblockAll();
+  bool EvictEntries(const uint64_t leave_size, const unsigned max_entries,
+                    std::vector<BackgroundCleaner::Entry> *trash);
+  void MoveToTrash(std::vector<BackgroundCleaner::Entry> *trash);
+  void SpawnCleaner();
   bool DoCleanup(const uint64_t leave_size);
+  void DoBackgroundCleanup();
+  bool NeedsBackgroundCleanup();
+  void DoGetCleanupStatus(CleanupStatus *status);
+  uint64_t GetBacklogBytes();
 
   void MakeReturnPipe(int pipe[2]);
   int BindReturnPipe(int pipe_wronly);
@@ -216,8 +294,19 @@ class PosixQuotaManager : public QuotaManager {
   void CloseReturnPipe(int pipe[2]);
   void CleanupPipes();
 
+  void AttachCommandRing();
+  void SendCommand(const LruCommand *cmd, const unsigned size);
+  bool RecvCommand(LruCommand *cmd, char *description);
+  bool WaitForCommand(const unsigned timeout_ms);
+
   void CheckFreeSpace();
   void CheckHighPinWatermark();
+  void AddPinClient(const shash::Any &hash, const uint32_t client_id);
+  bool RemovePinClient(const shash::Any &hash, const uint32_t client_id);
+  void CollectDeadPinClients();
+  void DropPinClients();
+  void ReleasePin(const shash::Any &hash);
+  bool UnpinEntry(const shash::Any &hash);
   void ProcessCommandBunch(const unsigned num,
                            const LruCommand *commands,
                            const char *descriptions);
@@ -290,6 +379,33 @@ class PosixQuotaManager : public QuotaManager {
    */
   std::map<shash::Any, uint64_t> pinned_chunks_;
 
+  /**
+   * Clients that hold a pin on a content hash.  In a shared cache, several
+   * repositories can pin the same object, e.g. an identical file catalog.  The
+   * pin is only released once the last of these clients unpins the object.
+   * A client that pins an object several times holds a single reference.
+   */
+  std::map<shash::Any, std::set<uint32_t> > pin_clients_;
+
+  /**
+   * The client id that registered a back channel.  When the back channel goes
+   * away, e.g. because the client crashed, the client's pins are dropped.
+   * Protected by lock_back_channels_.
+   */
+  std::map<shash::Md5, uint32_t> back_channel_clients_;
+
+  /**
+   * Clients whose back channel went away.  The command server releases their
+   * pins before it reads the next command.
+   */
+  std::vector<uint32_t> dead_pin_clients_;
+
+  /**
+   * Random, non-zero id sent with kReserve and kUnpin.  Unlike the pid, it
+   * stays the same when the client daemonizes.
+   */
+  uint32_t client_id_;
+
   /**
    * Used to send RPCs to the quota manager thread or process.
    */
@@ -317,10 +433,89 @@ class PosixQuotaManager : public QuotaManager {
    */
   perf::MultiRecorder cleanup_recorder_;
 
+  /**
+   * If the cache grows beyond the watermark, the quota manager evicts entries
+   * in the background until the cleanup threshold is reached.  Zero if the
+   * cache is only cleaned up when it hits the limit.
+   */
+  uint64_t cleanup_watermark_;
+
+  /**
+   * Files per second evicted and unlinked by the background cleanup
+   */
+  unsigned unlink_rate_;
+
+  /**
+   * Set from crossing the watermark until reaching the cleanup threshold
+   */
+  bool background_cleanup_;
+
+  /**
+   * Number of entries evicted by the background cleanup
+   */
+  uint64_t num_background_evictions_;
+
+  /**
+   * Unlinks evicted files if cleanup_watermark_ is set.  Runs along with the
+   * quota manager thread or process.
+   */
+  UniquePtr<BackgroundCleaner> cleaner_;
+
+  /**
+   * Sequence number that makes the names in the trash directory unique
+   */
+  uint64_t num_trashed_;
+
+  /**
+   * Selects between the SQLite cache catalog and index_.
+   */
+  IndexType index_type_;
+
+  /**
+   * Replaces database_ and the prepared statements if index_type_ is
+   * kIndexJournal, NULL otherwise.
+   */
+  QuotaIndex *index_;
+
+  /**
+   * Decides which entries DoCleanup() spares in its first pass and which new
+   * entries of a full cache are inserted as volatile.  Learns from the inserts
+   * and touches processed by the cache manager.
+   */
+  UniquePtr<EvictionPolicy> eviction_policy_;
+
+  /**
+   * Shared cache manager only: carries asynchronous commands from the clients
+   * to the cache manager.  The FIFO is used for wake-up calls, synchronous
+   * commands, and as a fallback.
+   */
+  CommandRing *command_ring_;
+
+  /**
+   * Client only: set when a command went through the FIFO because the ring was
+   * full.  Until the cache manager caught up with the FIFO, the following
+   * commands use the FIFO, too, so that they cannot overtake it through the
+   * ring.
+   */
+  atomic_int32 ring_fallback_;
+  pthread_mutex_t *lock_ring_fallback_;
+
+  /**
+   * A command (plus description) received from the FIFO that is held back
+   * until the commands in the ring are processed.
+   */
+  std::string pending_command_;
+
+  /**
+   * Set when all clients closed the FIFO.
+   */
+  bool fifo_closed_;
+
   sqlite3 *database_;
   sqlite3_stmt *stmt_touch_;
   sqlite3_stmt *stmt_unpin_;
   sqlite3_stmt *stmt_block_;
+  sqlite3_stmt *stmt_defer_;
   sqlite3_stmt *stmt_unblock_;
   sqlite3_stmt *stmt_new_;
   sqlite3_stmt *stmt_lru_;
@@ -0,0 +1,220 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "quota_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "logging.h"
+#include "platform.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Creates the shared memory file for the consumer.  An existing file is
+ * replaced, producers attached to it keep the old mapping.  The number of
+ * slots must be a power of two.
+ */
+CommandRing *CommandRing::Create(const string &path, const unsigned num_slots) {
+  assert((num_slots > 0) && ((num_slots & (num_slots - 1)) == 0));
+  const size_t mapping_size = GetMappingSize(num_slots);
+
+  unlink(path.c_str());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to create command ring %s (%d)", path.c_str(), errno);
+    return NULL;
+  }
+  if (ftruncate(fd, mapping_size) != 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to resize command ring %s (%d)", path.c_str(), errno);
+    close(fd);
+    unlink(path.c_str());
+    return NULL;
+  }
+  void *mapping =
+    mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "failed to map command ring %s (%d)", path.c_str(), errno);
+    unlink(path.c_str());
+    return NULL;
+  }
+
+  CommandRing *ring = new CommandRing(mapping, mapping_size);
+  ring->header_->num_slots = num_slots;
+  ring->num_slots_ = num_slots;
+  for (unsigned i = 0; i < num_slots; ++i)
+    atomic_write64(&ring->slots_[i].seq, i);
+  atomic_write64(&ring->header_->tail, 0);
+  atomic_write64(&ring->header_->head, 0);
+  atomic_write32(&ring->header_->sleeping, 0);
+  // Producers check the magic number last
+  __sync_synchronize();
+  ring->header_->magic = kMagic;
+  return ring;
+}
+
+
+/**
+ * Maps the shared memory file of a running consumer.
+ */
+CommandRing *CommandRing::Attach(const string &path) {
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open command ring %s (%d)",
+             path.c_str(), errno);
+    return NULL;
+  }
+  platform_stat64 info;
+  if ((platform_fstat(fd, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) < sizeof(Header)))
+  {
+    LogCvmfs(kLogQuota, kLogDebug, "invalid command ring %s", path.c_str());
+    close(fd);
+    return NULL;
+  }
+  void *mapping =
+    mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to map command ring %s (%d)",
+             path.c_str(), errno);
+    return NULL;
+  }
+
+  CommandRing *ring = new CommandRing(mapping, info.st_size);
+  __sync_synchronize();
+  const unsigned num_slots = ring->header_->num_slots;
+  if ((ring->header_->magic != kMagic) || (num_slots == 0) ||
+      ((num_slots & (num_slots - 1)) != 0) ||
+      (GetMappingSize(num_slots) != static_cast<size_t>(info.st_size)))
+  {
+    LogCvmfs(kLogQuota, kLogDebug, "invalid command ring %s", path.c_str());
+    delete ring;
+    return NULL;
+  }
+  ring->num_slots_ = num_slots;
+  return ring;
+}
+
+
+CommandRing::CommandRing(void *mapping, const size_t mapping_size)
+  : mapping_(mapping)
+  , mapping_size_(mapping_size)
+  , header_(reinterpret_cast<Header *>(mapping))
+  , slots_(reinterpret_cast<Slot *>(
+      reinterpret_cast<char *>(mapping) + sizeof(Header)))
+  , num_slots_(0)
+{ }
+
+
+CommandRing::~CommandRing() {
+  munmap(mapping_, mapping_size_);
+}
+
+
+void CommandRing::Awake() {
+  atomic_write32(&header_->sleeping, 0);
+}
+
+
+/**
+ * True if the consumer took every message that producers claimed a slot for.
+ */
+bool CommandRing::IsEmpty() {
+  return atomic_read64(&header_->head) == atomic_read64(&header_->tail);
+}
+
+
+/**
+ * Only the consumer may call Dequeue().
+ *
+ * \return false if the ring is empty
+ */
+bool CommandRing::Dequeue(void *message, unsigned *size) {
+  const int64_t pos = atomic_read64(&header_->head);
+  Slot *slot = GetSlot(pos);
+  if (atomic_read64(&slot->seq) != pos + 1)
+    return false;
+  *size = (slot->size > kMaxMessageSize) ? kMaxMessageSize : slot->size;
+  memcpy(message, slot->message, *size);
+  // Hands the slot back to the producers of the next round
+  atomic_write64(&slot->seq, pos + num_slots_);
+  atomic_write64(&header_->head, pos + 1);
+  return true;
+}
+
+
+/**
+ * Never blocks.  If wakeup is set on return, the caller has to wake up the
+ * consumer.
+ *
+ * \return false if the ring is full
+ */
+bool CommandRing::Enqueue(
+  const void *message,
+  const unsigned size,
+  bool *wakeup)
+{
+  assert(size <= kMaxMessageSize);
+  *wakeup = false;
+
+  Slot *slot;
+  int64_t pos = atomic_read64(&header_->tail);
+  while (true) {
+    slot = GetSlot(pos);
+    const int64_t diff = atomic_read64(&slot->seq) - pos;
+    if (diff == 0) {
+      if (atomic_cas64(&header_->tail, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      return false;
+    }
+    pos = atomic_read64(&header_->tail);
+  }
+
+  memcpy(slot->message, message, size);
+  slot->size = size;
+  atomic_write64(&slot->seq, pos + 1);
+
+  // Pairs with PrepareSleep(): either the consumer sees the message or the
+  // producer sees the flag
+  if (atomic_read32(&header_->sleeping) != 0)
+    *wakeup = atomic_cas32(&header_->sleeping, 1, 0);
+  return true;
+}
+
+
+size_t CommandRing::GetMappingSize(const unsigned num_slots) {
+  return sizeof(Header) + static_cast<size_t>(num_slots) * sizeof(Slot);
+}
+
+
+/**
+ * Called by the consumer before it blocks on the wakeup channel.
+ *
+ * \return false if the ring is not empty, in which case the consumer should
+ * not block
+ */
+bool CommandRing::PrepareSleep() {
+  atomic_write32(&header_->sleeping, 1);
+  const int64_t pos = atomic_read64(&header_->head);
+  if (atomic_read64(&GetSlot(pos)->seq) == pos + 1) {
+    Awake();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,84 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_QUOTA_RING_H_
+#define CVMFS_QUOTA_RING_H_
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "atomic.h"
+#include "util/single_copy.h"
+
+/**
+ * Bounded multi-producer, single-consumer queue of small messages in a shared
+ * memory file.  The clients of the shared quota manager use it to send
+ * asynchronous commands without a system call.  Every slot carries a sequence
+ * number.  A producer claims a slot by advancing the tail with
+ * compare-and-swap and publishes the slot by advancing its sequence number
+ * (D. Vyukov's bounded queue).
+ *
+ * The ring itself cannot wake up the consumer.  Before the consumer blocks on
+ * its other input channel, it sets the sleeping flag.  A producer that finds
+ * the flag set after publishing a message resets the flag and has to wake up
+ * the consumer through that other channel.
+ *
+ * A producer that dies between claiming and publishing a slot stalls the ring.
+ * The ring then runs full and producers fall back to the other channel.
+ */
+class CommandRing : SingleCopy {
+ public:
+  static const unsigned kMaxMessageSize = 512;
+
+  static CommandRing *Create(const std::string &path, const unsigned num_slots);
+  static CommandRing *Attach(const std::string &path);
+  ~CommandRing();
+
+  bool Enqueue(const void *message, const unsigned size, bool *wakeup);
+  bool Dequeue(void *message, unsigned *size);
+  bool PrepareSleep();
+  void Awake();
+  bool IsEmpty();
+
+  unsigned num_slots() const { return num_slots_; }
+
+ private:
+  static const uint32_t kMagic = 0x474e5243;  // "CRNG"
+  static const unsigned kCacheLine = 64;
+
+  /**
+   * Producers and the consumer modify the tail and the head, resp.  They are
+   * on separate cache lines.
+   */
+  struct Header {
+    uint32_t magic;
+    uint32_t num_slots;
+    char pad0[kCacheLine - 2 * sizeof(uint32_t)];
+    atomic_int64 tail;
+    char pad1[kCacheLine - sizeof(atomic_int64)];
+    atomic_int64 head;
+    atomic_int32 sleeping;
+    char pad2[kCacheLine - sizeof(atomic_int64) - sizeof(atomic_int32)];
+  };
+
+  struct Slot {
+    atomic_int64 seq;
+    uint32_t size;
+    unsigned char message[kMaxMessageSize];
+  };
+
+  static size_t GetMappingSize(const unsigned num_slots);
+  CommandRing(void *mapping, const size_t mapping_size);
+  Slot *GetSlot(const int64_t pos) { return &slots_[pos & (num_slots_ - 1)]; }
+
+  void *mapping_;
+  size_t mapping_size_;
+  Header *header_;
+  Slot *slots_;
+  unsigned num_slots_;
+};  // class CommandRing
+
+#endif  // CVMFS_QUOTA_RING_H_
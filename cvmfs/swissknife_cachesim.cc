@@ -0,0 +1,151 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "swissknife_cachesim.h"
+
+#include <inttypes.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "logging.h"
+#include "platform.h"
+#include "quota_policy.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+/**
+ * Tracer::kEventOpen; tracer.h would require linking the tracer
+ */
+const int kTraceEventOpen = 1;
+
+/**
+ * Splits a line of the tracer's csv output.  All fields are quoted, quotes
+ * within fields are doubled.
+ */
+vector<string> SplitCsvLine(const string &line) {
+  vector<string> fields;
+  string field;
+  bool quoted = false;
+  for (unsigned i = 0; i < line.length(); ++i) {
+    const char c = line[i];
+    if (quoted) {
+      if (c != '"') {
+        field.push_back(c);
+      } else if ((i + 1 < line.length()) && (line[i + 1] == '"')) {
+        field.push_back('"');
+        ++i;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      fields.push_back(field);
+      field.clear();
+    } else if ((c != '\r') && (c != '\n')) {
+      field.push_back(c);
+    }
+  }
+  fields.push_back(field);
+  return fields;
+}
+
+}  // anonymous namespace
+
+
+int swissknife::CommandSimulateCache::Main(const ArgumentList &args) {
+  const string trace_path = *args.find('t')->second;
+  const uint64_t limit = String2Uint64(*args.find('l')->second) * 1024 * 1024;
+  string policy_names = "lru,tinylfu";
+  if (args.find('p') != args.end())
+    policy_names = *args.find('p')->second;
+  string repository;
+  if (args.find('r') != args.end())
+    repository = *args.find('r')->second;
+  uint64_t default_size = 64 * 1024;
+  if (args.find('s') != args.end())
+    default_size = String2Uint64(*args.find('s')->second) * 1024;
+
+  vector<string> names = SplitString(policy_names, ',');
+  vector<EvictionPolicy *> policies;
+  vector<CacheSimulator *> simulators;
+  for (unsigned i = 0; i < names.size(); ++i) {
+    EvictionPolicy::Type type;
+    if (!EvictionPolicy::ParseType(names[i], &type)) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "unknown eviction policy %s",
+               names[i].c_str());
+      return 1;
+    }
+    policies.push_back(EvictionPolicy::Create(type));
+    // Same threshold as the PosixQuotaManager
+    simulators.push_back(new CacheSimulator(policies[i], limit, limit / 2));
+  }
+
+  FILE *f = fopen(trace_path.c_str(), "r");
+  if (f == NULL) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "failed to open %s", trace_path.c_str());
+    return 1;
+  }
+  map<shash::Any, uint64_t> sizes;
+  uint64_t num_opens = 0;
+  string line;
+  while (GetLineFile(f, &line)) {
+    vector<string> fields = SplitCsvLine(line);
+    if ((fields.size() < 3) ||
+        (String2Int64(fields[1]) != kTraceEventOpen))
+    {
+      continue;
+    }
+    const string &path = fields[2];
+    shash::Any hash(shash::kMd5);
+    shash::HashString(path, &hash);
+
+    map<shash::Any, uint64_t>::const_iterator iter = sizes.find(hash);
+    uint64_t size = default_size;
+    if (iter != sizes.end()) {
+      size = iter->second;
+    } else {
+      platform_stat64 info;
+      if (!repository.empty() &&
+          (platform_stat((repository + path).c_str(), &info) == 0))
+      {
+        size = info.st_size;
+      }
+      sizes[hash] = size;
+    }
+
+    num_opens++;
+    for (unsigned i = 0; i < simulators.size(); ++i)
+      simulators[i]->Access(hash, size);
+  }
+  fclose(f);
+
+  LogCvmfs(kLogCvmfs, kLogStdout, "%" PRIu64 " open() calls, %lu distinct "
+           "files, cache limit %" PRIu64 " MB", num_opens, sizes.size(),
+           limit / (1024 * 1024));
+  LogCvmfs(kLogCvmfs, kLogStdout, "policy    hit ratio  byte hit ratio  "
+           "cleanups");
+  for (unsigned i = 0; i < simulators.size(); ++i) {
+    const CacheSimulator *sim = simulators[i];
+    const uint64_t num_total = sim->num_hits() + sim->num_misses();
+    const uint64_t bytes_total = sim->hit_bytes() + sim->miss_bytes();
+    LogCvmfs(kLogCvmfs, kLogStdout, "%-8s  %8.4f   %13.4f  %8" PRIu64,
+             names[i].c_str(),
+             num_total ? static_cast<double>(sim->num_hits()) / num_total : 0,
+             bytes_total ?
+               static_cast<double>(sim->hit_bytes()) / bytes_total : 0,
+             sim->num_cleanups());
+    delete simulators[i];
+    delete policies[i];
+  }
+  return 0;
+}
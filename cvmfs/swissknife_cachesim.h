@@ -0,0 +1,40 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_SWISSKNIFE_CACHESIM_H_
+#define CVMFS_SWISSKNIFE_CACHESIM_H_
+
+#include <string>
+
+#include "swissknife.h"
+
+namespace swissknife {
+
+class CommandSimulateCache : public Command {
+ public:
+  ~CommandSimulateCache() { }
+  virtual std::string GetName() const { return "simulate_cache"; }
+  virtual std::string GetDescription() const {
+    return "Replays the open() calls of a client trace file (CVMFS_TRACEFILE) "
+      "against a simulated cache and prints the hit ratio of the eviction "
+      "policies.";
+  }
+  virtual ParameterList GetParams() const {
+    ParameterList r;
+    r.push_back(Parameter::Mandatory('t', "trace file"));
+    r.push_back(Parameter::Mandatory('l', "cache limit in MB"));
+    r.push_back(Parameter::Optional('p', "comma-separated eviction policies "
+                                         "(default: lru,tinylfu)"));
+    r.push_back(Parameter::Optional('r', "mounted repository, used to find "
+                                         "the file sizes"));
+    r.push_back(Parameter::Optional('s', "file size in KB if unknown "
+                                         "(default: 64)"));
+    return r;
+  }
+  virtual int Main(const ArgumentList &args);
+};
+
+}  // namespace swissknife
+
+#endif  // CVMFS_SWISSKNIFE_CACHESIM_H_
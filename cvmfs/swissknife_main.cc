@@ -12,6 +12,7 @@
 #include "statistics_database.h"
 #include "swissknife.h"
 
+#include "swissknife_cachesim.h"
 #include "swissknife_check.h"
 #include "swissknife_diff.h"
 #include "swissknife_gc.h"
@@ -107,6 +108,7 @@ int main(int argc, char **argv) {
   command_list.push_back(new swissknife::CommandLease());
   command_list.push_back(new swissknife::Ingest());
   command_list.push_back(new swissknife::CommandNotify());
+  command_list.push_back(new swissknife::CommandSimulateCache());
 
   if (argc < 2) {
     Usage();
@@ -143,6 +143,36 @@ string TalkManager::FormatProxyInfo(download::DownloadManager *download_mgr) {
 }
 
 
+string TalkManager::FormatEndpointScores(
+  download::DownloadManager *download_mgr)
+{
+  vector<string> endpoints;
+  vector<download::EndpointScores::Score> scores;
+  if (!download_mgr->GetEndpointScores(&endpoints, &scores))
+    return "Latency-aware selection disabled\n";
+
+  string score_str;
+  for (unsigned i = 0; i < endpoints.size(); ++i) {
+    score_str += endpoints[i] + ": " +
+      "cost " + StringifyInt(static_cast<int64_t>(scores[i].Cost())) + " ms, " +
+      "ttfb " + StringifyInt(static_cast<int64_t>(scores[i].ttfb_ms)) +
+      " ms, throughput ";
+    if (scores[i].throughput > 0.0) {
+      score_str +=
+        StringifyInt(static_cast<int64_t>(scores[i].throughput / 1024)) +
+        " kB/s";
+    } else {
+      score_str += "unknown";
+    }
+    score_str += ", " + StringifyInt(scores[i].num_samples) + " samples, " +
+                 StringifyInt(scores[i].num_failures) + " failures\n";
+  }
+  if (endpoints.empty())
+    score_str = "No measurements yet\n";
+  return score_str;
+}
+
+
 /**
  * Listener thread on the socket.
  * TODO(jblomer): create Format... helpers to shorten this method
@@ -240,6 +270,26 @@ void *TalkManager::MainResponder(void *data) {
           talk_mgr->Answer(con_fd, StringifyInt(rate) + "\n");
         }
       }
+    } else if (line == "cleanup status") {
+      QuotaManager *quota_mgr = file_system->cache_mgr()->quota_mgr();
+      QuotaManager::CleanupStatus status;
+      if (!quota_mgr->GetCleanupStatus(&status)) {
+        talk_mgr->Answer(con_fd, "Unsupported by this cache\n");
+      } else if (status.watermark == 0) {
+        talk_mgr->Answer(con_fd, "Background cleanup disabled\n");
+      } else {
+        const string rate = (status.unlink_rate == 0) ? "unlimited" :
+          (StringifyInt(status.unlink_rate) + " files/s");
+        const string status_str =
+          "Watermark: " + StringifyInt(status.watermark / (1024*1024)) +
+            "MB (" + StringifyInt(status.watermark) + " Bytes)\n" +
+          "Unlink rate: " + rate + "\n" +
+          "Evicted in background: " + StringifyInt(status.num_evicted) + "\n" +
+          "Unlinked: " + StringifyInt(status.num_unlinked) + "\n" +
+          "Backlog: " + StringifyInt(status.backlog_files) + " files (" +
+            StringifyInt(status.backlog_bytes / (1024*1024)) + "MB)\n";
+        talk_mgr->Answer(con_fd, status_str);
+      }
     } else if (line.substr(0, 7) == "cleanup") {
       QuotaManager *quota_mgr = file_system->cache_mgr()->quota_mgr();
       if (!quota_mgr->HasCapability(QuotaManager::kCapShrink)) {
@@ -390,6 +440,14 @@ void *TalkManager::MainResponder(void *data) {
       string proxy_info =
         talk_mgr->FormatProxyInfo(mount_point->download_mgr());
       talk_mgr->Answer(con_fd, proxy_info);
+    } else if (line == "external endpoint scores") {
+      string scores =
+        talk_mgr->FormatEndpointScores(mount_point->external_download_mgr());
+      talk_mgr->Answer(con_fd, scores);
+    } else if (line == "endpoint scores") {
+      string scores =
+        talk_mgr->FormatEndpointScores(mount_point->download_mgr());
+      talk_mgr->Answer(con_fd, scores);
     } else if (line == "proxy rebalance") {
       mount_point->download_mgr()->RebalanceProxies();
       talk_mgr->Answer(con_fd, "OK\n");
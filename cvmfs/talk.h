@@ -47,6 +47,7 @@ class TalkManager : SingleCopy {
   void AnswerStringList(int con_fd, const std::vector<std::string> &list);
   std::string FormatHostInfo(download::DownloadManager *download_mgr);
   std::string FormatProxyInfo(download::DownloadManager *download_mgr);
+  std::string FormatEndpointScores(download::DownloadManager *download_mgr);
 
   std::string socket_path_;
   int socket_fd_;
@@ -97,6 +97,7 @@ Failures Whitelist::Load(const std::string &base_url) {
   const string whitelist_url = base_url + string("/.cvmfswhitelist");
   download::JobInfo download_whitelist(&whitelist_url,
                                        false, probe_hosts, NULL);
+  download_whitelist.latency_critical = true;
   retval_dl = download_manager_->Fetch(&download_whitelist);
   if (retval_dl != download::kFailOk)
     return kFailLoad;
@@ -0,0 +1,140 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bm_util.h"
+#include "cache_extern.h"
+#include "hash.h"
+#include "smalloc.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Read throughput of ExternalCacheManager::Pread() against the cvmfs_cache_null
+ * demo plugin.  The plugin binary is taken from $CVMFS_CACHE_NULL or else
+ * searched in $PATH.  The first argument is the size of a single Pread(), the
+ * second argument is the number of read requests kept in flight.  With one
+ * request in flight, Pread() waits for every reply before sending the next
+ * request.
+ */
+namespace {
+
+const uint64_t kObjectSize = 16 * 1024 * 1024;
+
+struct NullPlugin {
+  NullPlugin() : pid(0), cache_mgr(NULL), fd(-1) { }
+  pid_t pid;
+  string config_path;
+  string socket_path;
+  ExternalCacheManager *cache_mgr;
+  int fd;
+};
+
+NullPlugin *g_null_plugin = NULL;
+pthread_once_t g_null_plugin_once = PTHREAD_ONCE_INIT;
+
+void StopNullPlugin() {
+  g_null_plugin->cache_mgr->Close(g_null_plugin->fd);
+  delete g_null_plugin->cache_mgr;
+  kill(g_null_plugin->pid, SIGTERM);
+  unlink(g_null_plugin->socket_path.c_str());
+  unlink(g_null_plugin->config_path.c_str());
+  delete g_null_plugin;
+}
+
+void StartNullPlugin() {
+  g_null_plugin = new NullPlugin();
+  g_null_plugin->config_path = "/tmp/cvmfs_benchmark_null.conf";
+  g_null_plugin->socket_path = "/tmp/cvmfs_benchmark_null.socket";
+  string binary = (getenv("CVMFS_CACHE_NULL") != NULL)
+                  ? getenv("CVMFS_CACHE_NULL") : "cvmfs_cache_null";
+
+  // In test mode, the plugin daemonizes and prints its pid
+  string config =
+    "CVMFS_CACHE_PLUGIN_LOCATOR=unix=" + g_null_plugin->socket_path + "\n" +
+    "CVMFS_CACHE_PLUGIN_TEST=yes\n";
+  bool retval = SafeWriteToFile(config, g_null_plugin->config_path, 0600);
+  assert(retval);
+  int fd_stdin, fd_stdout, fd_stderr;
+  retval = ExecuteBinary(&fd_stdin, &fd_stdout, &fd_stderr, binary,
+                         vector<string>(1, g_null_plugin->config_path));
+  if (!retval) {
+    fprintf(stderr, "failed to start %s\n", binary.c_str());
+    abort();
+  }
+  string line;
+  retval = GetLineFd(fd_stdout, &line);
+  close(fd_stdin);
+  close(fd_stdout);
+  close(fd_stderr);
+  if (!retval || (String2Uint64(line) == 0)) {
+    fprintf(stderr, "failed to start %s\n", binary.c_str());
+    abort();
+  }
+  g_null_plugin->pid = String2Uint64(line);
+
+  int fd_client = ConnectSocket(g_null_plugin->socket_path);
+  assert(fd_client >= 0);
+  ExternalCacheManager *cache_mgr =
+    ExternalCacheManager::Create(fd_client, 128, "benchmark");
+  assert(cache_mgr != NULL);
+  cache_mgr->AcquireQuotaManager(ExternalQuotaManager::Create(cache_mgr));
+  cache_mgr->Spawn();
+
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(kObjectSize));
+  for (unsigned i = 0; i < kObjectSize; ++i)
+    buffer[i] = static_cast<unsigned char>(i % 251);
+  shash::Any id(shash::kSha1);
+  shash::HashMem(buffer, kObjectSize, &id);
+  retval = cache_mgr->CommitFromMem(id, buffer, kObjectSize, "benchmark");
+  assert(retval);
+  free(buffer);
+  g_null_plugin->fd = cache_mgr->Open(CacheManager::Bless(id));
+  assert(g_null_plugin->fd >= 0);
+  g_null_plugin->cache_mgr = cache_mgr;
+  atexit(StopNullPlugin);
+}
+
+}  // anonymous namespace
+
+
+static void BM_CacheNullPread(benchmark::State &st) {
+  pthread_once(&g_null_plugin_once, StartNullPlugin);
+  ExternalCacheManager *cache_mgr = g_null_plugin->cache_mgr;
+  if (st.thread_index == 0)
+    cache_mgr->set_max_inflight_reads(st.range_y());
+
+  const uint64_t size = st.range_x();
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(size));
+  uint64_t offset = 0;
+  while (st.KeepRunning()) {
+    int64_t nbytes = cache_mgr->Pread(g_null_plugin->fd, buffer, size, offset);
+    assert(nbytes == static_cast<int64_t>(size));
+    Escape(buffer);
+    offset += size;
+    if (offset + size > kObjectSize)
+      offset = 0;
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+  free(buffer);
+}
+BENCHMARK(BM_CacheNullPread)->Repetitions(3)->UseRealTime()->
+  ArgPair(1024 * 1024, 1)->ArgPair(1024 * 1024, 4)->
+  ArgPair(1024 * 1024, 8)->ArgPair(4 * 1024 * 1024, 1)->
+  ArgPair(4 * 1024 * 1024, 8)->ArgPair(4 * 1024 * 1024, 16)->
+  Threads(1)->Threads(4);
@@ -0,0 +1,62 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <alloca.h>
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "bm_util.h"
+#include "cache_posix.h"
+#include "hash.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Writes 16MB objects in chunks of the given size.  The second argument sets
+ * the direct I/O threshold, zero for writes through the page cache.
+ */
+class BM_CachePosix : public benchmark::Fixture {
+ protected:
+  static const unsigned kObjectSize = 16 * 1024 * 1024;
+
+  virtual void SetUp(const benchmark::State &st) {
+    tmp_path_ = CreateTempDir("./cvmfs_ubenchmark_cache_posix");
+    assert(!tmp_path_.empty());
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_, false);
+    assert(cache_mgr_ != NULL);
+    cache_mgr_->SetDirectIoThreshold(st.range_y());
+    buffer_.resize(st.range_x(), 'x');
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    delete cache_mgr_;
+    RemoveTree(tmp_path_);
+  }
+
+  string tmp_path_;
+  PosixCacheManager *cache_mgr_;
+  vector<char> buffer_;
+};
+
+BENCHMARK_DEFINE_F(BM_CachePosix, Commit)(benchmark::State &st) {
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  shash::Any id(shash::kSha1);
+  while (st.KeepRunning()) {
+    id.Randomize();
+    int retval = cache_mgr_->StartTxn(id, kObjectSize, txn);
+    assert(retval >= 0);
+    for (unsigned pos = 0; pos < kObjectSize; pos += buffer_.size())
+      cache_mgr_->Write(&buffer_[0], buffer_.size(), txn);
+    retval = cache_mgr_->CommitTxn(txn);
+    assert(retval == 0);
+    ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(kObjectSize));
+}
+BENCHMARK_REGISTER_F(BM_CachePosix, Commit)->Repetitions(3)->UseRealTime()->
+  ArgPair(1024, 0)->ArgPair(16 * 1024, 0)->ArgPair(16 * 1024, 1);
@@ -0,0 +1,169 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+
+#include <cassert>
+
+#include "bm_util.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "murmur.h"
+#include "shortstring.h"
+#include "smallhash.h"
+
+/**
+ * Mimics the hash map lookups of cvmfs_read() on chunked files.  Every thread
+ * owns a set of open chunk handles to a shared set of chunked files.  The
+ * "GlobalLock" variants use a single mutex over flat hash maps as ChunkTables
+ * did before it was sharded.
+ */
+namespace {
+
+const unsigned kNumFiles = 256;
+const unsigned kNumChunks = 16;
+const unsigned kHandlesPerThread = 64;
+const unsigned kMaxThreads = 64;
+
+inline uint32_t hasher_uint64t(const uint64_t &value) {
+  return MurmurHash2(&value, sizeof(value), 0x07387a4f);
+}
+
+FileChunkReflist MakeReflist() {
+  FileChunkList *list = new FileChunkList();
+  for (unsigned i = 0; i < kNumChunks; ++i) {
+    shash::Any hash(shash::kSha1);
+    hash.Randomize();
+    list->PushBack(FileChunk(hash, i * 1024 * 1024, 1024 * 1024));
+  }
+  return FileChunkReflist(list, PathString("/chunked"), zlib::kZlibDefault,
+                          false);
+}
+
+uint64_t HandleOf(unsigned thread_index, unsigned i) {
+  return 2 + thread_index * kHandlesPerThread + i;
+}
+
+uint64_t InodeOf(uint64_t handle) {
+  return 1000 + (handle % kNumFiles);
+}
+
+
+struct GlobalLockTables {
+  GlobalLockTables() {
+    int retval = pthread_mutex_init(&lock, NULL);
+    assert(retval == 0);
+    handle2uniqino.Init(16, 0, hasher_uint64t);
+    handle2fd.Init(16, 0, hasher_uint64t);
+    inode2chunks.Init(16, 0, hasher_uint64t);
+    for (unsigned i = 0; i < kNumFiles; ++i)
+      inode2chunks.Insert(1000 + i, MakeReflist());
+    for (unsigned t = 0; t < kMaxThreads; ++t) {
+      for (unsigned i = 0; i < kHandlesPerThread; ++i) {
+        uint64_t handle = HandleOf(t, i);
+        handle2uniqino.Insert(handle, InodeOf(handle));
+        handle2fd.Insert(handle, ChunkFd());
+      }
+    }
+  }
+
+  pthread_mutex_t lock;
+  SmallHashDynamic<uint64_t, uint64_t> handle2uniqino;
+  SmallHashDynamic<uint64_t, ChunkFd> handle2fd;
+  SmallHashDynamic<uint64_t, FileChunkReflist> inode2chunks;
+};
+
+
+struct ShardedTables {
+  ShardedTables() {
+    for (unsigned i = 0; i < kNumFiles; ++i) {
+      ChunkTables::InodeShard *shard = tables.Inode2Shard(1000 + i);
+      shard->inode2chunks.Insert(1000 + i, MakeReflist());
+    }
+    for (unsigned t = 0; t < kMaxThreads; ++t) {
+      for (unsigned i = 0; i < kHandlesPerThread; ++i) {
+        uint64_t handle = HandleOf(t, i);
+        ChunkTables::HandleShard *shard = tables.Handle2Shard(handle);
+        shard->handle2uniqino.Insert(handle, InodeOf(handle));
+        shard->handle2fd.Insert(handle, ChunkFd());
+      }
+    }
+  }
+
+  ChunkTables tables;
+};
+
+GlobalLockTables *GetGlobalLockTables() {
+  static GlobalLockTables *global_lock_tables = new GlobalLockTables();
+  return global_lock_tables;
+}
+
+ShardedTables *GetShardedTables() {
+  static ShardedTables *sharded_tables = new ShardedTables();
+  return sharded_tables;
+}
+
+}  // anonymous namespace
+
+
+static void BM_ChunkTablesGlobalLock(benchmark::State &st) {
+  GlobalLockTables *t = GetGlobalLockTables();
+  unsigned i = 0;
+  while (st.KeepRunning()) {
+    uint64_t handle = HandleOf(st.thread_index, i % kHandlesPerThread);
+    uint64_t unique_inode;
+    FileChunkReflist chunks;
+    ChunkFd chunk_fd;
+
+    pthread_mutex_lock(&t->lock);
+    t->handle2uniqino.Lookup(handle, &unique_inode);
+    t->inode2chunks.Lookup(unique_inode, &chunks);
+    pthread_mutex_unlock(&t->lock);
+    unsigned chunk_idx = chunks.FindChunkIdx((i * 4096) % (16 * 1024 * 1024));
+    pthread_mutex_lock(&t->lock);
+    t->handle2fd.Lookup(handle, &chunk_fd);
+    pthread_mutex_unlock(&t->lock);
+    chunk_fd.chunk_idx = chunk_idx;
+    Escape(&chunk_fd);
+    pthread_mutex_lock(&t->lock);
+    t->handle2fd.Insert(handle, chunk_fd);
+    pthread_mutex_unlock(&t->lock);
+    ++i;
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_ChunkTablesGlobalLock)->Repetitions(3)->ThreadRange(1, 64);
+
+
+static void BM_ChunkTablesSharded(benchmark::State &st) {
+  ChunkTables *t = &GetShardedTables()->tables;
+  unsigned i = 0;
+  while (st.KeepRunning()) {
+    uint64_t handle = HandleOf(st.thread_index, i % kHandlesPerThread);
+    uint64_t unique_inode;
+    FileChunkReflist chunks;
+    ChunkFd chunk_fd;
+
+    ChunkTables::HandleShard *handle_shard = t->Handle2Shard(handle);
+    handle_shard->Lock();
+    handle_shard->handle2uniqino.Lookup(handle, &unique_inode);
+    handle_shard->Unlock();
+    ChunkTables::InodeShard *inode_shard = t->Inode2Shard(unique_inode);
+    inode_shard->Lock();
+    inode_shard->inode2chunks.Lookup(unique_inode, &chunks);
+    inode_shard->Unlock();
+    unsigned chunk_idx = chunks.FindChunkIdx((i * 4096) % (16 * 1024 * 1024));
+    handle_shard->Lock();
+    handle_shard->handle2fd.Lookup(handle, &chunk_fd);
+    handle_shard->Unlock();
+    chunk_fd.chunk_idx = chunk_idx;
+    Escape(&chunk_fd);
+    handle_shard->Lock();
+    handle_shard->handle2fd.Insert(handle, chunk_fd);
+    handle_shard->Unlock();
+    ++i;
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_ChunkTablesSharded)->Repetitions(3)->ThreadRange(1, 64);
@@ -0,0 +1,129 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "backoff.h"
+#include "cache_posix.h"
+#include "compression.h"
+#include "download.h"
+#include "fetch.h"
+#include "hash.h"
+#include "statistics.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Cold cache start of many jobs that use the same software.  The first
+ * argument is the number of threads that fetch the same set of objects from
+ * a file:// host into an empty cache, half of them in the same order.  Most
+ * Fetch() calls thus wait for a download started by another thread.  An
+ * iteration ends when every thread has opened every object.
+ */
+namespace {
+
+const unsigned kNumObjects = 64;
+const unsigned kObjectSize = 16 * 1024;
+
+struct StormArgs {
+  cvmfs::Fetcher *fetcher;
+  const vector<shash::Any> *hashes;
+  unsigned offset;
+};
+
+void *MainStorm(void *data) {
+  StormArgs *args = reinterpret_cast<StormArgs *>(data);
+  const unsigned num_hashes = args->hashes->size();
+  for (unsigned i = 0; i < num_hashes; ++i) {
+    const shash::Any &hash = (*args->hashes)[(args->offset + i) % num_hashes];
+    int fd = args->fetcher->Fetch(hash, CacheManager::kSizeUnknown, "storm",
+                                  zlib::kZlibDefault,
+                                  CacheManager::kTypeRegular);
+    assert(fd >= 0);
+    args->fetcher->cache_mgr()->Close(fd);
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
+static void BM_FetchCollapseStorm(benchmark::State &st) {
+  const unsigned num_threads = st.range_x();
+  const string tmp_path = CreateTempDir("/tmp/cvmfs_benchmark_fetch");
+  assert(!tmp_path.empty());
+
+  vector<shash::Any> hashes;
+  string content(kObjectSize, '\0');
+  for (unsigned i = 0; i < kNumObjects; ++i) {
+    for (unsigned j = 0; j < kObjectSize; ++j)
+      content[j] = static_cast<char>((i * 31 + j * 7) % 251);
+    void *buf;
+    uint64_t buf_size;
+    bool retval =
+      zlib::CompressMem2Mem(content.data(), content.length(), &buf, &buf_size);
+    assert(retval);
+    shash::Any hash(shash::kSha1);
+    shash::HashMem(static_cast<unsigned char *>(buf), buf_size, &hash);
+    const string path = tmp_path + "/data/" + hash.MakePath();
+    MkdirDeep(GetParentPath(path), 0700);
+    retval = CopyMem2Path(static_cast<unsigned char *>(buf), buf_size, path);
+    assert(retval);
+    free(buf);
+    hashes.push_back(hash);
+  }
+
+  perf::Statistics statistics;
+  download::DownloadManager download_mgr;
+  download_mgr.Init(16, false /* use_system_proxy */,
+                    perf::StatisticsTemplate("download", &statistics));
+  download_mgr.SetHostChain("file://" + tmp_path);
+  BackoffThrottle backoff_throttle;
+
+  vector<pthread_t> threads(num_threads);
+  vector<StormArgs> args(num_threads);
+  unsigned round = 0;
+  while (st.KeepRunning()) {
+    st.PauseTiming();
+    const string cache_path = tmp_path + "/cache" + StringifyInt(round++);
+    PosixCacheManager *cache_mgr = PosixCacheManager::Create(cache_path, false);
+    assert(cache_mgr != NULL);
+    perf::Statistics fetch_statistics;
+    cvmfs::Fetcher *fetcher = new cvmfs::Fetcher(
+      cache_mgr, &download_mgr, &backoff_throttle,
+      perf::StatisticsTemplate("fetch", &fetch_statistics));
+    st.ResumeTiming();
+
+    for (unsigned i = 0; i < num_threads; ++i) {
+      args[i].fetcher = fetcher;
+      args[i].hashes = &hashes;
+      args[i].offset = (i % 2) ? 0 : i;
+      int retval = pthread_create(&threads[i], NULL, MainStorm, &args[i]);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_threads; ++i)
+      pthread_join(threads[i], NULL);
+
+    st.PauseTiming();
+    assert(fetch_statistics.Lookup("fetch.n_downloads")->Get() ==
+           static_cast<int64_t>(kNumObjects));
+    delete fetcher;
+    delete cache_mgr;
+    RemoveTree(cache_path);
+    st.ResumeTiming();
+  }
+  st.SetItemsProcessed(st.iterations() * num_threads * kNumObjects);
+
+  download_mgr.Fini();
+  RemoveTree(tmp_path);
+}
+BENCHMARK(BM_FetchCollapseStorm)->Repetitions(3)->UseRealTime()->
+  Arg(1)->Arg(8)->Arg(32)->Arg(128);
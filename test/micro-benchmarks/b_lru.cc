@@ -0,0 +1,104 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "bm_util.h"
+#include "directory_entry.h"
+#include "hash.h"
+#include "lru.h"
+#include "statistics.h"
+#include "util/string.h"
+
+/**
+ * Mimics the meta-data cache accesses of cvmfs_lookup() and cvmfs_getattr().
+ * Lookups dominate; every 16th access inserts an entry, which evicts another
+ * one once the cache is full.  The "Lru" variants use the mutex-protected
+ * LruCache, the "Clock" variants the sharded ClockCache, both keyed like the
+ * md5path cache.
+ */
+namespace {
+
+typedef lru::LruCache<shash::Md5, catalog::DirectoryEntry> LruCache;
+typedef lru::ClockCache<shash::Md5, catalog::DirectoryEntry> ClockCache;
+
+const unsigned kCacheSize = 64 * 1024;
+// Larger than the cache, so that there are misses and evictions
+const unsigned kNumPaths = 80 * 1024;
+
+shash::Md5 *MakePaths() {
+  shash::Md5 *paths = new shash::Md5[kNumPaths];
+  for (unsigned i = 0; i < kNumPaths; ++i) {
+    const std::string path = "/path/to/entry/" + StringifyInt(i);
+    paths[i] = shash::Md5(path.data(), path.length());
+  }
+  return paths;
+}
+
+shash::Md5 *GetPaths() {
+  static shash::Md5 *paths = MakePaths();
+  return paths;
+}
+
+// Same as in lru_md.h
+inline uint32_t hasher_md5(const shash::Md5 &key) {
+  return (uint32_t) *(reinterpret_cast<const uint32_t *>(key.digest) + 1);
+}
+
+template <class CacheT>
+CacheT *MakeCache(const std::string &name) {
+  perf::Statistics *statistics = new perf::Statistics();
+  CacheT *cache = new CacheT(kCacheSize, shash::Md5(shash::AsciiPtr("!")),
+                             hasher_md5,
+                             perf::StatisticsTemplate(name, statistics));
+  shash::Md5 *paths = GetPaths();
+  catalog::DirectoryEntry dirent;
+  for (unsigned i = 0; i < kCacheSize; ++i)
+    cache->Insert(paths[i], dirent);
+  return cache;
+}
+
+LruCache *GetLruCache() {
+  static LruCache *cache = MakeCache<LruCache>("lru");
+  return cache;
+}
+
+ClockCache *GetClockCache() {
+  static ClockCache *cache = MakeCache<ClockCache>("clock");
+  return cache;
+}
+
+template <class CacheT>
+void RunMd5PathCache(benchmark::State &st, CacheT *cache) {
+  shash::Md5 *paths = GetPaths();
+  catalog::DirectoryEntry dirent;
+  // Different threads walk the paths with different strides
+  unsigned i = st.thread_index * 7919;
+  const unsigned stride = 2 * st.thread_index + 1;
+  while (st.KeepRunning()) {
+    const shash::Md5 &md5path = paths[i % kNumPaths];
+    if ((i % 16) == 0)
+      cache->Insert(md5path, dirent);
+    else
+      cache->Lookup(md5path, &dirent);
+    Escape(&dirent);
+    i += stride;
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+
+}  // anonymous namespace
+
+
+static void BM_Md5PathCacheLru(benchmark::State &st) {
+  RunMd5PathCache(st, GetLruCache());
+}
+BENCHMARK(BM_Md5PathCacheLru)->Repetitions(3)->ThreadRange(1, 64);
+
+
+static void BM_Md5PathCacheClock(benchmark::State &st) {
+  RunMd5PathCache(st, GetClockCache());
+}
+BENCHMARK(BM_Md5PathCacheClock)->Repetitions(3)->ThreadRange(1, 64);
@@ -0,0 +1,211 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <string>
+
+#include "bm_util.h"
+#include "quota_ring.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Emulates the transport between the clients and the shared quota manager
+ * without the cache catalog.  The synchronous commands (Pin/Reserve, Cleanup,
+ * List, GetLimits, ...) send the number of a named return pipe through the
+ * command FIFO.  The asynchronous commands (Insert, Touch, Unpin, ...) go
+ * through the shared memory ring.
+ */
+class BM_Quota : public benchmark::Fixture {
+ protected:
+  struct Command {
+    Command() : type(0), return_pipe(-1) { }
+    int type;
+    int return_pipe;
+    char payload[56];
+  };
+
+  static const int kQuit = 0;
+  static const int kSync = 1;
+  static const int kSyncPersistent = 2;
+
+  virtual void SetUp(const benchmark::State &st) {
+    workspace_ = CreateTempDir("/tmp/cvmfs_benchmark_quota");
+    assert(!workspace_.empty());
+    MakePipe(pipe_cmd_);
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    ClosePipe(pipe_cmd_);
+    RemoveTree(workspace_);
+  }
+
+  string GetReturnPipePath(const int id) {
+    return workspace_ + "/pipe" + StringifyInt(id);
+  }
+
+  /**
+   * Answers synchronous commands like the shared quota manager: the return
+   * pipe is opened and closed for every reply.
+   */
+  void RunServer(int fd_persistent) {
+    close(pipe_cmd_[1]);
+    Command cmd;
+    const uint64_t reply = 42;
+    while (true) {
+      ReadPipe(pipe_cmd_[0], &cmd, sizeof(cmd));
+      switch (cmd.type) {
+        case kQuit:
+          exit(0);
+        case kSync: {
+          int fd = open(GetReturnPipePath(cmd.return_pipe).c_str(),
+                        O_WRONLY | O_NONBLOCK);
+          assert(fd >= 0);
+          Nonblock2Block(fd);
+          WritePipe(fd, &reply, sizeof(reply));
+          close(fd);
+          break;
+        }
+        case kSyncPersistent:
+          WritePipe(fd_persistent, &reply, sizeof(reply));
+          break;
+        default:
+          abort();
+      }
+    }
+  }
+
+  void StopServer(pid_t pid) {
+    Command cmd;
+    cmd.type = kQuit;
+    WritePipe(pipe_cmd_[1], &cmd, sizeof(cmd));
+    int statloc;
+    waitpid(pid, &statloc, 0);
+  }
+
+  string workspace_;
+  int pipe_cmd_[2];
+};
+
+
+/**
+ * A synchronous command of a client of the shared quota manager, including
+ * the creation, binding, and removal of the named return pipe
+ */
+BENCHMARK_DEFINE_F(BM_Quota, SyncReturnPipe)(benchmark::State &st) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0)
+    RunServer(-1);
+  close(pipe_cmd_[0]);
+
+  Command cmd;
+  cmd.type = kSync;
+  cmd.return_pipe = 0;
+  uint64_t reply;
+  while (st.KeepRunning()) {
+    const string path = GetReturnPipePath(cmd.return_pipe);
+    int retval = mkfifo(path.c_str(), 0600);
+    assert(retval == 0);
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    assert(fd >= 0);
+    Nonblock2Block(fd);
+    WritePipe(pipe_cmd_[1], &cmd, sizeof(cmd));
+    ReadHalfPipe(fd, &reply, sizeof(reply));
+    close(fd);
+    unlink(path.c_str());
+    Escape(&reply);
+  }
+  st.SetItemsProcessed(st.iterations());
+
+  StopServer(pid);
+}
+BENCHMARK_REGISTER_F(BM_Quota, SyncReturnPipe)->Repetitions(3)->
+  UseRealTime();
+
+
+/**
+ * The same round trip with a reply channel that is set up only once.  This is
+ * the lower bound for any reply channel that wakes up the blocked client
+ * through the kernel, e.g. futex signaled reply slots in shared memory.
+ */
+BENCHMARK_DEFINE_F(BM_Quota, SyncPersistentPipe)(benchmark::State &st) {
+  int pipe_reply[2];
+  MakePipe(pipe_reply);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    close(pipe_reply[0]);
+    RunServer(pipe_reply[1]);
+  }
+  close(pipe_cmd_[0]);
+  close(pipe_reply[1]);
+
+  Command cmd;
+  cmd.type = kSyncPersistent;
+  uint64_t reply;
+  while (st.KeepRunning()) {
+    WritePipe(pipe_cmd_[1], &cmd, sizeof(cmd));
+    ReadPipe(pipe_reply[0], &reply, sizeof(reply));
+    Escape(&reply);
+  }
+  st.SetItemsProcessed(st.iterations());
+
+  StopServer(pid);
+  close(pipe_reply[0]);
+}
+BENCHMARK_REGISTER_F(BM_Quota, SyncPersistentPipe)->Repetitions(3)->
+  UseRealTime();
+
+
+/**
+ * An asynchronous command through the shared memory ring with a consumer that
+ * keeps up
+ */
+BENCHMARK_DEFINE_F(BM_Quota, AsyncRing)(benchmark::State &st) {
+  CommandRing *ring = CommandRing::Create(workspace_ + "/cachemgr.ring", 1024);
+  assert(ring != NULL);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    Command cmd;
+    unsigned size;
+    while (true) {
+      if (!ring->Dequeue(&cmd, &size)) {
+        sched_yield();
+        continue;
+      }
+      if (cmd.type == kQuit)
+        exit(0);
+    }
+  }
+
+  Command cmd;
+  cmd.type = kSync;
+  bool wakeup;
+  while (st.KeepRunning()) {
+    while (!ring->Enqueue(&cmd, sizeof(cmd), &wakeup))
+      sched_yield();
+  }
+  st.SetItemsProcessed(st.iterations());
+
+  cmd.type = kQuit;
+  while (!ring->Enqueue(&cmd, sizeof(cmd), &wakeup))
+    sched_yield();
+  int statloc;
+  waitpid(pid, &statloc, 0);
+  delete ring;
+}
+BENCHMARK_REGISTER_F(BM_Quota, AsyncRing)->Repetitions(3)->
+  UseRealTime();
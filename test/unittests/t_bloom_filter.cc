@@ -0,0 +1,52 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "bloom_filter.h"
+#include "hash.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+TEST(T_BloomFilter, Empty) {
+  BloomFilter filter(0, 10);
+  EXPECT_EQ(64u, filter.num_bits());
+  EXPECT_EQ(7u, filter.num_probes());
+  EXPECT_FALSE(filter.Contains(shash::Md5(shash::AsciiPtr(""))));
+  EXPECT_FALSE(filter.Contains(shash::Md5(shash::AsciiPtr("/foo"))));
+}
+
+
+TEST(T_BloomFilter, Probes) {
+  EXPECT_EQ(1u, BloomFilter(1000, 1).num_probes());
+  EXPECT_EQ(6u, BloomFilter(1000, 8).num_probes());
+  const unsigned max_probes = BloomFilter::kMaxProbes;
+  EXPECT_EQ(max_probes, BloomFilter(1000, 64).num_probes());
+  EXPECT_EQ(8000u, BloomFilter(1000, 8).num_bits());
+  EXPECT_EQ(128u, BloomFilter(10, 7).num_bits());
+}
+
+
+TEST(T_BloomFilter, NoFalseNegatives) {
+  const unsigned kNumEntries = 10000;
+  BloomFilter filter(kNumEntries, 10);
+  for (unsigned i = 0; i < kNumEntries; ++i)
+    filter.Insert(shash::Md5(shash::AsciiPtr("/in/" + StringifyInt(i))));
+  for (unsigned i = 0; i < kNumEntries; ++i) {
+    EXPECT_TRUE(
+      filter.Contains(shash::Md5(shash::AsciiPtr("/in/" + StringifyInt(i)))));
+  }
+
+  // Expected false positive rate is about 1%
+  unsigned num_false_positives = 0;
+  for (unsigned i = 0; i < kNumEntries; ++i) {
+    const string path = "/out/" + StringifyInt(i);
+    if (filter.Contains(shash::Md5(shash::AsciiPtr(path))))
+      num_false_positives++;
+  }
+  EXPECT_LT(num_false_positives, kNumEntries / 50);
+}
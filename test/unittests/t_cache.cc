@@ -10,9 +10,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "cache_posix.h"
 #include "compression.h"
@@ -214,6 +216,7 @@ class TestQuotaManager : public QuotaManager {
   virtual uint64_t GetSize() { return size; }
   virtual uint64_t GetSizePinned() { return 0; }
   virtual uint64_t GetCleanupRate(uint64_t period_s) { return 0; }
+  virtual bool GetCleanupStatus(CleanupStatus *status) { return false; }
 
   virtual void Spawn() { }
   virtual pid_t GetPid() { return getpid(); }
@@ -605,6 +608,23 @@ TEST_F(T_CacheManager, Dup) {
 }
 
 
+TEST_F(T_CacheManager, GetBackingFd) {
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd, 0);
+  uint64_t offset = 1;
+  int backing_fd = cache_mgr_->GetBackingFd(fd, &offset);
+  EXPECT_EQ(fd, backing_fd);
+  EXPECT_EQ(0U, offset);
+  char buf;
+  EXPECT_EQ(1, pread(backing_fd, &buf, 1, offset));
+  EXPECT_EQ('A', buf);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  TestCacheManager test_cache_mgr;
+  EXPECT_EQ(-ENOTSUP, test_cache_mgr.GetBackingFd(0, &offset));
+}
+
+
 TEST_F(T_CacheManager, GetSize) {
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_null_));
   EXPECT_GE(fd, 0);
@@ -903,6 +923,47 @@ TEST_F(T_CacheManager, WriteCompare) {
 }
 
 
+/**
+ * Mixes writes that fit into the transaction buffer with writes that bypass
+ * it, with and without direct I/O.  Direct I/O silently falls back to buffered
+ * writes if the file system does not support it.
+ */
+TEST_F(T_CacheManager, WriteChunks) {
+  const unsigned N = 3 * PosixCacheManager::kDirectIoBufferSize + 1234;
+  vector<char> large_buf(N);
+  Prng prng;
+  prng.InitLocaltime();
+  for (unsigned i = 0; i < N; ++i)
+    large_buf[i] = prng.Next(128);
+  const unsigned chunk_sizes[] = {1, 100, 4095, 4096, 7000, 65536, 300000};
+  const unsigned num_chunk_sizes = sizeof(chunk_sizes) / sizeof(unsigned);
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+
+  for (unsigned direct_io = 0; direct_io < 2; ++direct_io) {
+    cache_mgr_->SetDirectIoThreshold(direct_io);
+    shash::Any rnd_hash;
+    rnd_hash.Randomize();
+    EXPECT_GE(cache_mgr_->StartTxn(rnd_hash, N, txn), 0);
+    unsigned pos = 0;
+    for (unsigned i = 0; pos < N; ++i) {
+      const unsigned size = std::min(N - pos, chunk_sizes[i % num_chunk_sizes]);
+      EXPECT_EQ(static_cast<int64_t>(size),
+                cache_mgr_->Write(&large_buf[pos], size, txn));
+      pos += size;
+    }
+    EXPECT_EQ(0, cache_mgr_->CommitTxn(txn));
+
+    int fd = cache_mgr_->Open(CacheManager::Bless(rnd_hash));
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(N, cache_mgr_->GetSize(fd));
+    vector<char> receive_buf(N);
+    EXPECT_EQ(N, cache_mgr_->Pread(fd, &receive_buf[0], N, 0));
+    EXPECT_EQ(0, memcmp(&large_buf[0], &receive_buf[0], N));
+    cache_mgr_->Close(fd);
+  }
+}
+
+
 TEST_F(T_CacheManager, SaveState) {
   TestCacheManager test_cache;
   int fd_progress = open("/dev/null", O_WRONLY);
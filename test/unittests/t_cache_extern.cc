@@ -8,11 +8,13 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <map>
@@ -483,6 +485,106 @@ TEST_F(T_ExternalCacheManager, TransactionAbort) {
 }
 
 
+TEST_F(T_ExternalCacheManager, SharedMemory) {
+  // Requires memfd_create()
+  int fd_memfd = -1;
+#ifdef __NR_memfd_create
+  fd_memfd = syscall(__NR_memfd_create, "t_cache_extern", 0);
+#endif
+  if (fd_memfd < 0) {
+    printf("Skipping, kernel without memfd_create()\n");
+    RecordProperty("skipped", "kernel without memfd_create()");
+    return;
+  }
+  close(fd_memfd);
+  ASSERT_LT(0U, cache_mgr_->shm_num_slots());
+  const unsigned max_slots = ExternalCacheManager::kMaxShmSlots;
+  EXPECT_GE(max_slots, cache_mgr_->shm_num_slots());
+
+  shash::Any id(shash::kSha1);
+  uint64_t size = cache_mgr_->max_object_size() * 3 + 5;
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(size));
+  for (unsigned i = 0; i < size; ++i)
+    buffer[i] = static_cast<unsigned char>(i % 251);
+  HashMem(buffer, size, &id);
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(id, buffer, size, "test"));
+  EXPECT_EQ(string(reinterpret_cast<char *>(buffer), size),
+            mock_plugin_->new_object_content);
+
+  unsigned char *read_buffer;
+  uint64_t read_size;
+  EXPECT_TRUE(cache_mgr_->Open2Mem(id, "test", &read_buffer, &read_size));
+  EXPECT_EQ(size, read_size);
+  EXPECT_EQ(0, memcmp(buffer, read_buffer, size));
+  free(read_buffer);
+  EXPECT_EQ(0, atomic_read32(&cache_mgr_->shm_used_slots_));
+
+  // Without free slots, payloads are sent as attachments
+  vector<int> slots;
+  int slot;
+  while ((slot = cache_mgr_->AcquireShmSlot()) >= 0)
+    slots.push_back(slot);
+  EXPECT_EQ(cache_mgr_->shm_num_slots(), slots.size());
+  mock_plugin_->new_object_content.clear();
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(id, buffer, size, "test"));
+  EXPECT_EQ(string(reinterpret_cast<char *>(buffer), size),
+            mock_plugin_->new_object_content);
+  EXPECT_TRUE(cache_mgr_->Open2Mem(id, "test", &read_buffer, &read_size));
+  EXPECT_EQ(size, read_size);
+  EXPECT_EQ(0, memcmp(buffer, read_buffer, size));
+  free(read_buffer);
+  for (unsigned i = 0; i < slots.size(); ++i)
+    cache_mgr_->ReleaseShmSlot(slots[i]);
+  EXPECT_EQ(0, atomic_read32(&cache_mgr_->shm_used_slots_));
+  free(buffer);
+}
+
+
+TEST_F(T_ExternalCacheManager, PreadPipelined) {
+  cache_mgr_->Spawn();
+  const unsigned default_inflight = ExternalCacheManager::kDefaultInflightReads;
+  EXPECT_EQ(default_inflight, cache_mgr_->max_inflight_reads());
+  cache_mgr_->set_max_inflight_reads(3);
+
+  shash::Any id(shash::kSha1);
+  uint64_t size = cache_mgr_->max_object_size() * 7 + 5;
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(size));
+  for (unsigned i = 0; i < size; ++i)
+    buffer[i] = static_cast<unsigned char>(i % 251);
+  HashMem(buffer, size, &id);
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(id, buffer, size, "test"));
+
+  int fd = cache_mgr_->Open(CacheManager::Bless(id));
+  EXPECT_GE(fd, 0);
+  // Rounded up buffer, the last request within the fan-out is a short read
+  uint64_t read_size = size + cache_mgr_->max_object_size();
+  unsigned char *read_buffer = static_cast<unsigned char *>(smalloc(read_size));
+  EXPECT_EQ(static_cast<int64_t>(size),
+            cache_mgr_->Pread(fd, read_buffer, read_size, 0));
+  EXPECT_EQ(0, memcmp(buffer, read_buffer, size));
+
+  // Unaligned offset
+  uint64_t offset = cache_mgr_->max_object_size() / 2 + 1;
+  memset(read_buffer, 0, read_size);
+  EXPECT_EQ(static_cast<int64_t>(size - offset),
+            cache_mgr_->Pread(fd, read_buffer, size - offset, offset));
+  EXPECT_EQ(0, memcmp(buffer + offset, read_buffer, size - offset));
+
+  // Short read in the middle of a fan-out
+  cache_mgr_->set_max_inflight_reads(ExternalCacheManager::kMaxInflightReads);
+  offset = size - cache_mgr_->max_object_size() * 2;
+  EXPECT_EQ(static_cast<int64_t>(size - offset),
+            cache_mgr_->Pread(fd, read_buffer, read_size, offset));
+  EXPECT_EQ(0, memcmp(buffer + offset, read_buffer, size - offset));
+
+  EXPECT_EQ(-EINVAL, cache_mgr_->Pread(fd, read_buffer, 1, size + 1));
+  EXPECT_EQ(0, atomic_read32(&cache_mgr_->shm_used_slots_));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  free(read_buffer);
+  free(buffer);
+}
+
+
 namespace {
 
 struct BackchannelData {
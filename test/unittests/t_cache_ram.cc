@@ -342,3 +342,58 @@ TEST_F(T_RamCacheManager, OpenClose) {
     EXPECT_EQ(0, ramcache_.Close(fds[i]));
   }
 }
+
+
+TEST_F(T_RamCacheManager, Sharded) {
+  perf::Statistics statistics;
+  RamCacheManager ramcache(4*alloc_size,
+                           cache_size,
+                           MemoryKvStore::kMallocLibc,
+                           perf::StatisticsTemplate("test", &statistics),
+                           4);
+  char buf[alloc_size];
+  char out[alloc_size];
+  void *txn = alloca(ramcache.SizeOfTxn());
+
+  // Every shard holds one object, newer objects push out older ones
+  for (unsigned i = 1; i <= 8; ++i) {
+    a_.digest[1] = i;
+    memset(buf, i, alloc_size);
+    EXPECT_EQ(0, ramcache.StartTxn(a_, alloc_size, txn));
+    EXPECT_EQ(alloc_size, ramcache.Write(buf, alloc_size, txn));
+    EXPECT_EQ(0, ramcache.CommitTxn(txn));
+  }
+  for (unsigned i = 1; i <= 4; ++i) {
+    a_.digest[1] = i;
+    EXPECT_EQ(-ENOENT, ramcache.Open(CacheManager::Bless(a_)));
+  }
+  int fds[4];
+  for (unsigned i = 5; i <= 8; ++i) {
+    a_.digest[1] = i;
+    fds[i - 5] = ramcache.Open(CacheManager::Bless(a_));
+    ASSERT_GE(fds[i - 5], 0);
+    EXPECT_EQ(alloc_size, ramcache.Pread(fds[i - 5], out, alloc_size, 0));
+    EXPECT_EQ(i, static_cast<unsigned>(out[alloc_size - 1]));
+  }
+
+  // Shard 1 only has an open entry, the next shard has to give way
+  EXPECT_EQ(0, ramcache.Close(fds[1]));
+  a_.digest[1] = 9;
+  EXPECT_EQ(0, ramcache.StartTxn(a_, alloc_size, txn));
+  EXPECT_EQ(alloc_size, ramcache.Write(buf, alloc_size, txn));
+  fds[1] = ramcache.OpenFromTxn(txn);
+  EXPECT_GE(fds[1], 0);
+  EXPECT_EQ(0, ramcache.AbortTxn(txn));
+  a_.digest[1] = 6;
+  EXPECT_EQ(-ENOENT, ramcache.Open(CacheManager::Bless(a_)));
+
+  // All the open entries are pinned
+  a_.digest[1] = 10;
+  EXPECT_EQ(0, ramcache.StartTxn(a_, alloc_size, txn));
+  EXPECT_EQ(alloc_size, ramcache.Write(buf, alloc_size, txn));
+  EXPECT_EQ(-ENOSPC, ramcache.CommitTxn(txn));
+  EXPECT_EQ(0, ramcache.AbortTxn(txn));
+
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_EQ(0, ramcache.Close(fds[i]));
+}
@@ -9,6 +9,7 @@
 #include "cache_tiered.h"
 #include "hash.h"
 #include "statistics.h"
+#include "util/posix.h"
 
 using namespace std;  // NOLINT
 
@@ -107,3 +108,108 @@ TEST_F(T_TieredCacheManager, ReadOnly) {
   EXPECT_EQ(0, tiered_cache_->Reset(txn));
   EXPECT_EQ(0, tiered_cache_->AbortTxn(txn));
 }
+
+
+TEST_F(T_TieredCacheManager, AsyncPromotion) {
+  perf::Statistics stats_tiered;
+  TieredCacheManager *tiered =
+    reinterpret_cast<TieredCacheManager *>(tiered_cache_);
+  tiered->SetAsync(1024, perf::StatisticsTemplate("tiered", &stats_tiered));
+
+  EXPECT_TRUE(lower_cache_->CommitFromMem(hash_one_, &buf_, 1, "one"));
+  int fd = tiered_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd, 0);
+  // Served from the lower cache, the copy-up is still queued
+  EXPECT_EQ(-ENOENT, upper_cache_->Open(CacheManager::Bless(hash_one_)));
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.sz_queued")->Get());
+
+  // A second miss does not queue another promotion
+  int fd_dup = tiered_cache_->Dup(fd);
+  EXPECT_GE(fd_dup, 0);
+  int fd2 = tiered_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd2, 0);
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.sz_queued")->Get());
+
+  unsigned char buf;
+  EXPECT_EQ(1, tiered_cache_->GetSize(fd_dup));
+  EXPECT_EQ(1, tiered_cache_->Pread(fd_dup, &buf, 1, 0));
+  EXPECT_EQ(buf_, buf);
+  EXPECT_EQ(0, tiered_cache_->Close(fd_dup));
+  EXPECT_EQ(0, tiered_cache_->Close(fd2));
+
+  tiered->Drain();
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.n_promote")->Get());
+  EXPECT_EQ(0, stats_tiered.Lookup("tiered.sz_queued")->Get());
+  int fd_upper = upper_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd_upper, 0);
+  EXPECT_EQ(0, upper_cache_->Close(fd_upper));
+  EXPECT_EQ(0, tiered_cache_->Close(fd));
+
+  // Now served from the upper cache
+  fd = tiered_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(1, tiered_cache_->Pread(fd, &buf, 1, 0));
+  EXPECT_EQ(0, tiered_cache_->Close(fd));
+  tiered->Drain();
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.n_promote")->Get());
+}
+
+
+TEST_F(T_TieredCacheManager, AsyncWriteBack) {
+  perf::Statistics stats_tiered;
+  TieredCacheManager *tiered =
+    reinterpret_cast<TieredCacheManager *>(tiered_cache_);
+  tiered->SetAsync(1024, perf::StatisticsTemplate("tiered", &stats_tiered));
+  tiered->Spawn();
+
+  EXPECT_TRUE(tiered_cache_->CommitFromMem(hash_one_, &buf_, 1, "one"));
+  int fd_upper = upper_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd_upper, 0);
+  EXPECT_EQ(0, upper_cache_->Close(fd_upper));
+
+  for (unsigned i = 0; (i < 1000) &&
+       (stats_tiered.Lookup("tiered.n_writeback")->Get() == 0); ++i)
+  {
+    SafeSleepMs(10);
+  }
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.n_writeback")->Get());
+  int fd_lower = lower_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd_lower, 0);
+  EXPECT_EQ(0, lower_cache_->Close(fd_lower));
+
+  // Aborted transactions do not reach the lower cache
+  shash::Any hash_two;
+  hash_two.digest[1] = 2;
+  void *txn = alloca(tiered_cache_->SizeOfTxn());
+  EXPECT_EQ(0, tiered_cache_->StartTxn(hash_two, 1, txn));
+  EXPECT_EQ(1, tiered_cache_->Write(&buf_, 1, txn));
+  EXPECT_EQ(0, tiered_cache_->AbortTxn(txn));
+  tiered->Drain();
+  EXPECT_EQ(-ENOENT, lower_cache_->Open(CacheManager::Bless(hash_two)));
+}
+
+
+TEST_F(T_TieredCacheManager, AsyncQueueFull) {
+  perf::Statistics stats_tiered;
+  TieredCacheManager *tiered =
+    reinterpret_cast<TieredCacheManager *>(tiered_cache_);
+  tiered->SetAsync(0, perf::StatisticsTemplate("tiered", &stats_tiered));
+
+  // Write-back falls back to synchronous copies
+  EXPECT_TRUE(tiered_cache_->CommitFromMem(hash_one_, &buf_, 1, "one"));
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.n_writeback_sync")->Get());
+  int fd_lower = lower_cache_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd_lower, 0);
+  EXPECT_EQ(0, lower_cache_->Close(fd_lower));
+
+  // Promotion is skipped
+  shash::Any hash_two;
+  hash_two.digest[1] = 2;
+  EXPECT_TRUE(lower_cache_->CommitFromMem(hash_two, &buf_, 1, "two"));
+  int fd = tiered_cache_->Open(CacheManager::Bless(hash_two));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, tiered_cache_->Close(fd));
+  EXPECT_EQ(1, stats_tiered.Lookup("tiered.n_promote_skipped")->Get());
+  tiered->Drain();
+  EXPECT_EQ(-ENOENT, upper_cache_->Open(CacheManager::Bless(hash_two)));
+}
@@ -8,12 +8,15 @@
 #include <unistd.h>
 
 #include "catalog.h"
+#include "catalog_index.h"
 #include "catalog_rw.h"
 #include "compression.h"
 #include "hash.h"
 #include "shortstring.h"
+#include "statistics.h"
 #include "testutil.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -125,6 +128,15 @@ class T_Catalog : public ::testing::Test {
     writable_catalog->UpdateLastModified();
   }
 
+  string BuildIndexImage(const string &db_path) {
+    string image;
+    UniquePtr<CatalogDatabase> database(
+      CatalogDatabase::Open(db_path, CatalogDatabase::kOpenReadOnly));
+    EXPECT_TRUE(database.IsValid());
+    EXPECT_TRUE(CatalogIndex::Build(*database, &image));
+    return image;
+  }
+
   virtual void TearDown() {
     delete catalog;
     delete nested;
@@ -367,6 +379,311 @@ TEST_F(T_Catalog, Listing) {
     EXPECT_NE(NameString("hidden"), root_stat_entry_list.At(i).name);
 }
 
+TEST_F(T_Catalog, LookupPaths) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+
+  vector<PathString> paths;
+  paths.push_back(PathString("/dir/dir/link"));
+  paths.push_back(PathString("/fakepath/fakefile"));
+  paths.push_back(PathString("/dir/dir/bar"));
+  paths.push_back(PathString("/dir/dir"));
+  paths.push_back(PathString("/dir/dir/bar2"));
+  vector<DirectoryEntry> dirents;
+  vector<bool> found;
+  EXPECT_EQ(4u, catalog->LookupPaths(paths, &dirents, &found));
+  ASSERT_EQ(paths.size(), dirents.size());
+  ASSERT_EQ(paths.size(), found.size());
+  EXPECT_FALSE(found[1]);
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    if (!found[i])
+      continue;
+    DirectoryEntry dirent;
+    EXPECT_TRUE(catalog->LookupPath(paths[i], &dirent));
+    EXPECT_EQ(dirent.name(), dirents[i].name());
+    EXPECT_EQ(dirent.inode(), dirents[i].inode());
+    EXPECT_EQ(dirent.IsLink(), dirents[i].IsLink());
+  }
+  EXPECT_EQ(NameString("link"), dirents[0].name());
+  EXPECT_EQ(NameString("bar"), dirents[2].name());
+
+  EXPECT_EQ(0u, catalog->LookupPaths(vector<PathString>(), &dirents, &found));
+  EXPECT_TRUE(dirents.empty());
+  EXPECT_TRUE(found.empty());
+}
+
+TEST_F(T_Catalog, ListingRange) {
+  PathString path("/dir/dir");
+  PathString root_path("");
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+
+  StatEntryList slice;
+  vector<uint64_t> row_ids;
+  EXPECT_TRUE(catalog->ListingPathStatRange(PathString("/fakepath"), 0, 10,
+                                            &slice, &row_ids));
+  EXPECT_TRUE(slice.IsEmpty());
+  EXPECT_TRUE(row_ids.empty());
+
+  EXPECT_TRUE(catalog->ListingPathStatRange(path, 0, 2, &slice, &row_ids));
+  ASSERT_EQ(2u, slice.size());
+  ASSERT_EQ(2u, row_ids.size());
+  EXPECT_EQ(NameString("bar"), slice.AtPtr(0)->name);
+  EXPECT_EQ(NameString("bar2"), slice.AtPtr(1)->name);
+  EXPECT_LT(row_ids[0], row_ids[1]);
+
+  StatEntryList next_slice;
+  vector<uint64_t> next_row_ids;
+  EXPECT_TRUE(catalog->ListingPathStatRange(path, row_ids[1], 2,
+                                            &next_slice, &next_row_ids));
+  ASSERT_EQ(1u, next_slice.size());
+  EXPECT_EQ(NameString("link"), next_slice.AtPtr(0)->name);
+  EXPECT_LT(row_ids[1], next_row_ids[0]);
+
+  // Stepping through the root in slices yields the full listing
+  StatEntryList full_listing;
+  EXPECT_TRUE(catalog->ListingPathStat(root_path, &full_listing));
+  unsigned num_entries = 0;
+  uint64_t after_row_id = 0;
+  while (true) {
+    StatEntryList root_slice;
+    vector<uint64_t> root_row_ids;
+    EXPECT_TRUE(catalog->ListingPathStatRange(root_path, after_row_id, 1,
+                                              &root_slice, &root_row_ids));
+    if (root_slice.IsEmpty())
+      break;
+    EXPECT_NE(NameString("hidden"), root_slice.AtPtr(0)->name);
+    EXPECT_LT(after_row_id, root_row_ids[0]);
+    after_row_id = root_row_ids[0];
+    ++num_entries;
+  }
+  EXPECT_EQ(full_listing.size(), num_entries);
+}
+
+TEST_F(T_Catalog, Index) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  Catalog *indexed = catalog::Catalog::AttachFreely("",
+                                                    catalog_db_root,
+                                                    shash::Any(),
+                                                    NULL,
+                                                    false);
+  const string image = BuildIndexImage(catalog_db_root);
+  CatalogIndex *index = CatalogIndex::Create(image);
+  ASSERT_TRUE(index != NULL);
+  EXPECT_FALSE(index->IsMapped());
+  EXPECT_EQ(image.size(), index->size());
+  EXPECT_FALSE(indexed->HasIndex());
+  indexed->SetIndex(index);
+  EXPECT_TRUE(indexed->HasIndex());
+
+  const char *paths[] = {"", "/dir", "/dir/dir", "/dir/dir/bar",
+    "/dir/dir/bar2", "/dir/dir/link", "/hidden", "/fakepath/fakefile"};
+  for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+    PathString path(paths[i]);
+    DirectoryEntry expected;
+    DirectoryEntry dirent;
+    EXPECT_EQ(catalog->LookupPath(path, &expected),
+              indexed->LookupPath(path, &dirent));
+    EXPECT_TRUE(expected == dirent) << paths[i];
+    EXPECT_EQ(expected.IsHidden(), dirent.IsHidden());
+    EXPECT_EQ(expected.checksum(), dirent.checksum());
+
+    StatEntryList expected_listing;
+    StatEntryList listing;
+    EXPECT_TRUE(catalog->ListingPathStat(path, &expected_listing));
+    EXPECT_TRUE(indexed->ListingPathStat(path, &listing));
+    ASSERT_EQ(expected_listing.size(), listing.size());
+    for (unsigned j = 0; j < listing.size(); ++j) {
+      EXPECT_EQ(expected_listing.AtPtr(j)->name, listing.AtPtr(j)->name);
+      EXPECT_EQ(expected_listing.AtPtr(j)->info.st_ino,
+                listing.AtPtr(j)->info.st_ino);
+    }
+
+    DirectoryEntryList expected_dirents;
+    DirectoryEntryList dirents;
+    EXPECT_TRUE(catalog->ListingPath(path, &expected_dirents));
+    EXPECT_TRUE(indexed->ListingPath(path, &dirents));
+    EXPECT_EQ(expected_dirents.size(), dirents.size());
+  }
+
+  LinkString raw_symlink;
+  EXPECT_TRUE(indexed->LookupRawSymlink(PathString("/dir/dir/link"),
+                                        &raw_symlink));
+  EXPECT_EQ("/foo", raw_symlink.ToString());
+
+  StatEntryList slice;
+  vector<uint64_t> row_ids;
+  EXPECT_TRUE(indexed->ListingPathStatRange(PathString("/dir/dir"), 0, 2,
+                                            &slice, &row_ids));
+  ASSERT_EQ(2u, slice.size());
+  EXPECT_EQ(NameString("bar"), slice.AtPtr(0)->name);
+  EXPECT_EQ(NameString("bar2"), slice.AtPtr(1)->name);
+  StatEntryList next_slice;
+  vector<uint64_t> next_row_ids;
+  EXPECT_TRUE(indexed->ListingPathStatRange(PathString("/dir/dir"), row_ids[1],
+                                            2, &next_slice, &next_row_ids));
+  ASSERT_EQ(1u, next_slice.size());
+  EXPECT_EQ(NameString("link"), next_slice.AtPtr(0)->name);
+
+  vector<PathString> lookup_paths;
+  lookup_paths.push_back(PathString("/dir/dir/link"));
+  lookup_paths.push_back(PathString("/fakepath/fakefile"));
+  lookup_paths.push_back(PathString("/dir/dir/bar"));
+  vector<DirectoryEntry> dirents;
+  vector<bool> found;
+  EXPECT_EQ(2u, indexed->LookupPaths(lookup_paths, &dirents, &found));
+  EXPECT_FALSE(found[1]);
+  EXPECT_EQ(NameString("bar"), dirents[2].name());
+
+  delete indexed;
+}
+
+TEST_F(T_Catalog, IndexCorrupted) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  const string image = BuildIndexImage(catalog_db_root);
+  EXPECT_TRUE(CatalogIndex::Create("") == NULL);
+  EXPECT_TRUE(CatalogIndex::Create(image.substr(0, image.size() - 1)) == NULL);
+  string bad_magic = image;
+  bad_magic[0] ^= 0xFF;
+  EXPECT_TRUE(CatalogIndex::Create(bad_magic) == NULL);
+  // Even changes of the header that keep its sizes consistent are detected
+  string bad_header = image;
+  bad_header[36] ^= 0x01;
+  EXPECT_TRUE(CatalogIndex::Create(bad_header) == NULL);
+
+  // Points the name of the first record beyond the string pool.  Records are
+  // only checked on access; the catalog falls back to its database.
+  string bad_offset = image;
+  bad_offset[40 + 72] = 0xFF;
+  bad_offset[40 + 73] = 0xFF;
+  bad_offset[40 + 74] = 0xFF;
+  CatalogIndex *bad_index = CatalogIndex::Create(bad_offset);
+  ASSERT_TRUE(bad_index != NULL);
+  EXPECT_FALSE(bad_index->IsCorrupted());
+  Catalog *indexed = catalog::Catalog::AttachFreely("",
+                                                    catalog_db_root,
+                                                    shash::Any(),
+                                                    NULL,
+                                                    false);
+  indexed->SetIndex(bad_index);
+  const char *paths[] = {"", "/dir", "/dir/dir", "/dir/dir/bar",
+    "/dir/dir/bar2", "/dir/dir/link", "/hidden"};
+  for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+    PathString path(paths[i]);
+    DirectoryEntry expected;
+    DirectoryEntry dirent;
+    EXPECT_EQ(catalog->LookupPath(path, &expected),
+              indexed->LookupPath(path, &dirent)) << paths[i];
+    EXPECT_TRUE(expected == dirent) << paths[i];
+
+    DirectoryEntryList expected_dirents;
+    DirectoryEntryList dirents;
+    EXPECT_TRUE(catalog->ListingPath(path, &expected_dirents));
+    EXPECT_TRUE(indexed->ListingPath(path, &dirents));
+    EXPECT_EQ(expected_dirents.size(), dirents.size()) << paths[i];
+  }
+  EXPECT_TRUE(bad_index->IsCorrupted());
+  delete indexed;
+
+  shash::Any catalog_hash(shash::kSha1, shash::kSuffixCatalog);
+  shash::HashString("catalog", &catalog_hash);
+  shash::Any other_hash(shash::kSha1, shash::kSuffixCatalog);
+  shash::HashString("other catalog", &other_hash);
+  const string file_name = CatalogIndex::MakeFileName(catalog_hash);
+  EXPECT_EQ(file_name, CatalogIndex::MakeFileName(catalog_hash));
+  EXPECT_NE(file_name, CatalogIndex::MakeFileName(other_hash));
+
+  // Stored images are mapped
+  const string path = sandbox + "/" + file_name;
+  EXPECT_TRUE(CatalogIndex::Load(path) == NULL);
+  ASSERT_TRUE(SafeWriteToFile(image, path, 0600));
+  CatalogIndex *index = CatalogIndex::Load(path);
+  ASSERT_TRUE(index != NULL);
+  EXPECT_TRUE(index->IsMapped());
+  EXPECT_EQ(image.size(), index->size());
+  delete index;
+  ASSERT_TRUE(SafeWriteToFile(bad_magic, path, 0600));
+  EXPECT_TRUE(CatalogIndex::Load(path) == NULL);
+}
+
+TEST_F(T_Catalog, PathFilter) {
+  perf::Statistics statistics;
+  perf::Counter *n_filtered =
+    statistics.Register("test.n_filtered", "filtered lookups");
+  perf::Counter *n_false_positives =
+    statistics.Register("test.n_false_positives", "false positives");
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  EXPECT_FALSE(catalog->HasPathFilter());
+  CatalogDatabase *database =
+    CatalogDatabase::Open(catalog_db_root, CatalogDatabase::kOpenReadOnly);
+  ASSERT_TRUE(database != NULL);
+  catalog->SetPathFilter(Catalog::CreatePathFilter(*database, 10),
+                         n_filtered, n_false_positives);
+  delete database;
+  EXPECT_TRUE(catalog->HasPathFilter());
+
+  DirectoryEntry dirent;
+  EXPECT_TRUE(catalog->LookupPath(PathString("/dir/dir/bar"), &dirent));
+  EXPECT_EQ(NameString("bar"), dirent.name());
+  EXPECT_TRUE(catalog->LookupPath(PathString("/dir"), &dirent));
+  EXPECT_TRUE(catalog->LookupPath(PathString("/hidden"), &dirent));
+  EXPECT_EQ(0, n_filtered->Get() + n_false_positives->Get());
+
+  const int kNumMisses = 100;
+  vector<PathString> paths;
+  for (int i = 0; i < kNumMisses; ++i) {
+    PathString path("/fakepath/" + StringifyInt(i));
+    EXPECT_FALSE(catalog->LookupPath(path, &dirent));
+    paths.push_back(path);
+  }
+  EXPECT_EQ(kNumMisses, n_filtered->Get() + n_false_positives->Get());
+  EXPECT_LT(n_false_positives->Get(), 10);
+
+  paths.push_back(PathString("/dir/dir/link"));
+  vector<DirectoryEntry> dirents;
+  vector<bool> found;
+  EXPECT_EQ(1u, catalog->LookupPaths(paths, &dirents, &found));
+  EXPECT_TRUE(found[kNumMisses]);
+  EXPECT_EQ(NameString("link"), dirents[kNumMisses].name());
+  EXPECT_EQ(2 * kNumMisses, n_filtered->Get() + n_false_positives->Get());
+
+  // A filter built from the index
+  Catalog *indexed = catalog::Catalog::AttachFreely("",
+                                                    catalog_db_root,
+                                                    shash::Any(),
+                                                    NULL,
+                                                    false);
+  CatalogIndex *index = CatalogIndex::Create(BuildIndexImage(catalog_db_root));
+  indexed->SetIndex(index);
+  indexed->SetPathFilter(Catalog::CreatePathFilter(*index, 10),
+                         n_filtered, n_false_positives);
+  EXPECT_EQ(1u, indexed->LookupPaths(paths, &dirents, &found));
+  EXPECT_TRUE(found[kNumMisses]);
+  EXPECT_EQ(3 * kNumMisses, n_filtered->Get() + n_false_positives->Get());
+  EXPECT_TRUE(indexed->LookupPath(PathString("/dir/dir/bar"), &dirent));
+  EXPECT_TRUE(indexed->LookupPath(PathString("/hidden"), &dirent));
+  EXPECT_EQ(3 * kNumMisses, n_filtered->Get() + n_false_positives->Get());
+  delete indexed;
+}
+
 TEST_F(T_Catalog, Chunks) {
   catalog = catalog::Catalog::AttachFreely("",
                                            catalog_db_root,
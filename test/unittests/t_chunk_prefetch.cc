@@ -0,0 +1,221 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "backoff.h"
+#include "cache_posix.h"
+#include "chunk_prefetch.h"
+#include "clientctx.h"
+#include "compression.h"
+#include "download.h"
+#include "fetch.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace cvmfs {
+
+class T_ChunkPrefetcher : public ::testing::Test {
+ protected:
+  static const unsigned kNumChunks = 6;
+
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+
+    tmp_path_ = CreateTempDir(GetCurrentWorkingDirectory() +
+                              "/cvmfs_ut_chunk_prefetch");
+    src_path_ = tmp_path_ + "/data";
+    list_ = new FileChunkList();
+    for (unsigned i = 0; i < kNumChunks; ++i) {
+      unsigned char c = 'a' + i;
+      void *buf;
+      uint64_t buf_size;
+      EXPECT_TRUE(zlib::CompressMem2Mem(&c, 1, &buf, &buf_size));
+      shash::Any hash(shash::kSha1);
+      shash::HashMem(static_cast<unsigned char *>(buf), buf_size, &hash);
+      MkdirDeep(GetParentPath(src_path_ + "/" + hash.MakePath()), 0700);
+      EXPECT_TRUE(CopyMem2Path(static_cast<unsigned char *>(buf), buf_size,
+                               src_path_ + "/" + hash.MakePath()));
+      free(buf);
+      list_->PushBack(FileChunk(hash, i, 1));
+    }
+    chunks_ = FileChunkReflist(list_, PathString("/chunked"),
+                               zlib::kZlibDefault, false);
+
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_, false);
+    ASSERT_TRUE(cache_mgr_ != NULL);
+
+    download_mgr_ = new download::DownloadManager();
+    download_mgr_->Init(8, false, /* use_system_proxy */
+      perf::StatisticsTemplate("test", &statistics_));
+    download_mgr_->SetHostChain("file://" + tmp_path_);
+
+    fetcher_ = new Fetcher(
+      cache_mgr_, download_mgr_, &backoff_throttle_,
+      perf::StatisticsTemplate("fetch", &statistics_));
+    prefetcher_ = new ChunkPrefetcher(
+      fetcher_, fetcher_, 2, 2,
+      perf::StatisticsTemplate("prefetch", &statistics_));
+  }
+
+  virtual void TearDown() {
+    delete prefetcher_;
+    delete fetcher_;
+    download_mgr_->Fini();
+    delete download_mgr_;
+    delete cache_mgr_;
+    delete list_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  bool IsCached(unsigned chunk_idx) {
+    int fd = cache_mgr_->Open(
+      CacheManager::Bless(list_->AtPtr(chunk_idx)->content_hash()));
+    if (fd < 0)
+      return false;
+    cache_mgr_->Close(fd);
+    return true;
+  }
+
+  bool WaitCached(unsigned chunk_idx) {
+    for (unsigned i = 0; i < 1000; ++i) {
+      if (IsCached(chunk_idx))
+        return true;
+      SafeSleepMs(10);
+    }
+    return false;
+  }
+
+  ChunkFd MakeChunkFd(unsigned chunk_idx) {
+    ChunkFd chunk_fd;
+    chunk_fd.fd = 0;
+    chunk_fd.chunk_idx = chunk_idx;
+    return chunk_fd;
+  }
+
+  int64_t Counter(const string &name) {
+    return statistics_.Lookup("prefetch." + name)->Get();
+  }
+
+  ChunkPrefetcher *prefetcher_;
+  Fetcher *fetcher_;
+  PosixCacheManager *cache_mgr_;
+  perf::Statistics statistics_;
+  download::DownloadManager *download_mgr_;
+  BackoffThrottle backoff_throttle_;
+  FileChunkList *list_;
+  FileChunkReflist chunks_;
+  unsigned used_fds_;
+  string tmp_path_;
+  string src_path_;
+};
+
+
+TEST_F(T_ChunkPrefetcher, RandomAccess) {
+  prefetcher_->Spawn();
+  prefetcher_->OnChunkSwitch(chunks_, ChunkFd(), 0,
+                             CacheManager::kTypeRegular);
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(0), 3,
+                             CacheManager::kTypeRegular);
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(3), 1,
+                             CacheManager::kTypeRegular);
+  EXPECT_EQ(0, Counter("n_prefetch"));
+  EXPECT_EQ(0, Counter("n_hits"));
+}
+
+
+TEST_F(T_ChunkPrefetcher, Sequential) {
+  prefetcher_->Spawn();
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(0), 1,
+                             CacheManager::kTypeRegular);
+  EXPECT_EQ(2, Counter("n_prefetch"));
+  EXPECT_TRUE(WaitCached(2));
+  EXPECT_TRUE(WaitCached(3));
+  EXPECT_FALSE(IsCached(4));
+
+  // Already prefetched chunk 3 is not queued again
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(1), 2,
+                             CacheManager::kTypeRegular);
+  EXPECT_EQ(3, Counter("n_prefetch"));
+  EXPECT_TRUE(WaitCached(4));
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(2), 3,
+                             CacheManager::kTypeRegular);
+  EXPECT_TRUE(WaitCached(5));
+  EXPECT_EQ(4, Counter("n_prefetch"));
+  EXPECT_LE(2, Counter("n_hits"));
+  EXPECT_EQ(0, Counter("n_failed"));
+  EXPECT_EQ(0, Counter("n_waste"));
+}
+
+
+TEST_F(T_ChunkPrefetcher, ClientCtx) {
+  // Without spawned threads, the jobs stay in the queue
+  {
+    ClientCtxGuard ctx_guard(1, 2, 3);
+    prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(0), 1,
+                               CacheManager::kTypeRegular);
+  }
+  prefetcher_->OnChunkSwitch(chunks_, MakeChunkFd(2), 3,
+                             CacheManager::kTypeRegular);
+  ASSERT_EQ(4U, prefetcher_->jobs_.size());
+  for (unsigned i = 0; i < 2; ++i) {
+    EXPECT_EQ(1U, prefetcher_->jobs_[i].uid);
+    EXPECT_EQ(2U, prefetcher_->jobs_[i].gid);
+    EXPECT_EQ(3, prefetcher_->jobs_[i].pid);
+  }
+  EXPECT_EQ(-1, prefetcher_->jobs_[3].pid);
+
+  // Jobs are processed with the client context of the reader
+  prefetcher_->Spawn();
+  EXPECT_TRUE(WaitCached(5));
+  EXPECT_FALSE(ClientCtx::GetInstance()->IsSet());
+}
+
+
+TEST_F(T_ChunkPrefetcher, TrackPrefetched) {
+  const shash::Any &id = list_->AtPtr(0)->content_hash();
+  const unsigned max_tracked = ChunkPrefetcher::kMaxTracked;
+  {
+    MutexLockGuard guard(prefetcher_->lock_);
+    prefetcher_->TrackPrefetched(id);
+  }
+  prefetcher_->OnChunkSwitch(chunks_, ChunkFd(), 0,
+                             CacheManager::kTypeRegular);
+  EXPECT_EQ(1, Counter("n_hits"));
+  EXPECT_TRUE(prefetcher_->prefetched_fifo_.empty());
+
+  // The opened chunk does not linger in the FIFO and cannot evict the
+  // chunk when it is prefetched again
+  MutexLockGuard guard(prefetcher_->lock_);
+  prefetcher_->TrackPrefetched(id);
+  for (unsigned i = 1; i < max_tracked; ++i) {
+    shash::Any other(shash::kSha1);
+    other.Randomize(i);
+    prefetcher_->TrackPrefetched(other);
+  }
+  EXPECT_EQ(0, Counter("n_waste"));
+  EXPECT_EQ(max_tracked, prefetcher_->prefetched_.size());
+  EXPECT_EQ(id, prefetcher_->prefetched_fifo_.front());
+
+  shash::Any other(shash::kSha1);
+  other.Randomize(max_tracked);
+  prefetcher_->TrackPrefetched(other);
+  EXPECT_EQ(1, Counter("n_waste"));
+  EXPECT_TRUE(prefetcher_->prefetched_.find(id) ==
+              prefetcher_->prefetched_.end());
+}
+
+}  // namespace cvmfs
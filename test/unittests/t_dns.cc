@@ -583,6 +583,92 @@ TEST_F(T_Dns, ResolverManySlow) {
 }
 
 
+TEST_F(T_Dns, HostCache) {
+  const string path = GetCurrentWorkingDirectory() + "/cvmfs_ut_dnscache";
+  EXPECT_TRUE(HostCache::Create("/no/such/dir/dnscache") == NULL);
+  UniquePtr<HostCache> cache(HostCache::Create(path));
+  ASSERT_TRUE(cache.IsValid());
+  Host host;
+  EXPECT_FALSE(cache->Lookup("normal", &host));
+
+  DummyResolver resolver;
+  vector<string> names;
+  names.push_back("normal");
+  names.push_back("timeout");
+  vector<Host> hosts;
+  resolver.ResolveMany(names, &hosts);
+  cache->Store(names, hosts);
+  ASSERT_TRUE(cache->Lookup("normal", &host));
+  EXPECT_TRUE(host.IsEquivalent(hosts[0]));
+  EXPECT_EQ(hosts[0].deadline(), host.deadline());
+  EXPECT_NE(hosts[0].id(), host.id());
+  EXPECT_FALSE(cache->Lookup("timeout", &host));
+
+  // Another cache on the same file, e.g. of another repository
+  UniquePtr<HostCache> other(HostCache::Create(path));
+  ASSERT_TRUE(other->Lookup("normal", &host));
+  EXPECT_TRUE(host.IsEquivalent(hosts[0]));
+  names.clear();
+  names.push_back("ipv4");
+  resolver.ResolveMany(names, &hosts);
+  other->Store(names, vector<Host>(1, hosts[0]));
+  ASSERT_TRUE(cache->Lookup("ipv4", &host));
+  EXPECT_TRUE(host.IsEquivalent(hosts[0]));
+  EXPECT_TRUE(cache->Lookup("normal", &host));
+
+  // Malformed lines are skipped
+  unlink(path.c_str());
+  ASSERT_TRUE(SafeWriteToFile("a a 100 - -\nbroken line\n"
+                              "b b.fqdn 100 10.0.0.1 -\n", path, 0600));
+  cache = HostCache::Create(path);
+  EXPECT_FALSE(cache->Lookup("a", &host));
+  ASSERT_TRUE(cache->Lookup("b", &host));
+  ExpectResolvedName(host, "b.fqdn", "10.0.0.1", "");
+  EXPECT_EQ(100, host.deadline());
+  EXPECT_TRUE(host.IsExpired());
+  unlink(path.c_str());
+}
+
+
+TEST_F(T_Dns, ResolverCache) {
+  const string path = GetCurrentWorkingDirectory() + "/cvmfs_ut_dnscache";
+  const time_t now = time(NULL);
+  ASSERT_TRUE(SafeWriteToFile(
+    "cached cached.example.org " + StringifyInt(now + 600) +
+    " 10.0.0.1 [::1]\n"
+    "stale stale " + StringifyInt(now - 600) + " 10.0.0.2 -\n", path, 0600));
+  UniquePtr<HostCache> cache(HostCache::Create(path));
+  ASSERT_TRUE(cache.IsValid());
+
+  // The dummy resolver knows no addresses for these names
+  DummyResolver resolver;
+  EXPECT_EQ(kFailNoAddress, resolver.Resolve("cached").status());
+  resolver.set_cache(cache.weak_ref());
+  Host host = resolver.Resolve("cached");
+  EXPECT_TRUE(host.IsValid());
+  ExpectResolvedName(host, "cached.example.org", "10.0.0.1", "[::1]");
+
+  // Expired entries are only used in stale mode
+  EXPECT_EQ(kFailNoAddress, resolver.Resolve("stale").status());
+  resolver.set_max_stale(3600);
+  host = resolver.Resolve("stale");
+  EXPECT_EQ(kFailOk, host.status());
+  EXPECT_TRUE(host.IsExpired());
+  ExpectResolvedName(host, "stale", "10.0.0.2", "");
+  resolver.set_max_stale(60);
+  EXPECT_EQ(kFailNoAddress, resolver.Resolve("stale").status());
+
+  // Successfully resolved names are stored
+  EXPECT_FALSE(cache->Lookup("ipv4", &host));
+  resolver.Resolve("ipv4");
+  EXPECT_TRUE(cache->Lookup("ipv4", &host));
+  EXPECT_FALSE(cache->Lookup("empty", &host));
+  resolver.Resolve("empty");
+  EXPECT_FALSE(cache->Lookup("empty", &host));
+  unlink(path.c_str());
+}
+
+
 TEST_F(T_Dns, CaresResolverConstruct) {
   CaresResolver *resolver = CaresResolver::Create(false, 2, 2000);
   EXPECT_EQ(resolver->retries(), 2U);
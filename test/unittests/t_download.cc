@@ -4,9 +4,26 @@
 
 #include "gtest/gtest.h"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
 #include <unistd.h>
 
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "compression.h"
 #include "download.h"
@@ -14,8 +31,10 @@
 #include "prng.h"
 #include "sink.h"
 #include "statistics.h"
+#include "util/algorithm.h"
 #include "util/file_guard.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -67,6 +86,8 @@ class TestSink : public cvmfs::Sink {
   virtual int Reset() {
     int retval = ftruncate(fd, 0);
     assert(retval == 0);
+    off_t offset = lseek(fd, 0, SEEK_SET);
+    assert(offset == 0);
     return 0;
   }
 
@@ -80,6 +101,467 @@ class TestSink : public cvmfs::Sink {
 };
 
 
+/**
+ * Minimal HTTP server on localhost that serves a single object and optionally
+ * answers range requests.  Connections are handled one after another.  The
+ * connections that wait in the meantime count as concurrent requests.
+ */
+class RangeServer {
+ public:
+  enum Mode {
+    kRangesSupported = 0,
+    kRangesIgnored,  // always sends the entire object
+    kRangesBroken,   // fails range requests beyond the first segment
+  };
+
+  RangeServer(const string &object, const Mode mode)
+    : object_(object), mode_(mode), port_(0), stop_(false)
+    , n_requests_(0), n_range_requests_(0), max_concurrent_requests_(0)
+    , delay_ms_(0)
+  {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listen_fd_ >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int retval = bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr));
+    assert(retval == 0);
+    socklen_t addr_len = sizeof(addr);
+    retval = getsockname(listen_fd_,
+                         reinterpret_cast<struct sockaddr *>(&addr), &addr_len);
+    assert(retval == 0);
+    port_ = ntohs(addr.sin_port);
+    retval = listen(listen_fd_, 16);
+    assert(retval == 0);
+    retval = pthread_create(&thread_, NULL, MainServer, this);
+    assert(retval == 0);
+  }
+
+  ~RangeServer() {
+    stop_ = true;
+    pthread_join(thread_, NULL);
+    close(listen_fd_);
+  }
+
+  string url() const { return "http://127.0.0.1:" + StringifyInt(port_); }
+  unsigned n_requests() const { return n_requests_; }
+  unsigned n_range_requests() const { return n_range_requests_; }
+  unsigned max_concurrent_requests() const { return max_concurrent_requests_; }
+  void set_delay_ms(const unsigned delay_ms) { delay_ms_ = delay_ms; }
+
+ private:
+  static void *MainServer(void *data) {
+    RangeServer *server = reinterpret_cast<RangeServer *>(data);
+    std::deque<int> connections;
+    while (!server->stop_) {
+      // Accept all waiting connections before serving the next one
+      struct pollfd pfd;
+      pfd.fd = server->listen_fd_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      while (poll(&pfd, 1, connections.empty() ? 50 : 0) > 0) {
+        int fd = accept(server->listen_fd_, NULL, NULL);
+        if (fd < 0)
+          break;
+        connections.push_back(fd);
+      }
+      if (connections.size() > server->max_concurrent_requests_)
+        server->max_concurrent_requests_ = connections.size();
+      if (connections.empty())
+        continue;
+      server->Serve(connections.front());
+      close(connections.front());
+      connections.pop_front();
+    }
+    for (unsigned i = 0; i < connections.size(); ++i)
+      close(connections[i]);
+    return NULL;
+  }
+
+  void Serve(int fd) {
+    string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == string::npos) {
+      ssize_t nbytes = read(fd, buf, sizeof(buf));
+      if (nbytes <= 0)
+        return;
+      request.append(buf, nbytes);
+    }
+    n_requests_++;
+    if (delay_ms_ > 0)
+      SafeSleepMs(delay_ms_);
+
+    uint64_t begin = 0;
+    uint64_t end = object_.size() - 1;
+    bool is_range = false;
+    size_t pos = request.find("Range: bytes=");
+    if (pos != string::npos) {
+      n_range_requests_++;
+      unsigned long long a, b;  // NOLINT
+      if (sscanf(request.c_str() + pos, "Range: bytes=%llu-%llu", &a, &b) == 2)
+      {
+        is_range = (mode_ != kRangesIgnored);
+        begin = a;
+        end = std::min(static_cast<uint64_t>(b), end);
+      }
+    }
+
+    string reply;
+    if (is_range && (mode_ == kRangesBroken) && (begin > 0)) {
+      reply = "HTTP/1.1 500 Internal Server Error\r\n"
+              "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    } else if (is_range) {
+      reply = "HTTP/1.1 206 Partial Content\r\n"
+              "Content-Range: bytes " + StringifyInt(begin) + "-" +
+              StringifyInt(end) + "/" + StringifyInt(object_.size()) + "\r\n"
+              "Content-Length: " + StringifyInt(end - begin + 1) + "\r\n"
+              "Connection: close\r\n\r\n" +
+              object_.substr(begin, end - begin + 1);
+    } else {
+      reply = "HTTP/1.1 200 OK\r\n"
+              "Content-Length: " + StringifyInt(object_.size()) + "\r\n"
+              "Connection: close\r\n\r\n" + object_;
+    }
+    SafeWrite(fd, reply.data(), reply.length());
+  }
+
+  string object_;
+  Mode mode_;
+  int listen_fd_;
+  int port_;
+  pthread_t thread_;
+  volatile bool stop_;
+  volatile unsigned n_requests_;
+  volatile unsigned n_range_requests_;
+  volatile unsigned max_concurrent_requests_;
+  volatile unsigned delay_ms_;
+};
+
+
+/**
+ * Stand-in for an HTTP/2 server on localhost.  HTTP/2 is negotiated by ALPN
+ * during the TLS handshake; the server uses a self-signed certificate that is
+ * written to cert_path().  It serves the same object for every stream and
+ * handles just enough of the protocol for libcurl: no flow control, no header
+ * decoding, objects must fit into a single DATA frame.
+ */
+class Http2Server {
+ public:
+  explicit Http2Server(const string &object)
+    : object_(object), port_(0), ssl_ctx_(NULL), stop_(false)
+    , n_connections_(0), n_streams_(0)
+  {
+    assert(object_.size() <= kMaxFrameSize);
+    CreateSslContext();
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listen_fd_ >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int retval = bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr));
+    assert(retval == 0);
+    socklen_t addr_len = sizeof(addr);
+    retval = getsockname(listen_fd_,
+                         reinterpret_cast<struct sockaddr *>(&addr), &addr_len);
+    assert(retval == 0);
+    port_ = ntohs(addr.sin_port);
+    retval = listen(listen_fd_, 16);
+    assert(retval == 0);
+    retval = pthread_create(&thread_, NULL, MainServer, this);
+    assert(retval == 0);
+  }
+
+  ~Http2Server() {
+    stop_ = true;
+    pthread_join(thread_, NULL);
+    for (unsigned i = 0; i < connections_.size(); ++i) {
+      shutdown(connections_[i].first, SHUT_RDWR);
+      pthread_join(connections_[i].second, NULL);
+      close(connections_[i].first);
+    }
+    close(listen_fd_);
+    SSL_CTX_free(ssl_ctx_);
+    unlink(cert_path_.c_str());
+  }
+
+  string url() const { return "https://127.0.0.1:" + StringifyInt(port_); }
+  string cert_path() const { return cert_path_; }
+  unsigned n_connections() const { return n_connections_; }
+  unsigned n_streams() const { return n_streams_; }
+
+ private:
+  static const unsigned kMaxFrameSize = 16384;
+  enum FrameType {
+    kFrameData = 0,
+    kFrameHeaders = 1,
+    kFrameSettings = 4,
+    kFramePing = 6,
+    kFrameGoaway = 7,
+  };
+  static const unsigned char kFlagEndStream = 0x01;
+  static const unsigned char kFlagAck = 0x01;
+  static const unsigned char kFlagEndHeaders = 0x04;
+
+  struct Connection {
+    Http2Server *server;
+    int fd;
+  };
+
+  static int CallbackAlpn(SSL *ssl, const unsigned char **out,
+                          unsigned char *outlen, const unsigned char *in,
+                          unsigned int inlen, void *arg)
+  {
+    static const unsigned char kH2[] = {2, 'h', '2'};
+    int retval = SSL_select_next_proto(const_cast<unsigned char **>(out),
+                                       outlen, kH2, sizeof(kH2), in, inlen);
+    return (retval == OPENSSL_NPN_NEGOTIATED) ? SSL_TLSEXT_ERR_OK
+                                              : SSL_TLSEXT_ERR_NOACK;
+  }
+
+  void CreateSslContext() {
+    EVP_PKEY *key = EVP_PKEY_new();
+    RSA *rsa = RSA_new();
+    BIGNUM *exponent = BN_new();
+    BN_set_word(exponent, RSA_F4);
+    int retval = RSA_generate_key_ex(rsa, 2048, exponent, NULL);
+    assert(retval == 1);
+    BN_free(exponent);
+    EVP_PKEY_assign_RSA(key, rsa);
+
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char *>("127.0.0.1"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    const char *extensions[][2] = {
+      {"basicConstraints", "critical,CA:TRUE"},
+      {"subjectAltName", "IP:127.0.0.1"},
+    };
+    for (unsigned i = 0; i < 2; ++i) {
+      X509_EXTENSION *ext = X509V3_EXT_conf(NULL, NULL,
+        const_cast<char *>(extensions[i][0]),
+        const_cast<char *>(extensions[i][1]));
+      assert(ext != NULL);
+      X509_add_ext(cert, ext, -1);
+      X509_EXTENSION_free(ext);
+    }
+    retval = X509_sign(cert, key, EVP_sha256());
+    assert(retval > 0);
+
+    FILE *fcert = CreateTempFile("./cvmfs_ut_download_cert", 0600, "w",
+                                 &cert_path_);
+    assert(fcert != NULL);
+    PEM_write_X509(fcert, cert);
+    fclose(fcert);
+
+    ssl_ctx_ = SSL_CTX_new(SSLv23_server_method());
+    assert(ssl_ctx_ != NULL);
+    retval = SSL_CTX_use_certificate(ssl_ctx_, cert);
+    assert(retval == 1);
+    retval = SSL_CTX_use_PrivateKey(ssl_ctx_, key);
+    assert(retval == 1);
+    SSL_CTX_set_alpn_select_cb(ssl_ctx_, CallbackAlpn, NULL);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+  }
+
+  static void *MainServer(void *data) {
+    Http2Server *server = reinterpret_cast<Http2Server *>(data);
+    while (!server->stop_) {
+      struct pollfd pfd;
+      pfd.fd = server->listen_fd_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, 50) <= 0)
+        continue;
+      int fd = accept(server->listen_fd_, NULL, NULL);
+      if (fd < 0)
+        continue;
+      __sync_fetch_and_add(&server->n_connections_, 1);
+      Connection *connection = new Connection();
+      connection->server = server;
+      connection->fd = fd;
+      pthread_t thread;
+      int retval = pthread_create(&thread, NULL, MainConnection, connection);
+      assert(retval == 0);
+      server->connections_.push_back(make_pair(fd, thread));
+    }
+    return NULL;
+  }
+
+  static void *MainConnection(void *data) {
+    Connection *connection = reinterpret_cast<Connection *>(data);
+    SSL *ssl = SSL_new(connection->server->ssl_ctx_);
+    assert(ssl != NULL);
+    SSL_set_fd(ssl, connection->fd);
+    if (SSL_accept(ssl) == 1)
+      connection->server->Serve(ssl);
+    SSL_free(ssl);
+    delete connection;
+    return NULL;
+  }
+
+  static bool Read(SSL *ssl, void *buf, unsigned size) {
+    unsigned pos = 0;
+    while (pos < size) {
+      int nbytes = SSL_read(ssl, static_cast<char *>(buf) + pos, size - pos);
+      if (nbytes <= 0)
+        return false;
+      pos += nbytes;
+    }
+    return true;
+  }
+
+  static void SendFrame(SSL *ssl, FrameType type, unsigned char flags,
+                        uint32_t stream_id, const string &payload)
+  {
+    string frame(9, '\0');
+    frame[0] = (payload.size() >> 16) & 0xff;
+    frame[1] = (payload.size() >> 8) & 0xff;
+    frame[2] = payload.size() & 0xff;
+    frame[3] = type;
+    frame[4] = flags;
+    frame[5] = (stream_id >> 24) & 0x7f;
+    frame[6] = (stream_id >> 16) & 0xff;
+    frame[7] = (stream_id >> 8) & 0xff;
+    frame[8] = stream_id & 0xff;
+    frame += payload;
+    SSL_write(ssl, frame.data(), frame.size());
+  }
+
+  void Serve(SSL *ssl) {
+    char preface[24];
+    if (!Read(ssl, preface, sizeof(preface)))
+      return;
+    if (memcmp(preface, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24) != 0)
+      return;
+    SendFrame(ssl, kFrameSettings, 0, 0, "");
+
+    while (true) {
+      unsigned char header[9];
+      if (!Read(ssl, header, sizeof(header)))
+        return;
+      const unsigned length = (header[0] << 16) | (header[1] << 8) | header[2];
+      const unsigned char type = header[3];
+      const unsigned char flags = header[4];
+      const uint32_t stream_id = ((header[5] & 0x7f) << 24) |
+        (header[6] << 16) | (header[7] << 8) | header[8];
+      string payload(length, '\0');
+      if ((length > 0) && !Read(ssl, &payload[0], length))
+        return;
+
+      switch (type) {
+        case kFrameSettings:
+          if ((flags & kFlagAck) == 0)
+            SendFrame(ssl, kFrameSettings, kFlagAck, 0, "");
+          break;
+        case kFramePing:
+          if ((flags & kFlagAck) == 0)
+            SendFrame(ssl, kFramePing, kFlagAck, 0, payload);
+          break;
+        case kFrameHeaders: {
+          // A GET request ends with its headers
+          if ((flags & kFlagEndStream) == 0)
+            break;
+          __sync_fetch_and_add(&n_streams_, 1);
+          // HPACK: ":status: 200" from the static table followed by
+          // content-length (static index 28) as a literal without indexing
+          const string size = StringifyInt(object_.size());
+          string headers = "\x88\x0f\x0d";
+          headers.push_back(static_cast<char>(size.length()));
+          headers += size;
+          SendFrame(ssl, kFrameHeaders, kFlagEndHeaders, stream_id, headers);
+          SendFrame(ssl, kFrameData, kFlagEndStream, stream_id, object_);
+          break;
+        }
+        case kFrameGoaway:
+          return;
+        default:
+          // Window updates, priorities, etc.
+          break;
+      }
+    }
+  }
+
+  string object_;
+  int listen_fd_;
+  int port_;
+  string cert_path_;
+  SSL_CTX *ssl_ctx_;
+  pthread_t thread_;
+  /**
+   * Connection file descriptors and their threads
+   */
+  vector<pair<int, pthread_t> > connections_;
+  volatile bool stop_;
+  volatile unsigned n_connections_;
+  volatile unsigned n_streams_;
+};
+
+
+/**
+ * Compressed random data, the uncompressed data is in plain and the hash of
+ * the compressed object in hash.
+ */
+static string MakeRandomObject(const unsigned size, string *plain,
+                               shash::Any *hash)
+{
+  Prng prng;
+  prng.InitLocaltime();
+  plain->resize(size);
+  for (unsigned i = 0; i < size; ++i)
+    (*plain)[i] = static_cast<char>(prng.Next(256));
+  void *buf;
+  uint64_t buf_size;
+  bool retval = zlib::CompressMem2Mem(plain->data(), size, &buf, &buf_size);
+  assert(retval);
+  string object(static_cast<char *>(buf), buf_size);
+  free(buf);
+  shash::HashMem(reinterpret_cast<const unsigned char *>(object.data()),
+                 object.size(), hash);
+  return object;
+}
+
+
+static const unsigned kNumFetchThreads = 8;
+static const unsigned kNumFetchesPerThread = 4;
+
+struct FetchArgs {
+  DownloadManager *download_mgr;
+  const shash::Any *hash;
+  uint64_t size;
+  unsigned num_ok;
+};
+
+static void *MainFetch(void *data) {
+  FetchArgs *args = reinterpret_cast<FetchArgs *>(data);
+  for (unsigned i = 0; i < kNumFetchesPerThread; ++i) {
+    TestSink sink;
+    string url = "/data/" + StringifyInt(i);
+    JobInfo info(&url, true /* compressed */, true /* probe hosts */,
+                 &sink, args->hash);
+    args->download_mgr->Fetch(&info);
+    if ((info.error_code == kFailOk) &&
+        (GetFileSize(sink.path) == static_cast<int64_t>(args->size)))
+    {
+      args->num_ok++;
+    }
+  }
+  return NULL;
+}
+
+
 //------------------------------------------------------------------------------
 
 
@@ -291,6 +773,450 @@ TEST_F(T_Download, ValidateGeoReply) {
 }
 
 
+TEST_F(T_Download, ParallelRanges) {
+  const unsigned kSegment = 64 * 1024;
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(1024 * 1024, &plain, &hash);
+  RangeServer server(object, RangeServer::kRangesSupported);
+  download_mgr.SetHostChain(server.url());
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+  download_mgr.SetParallelRanges(4, kSegment);
+  download_mgr.Spawn();
+
+  TestSink sink;
+  string url = "/data";
+  JobInfo info(&url, true /* compressed */, true /* probe hosts */,
+               &sink, &hash);
+  info.expected_size = plain.size();
+  download_mgr.Fetch(&info);
+  EXPECT_EQ(kFailOk, info.error_code);
+  ASSERT_EQ(plain.size(), GetFileSize(sink.path));
+  string result(plain.size(), '\0');
+  EXPECT_EQ(static_cast<int>(plain.size()),
+            pread(sink.fd, &result[0], plain.size(), 0));
+  EXPECT_EQ(plain, result);
+
+  const unsigned n_parts = (object.size() + kSegment - 1) / kSegment - 1;
+  EXPECT_EQ(n_parts + 1, server.n_range_requests());
+  EXPECT_EQ(1, statistics.Lookup("test.n_parallel_downloads")->Get());
+  EXPECT_EQ(static_cast<int64_t>(n_parts),
+            statistics.Lookup("test.n_parallel_parts")->Get());
+  EXPECT_EQ(0, statistics.Lookup("test.n_parallel_fallbacks")->Get());
+
+  // Objects of unknown size are downloaded by a single plain request so that
+  // proxies can cache them
+  RangeServer unknown_server(object, RangeServer::kRangesSupported);
+  download_mgr.SetHostChain(unknown_server.url());
+  TestSink unknown_sink;
+  JobInfo unknown_info(&url, true /* compressed */, true /* probe hosts */,
+                       &unknown_sink, &hash);
+  download_mgr.Fetch(&unknown_info);
+  EXPECT_EQ(kFailOk, unknown_info.error_code);
+  EXPECT_EQ(plain.size(), GetFileSize(unknown_sink.path));
+  EXPECT_EQ(1U, unknown_server.n_requests());
+  EXPECT_EQ(0U, unknown_server.n_range_requests());
+  EXPECT_EQ(1, statistics.Lookup("test.n_parallel_downloads")->Get());
+
+  // Small objects are downloaded by a single plain request
+  string small_plain;
+  shash::Any small_hash(shash::kSha1);
+  string small_object = MakeRandomObject(1024, &small_plain, &small_hash);
+  RangeServer small_server(small_object, RangeServer::kRangesSupported);
+  download_mgr.SetHostChain(small_server.url());
+  TestSink small_sink;
+  JobInfo small_info(&url, true /* compressed */, true /* probe hosts */,
+                     &small_sink, &small_hash);
+  small_info.expected_size = small_plain.size();
+  download_mgr.Fetch(&small_info);
+  EXPECT_EQ(kFailOk, small_info.error_code);
+  EXPECT_EQ(small_plain.size(), GetFileSize(small_sink.path));
+  EXPECT_EQ(1U, small_server.n_requests());
+  EXPECT_EQ(0U, small_server.n_range_requests());
+  EXPECT_EQ(1, statistics.Lookup("test.n_parallel_downloads")->Get());
+}
+
+
+TEST_F(T_Download, ParallelRangesFallback) {
+  const unsigned kSegment = 64 * 1024;
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(512 * 1024, &plain, &hash);
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+  download_mgr.SetParallelRanges(4, kSegment);
+  download_mgr.Spawn();
+  string url = "/data";
+
+  // The server ignores the range header
+  RangeServer server_ignore(object, RangeServer::kRangesIgnored);
+  download_mgr.SetHostChain(server_ignore.url());
+  TestSink sink_ignore;
+  JobInfo info_ignore(&url, true /* compressed */, true /* probe hosts */,
+                      &sink_ignore, &hash);
+  info_ignore.expected_size = plain.size();
+  download_mgr.Fetch(&info_ignore);
+  EXPECT_EQ(kFailOk, info_ignore.error_code);
+  EXPECT_EQ(plain.size(), GetFileSize(sink_ignore.path));
+  EXPECT_EQ(1U, server_ignore.n_requests());
+  EXPECT_EQ(0, statistics.Lookup("test.n_parallel_downloads")->Get());
+
+  // Range requests beyond the first segment fail
+  RangeServer server_broken(object, RangeServer::kRangesBroken);
+  download_mgr.SetHostChain(server_broken.url());
+  TestSink sink_broken;
+  JobInfo info_broken(&url, true /* compressed */, true /* probe hosts */,
+                      &sink_broken, &hash);
+  info_broken.expected_size = plain.size();
+  download_mgr.Fetch(&info_broken);
+  EXPECT_EQ(kFailOk, info_broken.error_code);
+  ASSERT_EQ(plain.size(), GetFileSize(sink_broken.path));
+  string result(plain.size(), '\0');
+  EXPECT_EQ(static_cast<int>(plain.size()),
+            pread(sink_broken.fd, &result[0], plain.size(), 0));
+  EXPECT_EQ(plain, result);
+  EXPECT_EQ(1, statistics.Lookup("test.n_parallel_fallbacks")->Get());
+}
+
+
+TEST_F(T_Download, Http2Multiplexing) {
+  curl_version_info_data *curl_info = curl_version_info(CURLVERSION_NOW);
+  if ((curl_info->features & CURL_VERSION_HTTP2) == 0) {
+    // E.g. the bundled libcurl, which is built without nghttp2
+    EXPECT_FALSE(download_mgr.EnableHttp2());
+    printf("Skipping, libcurl %s without HTTP/2 support\n", curl_info->version);
+    RecordProperty("skipped", "libcurl without HTTP/2 support");
+    return;
+  }
+
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(4096, &plain, &hash);
+  Http2Server server(object);
+  setenv("X509_CERT_BUNDLE", server.cert_path().c_str(), 1);
+  setenv("X509_CERT_DIR", GetCurrentWorkingDirectory().c_str(), 1);
+  download_mgr.SetHostChain(server.url());
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+  EXPECT_TRUE(download_mgr.EnableHttp2());
+  download_mgr.Spawn();
+
+  // Concurrent requests share the connection
+  FetchArgs args[kNumFetchThreads];
+  pthread_t threads[kNumFetchThreads];
+  for (unsigned i = 0; i < kNumFetchThreads; ++i) {
+    args[i].download_mgr = &download_mgr;
+    args[i].hash = &hash;
+    args[i].size = plain.size();
+    args[i].num_ok = 0;
+    int retval = pthread_create(&threads[i], NULL, MainFetch, &args[i]);
+    ASSERT_EQ(0, retval);
+  }
+  unsigned num_ok = 0;
+  for (unsigned i = 0; i < kNumFetchThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    num_ok += args[i].num_ok;
+  }
+  unsetenv("X509_CERT_BUNDLE");
+  unsetenv("X509_CERT_DIR");
+
+  const unsigned num_requests = kNumFetchThreads * kNumFetchesPerThread;
+  EXPECT_EQ(num_requests, num_ok);
+  EXPECT_EQ(num_requests, server.n_streams());
+  EXPECT_EQ(1U, server.n_connections());
+  EXPECT_EQ(static_cast<int64_t>(num_requests),
+            statistics.Lookup("test.n_http2_requests")->Get());
+  EXPECT_EQ(1, statistics.Lookup("test.n_connections")->Get());
+  EXPECT_EQ(static_cast<int64_t>(num_requests - 1),
+            statistics.Lookup("test.n_connections_reused")->Get());
+
+  // Plain http stays on HTTP/1.1
+  RangeServer http_server(object, RangeServer::kRangesIgnored);
+  download_mgr.SetHostChain(http_server.url());
+  TestSink sink;
+  string url = "/data";
+  JobInfo info(&url, true /* compressed */, true /* probe hosts */,
+               &sink, &hash);
+  download_mgr.Fetch(&info);
+  EXPECT_EQ(kFailOk, info.error_code);
+  EXPECT_EQ(1U, http_server.n_requests());
+  EXPECT_EQ(static_cast<int64_t>(num_requests),
+            statistics.Lookup("test.n_http2_requests")->Get());
+  EXPECT_EQ(2, statistics.Lookup("test.n_connections")->Get());
+}
+
+
+TEST_F(T_Download, EndpointScores) {
+  EndpointScores scores;
+  EXPECT_EQ(0.0, scores.GetCost("http://a"));
+
+  scores.AddSample("http://a", 100.0, 1024, 1.0);
+  EXPECT_DOUBLE_EQ(100.0, scores.GetCost("http://a"));
+  scores.AddSample("http://a", 200.0, 1024, 1.0);
+  EXPECT_DOUBLE_EQ(130.0, scores.GetCost("http://a"));
+
+  // Large transfers add the time to download the reference size
+  scores.AddSample("http://b", 10.0, EndpointScores::kReferenceSize, 1000.0);
+  EXPECT_DOUBLE_EQ(1010.0, scores.GetCost("http://b"));
+
+  scores.AddFailure("http://c", 5000.0);
+  scores.AddFailure("http://a", 5000.0);
+  EXPECT_DOUBLE_EQ(5000.0, scores.GetCost("http://c"));
+  EXPECT_DOUBLE_EQ(130.0 + (5000.0 - 130.0) * 0.3, scores.GetCost("http://a"));
+
+  vector<string> endpoints;
+  vector<EndpointScores::Score> values;
+  scores.GetScores(&endpoints, &values);
+  ASSERT_EQ(3U, endpoints.size());
+  ASSERT_EQ(3U, values.size());
+  EXPECT_EQ("http://a", endpoints[0]);
+  EXPECT_EQ(2U, values[0].num_samples);
+  EXPECT_EQ(1U, values[0].num_failures);
+  EXPECT_EQ(0.0, values[0].throughput);
+  EXPECT_DOUBLE_EQ(EndpointScores::kReferenceSize, values[1].throughput);
+
+  scores.Clear();
+  EXPECT_EQ(0.0, scores.GetCost("http://a"));
+}
+
+
+TEST_F(T_Download, LatencySelection) {
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(1024, &plain, &hash);
+  RangeServer slow_server(object, RangeServer::kRangesSupported);
+  RangeServer fast_server(object, RangeServer::kRangesSupported);
+  slow_server.set_delay_ms(200);
+  download_mgr.SetHostChain(slow_server.url() + ";" + fast_server.url());
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+  vector<string> endpoints;
+  vector<EndpointScores::Score> scores;
+  EXPECT_FALSE(download_mgr.GetEndpointScores(&endpoints, &scores));
+  download_mgr.EnableLatencySelection(60, 0);
+
+  // Both hosts are measured once, then the fast one is kept
+  string url = "/data";
+  for (unsigned i = 0; i < 4; ++i) {
+    download_mgr.opt_timestamp_latency_ = 0;
+    JobInfo info(&url, true /* compressed */, true /* probe hosts */, &hash);
+    download_mgr.Fetch(&info);
+    EXPECT_EQ(kFailOk, info.error_code);
+    free(info.destination_mem.data);
+  }
+  EXPECT_EQ(1U, slow_server.n_requests());
+  EXPECT_EQ(3U, fast_server.n_requests());
+  unsigned current_host;
+  download_mgr.GetHostInfo(NULL, NULL, &current_host);
+  EXPECT_EQ(1U, current_host);
+
+  EXPECT_TRUE(download_mgr.GetEndpointScores(&endpoints, &scores));
+  ASSERT_EQ(3U, endpoints.size());
+  EXPECT_EQ("DIRECT", endpoints[0]);
+  EXPECT_EQ(4U, scores[0].num_samples);
+  // Scores are sorted by the endpoint URL, i.e. by the random port
+  const unsigned idx_slow = (endpoints[1] == slow_server.url()) ? 1 : 2;
+  const unsigned idx_fast = 3 - idx_slow;
+  EXPECT_EQ(slow_server.url(), endpoints[idx_slow]);
+  EXPECT_EQ(fast_server.url(), endpoints[idx_fast]);
+  EXPECT_GE(scores[idx_slow].ttfb_ms, 200.0);
+  EXPECT_LT(scores[idx_fast].Cost(), scores[idx_slow].Cost());
+}
+
+
+TEST_F(T_Download, Hedging) {
+  // The slow server writes to canceled connections
+  signal(SIGPIPE, SIG_IGN);
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(4096, &plain, &hash);
+  RangeServer slow_server(object, RangeServer::kRangesSupported);
+  RangeServer fast_server(object, RangeServer::kRangesSupported);
+  download_mgr.SetHostChain(fast_server.url());
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+  download_mgr.EnableHedging(50, 100);
+  download_mgr.Spawn();
+
+  // Learn the usual time to first byte
+  string url = "/data";
+  for (unsigned i = 0; i < DownloadManager::kMinHedgeSamples; ++i) {
+    JobInfo info(&url, true /* compressed */, true /* probe hosts */, &hash);
+    info.latency_critical = true;
+    download_mgr.Fetch(&info);
+    EXPECT_EQ(kFailOk, info.error_code);
+    free(info.destination_mem.data);
+  }
+  EXPECT_EQ(0, statistics.Lookup("test.n_hedges_fired")->Get());
+
+  // The duplicate request to the next host completes first
+  slow_server.set_delay_ms(1000);
+  download_mgr.SetHostChain(slow_server.url() + ";" + fast_server.url());
+  TestSink sink;
+  JobInfo info(&url, true /* compressed */, true /* probe hosts */,
+               &sink, &hash);
+  info.latency_critical = true;
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  download_mgr.Fetch(&info);
+  gettimeofday(&end, NULL);
+  EXPECT_EQ(kFailOk, info.error_code);
+  EXPECT_LT(DiffTimeSeconds(start, end), 0.9);
+  ASSERT_EQ(plain.size(), GetFileSize(sink.path));
+  string result(plain.size(), '\0');
+  EXPECT_EQ(static_cast<int>(plain.size()),
+            pread(sink.fd, &result[0], plain.size(), 0));
+  EXPECT_EQ(plain, result);
+  EXPECT_EQ(1U, slow_server.n_requests());
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedges_fired")->Get());
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedges_won")->Get());
+
+  // Other downloads are not hedged
+  slow_server.set_delay_ms(100);
+  JobInfo regular(&url, true /* compressed */, true /* probe hosts */, &hash);
+  download_mgr.Fetch(&regular);
+  EXPECT_EQ(kFailOk, regular.error_code);
+  free(regular.destination_mem.data);
+  EXPECT_EQ(2U, slow_server.n_requests());
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedges_fired")->Get());
+}
+
+
+static unsigned batch_num_ok = 0;
+static unsigned batch_num_failed = 0;
+
+static void OnBatchJobDone(JobInfo * const &info) {
+  if (info->error_code == kFailOk)
+    batch_num_ok++;
+  else
+    batch_num_failed++;
+  free(info->destination_mem.data);
+}
+
+
+TEST_F(T_Download, Batch) {
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(64 * 1024, &plain, &hash);
+  RangeServer server(object, RangeServer::kRangesSupported);
+  download_mgr.SetHostChain(server.url());
+  download_mgr.SetProxyChain("DIRECT", "", DownloadManager::kSetProxyRegular);
+
+  // Without the I/O thread, jobs are completed during Submit()
+  const unsigned kNumJobs = 16;
+  string url = "/data";
+  JobInfo sync_info(&url, true /* compressed */, true /* probe hosts */, &hash);
+  JobBatch sync_batch(1);
+  download_mgr.Submit(&sync_batch, &sync_info);
+  EXPECT_EQ(&sync_info, sync_batch.WaitNext());
+  EXPECT_EQ(kFailOk, sync_info.error_code);
+  EXPECT_TRUE(sync_batch.WaitNext() == NULL);
+  free(sync_info.destination_mem.data);
+
+  download_mgr.Spawn();
+  vector<JobInfo *> jobs;
+  for (unsigned i = 0; i < kNumJobs; ++i)
+    jobs.push_back(new JobInfo(&url, true, true, &hash));
+
+  // Completion queue, the slow server lets requests pile up
+  const unsigned kMaxInFlight = 4;
+  server.set_delay_ms(10);
+  JobBatch batch(kMaxInFlight);
+  for (unsigned i = 0; i < kNumJobs; ++i)
+    download_mgr.Submit(&batch, jobs[i]);
+  set<JobInfo *> collected;
+  while (JobInfo *info = batch.WaitNext()) {
+    EXPECT_EQ(kFailOk, info->error_code);
+    EXPECT_EQ(plain, string(info->destination_mem.data,
+                            info->destination_mem.pos));
+    free(info->destination_mem.data);
+    collected.insert(info);
+  }
+  EXPECT_EQ(kNumJobs, collected.size());
+  EXPECT_EQ(kNumJobs + 1, server.n_requests());
+  EXPECT_LE(server.max_concurrent_requests(), kMaxInFlight);
+  server.set_delay_ms(0);
+  JobBatch::Statistics stats = batch.GetStatistics();
+  EXPECT_EQ(kNumJobs, stats.num_submitted);
+  EXPECT_EQ(kNumJobs, stats.num_completed);
+  EXPECT_EQ(0U, stats.num_failed);
+  EXPECT_EQ(kNumJobs * object.size(), stats.sz_transferred_bytes);
+
+  // Callback, including a failing job
+  for (unsigned i = 0; i < kNumJobs; ++i) {
+    delete jobs[i];
+    jobs[i] = new JobInfo(&url, true, true, &hash);
+  }
+  string missing_url = "file:///no/such/file";
+  JobInfo missing(&missing_url, false, false, NULL);
+  JobBatch callback_batch(0, JobBatch::MakeCallback(&OnBatchJobDone));
+  for (unsigned i = 0; i < kNumJobs; ++i)
+    download_mgr.Submit(&callback_batch, jobs[i]);
+  download_mgr.Submit(&callback_batch, &missing);
+  callback_batch.Wait();
+  EXPECT_EQ(kNumJobs, batch_num_ok);
+  EXPECT_EQ(1U, batch_num_failed);
+  stats = callback_batch.GetStatistics();
+  EXPECT_EQ(kNumJobs + 1, stats.num_completed);
+  EXPECT_EQ(1U, stats.num_failed);
+  for (unsigned i = 0; i < kNumJobs; ++i)
+    delete jobs[i];
+}
+
+
+TEST_F(T_Download, StaleDns) {
+  string plain;
+  shash::Any hash(shash::kSha1);
+  string object = MakeRandomObject(4096, &plain, &hash);
+  // Answers the proxy requests
+  RangeServer server(object, RangeServer::kRangesSupported);
+  const string port = server.url().substr(server.url().rfind(':') + 1);
+
+  // The proxy name is known only to the cache, where it is expired
+  const string cache_path =
+    GetCurrentWorkingDirectory() + "/cvmfs_ut_dnscache";
+  UnlinkGuard unlink_guard(cache_path);
+  ASSERT_TRUE(SafeWriteToFile(
+    "proxy.cvmfs.invalid proxy.cvmfs.invalid " +
+    StringifyInt(time(NULL) - 60) + " 127.0.0.1 -\n", cache_path, 0600));
+  download_mgr.SetDnsParameters(0, 200);
+  ASSERT_TRUE(download_mgr.SetDnsCache(cache_path));
+  // As in the client, the option is set before the threads are spawned
+  download_mgr.EnableStaleDns(3600);
+  download_mgr.Spawn();
+  download_mgr.SetHostChain("http://stratum1.cvmfs.invalid");
+  download_mgr.SetProxyChain("http://proxy.cvmfs.invalid:" + port, "",
+                             DownloadManager::kSetProxyRegular);
+  vector< vector<DownloadManager::ProxyInfo> > proxy_chain;
+  unsigned current_group;
+  unsigned fallback_group;
+  download_mgr.GetProxyInfo(&proxy_chain, &current_group, &fallback_group);
+  ASSERT_EQ(1U, proxy_chain.size());
+  ASSERT_EQ(1U, proxy_chain[0].size());
+  EXPECT_EQ(server.url(), proxy_chain[0][0].url);
+  EXPECT_TRUE(proxy_chain[0][0].host.IsExpired());
+
+  // The download does not wait for the background refresh
+  string url = "/data";
+  JobInfo info(&url, true /* compressed */, true /* probe hosts */, &hash);
+  download_mgr.Fetch(&info);
+  EXPECT_EQ(kFailOk, info.error_code);
+  free(info.destination_mem.data);
+  for (unsigned i = 0; i < 500; ++i) {
+    if (statistics.Lookup("test.n_dns_refreshes")->Get() > 0)
+      break;
+    SafeSleepMs(10);
+  }
+  EXPECT_EQ(1, statistics.Lookup("test.n_dns_refreshes")->Get());
+
+  // The name does not resolve, the cached address stays in use
+  download_mgr.GetProxyInfo(&proxy_chain, &current_group, &fallback_group);
+  ASSERT_EQ(1U, proxy_chain[0].size());
+  EXPECT_EQ(server.url(), proxy_chain[0][0].url);
+  JobInfo info2(&url, true /* compressed */, true /* probe hosts */, &hash);
+  download_mgr.Fetch(&info2);
+  EXPECT_EQ(kFailOk, info2.error_code);
+  free(info2.destination_mem.data);
+  EXPECT_EQ(2U, server.n_requests());
+}
+
+
 TEST_F(T_Download, ParseHttpCode) {
   char digits[3];
   digits[0] = '0';  digits[1] = '0';  digits[2] = 'a';
@@ -285,6 +285,19 @@ TEST_F(T_Fetcher, Fetch) {
 }
 
 
+TEST_F(T_Fetcher, FetchSizeUnknown) {
+  // Every object that exceeds one byte would qualify for range requests
+  download_mgr_->SetParallelRanges(4, 1);
+  int fd = fetcher_->Fetch(hash_catalog_, CacheManager::kSizeUnknown, "cat",
+                           zlib::kZlibDefault, CacheManager::kTypeCatalog);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  // Downloaded by a single plain request
+  EXPECT_EQ(0U, fetcher_->GetTls()->download_job.expected_size);
+  EXPECT_FALSE(fetcher_->GetTls()->download_job.range_parallel);
+}
+
+
 TEST_F(T_Fetcher, FetchUncompressed) {
   EXPECT_EQ(-ENOENT, cache_mgr_->Open(CacheManager::Bless(hash_uncompressed_)));
 
@@ -369,17 +382,18 @@ void *TestFetchCollapse2(void *data) {
   Fetcher *f = reinterpret_cast<Fetcher *>(data);
   BuggyCacheManager *bcm = reinterpret_cast<BuggyCacheManager *>(f->cache_mgr_);
   while (!bcm->continue_ctrltxn) {
-    pthread_mutex_lock(f->lock_queues_download_);
-    Fetcher::ThreadQueues::iterator iDownloadQueue =
-      f->queues_download_.begin();
-    for (; iDownloadQueue != f->queues_download_.end(); ++iDownloadQueue) {
-      if (iDownloadQueue->second->size() > 0) {
-        // printf("open up %s", iDownloadQueue->first.ToString().c_str());
-        bcm->stall_in_ctrltxn = false;
-        atomic_inc32(&bcm->continue_ctrltxn);
+    for (unsigned i = 0; i < Fetcher::kNumWaitShards; ++i) {
+      Fetcher::WaitShard *shard = &f->wait_shards_[i];
+      pthread_mutex_lock(&shard->lock);
+      Fetcher::ThreadQueues::iterator iDownloadQueue = shard->queues.begin();
+      for (; iDownloadQueue != shard->queues.end(); ++iDownloadQueue) {
+        if (iDownloadQueue->second->size() > 0) {
+          bcm->stall_in_ctrltxn = false;
+          atomic_inc32(&bcm->continue_ctrltxn);
+        }
       }
+      pthread_mutex_unlock(&shard->lock);
     }
-    pthread_mutex_unlock(f->lock_queues_download_);
   }
 
   return NULL;
@@ -431,38 +445,99 @@ TEST_F(T_Fetcher, SignalWaitingThreads) {
   EXPECT_TRUE(cache_mgr_->CommitFromMem(hash_regular_, &x, 1, ""));
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_regular_));
   EXPECT_GE(fd, 0);
-  int tls_pipe[2];
-  MakePipe(tls_pipe);
+  Fetcher::Waiter waiter0;
+  Fetcher::Waiter waiter1;
+  Fetcher::Waiter waiter2;
 
-  fetcher_->queues_download_[hash_regular_] = NULL;
-  fetcher_->queues_download_[hash_catalog_] = NULL;
-  fetcher_->queues_download_[hash_cert_] = NULL;
+  fetcher_->GetWaitShard(hash_regular_)->queues[hash_regular_] = NULL;
+  fetcher_->GetWaitShard(hash_catalog_)->queues[hash_catalog_] = NULL;
+  fetcher_->GetWaitShard(hash_cert_)->queues[hash_cert_] = NULL;
 
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
+  fetcher_->GetTls()->other_waiters.push_back(&waiter0);
   fetcher_->SignalWaitingThreads(-1, hash_regular_, fetcher_->GetTls());
-  EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_regular_));
+  EXPECT_EQ(0U,
+    fetcher_->GetWaitShard(hash_regular_)->queues.count(hash_regular_));
 
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
+  fetcher_->GetTls()->other_waiters.push_back(&waiter1);
   fetcher_->SignalWaitingThreads(fd, hash_catalog_, fetcher_->GetTls());
-  EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_catalog_));
+  EXPECT_EQ(0U,
+    fetcher_->GetWaitShard(hash_catalog_)->queues.count(hash_catalog_));
 
-  fetcher_->GetTls()->other_pipes_waiting.push_back(tls_pipe[1]);
+  fetcher_->GetTls()->other_waiters.push_back(&waiter2);
   fetcher_->SignalWaitingThreads(1000000, hash_cert_, fetcher_->GetTls());
-  EXPECT_EQ(0U, fetcher_->queues_download_.count(hash_cert_));
-
-  int fd_return0;
-  int fd_return1;
-  int fd_return2;
-  ReadPipe(tls_pipe[0], &fd_return0, sizeof(fd_return0));
-  ReadPipe(tls_pipe[0], &fd_return1, sizeof(fd_return1));
-  ReadPipe(tls_pipe[0], &fd_return2, sizeof(fd_return2));
-  EXPECT_EQ(-1, fd_return0);
-  EXPECT_NE(fd, fd_return1);
-  EXPECT_EQ(0, cache_mgr_->Close(fd_return1));
-  EXPECT_EQ(-EBADF, fd_return2);
-
-  ClosePipe(tls_pipe);
+  EXPECT_EQ(0U, fetcher_->GetWaitShard(hash_cert_)->queues.count(hash_cert_));
+  EXPECT_TRUE(fetcher_->GetTls()->other_waiters.empty());
+
+  EXPECT_TRUE(waiter0.done);
+  EXPECT_TRUE(waiter1.done);
+  EXPECT_TRUE(waiter2.done);
+  EXPECT_EQ(-1, waiter0.fd);
+  EXPECT_NE(fd, waiter1.fd);
+  EXPECT_EQ(0, cache_mgr_->Close(waiter1.fd));
+  EXPECT_EQ(-EBADF, waiter2.fd);
+
   EXPECT_EQ(0, cache_mgr_->Close(fd));
 }
 
+
+struct TestFetchStormInfo {
+  Fetcher *f;
+  const vector<shash::Any> *hashes;
+  unsigned offset;
+};
+
+void *TestFetchStorm(void *data) {
+  TestFetchStormInfo *info = reinterpret_cast<TestFetchStormInfo *>(data);
+  const unsigned num_hashes = info->hashes->size();
+  for (unsigned i = 0; i < num_hashes; ++i) {
+    const shash::Any &hash = (*info->hashes)[(info->offset + i) % num_hashes];
+    int fd = info->f->Fetch(hash, CacheManager::kSizeUnknown, "storm",
+                            zlib::kZlibDefault, CacheManager::kTypeRegular);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(0, info->f->cache_mgr()->Close(fd));
+  }
+  return NULL;
+}
+
+/**
+ * Cold cache start of many jobs that use the same software: many threads
+ * request the same set of objects at the same time.  Every object must be
+ * downloaded exactly once.
+ */
+TEST_F(T_Fetcher, FetchCollapseStorm) {
+  const unsigned kNumObjects = 64;
+  const unsigned kNumThreads = 32;
+  vector<shash::Any> hashes;
+  for (unsigned i = 0; i < kNumObjects; ++i) {
+    const string content = "storm object " + StringifyInt(i);
+    void *buf;
+    uint64_t buf_size;
+    EXPECT_TRUE(zlib::CompressMem2Mem(content.data(), content.length(),
+                                      &buf, &buf_size));
+    shash::Any hash(shash::kSha1);
+    shash::HashMem(static_cast<unsigned char *>(buf), buf_size, &hash);
+    MkdirDeep(GetParentPath(src_path_ + "/" + hash.MakePath()), 0700);
+    EXPECT_TRUE(CopyMem2Path(static_cast<unsigned char *>(buf), buf_size,
+                             src_path_ + "/" + hash.MakePath()));
+    free(buf);
+    hashes.push_back(hash);
+  }
+
+  pthread_t threads[kNumThreads];
+  TestFetchStormInfo infos[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    infos[i].f = fetcher_;
+    infos[i].hashes = &hashes;
+    // Half of the threads start with the same object
+    infos[i].offset = (i % 2) ? 0 : i;
+    EXPECT_EQ(0,
+      pthread_create(&threads[i], NULL, TestFetchStorm, &infos[i]));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(threads[i], NULL);
+
+  EXPECT_EQ(static_cast<int64_t>(kNumObjects),
+            statistics_.Lookup("fetch.n_downloads")->Get());
+}
+
 }  // namespace cvmfs
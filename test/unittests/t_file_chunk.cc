@@ -107,3 +107,40 @@ TEST_F(T_FileChunk, HashChunkList) {
   HashMem(buf, 40, &hash_cmp);
   EXPECT_EQ(h, hash_cmp);
 }
+
+
+TEST_F(T_FileChunk, ChunkTables) {
+  ChunkTables tables;
+  EXPECT_EQ(2U, tables.NextHandle());
+  EXPECT_EQ(3U, tables.NextHandle());
+  EXPECT_EQ(0U, tables.GetNumHandles());
+
+  for (uint64_t handle = 2; handle < 1002; ++handle) {
+    ChunkTables::HandleShard *shard = tables.Handle2Shard(handle);
+    EXPECT_EQ(shard, tables.Handle2Shard(handle));
+    shard->Lock();
+    shard->handle2fd.Insert(handle, ChunkFd());
+    shard->handle2uniqino.Insert(handle, handle + 1000);
+    shard->Unlock();
+  }
+  EXPECT_EQ(1000U, tables.GetNumHandles());
+
+  // The handles should spread over all the shards
+  for (unsigned i = 0; i < ChunkTables::kNumShards; ++i)
+    EXPECT_GT(tables.handle_shards[i].handle2fd.size(), 0U);
+
+  ChunkTables::InodeShard *inode_shard = tables.Inode2Shard(1042);
+  inode_shard->inode2references.Insert(1042, 1);
+
+  ChunkTables copy(tables);
+  EXPECT_EQ(1000U, copy.GetNumHandles());
+  EXPECT_EQ(4U, copy.NextHandle());
+  uint64_t unique_inode;
+  EXPECT_TRUE(
+    copy.Handle2Shard(42)->handle2uniqino.Lookup(42, &unique_inode));
+  EXPECT_EQ(1042U, unique_inode);
+  uint32_t refctr;
+  EXPECT_TRUE(
+    copy.Inode2Shard(1042)->inode2references.Lookup(1042, &refctr));
+  EXPECT_EQ(1U, refctr);
+}
@@ -3,6 +3,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 
 #include <string>
 
@@ -10,6 +11,7 @@
 #include "statistics.h"
 #include "util/string.h"
 
+using lru::ClockCache;
 using lru::LruCache;
 
 static inline uint32_t hasher_int(const int &value) {
@@ -569,3 +571,141 @@ TEST(T_LruCache, PauseAndResume) {
   EXPECT_TRUE(cache.IsEmpty());
   EXPECT_FALSE(cache.IsFull());
 }
+
+
+TEST(T_ClockCache, InsertLookup) {
+  perf::Statistics statistics;
+  ClockCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+  EXPECT_TRUE(cache.IsEmpty());
+  EXPECT_FALSE(cache.IsFull());
+
+  EXPECT_TRUE(cache.Insert(1, "eins"));
+  EXPECT_TRUE(cache.Insert(2, "zwei"));
+  EXPECT_FALSE(cache.Insert(2, "two"));
+  EXPECT_FALSE(cache.IsEmpty());
+
+  std::string v;
+  EXPECT_TRUE(cache.Lookup(1, &v)); EXPECT_EQ("eins", v);
+  EXPECT_TRUE(cache.Lookup(2, &v)); EXPECT_EQ("two", v);
+  EXPECT_FALSE(cache.Lookup(3, &v));
+  EXPECT_EQ(2, statistics.Lookup(name + ".n_hit")->Get());
+  EXPECT_EQ(1, statistics.Lookup(name + ".n_miss")->Get());
+  EXPECT_EQ(2, statistics.Lookup(name + ".n_insert")->Get());
+  EXPECT_EQ(1, statistics.Lookup(name + ".n_update")->Get());
+
+  EXPECT_TRUE(cache.Forget(1));
+  EXPECT_FALSE(cache.Forget(1));
+  EXPECT_FALSE(cache.Lookup(1, &v));
+  EXPECT_TRUE(cache.Lookup(2, &v));
+
+  cache.Drop();
+  EXPECT_TRUE(cache.IsEmpty());
+  EXPECT_FALSE(cache.Lookup(2, &v));
+}
+
+
+TEST(T_ClockCache, SecondChance) {
+  perf::Statistics statistics;
+  ClockCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+
+  const int num_shards = ClockCache<int, std::string>::kNumShards;
+  for (int i = 0; !cache.IsFull(); ++i)
+    EXPECT_TRUE(cache.Insert(i, StringifyInt(i)));
+  EXPECT_EQ(0, statistics.Lookup(name + ".n_replace")->Get());
+  EXPECT_EQ(static_cast<int>(cache_size),
+            statistics.Lookup(name + ".n_insert")->Get());
+
+  // All entries have their reference bit set, so the first eviction in shard
+  // zero walks around once and evicts the oldest entry
+  std::string v;
+  EXPECT_TRUE(cache.Insert(cache_size, "new"));
+  EXPECT_EQ(1, statistics.Lookup(name + ".n_replace")->Get());
+  EXPECT_FALSE(cache.Lookup(0, &v));
+  EXPECT_TRUE(cache.Lookup(cache_size, &v));
+
+  // The recently used entry gets a second chance, the next one is evicted
+  EXPECT_TRUE(cache.Lookup(num_shards, &v));
+  EXPECT_TRUE(cache.Insert(cache_size + num_shards, "newer"));
+  EXPECT_TRUE(cache.Lookup(num_shards, &v));
+  EXPECT_FALSE(cache.Lookup(2 * num_shards, &v));
+  EXPECT_TRUE(cache.Lookup(3 * num_shards, &v));
+
+  // Entries of other shards are untouched
+  for (int i = 1; i < num_shards; ++i)
+    EXPECT_TRUE(cache.Lookup(i, &v));
+  EXPECT_TRUE(cache.IsFull());
+}
+
+
+TEST(T_ClockCache, PauseAndResume) {
+  perf::Statistics statistics;
+  ClockCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+
+  EXPECT_TRUE(cache.Insert(1, "eins"));
+  cache.Pause();
+  EXPECT_FALSE(cache.Insert(2, "zwei"));
+  std::string v;
+  EXPECT_FALSE(cache.Lookup(1, &v));
+  EXPECT_FALSE(cache.Forget(1));
+  cache.Resume();
+  EXPECT_TRUE(cache.Lookup(1, &v)); EXPECT_EQ("eins", v);
+  EXPECT_FALSE(cache.Lookup(2, &v));
+
+  cache.Pause();
+  cache.Drop();
+  cache.Resume();
+  EXPECT_TRUE(cache.IsEmpty());
+  EXPECT_FALSE(cache.Lookup(1, &v));
+}
+
+
+namespace {
+
+struct ClockCacheWorker {
+  ClockCache<int, std::string> *cache;
+  int seed;
+};
+
+void *MainClockCacheWorker(void *data) {
+  ClockCacheWorker *worker = reinterpret_cast<ClockCacheWorker *>(data);
+  std::string v;
+  for (int i = 0; i < 20000; ++i) {
+    const int key = (i * 7 + worker->seed) % (4 * cache_size);
+    if ((i % 8) == 0) {
+      worker->cache->Insert(key, StringifyInt(key));
+    } else if (worker->cache->Lookup(key, &v)) {
+      EXPECT_EQ(StringifyInt(key), v);
+    }
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST(T_ClockCache, Concurrent) {
+  perf::Statistics statistics;
+  ClockCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+
+  const unsigned kNumThreads = 8;
+  pthread_t threads[kNumThreads];
+  ClockCacheWorker workers[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    workers[i].cache = &cache;
+    workers[i].seed = i;
+    EXPECT_EQ(0, pthread_create(&threads[i], NULL, MainClockCacheWorker,
+                                &workers[i]));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(threads[i], NULL);
+
+  EXPECT_FALSE(cache.IsEmpty());
+  EXPECT_EQ(kNumThreads * 20000,
+            statistics.Lookup(name + ".n_hit")->Get() +
+            statistics.Lookup(name + ".n_miss")->Get() +
+            statistics.Lookup(name + ".n_insert")->Get() +
+            statistics.Lookup(name + ".n_update")->Get());
+}
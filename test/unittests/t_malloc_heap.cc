@@ -179,6 +179,93 @@ TEST_F(T_MallocHeap, Stress) {
 }
 
 
+TEST_F(T_MallocHeap, CompactStep) {
+  IntMap int_map;
+  MallocHeap M(kSmallArena,
+               int_map.MakeCallback(&IntMap::OnBlockMove, &int_map));
+  EXPECT_TRUE(M.CompactStep(4096));
+  EXPECT_FALSE(M.IsCompacting());
+
+  unsigned elem_size = 4096 - 8;
+  unsigned num_elems = kSmallArena / 4096;
+  for (unsigned i = 0; i < num_elems; ++i) {
+    void *ptr = M.Allocate(elem_size, &i, sizeof(i));
+    ASSERT_TRUE(ptr != NULL);
+    memset(reinterpret_cast<unsigned char *>(ptr) + sizeof(i), i % 256,
+           elem_size - sizeof(i));
+    int_map.mem_digest[i] = IntMap::Info(ptr, MemChecksum(ptr, elem_size));
+  }
+  for (unsigned i = 0; i < num_elems; i += 2) {
+    M.MarkFree(int_map.mem_digest[i].ptr);
+    int_map.mem_digest.erase(i);
+  }
+  uint64_t used_bytes = M.used_bytes();
+
+  // Every step moves a few blocks; the heap stays usable in between
+  unsigned num_steps = 1;
+  while (!M.CompactStep(4 * 4096)) {
+    EXPECT_TRUE(M.IsCompacting());
+    EXPECT_EQ(used_bytes, M.used_bytes());
+    num_steps++;
+  }
+  EXPECT_FALSE(M.IsCompacting());
+  EXPECT_GT(num_steps, 1U);
+  EXPECT_LT(M.used_bytes(), used_bytes);
+  EXPECT_EQ(M.used_bytes(), M.compacted_bytes());
+  EXPECT_EQ(int_map.mem_digest.size(), M.num_blocks());
+
+  map<unsigned, IntMap::Info>::const_iterator iter =
+    int_map.mem_digest.begin();
+  map<unsigned, IntMap::Info>::const_iterator i_end =
+    int_map.mem_digest.end();
+  for (; iter != i_end; ++iter) {
+    EXPECT_EQ(MemChecksum(iter->second.ptr, M.GetSize(iter->second.ptr)),
+              iter->second.checksum);
+  }
+}
+
+
+TEST_F(T_MallocHeap, CompactAfterStep) {
+  IntMap int_map;
+  MallocHeap M(kSmallArena,
+               int_map.MakeCallback(&IntMap::OnBlockMove, &int_map));
+  unsigned elem_size = 4096 - 8;
+  unsigned num_elems = kSmallArena / 4096;
+  for (unsigned i = 0; i < num_elems; ++i) {
+    void *ptr = M.Allocate(elem_size, &i, sizeof(i));
+    ASSERT_TRUE(ptr != NULL);
+    memset(reinterpret_cast<unsigned char *>(ptr) + sizeof(i), i % 256,
+           elem_size - sizeof(i));
+    int_map.mem_digest[i] = IntMap::Info(ptr, MemChecksum(ptr, elem_size));
+  }
+  for (unsigned i = 0; i < num_elems; i += 2) {
+    M.MarkFree(int_map.mem_digest[i].ptr);
+    int_map.mem_digest.erase(i);
+  }
+  EXPECT_FALSE(M.CompactStep(4 * 4096));
+  EXPECT_TRUE(M.IsCompacting());
+
+  // The first blocks are already moved, free them behind the compaction
+  for (unsigned i = 1; i < 5; i += 2) {
+    M.MarkFree(int_map.mem_digest[i].ptr);
+    int_map.mem_digest.erase(i);
+  }
+  M.Compact();
+  EXPECT_FALSE(M.IsCompacting());
+  EXPECT_EQ(M.used_bytes(), M.compacted_bytes());
+  EXPECT_EQ(int_map.mem_digest.size(), M.num_blocks());
+
+  map<unsigned, IntMap::Info>::const_iterator iter =
+    int_map.mem_digest.begin();
+  map<unsigned, IntMap::Info>::const_iterator i_end =
+    int_map.mem_digest.end();
+  for (; iter != i_end; ++iter) {
+    EXPECT_EQ(MemChecksum(iter->second.ptr, M.GetSize(iter->second.ptr)),
+              iter->second.checksum);
+  }
+}
+
+
 TEST_F(T_MallocHeap, Fill) {
   IntMap int_map;
   MallocHeap M(kSmallArena,
@@ -7,6 +7,9 @@
 #include <pthread.h>
 #include <signal.h>
 
+#include <cstdio>
+#include <cstring>
+
 #include <algorithm>
 #include <string>
 #include <vector>
@@ -16,6 +19,7 @@
 #include "fs_traversal.h"
 #include "hash.h"
 #include "quota_posix.h"
+#include "quota_ring.h"
 #include "testutil.h"
 #include "util/algorithm.h"
 
@@ -100,6 +104,162 @@ class T_QuotaManager : public ::testing::Test {
 };
 
 
+TEST_F(T_QuotaManager, BackgroundCleanup) {
+  const string path = tmp_path_ + "/background";
+  EXPECT_TRUE(MkdirDeep(path, 0700));
+  delete PosixCacheManager::Create(path, false);
+  // The watermark has to be between threshold and limit
+  EXPECT_EQ(NULL, PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 5, 0));
+  EXPECT_EQ(NULL, PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 10, 0));
+  PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 7, 0);
+  ASSERT_TRUE(quota_mgr != NULL);
+  QuotaManager::CleanupStatus status;
+  EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+  EXPECT_EQ(7U, status.watermark);
+  EXPECT_EQ(0U, status.num_evicted);
+  quota_mgr->Spawn();
+
+  for (unsigned i = 0; i < hashes_.size(); ++i) {
+    CreateFile(path + "/" + hashes_[i].MakePath(), 0600);
+    quota_mgr->Insert(hashes_[i], 1, StringifyInt(i));
+  }
+  // Beyond the watermark but not at the limit: the inserts are not blocked
+  // and the cache shrinks to the threshold in the background
+  uint64_t size = quota_mgr->GetSize();
+  EXPECT_GT(size, 7U);
+  for (unsigned i = 0; (i < 1000) && (size > 5); ++i) {
+    SafeSleepMs(10);
+    size = quota_mgr->GetSize();
+  }
+  EXPECT_EQ(5U, size);
+  EXPECT_EQ(1U, quota_mgr->GetCleanupRate(60));
+  for (unsigned i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+    if (status.backlog_files == 0)
+      break;
+    SafeSleepMs(10);
+  }
+  EXPECT_EQ(3U, status.num_evicted);
+  EXPECT_EQ(3U, status.num_unlinked);
+  EXPECT_EQ(0U, status.backlog_bytes);
+  for (unsigned i = 0; i < hashes_.size(); ++i) {
+    EXPECT_EQ(i >= 3, FileExists(path + "/" + hashes_[i].MakePath()));
+  }
+
+  // Explicit cleanups return once the files are unlinked
+  EXPECT_TRUE(quota_mgr->Cleanup(0));
+  for (unsigned i = 0; i < hashes_.size(); ++i)
+    EXPECT_FALSE(FileExists(path + "/" + hashes_[i].MakePath()));
+  delete quota_mgr;
+
+  EXPECT_TRUE(quota_mgr_not_spawned_->GetCleanupStatus(&status));
+  EXPECT_EQ(0U, status.watermark);
+}
+
+
+TEST_F(T_QuotaManager, BackgroundCleanupTrash) {
+  const string path = tmp_path_ + "/trash";
+  EXPECT_TRUE(MkdirDeep(path, 0700));
+  delete PosixCacheManager::Create(path, false);
+  PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 7, 2);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+  EXPECT_TRUE(DirectoryExists(path + "/trash"));
+
+  for (unsigned i = 0; i < hashes_.size(); ++i) {
+    CreateFile(path + "/" + hashes_[i].MakePath(), 0600);
+    quota_mgr->Insert(hashes_[i], 1, StringifyInt(i));
+  }
+  uint64_t size = quota_mgr->GetSize();
+  for (unsigned i = 0; (i < 1000) && (size > 5); ++i) {
+    SafeSleepMs(10);
+    size = quota_mgr->GetSize();
+  }
+  EXPECT_EQ(5U, size);
+  // Evicted files leave their cache path before they are unlinked
+  for (unsigned i = 0; i < hashes_.size(); ++i)
+    EXPECT_EQ(i >= 3, FileExists(path + "/" + hashes_[i].MakePath()));
+
+  // Re-inserted while the eviction waits in the backlog: with two files per
+  // second, the last evicted file is unlinked only after a second
+  CreateFile(path + "/" + hashes_[2].MakePath(), 0600);
+  quota_mgr->Insert(hashes_[2], 1, "2");
+  QuotaManager::CleanupStatus status;
+  for (unsigned i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+    if (status.backlog_files == 0)
+      break;
+    SafeSleepMs(10);
+  }
+  EXPECT_EQ(3U, status.num_unlinked);
+  EXPECT_TRUE(FileExists(path + "/" + hashes_[2].MakePath()));
+  for (unsigned i = 0; i < 3; ++i) {
+    EXPECT_FALSE(FileExists(path + "/trash/" +
+      GetFileName(hashes_[i].MakePath()) + "." + StringifyInt(i)));
+  }
+  delete quota_mgr;
+
+  // Files left in the trash by a previous run are unlinked on start
+  CreateFile(path + "/trash/leftover.41", 0600);
+  quota_mgr = PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 7, 0);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+  for (unsigned i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+    if (status.num_unlinked == 1)
+      break;
+    SafeSleepMs(10);
+  }
+  EXPECT_EQ(1U, status.num_unlinked);
+  EXPECT_FALSE(FileExists(path + "/trash/leftover.41"));
+  delete quota_mgr;
+}
+
+
+TEST_F(T_QuotaManager, BackgroundCleanupLimit) {
+  const string path = tmp_path_ + "/limit";
+  EXPECT_TRUE(MkdirDeep(path, 0700));
+  delete PosixCacheManager::Create(path, false);
+  PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(path, 10, 5, false,
+    PosixQuotaManager::kIndexSqlite, EvictionPolicy::kLru, 7, 2);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+
+  for (unsigned i = 0; i < 5; ++i) {
+    CreateFile(path + "/" + hashes_[i].MakePath(), 0600);
+    quota_mgr->Insert(hashes_[i], (i < 4) ? 1 : 4, StringifyInt(i));
+  }
+  uint64_t size = quota_mgr->GetSize();
+  for (unsigned i = 0; (i < 1000) && (size > 5); ++i) {
+    SafeSleepMs(10);
+    size = quota_mgr->GetSize();
+  }
+  EXPECT_EQ(5U, size);
+  // With two files per second, the second and the third evicted file wait in
+  // the backlog
+  QuotaManager::CleanupStatus status;
+  EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+  EXPECT_EQ(3U, status.num_evicted);
+  EXPECT_GT(status.backlog_bytes, 0U);
+
+  // Fits into the limit only without the backlog, which has to be drained
+  CreateFile(path + "/" + hashes_[5].MakePath(), 0600);
+  quota_mgr->Insert(hashes_[5], 4, "5");
+  // Processes the buffered insert, unlike the cleanup status
+  EXPECT_EQ(9U, quota_mgr->GetSize());
+  EXPECT_TRUE(quota_mgr->GetCleanupStatus(&status));
+  EXPECT_GE(status.num_unlinked, 3U);
+  for (unsigned i = 0; i < 3; ++i)
+    EXPECT_FALSE(FileExists(path + "/" + hashes_[i].MakePath()));
+  delete quota_mgr;
+}
+
+
 TEST_F(T_QuotaManager, BroadcastBackchannels) {
   // Don't die without channels
   quota_mgr_->BroadcastBackchannels("X");
@@ -351,6 +511,73 @@ TEST_F(T_QuotaManager, CreateShared) {
 }
 
 
+TEST_F(T_QuotaManager, EvictionPolicy) {
+  const PosixQuotaManager::IndexType index_types[] =
+    {PosixQuotaManager::kIndexSqlite, PosixQuotaManager::kIndexJournal};
+  for (unsigned t = 0; t < 2; ++t) {
+    const string path = tmp_path_ + "/eviction" + StringifyInt(t);
+    EXPECT_TRUE(MkdirDeep(path, 0700));
+    delete PosixCacheManager::Create(path, false);
+    PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(
+      path, limit_, threshold_, false, index_types[t],
+      EvictionPolicy::kTinyLfu);
+    ASSERT_TRUE(quota_mgr != NULL);
+    quota_mgr->Spawn();
+
+    // 0 and 1 are the working set, 2-5 are read once by a scan
+    for (unsigned i = 0; i < 6; ++i)
+      quota_mgr->Insert(hashes_[i], 1, StringifyInt(i));
+    quota_mgr->Touch(hashes_[0]);
+    quota_mgr->Touch(hashes_[1]);
+    EXPECT_TRUE(quota_mgr->Pin(hashes_[6], 1, "catalog", true));
+
+    // The scan is more recent but evicted first
+    EXPECT_TRUE(quota_mgr->Cleanup(3));
+    vector<string> remaining = quota_mgr->List();
+    sort(remaining.begin(), remaining.end());
+    EXPECT_EQ("0\n1\n", PrintStringVector(remaining));
+    EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->ListPinned()));
+
+    // If the working set does not fit, it is evicted in LRU order
+    EXPECT_TRUE(quota_mgr->Cleanup(2));
+    EXPECT_EQ("1\n", PrintStringVector(quota_mgr->List()));
+    EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->ListPinned()));
+    delete quota_mgr;
+  }
+}
+
+
+TEST_F(T_QuotaManager, EvictionPolicyAdmission) {
+  const PosixQuotaManager::IndexType index_types[] =
+    {PosixQuotaManager::kIndexSqlite, PosixQuotaManager::kIndexJournal};
+  const uint64_t size = 2 * 1024 * 1024;
+  for (unsigned t = 0; t < 2; ++t) {
+    const string path = tmp_path_ + "/admission" + StringifyInt(t);
+    EXPECT_TRUE(MkdirDeep(path, 0700));
+    delete PosixCacheManager::Create(path, false);
+    PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(
+      path, limit_, threshold_, false, index_types[t],
+      EvictionPolicy::kTinyLfu);
+    ASSERT_TRUE(quota_mgr != NULL);
+    quota_mgr->Spawn();
+
+    for (unsigned i = 0; i < 5; ++i)
+      quota_mgr->Insert(hashes_[i], size, StringifyInt(i));
+    quota_mgr->Touch(hashes_[0]);
+    quota_mgr->Touch(hashes_[0]);
+    EXPECT_EQ("", PrintStringVector(quota_mgr->ListVolatile()));
+
+    // The cache is full and 5 is not accessed more often than the victim
+    quota_mgr->Insert(hashes_[5], size, "5");
+    EXPECT_EQ("5\n", PrintStringVector(quota_mgr->ListVolatile()));
+    vector<string> remaining = quota_mgr->List();
+    sort(remaining.begin(), remaining.end());
+    EXPECT_EQ("0\n4\n5\n", PrintStringVector(remaining));
+    delete quota_mgr;
+  }
+}
+
+
 TEST_F(T_QuotaManager, InsertList) {
   EXPECT_EQ("", PrintStringVector(quota_mgr_->List()));
   EXPECT_EQ("", PrintStringVector(quota_mgr_->ListCatalogs()));
@@ -422,6 +649,149 @@ TEST_F(T_QuotaManager, InitDatabase) {
 }
 
 
+TEST_F(T_QuotaManager, JournalIndex) {
+  const string path = tmp_path_ + "/journal";
+  EXPECT_TRUE(MkdirDeep(path, 0700));
+  delete PosixCacheManager::Create(path, false);
+  PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(
+    path, limit_, threshold_, false, PosixQuotaManager::kIndexJournal);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+  EXPECT_FALSE(FileExists(path + "/cachedb"));
+
+  unsigned N = hashes_.size();
+  for (unsigned i = 0; i < N - 2; ++i)
+    quota_mgr->Insert(hashes_[i], 1, StringifyInt(i));
+  quota_mgr->InsertVolatile(hashes_[N - 2], 1, "volatile");
+  EXPECT_TRUE(quota_mgr->Pin(hashes_[N - 1], 1, "catalog", true));
+  quota_mgr->Touch(hashes_[0]);
+  EXPECT_EQ(N, quota_mgr->GetSize());
+  EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->ListCatalogs()));
+  EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->ListPinned()));
+  EXPECT_EQ("volatile\n", PrintStringVector(quota_mgr->ListVolatile()));
+
+  // Volatile first, then least recently used, pinned catalog stays
+  EXPECT_TRUE(quota_mgr->Cleanup(N - 3));
+  EXPECT_EQ(N - 3, quota_mgr->GetSize());
+  vector<string> remaining = quota_mgr->List();
+  sort(remaining.begin(), remaining.end());
+  EXPECT_EQ("0\n3\n4\n5\n", PrintStringVector(remaining));
+
+  quota_mgr->Remove(hashes_[3]);
+  EXPECT_EQ(N - 4, quota_mgr->GetSize());
+
+  // Contents survive a restart, pinned flags don't
+  delete quota_mgr;
+  EXPECT_TRUE(FileExists(path + "/cachedb.lru"));
+  quota_mgr = PosixQuotaManager::Create(
+    path, limit_, threshold_, false, PosixQuotaManager::kIndexJournal);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+  EXPECT_EQ(N - 4, quota_mgr->GetSize());
+  EXPECT_EQ("", PrintStringVector(quota_mgr->ListPinned()));
+  EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->ListCatalogs()));
+  EXPECT_TRUE(quota_mgr->Cleanup(1));
+  EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr->List()) +
+                          PrintStringVector(quota_mgr->ListCatalogs()));
+  delete quota_mgr;
+
+  // Switching back to SQLite drops the index and rebuilds from the cache
+  // directory
+  quota_mgr = PosixQuotaManager::Create(path, limit_, threshold_, false);
+  ASSERT_TRUE(quota_mgr != NULL);
+  EXPECT_FALSE(FileExists(path + "/cachedb.lru"));
+  EXPECT_FALSE(FileExists(path + "/cachedb.lru.journal"));
+  delete quota_mgr;
+}
+
+
+TEST_F(T_QuotaManager, JournalIndexRebuild) {
+  const string path = tmp_path_ + "/journal";
+  EXPECT_TRUE(MkdirDeep(path, 0700));
+  delete PosixCacheManager::Create(path, false);
+  CreateFile(path + "/" + hashes_[0].MakePath(), 0600);
+  unsigned char buf = 'x';
+  EXPECT_TRUE(CopyMem2Path(&buf, 1, path + "/" + hashes_[1].MakePath()));
+  EXPECT_TRUE(CopyMem2Path(&buf, 1, path + "/00/not_a_hash"));
+
+  PosixQuotaManager *quota_mgr = PosixQuotaManager::Create(
+    path, limit_, threshold_, true, PosixQuotaManager::kIndexJournal);
+  ASSERT_TRUE(quota_mgr != NULL);
+  quota_mgr->Spawn();
+  // The empty file was removed during rebuild, the invalid name was ignored
+  EXPECT_EQ(1U, quota_mgr->GetSize());
+  EXPECT_EQ("unknown (automatic rebuild)\n",
+            PrintStringVector(quota_mgr->List()));
+  EXPECT_FALSE(FileExists(path + "/" + hashes_[0].MakePath()));
+  delete quota_mgr;
+
+  // An unreadable index is rebuilt as well
+  EXPECT_TRUE(CopyMem2Path(&buf, 1, path + "/cachedb.lru"));
+  quota_mgr = PosixQuotaManager::Create(
+    path, limit_, threshold_, false, PosixQuotaManager::kIndexJournal);
+  ASSERT_TRUE(quota_mgr != NULL);
+  EXPECT_EQ(1U, quota_mgr->GetSize());
+  delete quota_mgr;
+}
+
+
+/**
+ * Compares startup and cleanup of the SQLite database and the journal based
+ * index for a cache with many entries.
+ */
+TEST_F(T_QuotaManager, JournalIndexTimingSlow) {
+  const unsigned N = 200000;
+  const uint64_t limit = uint64_t(N) * 2;
+  const PosixQuotaManager::IndexType types[] =
+    { PosixQuotaManager::kIndexSqlite, PosixQuotaManager::kIndexJournal };
+  const char *names[] = { "sqlite", "journal" };
+  for (unsigned t = 0; t < 2; ++t) {
+    const string path = tmp_path_ + "/" + names[t];
+    EXPECT_TRUE(MkdirDeep(path, 0700));
+    delete PosixCacheManager::Create(path, false);
+    PosixQuotaManager *quota_mgr =
+      PosixQuotaManager::Create(path, limit, limit / 2, false, types[t]);
+    ASSERT_TRUE(quota_mgr != NULL);
+    quota_mgr->Spawn();
+
+    StopWatch watch_insert;
+    StopWatch watch_startup;
+    StopWatch watch_cleanup;
+    shash::Any hash(shash::kSha1);
+    watch_insert.Start();
+    for (unsigned i = 0; i < N; ++i) {
+      memcpy(hash.digest, &i, sizeof(i));
+      quota_mgr->Insert(hash, 1, "/some/path/to/a/file");
+    }
+    for (unsigned i = 0; i < N; i += 2) {
+      memcpy(hash.digest, &i, sizeof(i));
+      quota_mgr->Touch(hash);
+    }
+    EXPECT_EQ(N, quota_mgr->GetSize());
+    watch_insert.Stop();
+    delete quota_mgr;
+
+    watch_startup.Start();
+    quota_mgr =
+      PosixQuotaManager::Create(path, limit, limit / 2, false, types[t]);
+    watch_startup.Stop();
+    ASSERT_TRUE(quota_mgr != NULL);
+    quota_mgr->Spawn();
+    EXPECT_EQ(N, quota_mgr->GetSize());
+
+    watch_cleanup.Start();
+    EXPECT_TRUE(quota_mgr->Cleanup(N / 2));
+    watch_cleanup.Stop();
+    delete quota_mgr;
+
+    printf("%s: %u inserts and %u touches %.3fs, startup %.3fs, "
+           "cleanup of half %.3fs\n", names[t], N, N / 2,
+           watch_insert.GetTime(), watch_startup.GetTime(),
+           watch_cleanup.GetTime());
+  }
+}
+
+
 TEST_F(T_QuotaManager, MakeReturnPipe) {
   quota_mgr_->shared_ = true;
   int mypipe[2];
@@ -482,6 +852,114 @@ TEST_F(T_QuotaManager, PinUnpin) {
 }
 
 
+/**
+ * Simulates two clients of a shared cache that pin the same object.
+ */
+TEST_F(T_QuotaManager, PinClients) {
+  const uint32_t client_a = quota_mgr_->client_id_;
+  const uint32_t client_b = client_a + 1;
+  EXPECT_NE(0U, client_a);
+
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[0], 1, "x", true));
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[0], 1, "x", true));
+  quota_mgr_->client_id_ = client_b;
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[0], 1, "x", true));
+  EXPECT_EQ(1U, quota_mgr_->GetSizePinned());
+
+  // Still held by client a
+  quota_mgr_->Unpin(hashes_[0]);
+  quota_mgr_->Unpin(hashes_[0]);
+  EXPECT_EQ(1U, quota_mgr_->GetSizePinned());
+  EXPECT_EQ("x\n", PrintStringVector(quota_mgr_->ListPinned()));
+
+  // A single unpin releases the repeated pins of client a
+  quota_mgr_->client_id_ = client_a;
+  quota_mgr_->Unpin(hashes_[0]);
+  EXPECT_EQ(0U, quota_mgr_->GetSizePinned());
+  EXPECT_EQ("", PrintStringVector(quota_mgr_->ListPinned()));
+
+  // Clients that send no id release the pin immediately
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[1], 1, "y", true));
+  quota_mgr_->client_id_ = 0;
+  quota_mgr_->Unpin(hashes_[1]);
+  EXPECT_EQ(0U, quota_mgr_->GetSizePinned());
+}
+
+
+TEST_F(T_QuotaManager, DropPinClients) {
+  const uint32_t client_a = quota_mgr_->client_id_;
+  const uint32_t client_b = client_a + 1;
+  const uint32_t client_c = client_a + 2;
+  int channel_a[2];
+  int channel_b[2];
+  quota_mgr_->RegisterBackChannel(channel_a, "A");
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[0], 1, "x", true));
+  quota_mgr_->client_id_ = client_b;
+  quota_mgr_->RegisterBackChannel(channel_b, "B");
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[0], 1, "x", true));
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[1], 1, "y", true));
+  EXPECT_EQ(2U, quota_mgr_->GetSizePinned());
+
+  // Unregistering releases the pins that only client b holds
+  quota_mgr_->UnregisterBackChannel(channel_b, "B");
+  EXPECT_EQ(1U, quota_mgr_->GetSizePinned());
+  EXPECT_EQ("x\n", PrintStringVector(quota_mgr_->ListPinned()));
+
+  // Client a crashes, its back channel is removed by the next broadcast
+  close(channel_a[0]);
+  quota_mgr_->client_id_ = client_c;
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[1], 4000000, "y", false));
+  EXPECT_EQ(4000000U, quota_mgr_->GetSizePinned());
+
+  // A restarted client replaces the left-over back channel of client c
+  int channel_c[2];
+  quota_mgr_->RegisterBackChannel(channel_c, "C");
+  quota_mgr_->client_id_ = client_a;
+  int channel_new[2];
+  quota_mgr_->RegisterBackChannel(channel_new, "C");
+  EXPECT_EQ(0U, quota_mgr_->GetSizePinned());
+  EXPECT_EQ("", PrintStringVector(quota_mgr_->ListPinned()));
+
+  quota_mgr_->UnregisterBackChannel(channel_new, "C");
+  close(channel_c[0]);
+}
+
+
+TEST_F(T_QuotaManager, RingFallback) {
+  UniquePtr<CommandRing> consumer(
+    CommandRing::Create(tmp_path_ + "/fallback.ring", 2));
+  ASSERT_TRUE(consumer.IsValid());
+  // The command server would take the commands from the ring
+  PosixQuotaManager *quota_mgr = quota_mgr_not_spawned_;
+  quota_mgr->command_ring_ = CommandRing::Attach(tmp_path_ + "/fallback.ring");
+  ASSERT_TRUE(quota_mgr->command_ring_ != NULL);
+
+  char buf[CommandRing::kMaxMessageSize];
+  unsigned size;
+  quota_mgr->Touch(hashes_[0]);
+  quota_mgr->Touch(hashes_[1]);
+  EXPECT_EQ(0, atomic_read32(&quota_mgr->ring_fallback_));
+  quota_mgr->Touch(hashes_[2]);
+  EXPECT_EQ(1, atomic_read32(&quota_mgr->ring_fallback_));
+
+  // A free slot is not enough to go back to the ring
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  quota_mgr->Touch(hashes_[3]);
+  EXPECT_EQ(1, atomic_read32(&quota_mgr->ring_fallback_));
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_FALSE(consumer->Dequeue(buf, &size));
+
+  // The ring drained
+  quota_mgr->Touch(hashes_[4]);
+  EXPECT_EQ(0, atomic_read32(&quota_mgr->ring_fallback_));
+  quota_mgr->Touch(hashes_[5]);
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+
+  delete quota_mgr->command_ring_;
+  quota_mgr->command_ring_ = NULL;
+}
+
+
 TEST_F(T_QuotaManager, RebuildDatabase) {
   delete quota_mgr_;
   quota_mgr_ = NULL;
@@ -0,0 +1,114 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "quota_cleaner.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaCleaner : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_quota_cleaner");
+    ASSERT_NE("", tmp_path_);
+    for (unsigned i = 0; i < 20; ++i) {
+      const string path = tmp_path_ + "/" + StringifyInt(i);
+      ASSERT_TRUE(SafeWriteToFile(string(i, 'x'), path, 0600));
+      entries_.push_back(BackgroundCleaner::Entry(path, i));
+    }
+  }
+
+  virtual void TearDown() {
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+  }
+
+  unsigned CountFiles() {
+    unsigned result = 0;
+    for (unsigned i = 0; i < entries_.size(); ++i) {
+      if (FileExists(entries_[i].path))
+        result++;
+    }
+    return result;
+  }
+
+  string tmp_path_;
+  vector<BackgroundCleaner::Entry> entries_;
+};
+
+
+TEST_F(T_QuotaCleaner, BatchSize) {
+  const unsigned tick = BackgroundCleaner::kTickMs;
+  BackgroundCleaner unlimited(0);
+  EXPECT_EQ(0U, unlimited.batch_size());
+  EXPECT_EQ(tick, unlimited.tick_ms());
+  BackgroundCleaner slow(1);
+  EXPECT_EQ(1U, slow.batch_size());
+  EXPECT_EQ(1000U, slow.tick_ms());
+  BackgroundCleaner fast(1000);
+  EXPECT_EQ(1000U * tick / 1000, fast.batch_size());
+  EXPECT_EQ(tick, fast.tick_ms());
+}
+
+
+TEST_F(T_QuotaCleaner, Drain) {
+  BackgroundCleaner cleaner(1);
+  uint64_t num_files;
+  uint64_t num_bytes;
+  cleaner.GetBacklog(&num_files, &num_bytes);
+  EXPECT_EQ(0U, num_files);
+  EXPECT_EQ(0U, num_bytes);
+
+  cleaner.Enqueue(entries_);
+  cleaner.GetBacklog(&num_files, &num_bytes);
+  EXPECT_EQ(20U, num_files);
+  EXPECT_EQ(190U, num_bytes);
+  EXPECT_EQ(20U, CountFiles());
+
+  cleaner.Drain();
+  cleaner.GetBacklog(&num_files, &num_bytes);
+  EXPECT_EQ(0U, num_files);
+  EXPECT_EQ(0U, num_bytes);
+  EXPECT_EQ(20U, cleaner.GetNumUnlinked());
+  EXPECT_EQ(0U, CountFiles());
+}
+
+
+TEST_F(T_QuotaCleaner, Thread) {
+  BackgroundCleaner cleaner(0);
+  cleaner.Spawn();
+  cleaner.Enqueue(entries_);
+  for (unsigned i = 0; (i < 1000) && (cleaner.GetNumUnlinked() < 20); ++i)
+    SafeSleepMs(10);
+  EXPECT_EQ(20U, cleaner.GetNumUnlinked());
+  EXPECT_EQ(0U, CountFiles());
+
+  // Missing files are skipped
+  cleaner.Enqueue(entries_);
+  cleaner.Drain();
+  EXPECT_EQ(40U, cleaner.GetNumUnlinked());
+}
+
+
+TEST_F(T_QuotaCleaner, RateLimit) {
+  UniquePtr<BackgroundCleaner> cleaner(new BackgroundCleaner(1));
+  cleaner->Spawn();
+  cleaner->Enqueue(entries_);
+  SafeSleepMs(BackgroundCleaner::kTickMs / 2);
+  // One file per tick
+  EXPECT_LT(cleaner->GetNumUnlinked(), 20U);
+  EXPECT_GT(CountFiles(), 0U);
+
+  // Stopping the cleaner unlinks the remaining backlog
+  cleaner.Destroy();
+  EXPECT_EQ(0U, CountFiles());
+}
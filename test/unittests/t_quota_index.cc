@@ -0,0 +1,344 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "platform.h"
+#include "quota_index.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaIndex : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_quota_index");
+    ASSERT_NE("", tmp_path_);
+    path_ = tmp_path_ + "/cachedb.lru";
+    for (unsigned i = 0; i < 8; ++i) {
+      hashes_.push_back(shash::Any(shash::kSha1));
+      hashes_[i].digest[0] = i;
+    }
+  }
+
+  virtual void TearDown() {
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+  }
+
+  string PrintList(const vector<string> &lines) {
+    string result;
+    for (unsigned i = 0; i < lines.size(); ++i)
+      result += lines[i] + "\n";
+    return result;
+  }
+
+  int64_t GetJournalSize() {
+    platform_stat64 info;
+    if (platform_stat((path_ + ".journal").c_str(), &info) != 0)
+      return -1;
+    return info.st_size;
+  }
+
+  string tmp_path_;
+  string path_;
+  vector<shash::Any> hashes_;
+};
+
+
+TEST_F(T_QuotaIndex, Basics) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(0U, index->size());
+  EXPECT_EQ(0U, index->gauge());
+  EXPECT_FALSE(index->Contains(hashes_[0]));
+
+  index->Insert(hashes_[0], 10, 1, "a", false, false);
+  index->Insert(hashes_[1], 20, 2, "b", true, true);
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(30U, index->gauge());
+  EXPECT_EQ(2U, index->max_seq());
+  EXPECT_TRUE(index->Contains(hashes_[0]));
+
+  uint64_t size;
+  bool is_pinned;
+  EXPECT_TRUE(index->Lookup(hashes_[1], &size, &is_pinned));
+  EXPECT_EQ(20U, size);
+  EXPECT_TRUE(is_pinned);
+  index->Unpin(hashes_[1]);
+  EXPECT_TRUE(index->Lookup(hashes_[1], &size, &is_pinned));
+  EXPECT_FALSE(is_pinned);
+  EXPECT_FALSE(index->Lookup(hashes_[2], &size, &is_pinned));
+
+  // Replace
+  index->Insert(hashes_[0], 5, 3, "c", false, false);
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(25U, index->gauge());
+
+  EXPECT_TRUE(index->Remove(hashes_[0]));
+  EXPECT_FALSE(index->Remove(hashes_[0]));
+  EXPECT_EQ(1U, index->size());
+  EXPECT_EQ(20U, index->gauge());
+}
+
+
+TEST_F(T_QuotaIndex, Lists) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  const int64_t volatile_seq = static_cast<int64_t>(3 | (1ULL << 63));
+  index->Insert(hashes_[0], 1, 1, "regular", false, false);
+  index->Insert(hashes_[1], 1, 2, "catalog", true, true);
+  index->Insert(hashes_[2], 1, volatile_seq, "volatile", false, false);
+  index->Insert(hashes_[3], 1, 4, "pinned", false, true);
+
+  EXPECT_EQ("regular\nvolatile\npinned\n",
+            PrintList(index->List(QuotaIndex::kListRegular)));
+  EXPECT_EQ("catalog\n", PrintList(index->List(QuotaIndex::kListCatalogs)));
+  EXPECT_EQ("catalog\npinned\n",
+            PrintList(index->List(QuotaIndex::kListPinned)));
+  EXPECT_EQ("volatile\n", PrintList(index->List(QuotaIndex::kListVolatile)));
+
+  // Replaced entries move to the end
+  index->Insert(hashes_[0], 1, 5, "regular", false, false);
+  EXPECT_EQ("volatile\npinned\nregular\n",
+            PrintList(index->List(QuotaIndex::kListRegular)));
+}
+
+
+TEST_F(T_QuotaIndex, Lru) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  shash::Any hash;
+  uint64_t size;
+  EXPECT_FALSE(index->GetLru(&hash, &size));
+
+  for (unsigned i = 0; i < 4; ++i)
+    index->Insert(hashes_[i], i + 1, i + 1, "", false, false);
+  index->Insert(hashes_[4], 5, static_cast<int64_t>(5 | (1ULL << 63)), "",
+                false, false);
+
+  // Volatile entries go first
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[4], hash);
+  EXPECT_EQ(5U, size);
+  EXPECT_TRUE(index->Remove(hashes_[4]));
+
+  // Touching moves an entry to the end of the LRU order
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[0], hash);
+  index->Touch(hashes_[0], 6);
+  EXPECT_EQ(6U, index->max_seq());
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[1], hash);
+
+  // Touching keeps the volatile flag
+  index->Insert(hashes_[5], 1, static_cast<int64_t>(7 | (1ULL << 63)), "",
+                false, false);
+  index->Touch(hashes_[5], 8);
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[5], hash);
+  EXPECT_EQ(8U, index->max_seq());
+  EXPECT_TRUE(index->Remove(hashes_[5]));
+
+  // Blocked entries are skipped until they are unblocked
+  index->Block(hashes_[1]);
+  index->Block(hashes_[2]);
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[3], hash);
+  index->Touch(hashes_[1], 9);
+  index->UnblockAll();
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[2], hash);
+  bool is_pinned;
+  EXPECT_TRUE(index->Lookup(hashes_[1], &size, &is_pinned));
+  EXPECT_TRUE(is_pinned);
+
+  // Deferred entries are skipped, too, but remain unpinned
+  index->Defer(hashes_[2]);
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[3], hash);
+  index->UnblockAll();
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[2], hash);
+  EXPECT_TRUE(index->Lookup(hashes_[2], &size, &is_pinned));
+  EXPECT_FALSE(is_pinned);
+
+  // Removing the last entries empties the LRU order
+  for (unsigned i = 0; i < 4; ++i)
+    index->Remove(hashes_[i]);
+  EXPECT_FALSE(index->GetLru(&hash, &size));
+  EXPECT_EQ(0U, index->gauge());
+}
+
+
+TEST_F(T_QuotaIndex, Persistence) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  index->Insert(hashes_[0], 1, 1, "a", false, true);
+  index->Insert(hashes_[1], 2, 2, "b", true, false);
+  index->Insert(hashes_[2], 4, 3, "c", false, false);
+  index->Touch(hashes_[0], 4);
+  index->Remove(hashes_[2]);
+  EXPECT_TRUE(index->Sync());
+  index->Insert(hashes_[3], 8, 5, "d", false, false);
+  // Pending records are written on destruction
+  index.Destroy();
+  EXPECT_FALSE(FileExists(path_));
+
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(3U, index->size());
+  EXPECT_EQ(11U, index->gauge());
+  EXPECT_EQ(5U, index->max_seq());
+  EXPECT_EQ("a\nd\n", PrintList(index->List(QuotaIndex::kListRegular)));
+  EXPECT_EQ("b\n", PrintList(index->List(QuotaIndex::kListCatalogs)));
+  // Pinned flags are not persisted
+  EXPECT_EQ("", PrintList(index->List(QuotaIndex::kListPinned)));
+  shash::Any hash;
+  uint64_t size;
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[1], hash);
+
+  // Snapshot plus empty journal
+  EXPECT_TRUE(index->Snapshot());
+  EXPECT_TRUE(FileExists(path_));
+  EXPECT_EQ(4, GetJournalSize());
+  index->Remove(hashes_[1]);
+  index.Destroy();
+
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(9U, index->gauge());
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[0], hash);
+
+  index->Clear();
+  EXPECT_EQ(0U, index->size());
+  EXPECT_FALSE(FileExists(path_));
+  index.Destroy();
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(0U, index->size());
+}
+
+
+TEST_F(T_QuotaIndex, TornJournal) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  index->Insert(hashes_[0], 1, 1, "a", false, false);
+  index->Insert(hashes_[1], 2, 2, "b", false, false);
+  index.Destroy();
+
+  // Cut the last record in half
+  const int64_t journal_size = GetJournalSize();
+  ASSERT_GT(journal_size, 4);
+  EXPECT_EQ(0, truncate((path_ + ".journal").c_str(), journal_size - 3));
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(1U, index->size());
+  EXPECT_EQ("a\n", PrintList(index->List(QuotaIndex::kListRegular)));
+
+  // The torn record is dropped, new records are appended after the good ones
+  index->Insert(hashes_[2], 4, 3, "c", false, false);
+  index.Destroy();
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ("a\nc\n", PrintList(index->List(QuotaIndex::kListRegular)));
+  EXPECT_EQ(5U, index->gauge());
+}
+
+
+TEST_F(T_QuotaIndex, Corrupted) {
+  EXPECT_TRUE(SafeWriteToFile("garbage", path_, 0600));
+  EXPECT_EQ(NULL, QuotaIndex::Create(path_));
+  unlink(path_.c_str());
+
+  EXPECT_TRUE(SafeWriteToFile("garbage", path_ + ".journal", 0600));
+  EXPECT_EQ(NULL, QuotaIndex::Create(path_));
+  unlink((path_ + ".journal").c_str());
+
+  // A snapshot must not end in a torn record
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  index->Insert(hashes_[0], 1, 1, "a", false, false);
+  EXPECT_TRUE(index->Snapshot());
+  index.Destroy();
+  platform_stat64 info;
+  ASSERT_EQ(0, platform_stat(path_.c_str(), &info));
+  EXPECT_EQ(0, truncate(path_.c_str(), info.st_size - 1));
+  EXPECT_EQ(NULL, QuotaIndex::Create(path_));
+}
+
+
+TEST_F(T_QuotaIndex, Compaction) {
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  index->Insert(hashes_[0], 1, 1, "a", false, false);
+  index->Insert(hashes_[1], 1, 2, "b", false, false);
+
+  // Many touches on a small index trigger a snapshot once the journal has
+  // more than 64k records
+  unsigned seq = 3;
+  for (unsigned i = 0; i < 64 * 1024 - 2; ++i)
+    index->Touch(hashes_[i % 2], seq++);
+  EXPECT_TRUE(index->Sync());
+  EXPECT_FALSE(FileExists(path_));
+  index->Touch(hashes_[0], seq++);
+  EXPECT_TRUE(index->Sync());
+  EXPECT_TRUE(FileExists(path_));
+  EXPECT_EQ(4, GetJournalSize());
+
+  index->Touch(hashes_[1], seq++);
+  index.Destroy();
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(seq - 1, index->max_seq());
+  shash::Any hash;
+  uint64_t size;
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[0], hash);
+}
+
+
+TEST_F(T_QuotaIndex, ReplayTwice) {
+  // A crash between writing the snapshot and truncating the journal leaves
+  // a journal that is already contained in the snapshot
+  UniquePtr<QuotaIndex> index(QuotaIndex::Create(path_));
+  ASSERT_TRUE(index.IsValid());
+  index->Insert(hashes_[0], 1, 1, "a", false, false);
+  index->Insert(hashes_[1], 2, 2, "b", false, false);
+  index->Insert(hashes_[2], 4, 3, "c", false, false);
+  index->Touch(hashes_[0], 4);
+  index->Remove(hashes_[2]);
+  EXPECT_TRUE(index->Sync());
+  string journal;
+  int fd = open((path_ + ".journal").c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_TRUE(SafeReadToString(fd, &journal));
+  close(fd);
+  EXPECT_TRUE(index->Snapshot());
+  index.Destroy();
+  EXPECT_TRUE(SafeWriteToFile(journal, path_ + ".journal", 0600));
+
+  index = QuotaIndex::Create(path_);
+  ASSERT_TRUE(index.IsValid());
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(3U, index->gauge());
+  shash::Any hash;
+  uint64_t size;
+  EXPECT_TRUE(index->GetLru(&hash, &size));
+  EXPECT_EQ(hashes_[1], hash);
+}
@@ -0,0 +1,214 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "quota_policy.h"
+#include "util/pointer.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaPolicy : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (unsigned i = 0; i < 4096; ++i) {
+      hashes_.push_back(shash::Any(shash::kSha1));
+      hashes_[i].digest[0] = i % 256;
+      hashes_[i].digest[1] = i / 256;
+    }
+  }
+
+  vector<shash::Any> hashes_;
+};
+
+
+TEST_F(T_QuotaPolicy, FrequencySketch) {
+  FrequencySketch sketch(10);
+  EXPECT_EQ(1024U, sketch.width());
+  EXPECT_EQ(0U, sketch.Estimate(hashes_[0]));
+
+  for (unsigned i = 0; i < 5; ++i)
+    sketch.Increment(hashes_[0]);
+  sketch.Increment(hashes_[1]);
+  EXPECT_EQ(5U, sketch.Estimate(hashes_[0]));
+  EXPECT_EQ(1U, sketch.Estimate(hashes_[1]));
+
+  // Counters saturate
+  for (unsigned i = 0; i < 100; ++i)
+    sketch.Increment(hashes_[2]);
+  const unsigned max_frequency = FrequencySketch::kMaxFrequency;
+  EXPECT_EQ(max_frequency, sketch.Estimate(hashes_[2]));
+
+  sketch.Clear();
+  EXPECT_EQ(0U, sketch.Estimate(hashes_[0]));
+  EXPECT_EQ(0U, sketch.Estimate(hashes_[2]));
+}
+
+
+TEST_F(T_QuotaPolicy, FrequencySketchAging) {
+  FrequencySketch sketch(8);
+  for (unsigned i = 0; i < 8; ++i)
+    sketch.Increment(hashes_[0]);
+  EXPECT_EQ(8U, sketch.Estimate(hashes_[0]));
+
+  // Many other accesses let the frequency decay
+  for (unsigned i = 0; i < sketch.sample_size(); ++i)
+    sketch.Increment(hashes_[1 + (i % 1000)]);
+  EXPECT_LE(sketch.Estimate(hashes_[0]), 4U);
+}
+
+
+TEST_F(T_QuotaPolicy, RequiredFrequency) {
+  EXPECT_EQ(2U, TinyLfuPolicy::GetRequiredFrequency(0));
+  EXPECT_EQ(2U, TinyLfuPolicy::GetRequiredFrequency(1024));
+  EXPECT_EQ(2U, TinyLfuPolicy::GetRequiredFrequency(1024 * 1024));
+  EXPECT_EQ(3U, TinyLfuPolicy::GetRequiredFrequency(2 * 1024 * 1024));
+  EXPECT_EQ(5U, TinyLfuPolicy::GetRequiredFrequency(8 * 1024 * 1024));
+  EXPECT_EQ(15U, TinyLfuPolicy::GetRequiredFrequency(uint64_t(1) << 62));
+}
+
+
+TEST_F(T_QuotaPolicy, Defer) {
+  UniquePtr<EvictionPolicy> lru(EvictionPolicy::Create(EvictionPolicy::kLru));
+  UniquePtr<EvictionPolicy> tinylfu(
+    EvictionPolicy::Create(EvictionPolicy::kTinyLfu));
+  EXPECT_EQ(EvictionPolicy::kLru, lru->GetType());
+  EXPECT_EQ(EvictionPolicy::kTinyLfu, tinylfu->GetType());
+
+  for (unsigned i = 0; i < 3; ++i) {
+    lru->Access(hashes_[0]);
+    tinylfu->Access(hashes_[0]);
+  }
+  tinylfu->Access(hashes_[1]);
+  EXPECT_FALSE(lru->Defer(hashes_[0], 1));
+  EXPECT_TRUE(tinylfu->Defer(hashes_[0], 1));
+  EXPECT_FALSE(tinylfu->Defer(hashes_[1], 1));
+  // Large entries need more accesses
+  EXPECT_FALSE(tinylfu->Defer(hashes_[0], 16 * 1024 * 1024));
+  // New entries need more accesses than the entries they displace
+  EXPECT_TRUE(lru->Admit(hashes_[1], hashes_[0]));
+  EXPECT_FALSE(tinylfu->Admit(hashes_[1], hashes_[0]));
+  EXPECT_TRUE(tinylfu->Admit(hashes_[0], hashes_[1]));
+  EXPECT_FALSE(tinylfu->Admit(hashes_[1], hashes_[1]));
+
+  EvictionPolicy::Type type;
+  EXPECT_TRUE(EvictionPolicy::ParseType("", &type));
+  EXPECT_EQ(EvictionPolicy::kLru, type);
+  EXPECT_TRUE(EvictionPolicy::ParseType("tinylfu", &type));
+  EXPECT_EQ(EvictionPolicy::kTinyLfu, type);
+  EXPECT_TRUE(EvictionPolicy::ParseType("lru", &type));
+  EXPECT_EQ(EvictionPolicy::kLru, type);
+  EXPECT_FALSE(EvictionPolicy::ParseType("arc", &type));
+}
+
+
+TEST_F(T_QuotaPolicy, Simulator) {
+  LruPolicy policy;
+  CacheSimulator sim(&policy, 10, 5);
+  EXPECT_FALSE(sim.Access(hashes_[0], 4));
+  EXPECT_TRUE(sim.Access(hashes_[0], 4));
+  EXPECT_FALSE(sim.Access(hashes_[1], 4));
+  EXPECT_EQ(8U, sim.gauge());
+  // Too large to be cached
+  EXPECT_FALSE(sim.Access(hashes_[2], 6));
+  EXPECT_FALSE(sim.Access(hashes_[2], 6));
+  EXPECT_EQ(0U, sim.num_cleanups());
+
+  // Cleans up to the threshold, least recently used first
+  EXPECT_FALSE(sim.Access(hashes_[3], 4));
+  EXPECT_EQ(1U, sim.num_cleanups());
+  EXPECT_EQ(8U, sim.gauge());
+  EXPECT_TRUE(sim.Access(hashes_[1], 4));
+  EXPECT_FALSE(sim.Access(hashes_[0], 4));
+
+  EXPECT_EQ(2U, sim.num_hits());
+  EXPECT_EQ(8U, sim.hit_bytes());
+  EXPECT_EQ(6U, sim.num_misses());
+  EXPECT_EQ(28U, sim.miss_bytes());
+}
+
+
+/**
+ * A working set that fits into the cache is accessed round-robin, interrupted
+ * by scans through a large data set.  LRU loses the working set with every
+ * scan, TinyLFU keeps it.
+ */
+TEST_F(T_QuotaPolicy, ScanResistance) {
+  const unsigned kWorkingSet = 100;
+  const unsigned kScanSize = 1000;
+  LruPolicy lru;
+  TinyLfuPolicy tinylfu(12);
+  CacheSimulator sim_lru(&lru, 400, 200);
+  CacheSimulator sim_tinylfu(&tinylfu, 400, 200);
+
+  unsigned next_scan = kWorkingSet;
+  for (unsigned round = 0; round < 10; ++round) {
+    for (unsigned rep = 0; rep < 3; ++rep) {
+      for (unsigned i = 0; i < kWorkingSet; ++i) {
+        sim_lru.Access(hashes_[i], 1);
+        sim_tinylfu.Access(hashes_[i], 1);
+      }
+    }
+    for (unsigned i = 0; i < kScanSize / 10; ++i) {
+      const shash::Any &hash =
+        hashes_[kWorkingSet + (next_scan++ % kScanSize)];
+      sim_lru.Access(hash, 4);
+      sim_tinylfu.Access(hash, 4);
+    }
+  }
+
+  EXPECT_GT(sim_lru.num_cleanups(), 0U);
+  EXPECT_GT(sim_tinylfu.num_cleanups(), 0U);
+  EXPECT_GT(sim_tinylfu.num_hits(), sim_lru.num_hits());
+  // The working set misses only when it is first read
+  EXPECT_EQ(kWorkingSet + kScanSize, sim_tinylfu.num_misses());
+}
+
+
+/**
+ * If the frequently used entries exceed the cleanup threshold, the cleanup
+ * falls back to LRU order.
+ */
+TEST_F(T_QuotaPolicy, SimulatorFallback) {
+  TinyLfuPolicy policy(10);
+  CacheSimulator sim(&policy, 10, 5);
+  for (unsigned rep = 0; rep < 3; ++rep) {
+    sim.Access(hashes_[0], 4);
+    sim.Access(hashes_[1], 4);
+  }
+  EXPECT_FALSE(sim.Access(hashes_[2], 4));
+  EXPECT_EQ(1U, sim.num_cleanups());
+  EXPECT_EQ(8U, sim.gauge());
+  EXPECT_TRUE(sim.Access(hashes_[1], 4));
+  EXPECT_TRUE(sim.Access(hashes_[2], 4));
+  EXPECT_FALSE(sim.Access(hashes_[0], 4));
+}
+
+
+/**
+ * New objects that are accessed less often than the least recently used one
+ * are the first to go at the next cleanup.
+ */
+TEST_F(T_QuotaPolicy, SimulatorAdmission) {
+  TinyLfuPolicy policy(10);
+  CacheSimulator sim(&policy, 8, 6);
+  for (unsigned rep = 0; rep < 3; ++rep)
+    sim.Access(hashes_[0], 2);
+  for (unsigned i = 1; i < 4; ++i)
+    EXPECT_FALSE(sim.Access(hashes_[i], 2));
+
+  EXPECT_FALSE(sim.Access(hashes_[4], 2));
+  EXPECT_EQ(1U, sim.num_cleanups());
+  // Evicts 4 instead of the less recently used 2
+  EXPECT_FALSE(sim.Access(hashes_[5], 2));
+  EXPECT_EQ(2U, sim.num_cleanups());
+  EXPECT_EQ(8U, sim.gauge());
+  EXPECT_TRUE(sim.Access(hashes_[0], 2));
+  EXPECT_TRUE(sim.Access(hashes_[2], 2));
+  EXPECT_FALSE(sim.Access(hashes_[4], 2));
+}
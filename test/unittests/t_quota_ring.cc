@@ -0,0 +1,195 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "quota_ring.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaRing : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_quota_ring");
+    ASSERT_NE("", tmp_path_);
+    path_ = tmp_path_ + "/cachemgr.ring";
+  }
+
+  virtual void TearDown() {
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+  }
+
+  string tmp_path_;
+  string path_;
+};
+
+
+struct ProducerInfo {
+  CommandRing *ring;
+  unsigned id;
+  unsigned num_messages;
+};
+
+static void *MainProducer(void *data) {
+  ProducerInfo *info = reinterpret_cast<ProducerInfo *>(data);
+  for (unsigned i = 0; i < info->num_messages; ++i) {
+    unsigned message[2] = {info->id, i};
+    bool wakeup;
+    while (!info->ring->Enqueue(message, sizeof(message), &wakeup))
+      sched_yield();
+  }
+  return NULL;
+}
+
+
+TEST_F(T_QuotaRing, Basics) {
+  UniquePtr<CommandRing> consumer(CommandRing::Create(path_, 4));
+  ASSERT_TRUE(consumer.IsValid());
+  UniquePtr<CommandRing> producer(CommandRing::Attach(path_));
+  ASSERT_TRUE(producer.IsValid());
+  EXPECT_EQ(4U, producer->num_slots());
+
+  char buf[CommandRing::kMaxMessageSize];
+  unsigned size;
+  bool wakeup;
+  EXPECT_FALSE(consumer->Dequeue(buf, &size));
+  EXPECT_TRUE(producer->IsEmpty());
+
+  EXPECT_TRUE(producer->Enqueue("a", 1, &wakeup));
+  EXPECT_FALSE(wakeup);
+  EXPECT_FALSE(producer->IsEmpty());
+  EXPECT_TRUE(producer->Enqueue("bc", 2, &wakeup));
+  EXPECT_TRUE(producer->Enqueue("", 0, &wakeup));
+  EXPECT_TRUE(producer->Enqueue("def", 3, &wakeup));
+  EXPECT_FALSE(producer->Enqueue("g", 1, &wakeup));
+
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_EQ("a", string(buf, size));
+  EXPECT_TRUE(producer->Enqueue("g", 1, &wakeup));
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_EQ("bc", string(buf, size));
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_EQ(0U, size);
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_EQ("def", string(buf, size));
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_EQ("g", string(buf, size));
+  EXPECT_FALSE(consumer->Dequeue(buf, &size));
+  EXPECT_TRUE(producer->IsEmpty());
+
+  // Wraps around several times
+  for (unsigned i = 0; i < 100; ++i) {
+    EXPECT_TRUE(producer->Enqueue(&i, sizeof(i), &wakeup));
+    EXPECT_TRUE(consumer->Dequeue(buf, &size));
+    ASSERT_EQ(sizeof(i), size);
+    unsigned value;
+    memcpy(&value, buf, sizeof(value));
+    EXPECT_EQ(i, value);
+  }
+}
+
+
+TEST_F(T_QuotaRing, Sleep) {
+  UniquePtr<CommandRing> consumer(CommandRing::Create(path_, 4));
+  ASSERT_TRUE(consumer.IsValid());
+  UniquePtr<CommandRing> producer(CommandRing::Attach(path_));
+  ASSERT_TRUE(producer.IsValid());
+
+  char buf[CommandRing::kMaxMessageSize];
+  unsigned size;
+  bool wakeup;
+  EXPECT_TRUE(consumer->PrepareSleep());
+  EXPECT_TRUE(producer->Enqueue("a", 1, &wakeup));
+  EXPECT_TRUE(wakeup);
+  // Only the first producer has to wake up the consumer
+  EXPECT_TRUE(producer->Enqueue("b", 1, &wakeup));
+  EXPECT_FALSE(wakeup);
+  consumer->Awake();
+
+  // A non-empty ring prevents the consumer from sleeping
+  EXPECT_FALSE(consumer->PrepareSleep());
+  EXPECT_TRUE(producer->Enqueue("c", 1, &wakeup));
+  EXPECT_FALSE(wakeup);
+  for (unsigned i = 0; i < 3; ++i)
+    EXPECT_TRUE(consumer->Dequeue(buf, &size));
+  EXPECT_TRUE(consumer->PrepareSleep());
+  consumer->Awake();
+  EXPECT_TRUE(producer->Enqueue("d", 1, &wakeup));
+  EXPECT_FALSE(wakeup);
+}
+
+
+TEST_F(T_QuotaRing, Attach) {
+  EXPECT_EQ(NULL, CommandRing::Attach(path_));
+  ASSERT_TRUE(SafeWriteToFile("garbage", path_, 0600));
+  EXPECT_EQ(NULL, CommandRing::Attach(path_));
+
+  UniquePtr<CommandRing> consumer(CommandRing::Create(path_, 8));
+  ASSERT_TRUE(consumer.IsValid());
+  UniquePtr<CommandRing> producer(CommandRing::Attach(path_));
+  ASSERT_TRUE(producer.IsValid());
+  EXPECT_EQ(8U, producer->num_slots());
+
+  // A new consumer replaces the ring, existing producers keep the old one
+  UniquePtr<CommandRing> consumer2(CommandRing::Create(path_, 8));
+  ASSERT_TRUE(consumer2.IsValid());
+  bool wakeup;
+  EXPECT_TRUE(producer->Enqueue("a", 1, &wakeup));
+  char buf[CommandRing::kMaxMessageSize];
+  unsigned size;
+  EXPECT_FALSE(consumer2->Dequeue(buf, &size));
+  EXPECT_TRUE(consumer->Dequeue(buf, &size));
+}
+
+
+TEST_F(T_QuotaRing, MultipleProducers) {
+  const unsigned kNumProducers = 4;
+  const unsigned kNumMessages = 10000;
+  UniquePtr<CommandRing> consumer(CommandRing::Create(path_, 16));
+  ASSERT_TRUE(consumer.IsValid());
+
+  vector<CommandRing *> producers;
+  vector<ProducerInfo> infos(kNumProducers);
+  vector<pthread_t> threads(kNumProducers);
+  for (unsigned i = 0; i < kNumProducers; ++i) {
+    producers.push_back(CommandRing::Attach(path_));
+    ASSERT_TRUE(producers[i] != NULL);
+    infos[i].ring = producers[i];
+    infos[i].id = i;
+    infos[i].num_messages = kNumMessages;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainProducer, &infos[i]));
+  }
+
+  // Messages of every producer arrive in order
+  vector<unsigned> next(kNumProducers, 0);
+  for (unsigned i = 0; i < kNumProducers * kNumMessages; ++i) {
+    unsigned message[2];
+    unsigned size;
+    while (!consumer->Dequeue(message, &size))
+      sched_yield();
+    ASSERT_EQ(sizeof(message), size);
+    ASSERT_LT(message[0], kNumProducers);
+    ASSERT_EQ(next[message[0]], message[1]);
+    next[message[0]]++;
+  }
+  char buf[CommandRing::kMaxMessageSize];
+  unsigned size;
+  EXPECT_FALSE(consumer->Dequeue(buf, &size));
+
+  for (unsigned i = 0; i < kNumProducers; ++i) {
+    pthread_join(threads[i], NULL);
+    delete producers[i];
+  }
+}